@@ -0,0 +1,328 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures a small async write and read over a named pipe bound to a
+ * completion port, once with the async API of the IOCP streams and once
+ * with the callbacks of WingThreadPoolIo, with each engine delivering
+ * the completions. Besides the time, it counts the heap blocks held by
+ * a read waiting for data, which is what each operation allocates */
+
+#include <wing/wing.h>
+#include <windows.h>
+
+#include <string.h>
+
+#define PIPE_NAME "\\\\.\\pipe\\wing-benchmark-async-io"
+#define MESSAGE_SIZE 64
+
+static gint iterations = 100000;
+
+static GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of round trips", "N" },
+  { NULL }
+};
+
+static void
+connect_pair (WingNamedPipeListener   **listener,
+              WingNamedPipeConnection **server,
+              WingNamedPipeConnection **client)
+{
+  WingNamedPipeClient *pipe_client;
+  GError *error = NULL;
+
+  *listener = wing_named_pipe_listener_new (PIPE_NAME, NULL, FALSE, NULL, &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (*listener, TRUE);
+
+  pipe_client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (pipe_client, TRUE);
+
+  *client = wing_named_pipe_client_connect (pipe_client, PIPE_NAME,
+                                            WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                            NULL, &error);
+  g_assert_no_error (error);
+
+  *server = wing_named_pipe_listener_accept (*listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_unref (pipe_client);
+}
+
+/* The blocks in use in all the heaps of the process, the C runtime
+ * not necessarily allocating from the default one */
+static gsize
+count_heap_blocks (void)
+{
+  HANDLE heaps[64];
+  DWORD n_heaps;
+  DWORD i;
+  gsize n_blocks = 0;
+
+  n_heaps = GetProcessHeaps (G_N_ELEMENTS (heaps), heaps);
+  n_heaps = MIN (n_heaps, G_N_ELEMENTS (heaps));
+
+  for (i = 0; i < n_heaps; i++)
+    {
+      PROCESS_HEAP_ENTRY entry;
+
+      if (!HeapLock (heaps[i]))
+        continue;
+
+      memset (&entry, 0, sizeof (entry));
+      while (HeapWalk (heaps[i], &entry))
+        if (entry.wFlags & PROCESS_HEAP_ENTRY_BUSY)
+          n_blocks++;
+
+      HeapUnlock (heaps[i]);
+    }
+
+  return n_blocks;
+}
+
+static void
+report (const gchar *name,
+        gint64       elapsed,
+        gssize       blocks)
+{
+  g_print ("%-24s %8.3f us per round trip, %3" G_GSSIZE_FORMAT " heap blocks per pending read\n",
+           name, (gdouble) elapsed / iterations, blocks);
+}
+
+typedef struct
+{
+  GInputStream *in;
+  GOutputStream *out;
+  guint8 buffer[MESSAGE_SIZE];
+  gint remaining;
+  GMainLoop *loop;
+} StreamsData;
+
+static void stream_write_cb (GObject      *source,
+                             GAsyncResult *result,
+                             gpointer      user_data);
+
+static void
+stream_read_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  StreamsData *data = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpint (g_input_stream_read_finish (data->in, result, &error), ==, MESSAGE_SIZE);
+  g_assert_no_error (error);
+
+  if (--data->remaining > 0)
+    g_output_stream_write_async (data->out, data->buffer, MESSAGE_SIZE, G_PRIORITY_DEFAULT,
+                                 NULL, stream_write_cb, data);
+  else
+    g_main_loop_quit (data->loop);
+}
+
+static void
+stream_write_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  StreamsData *data = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpint (g_output_stream_write_finish (data->out, result, &error), ==, MESSAGE_SIZE);
+  g_assert_no_error (error);
+
+  g_input_stream_read_async (data->in, data->buffer, MESSAGE_SIZE, G_PRIORITY_DEFAULT,
+                             NULL, stream_read_cb, data);
+}
+
+static void
+bench_streams (const gchar *name)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeConnection *server, *client;
+  StreamsData data = { NULL, };
+  gsize blocks_before, blocks_after;
+  GError *error = NULL;
+  gint64 start, elapsed;
+
+  connect_pair (&listener, &server, &client);
+  data.out = g_io_stream_get_output_stream (G_IO_STREAM (client));
+  data.in = g_io_stream_get_input_stream (G_IO_STREAM (server));
+  data.loop = g_main_loop_new (NULL, FALSE);
+
+  start = g_get_monotonic_time ();
+
+  data.remaining = iterations;
+  g_output_stream_write_async (data.out, data.buffer, MESSAGE_SIZE, G_PRIORITY_DEFAULT,
+                               NULL, stream_write_cb, &data);
+  g_main_loop_run (data.loop);
+  elapsed = g_get_monotonic_time () - start;
+
+  /* A read with no data to read stays pending */
+  blocks_before = count_heap_blocks ();
+  data.remaining = 1;
+  g_input_stream_read_async (data.in, data.buffer, MESSAGE_SIZE, G_PRIORITY_DEFAULT,
+                             NULL, stream_read_cb, &data);
+  blocks_after = count_heap_blocks ();
+
+  g_assert_cmpint (g_output_stream_write (data.out, data.buffer, MESSAGE_SIZE, NULL, &error), ==, MESSAGE_SIZE);
+  g_assert_no_error (error);
+  g_main_loop_run (data.loop);
+
+  report (name, elapsed, (gssize) blocks_after - (gssize) blocks_before);
+
+  g_main_loop_unref (data.loop);
+  g_object_unref (client);
+  g_object_unref (server);
+  g_object_unref (listener);
+}
+
+typedef struct
+{
+  WingThreadPoolIo *server_io;
+  WingThreadPoolIo *client_io;
+  guint8 buffer[MESSAGE_SIZE];
+  volatile gint remaining;
+  HANDLE done;
+} CallbacksData;
+
+static void callback_write_done (WingThreadPoolIo *self,
+                                 gulong            result,
+                                 gsize             n_bytes,
+                                 gpointer          user_data);
+
+static void
+callback_read_done (WingThreadPoolIo *self,
+                    gulong            result,
+                    gsize             n_bytes,
+                    gpointer          user_data)
+{
+  CallbacksData *data = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpuint (result, ==, 0);
+  g_assert_cmpuint (n_bytes, ==, MESSAGE_SIZE);
+
+  if (g_atomic_int_dec_and_test (&data->remaining))
+    SetEvent (data->done);
+  else
+    {
+      wing_thread_pool_io_write (data->client_io, data->buffer, MESSAGE_SIZE,
+                                 callback_write_done, data, &error);
+      g_assert_no_error (error);
+    }
+}
+
+static void
+callback_write_done (WingThreadPoolIo *self,
+                     gulong            result,
+                     gsize             n_bytes,
+                     gpointer          user_data)
+{
+  CallbacksData *data = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpuint (result, ==, 0);
+  g_assert_cmpuint (n_bytes, ==, MESSAGE_SIZE);
+
+  wing_thread_pool_io_read (data->server_io, data->buffer, MESSAGE_SIZE,
+                            callback_read_done, data, &error);
+  g_assert_no_error (error);
+}
+
+static void
+ignore_write_done (WingThreadPoolIo *self,
+                   gulong            result,
+                   gsize             n_bytes,
+                   gpointer          user_data)
+{
+}
+
+static void
+bench_callbacks (const gchar *name)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeConnection *server, *client;
+  CallbacksData data = { NULL, };
+  guint8 message[MESSAGE_SIZE] = { 0, };
+  gsize blocks_before, blocks_after;
+  GError *error = NULL;
+  gint64 start, elapsed;
+
+  connect_pair (&listener, &server, &client);
+  g_object_get (server, "threadpool-io", &data.server_io, NULL);
+  g_object_get (client, "threadpool-io", &data.client_io, NULL);
+  data.done = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+  start = g_get_monotonic_time ();
+
+  data.remaining = iterations;
+  wing_thread_pool_io_write (data.client_io, data.buffer, MESSAGE_SIZE,
+                             callback_write_done, &data, &error);
+  g_assert_no_error (error);
+  WaitForSingleObject (data.done, INFINITE);
+  elapsed = g_get_monotonic_time () - start;
+
+  /* A read with no data to read stays pending */
+  blocks_before = count_heap_blocks ();
+  data.remaining = 1;
+  wing_thread_pool_io_read (data.server_io, data.buffer, MESSAGE_SIZE,
+                            callback_read_done, &data, &error);
+  g_assert_no_error (error);
+  blocks_after = count_heap_blocks ();
+
+  wing_thread_pool_io_write (data.client_io, message, MESSAGE_SIZE,
+                             ignore_write_done, NULL, &error);
+  g_assert_no_error (error);
+  WaitForSingleObject (data.done, INFINITE);
+
+  report (name, elapsed, (gssize) blocks_after - (gssize) blocks_before);
+
+  CloseHandle (data.done);
+  wing_thread_pool_io_unref (data.server_io);
+  wing_thread_pool_io_unref (data.client_io);
+  g_object_unref (client);
+  g_object_unref (server);
+  g_object_unref (listener);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+
+  context = g_option_context_new ("- benchmark the async I/O over completion ports");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_THREAD_POOL);
+  bench_streams ("streams, thread pool");
+  bench_callbacks ("callbacks, thread pool");
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+  bench_streams ("streams, port");
+  bench_callbacks ("callbacks, port");
+
+  return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures a small sync write and read over a named pipe. The baselines
+ * do the same with raw overlapped I/O, once creating an event for each
+ * operation as the streams used to, and once reusing a single event.
+ *
+ * Besides the time, it reports the time spent in the kernel and the
+ * events created for each round trip. The raw baselines count the events
+ * they create, while the streams run on a new thread, whose event cache
+ * starts empty, and the events are the handles it leaves open */
+
+#include <wing/wing.h>
+#include <windows.h>
+
+#include <string.h>
+
+#define PIPE_NAME "\\\\.\\pipe\\wing-benchmark-sync-io"
+#define MESSAGE_SIZE 64
+
+static gint iterations = 100000;
+
+static GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of round trips", "N" },
+  { NULL }
+};
+
+static void
+connect_pair (gboolean                  use_iocp,
+              WingNamedPipeListener   **listener,
+              WingNamedPipeConnection **server,
+              WingNamedPipeConnection **client)
+{
+  WingNamedPipeClient *pipe_client;
+  GError *error = NULL;
+
+  *listener = wing_named_pipe_listener_new (PIPE_NAME, NULL, FALSE, NULL, &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (*listener, use_iocp);
+
+  pipe_client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (pipe_client, use_iocp);
+
+  *client = wing_named_pipe_client_connect (pipe_client, PIPE_NAME,
+                                            WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                            NULL, &error);
+  g_assert_no_error (error);
+
+  *server = wing_named_pipe_listener_accept (*listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_unref (pipe_client);
+}
+
+/* In microseconds */
+static gint64
+get_kernel_time (void)
+{
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  ULARGE_INTEGER kernel;
+
+  if (!GetThreadTimes (GetCurrentThread (), &creation_time, &exit_time, &kernel_time, &user_time))
+    return 0;
+
+  kernel.LowPart = kernel_time.dwLowDateTime;
+  kernel.HighPart = kernel_time.dwHighDateTime;
+
+  return kernel.QuadPart / 10;
+}
+
+static void
+report (const gchar *name,
+        gint64       elapsed,
+        gint64       kernel,
+        gssize       n_events)
+{
+  g_print ("%-28s %8.3f us per round trip, %8.3f us in the kernel, %8.5f events created\n",
+           name, (gdouble) elapsed / iterations, (gdouble) kernel / iterations,
+           (gdouble) n_events / iterations);
+}
+
+static void
+raw_transfer (HANDLE   handle,
+              gboolean write,
+              guint8  *buffer,
+              HANDLE   event)
+{
+  OVERLAPPED overlap = { 0, };
+  DWORD transferred;
+  BOOL res;
+
+  overlap.hEvent = event;
+
+  if (write)
+    res = WriteFile (handle, buffer, MESSAGE_SIZE, &transferred, &overlap);
+  else
+    res = ReadFile (handle, buffer, MESSAGE_SIZE, &transferred, &overlap);
+
+  if (!res)
+    {
+      g_assert_cmpint (GetLastError (), ==, ERROR_IO_PENDING);
+      res = GetOverlappedResult (handle, &overlap, &transferred, TRUE);
+      g_assert (res);
+    }
+
+  g_assert_cmpuint (transferred, ==, MESSAGE_SIZE);
+}
+
+static void
+bench_raw (gboolean reuse_event)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeConnection *server, *client;
+  HANDLE server_handle, client_handle;
+  HANDLE event = NULL;
+  guint8 buffer[MESSAGE_SIZE] = { 0, };
+  gint64 start, kernel_start;
+  gssize n_events = 0;
+  gint i;
+
+  connect_pair (FALSE, &listener, &server, &client);
+  g_object_get (server, "handle", &server_handle, NULL);
+  g_object_get (client, "handle", &client_handle, NULL);
+
+  start = g_get_monotonic_time ();
+  kernel_start = get_kernel_time ();
+
+  if (reuse_event)
+    {
+      event = CreateEvent (NULL, FALSE, FALSE, NULL);
+      n_events++;
+    }
+
+  for (i = 0; i < iterations; i++)
+    {
+      if (!reuse_event)
+        {
+          event = CreateEvent (NULL, FALSE, FALSE, NULL);
+          raw_transfer (client_handle, TRUE, buffer, event);
+          CloseHandle (event);
+
+          event = CreateEvent (NULL, FALSE, FALSE, NULL);
+          raw_transfer (server_handle, FALSE, buffer, event);
+          CloseHandle (event);
+
+          n_events += 2;
+        }
+      else
+        {
+          raw_transfer (client_handle, TRUE, buffer, event);
+          raw_transfer (server_handle, FALSE, buffer, event);
+        }
+    }
+
+  report (reuse_event ? "raw, one event" : "raw, event per operation",
+          g_get_monotonic_time () - start, get_kernel_time () - kernel_start,
+          n_events);
+
+  if (reuse_event)
+    CloseHandle (event);
+
+  g_object_unref (client);
+  g_object_unref (server);
+  g_object_unref (listener);
+}
+
+typedef struct
+{
+  GInputStream *in;
+  GOutputStream *out;
+  gint64 elapsed;
+  gint64 kernel;
+  gssize n_events;
+} StreamsData;
+
+static gpointer
+streams_thread (gpointer user_data)
+{
+  StreamsData *data = user_data;
+  guint8 buffer[MESSAGE_SIZE] = { 0, };
+  DWORD handles_before, handles_after;
+  GError *error = NULL;
+  gint64 start, kernel_start;
+  gint i;
+
+  GetProcessHandleCount (GetCurrentProcess (), &handles_before);
+  start = g_get_monotonic_time ();
+  kernel_start = get_kernel_time ();
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_assert_cmpint (g_output_stream_write (data->out, buffer, MESSAGE_SIZE, NULL, &error), ==, MESSAGE_SIZE);
+      g_assert_no_error (error);
+
+      g_assert_cmpint (g_input_stream_read (data->in, buffer, MESSAGE_SIZE, NULL, &error), ==, MESSAGE_SIZE);
+      g_assert_no_error (error);
+    }
+
+  data->elapsed = g_get_monotonic_time () - start;
+  data->kernel = get_kernel_time () - kernel_start;
+
+  /* The events cached by this thread are still open */
+  GetProcessHandleCount (GetCurrentProcess (), &handles_after);
+  data->n_events = (gssize) handles_after - (gssize) handles_before;
+
+  return NULL;
+}
+
+static void
+bench_streams (gboolean use_iocp)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeConnection *server, *client;
+  StreamsData data = { NULL, };
+
+  connect_pair (use_iocp, &listener, &server, &client);
+  data.out = g_io_stream_get_output_stream (G_IO_STREAM (client));
+  data.in = g_io_stream_get_input_stream (G_IO_STREAM (server));
+
+  g_thread_join (g_thread_new ("bench-streams", streams_thread, &data));
+
+  report (use_iocp ? "streams, iocp" : "streams", data.elapsed, data.kernel, data.n_events);
+
+  g_object_unref (client);
+  g_object_unref (server);
+  g_object_unref (listener);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+
+  context = g_option_context_new ("- benchmark the sync I/O of the streams");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  bench_raw (FALSE);
+  bench_raw (TRUE);
+  bench_streams (FALSE);
+  bench_streams (TRUE);
+
+  return 0;
+}
@@ -334,6 +334,67 @@ test_accept_fail_sync (gconstpointer user_data)
   g_object_unref (listener);
 }
 
+static void
+test_add_named_pipe_multiple_names (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *client_connection;
+  WingNamedPipeConnection *server_connection;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-multiple-names-control",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  wing_named_pipe_listener_add_named_pipe (listener,
+                                           "\\\\.\\pipe\\gtest-multiple-names-data",
+                                           "D:(A;;GA;;;BA)(A;;GA;;;SY)(A;;GA;;;IU)",
+                                           FALSE,
+                                           &error);
+  g_assert_no_error (error);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  client_connection = wing_named_pipe_client_connect (client,
+                                                      "\\\\.\\pipe\\gtest-multiple-names-data",
+                                                      WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                      NULL,
+                                                      &error);
+  g_assert_no_error (error);
+
+  server_connection = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr ("\\\\.\\pipe\\gtest-multiple-names-data", ==, wing_named_pipe_connection_get_pipe_name (server_connection));
+
+  g_object_unref (server_connection);
+  g_object_unref (client_connection);
+
+  client_connection = wing_named_pipe_client_connect (client,
+                                                      "\\\\.\\pipe\\gtest-multiple-names-control",
+                                                      WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                      NULL,
+                                                      &error);
+  g_assert_no_error (error);
+
+  server_connection = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr ("\\\\.\\pipe\\gtest-multiple-names-control", ==, wing_named_pipe_connection_get_pipe_name (server_connection));
+
+  g_object_unref (server_connection);
+  g_object_unref (client_connection);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
 static void
 test_connect_sync (gconstpointer user_data)
 {
@@ -393,6 +454,85 @@ test_connect_sync_fails (gconstpointer user_data)
   g_object_unref (client);
 }
 
+static void
+test_connect_backlog_sync (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *client_connections[4];
+  WingNamedPipeConnection *server_connection;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+  guint i;
+
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-connect-backlog-sync",
+                             "backlog", (guint) G_N_ELEMENTS (client_connections),
+                             NULL);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+  g_assert_cmpuint (wing_named_pipe_listener_get_backlog (listener), ==, G_N_ELEMENTS (client_connections));
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  /* All the clients find a waiting instance before anything is accepted */
+  for (i = 0; i < G_N_ELEMENTS (client_connections); i++)
+    {
+      client_connections[i] = wing_named_pipe_client_connect (client,
+                                                              "\\\\.\\pipe\\gtest-connect-backlog-sync",
+                                                              WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                              NULL,
+                                                              &error);
+      g_assert_no_error (error);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (client_connections); i++)
+    {
+      server_connection = wing_named_pipe_listener_accept (listener, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (server_connection != NULL);
+
+      g_object_unref (server_connection);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (client_connections); i++)
+    g_object_unref (client_connections[i]);
+
+  /* Lowering the backlog closes the instances in excess. Only the sync
+   * listener does not create a new instance once a client connected */
+  wing_named_pipe_listener_set_backlog (listener, 1);
+
+  if (!test_data->use_iocp)
+    {
+      g_object_set (client, "timeout", 100, NULL);
+
+      client_connections[0] = wing_named_pipe_client_connect (client,
+                                                              "\\\\.\\pipe\\gtest-connect-backlog-sync",
+                                                              WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                              NULL,
+                                                              &error);
+      g_assert_no_error (error);
+
+      g_assert (wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-connect-backlog-sync",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error) == NULL);
+      g_assert (error != NULL);
+      g_clear_error (&error);
+
+      g_object_unref (client_connections[0]);
+    }
+
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
 static void
 accept_cancelled_cb (GObject      *source,
                      GAsyncResult *result,
@@ -419,6 +559,67 @@ on_cancel_task (gpointer user_data)
   return G_SOURCE_REMOVE;
 }
 
+static void
+test_connect_async_busy (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *busy_connection;
+  WingNamedPipeConnection *server_connection;
+  gboolean success_accepted = FALSE;
+  gboolean success_connected = FALSE;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-connect-async-busy",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  /* Takes the only instance waiting for a client */
+  busy_connection = wing_named_pipe_client_connect (client,
+                                                    "\\\\.\\pipe\\gtest-connect-async-busy",
+                                                    WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                    NULL,
+                                                    &error);
+  g_assert_no_error (error);
+
+  /* Retried until the listener creates a new instance */
+  wing_named_pipe_client_connect_async (client,
+                                        "\\\\.\\pipe\\gtest-connect-async-busy",
+                                        WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                        NULL,
+                                        connected_cb,
+                                        &success_connected);
+
+  g_assert (!success_connected);
+
+  server_connection = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (server_connection);
+
+  wing_named_pipe_listener_accept_async (listener,
+                                         NULL,
+                                         accepted_cb,
+                                         &success_accepted);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (!success_accepted || !success_connected);
+
+  g_object_unref (busy_connection);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
 static void
 test_accept_cancel (gconstpointer user_data)
 {
@@ -583,96 +784,660 @@ test_multi_client_basic (gconstpointer user_data)
   g_object_unref (cancellable);
 }
 
+#define N_PENDING_ACCEPTS 100
+
 static void
-test_client_default_timeout (gconstpointer user_data)
+count_accepted_cb (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
 {
-  WingNamedPipeClient *client;
-  guint timeout;
-  TestData *test_data = (TestData *) user_data;
-
-  client = wing_named_pipe_client_new ();
-  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+  WingNamedPipeListener *listener = WING_NAMED_PIPE_LISTENER (source);
+  WingNamedPipeConnection *conn;
+  gint *n_accepted = user_data;
+  GError *error = NULL;
 
-  g_object_get (G_OBJECT (client), "timeout", &timeout, NULL);
+  conn = wing_named_pipe_listener_accept_finish (listener, result, &error);
+  g_assert_no_error (error);
+  g_object_unref (conn);
 
-  g_assert_cmpuint (timeout, ==, NMPWAIT_WAIT_FOREVER);
-  g_object_unref (client);
+  (*n_accepted)++;
 }
 
+/* The connects complete on the thread pool, so more of them can be
+ * pending at once than a main context can poll handles */
 static void
-accepted_read_write_cb (GObject      *source,
-                        GAsyncResult *result,
-                        gpointer      user_data)
+test_many_pending_accepts (void)
 {
-  WingNamedPipeListener *listener = WING_NAMED_PIPE_LISTENER (source);
-  WingNamedPipeConnection **conn = user_data;
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_clients[N_PENDING_ACCEPTS];
+  gint n_accepted = 0;
+  gint i;
   GError *error = NULL;
 
-  *conn = wing_named_pipe_listener_accept_finish (listener, result, &error);
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-many-pending-accepts",
+                             "use-iocp", TRUE,
+                             "backlog", (guint) N_PENDING_ACCEPTS,
+                             NULL);
   g_assert_no_error (error);
+
+  for (i = 0; i < N_PENDING_ACCEPTS; i++)
+    wing_named_pipe_listener_accept_async (listener, NULL, count_accepted_cb, &n_accepted);
+
+  /* No client yet */
+  while (g_main_context_iteration (NULL, FALSE));
+  g_assert_cmpint (n_accepted, ==, 0);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  for (i = 0; i < N_PENDING_ACCEPTS; i++)
+    {
+      conn_clients[i] = wing_named_pipe_client_connect (client,
+                                                        "\\\\.\\pipe\\gtest-many-pending-accepts",
+                                                        WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                        NULL,
+                                                        &error);
+      g_assert_no_error (error);
+    }
+
+  while (n_accepted < N_PENDING_ACCEPTS)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (i = 0; i < N_PENDING_ACCEPTS; i++)
+    g_object_unref (conn_clients[i]);
+
+  g_object_unref (client);
+  g_object_unref (listener);
 }
 
+/* The connects still pending on the thread pool are aborted, and
+ * complete once the listener is gone */
 static void
-connected_read_write_cb (GObject      *source,
-                         GAsyncResult *result,
-                         gpointer      user_data)
+test_finalize_pending_connect (void)
 {
-  WingNamedPipeClient *client = WING_NAMED_PIPE_CLIENT (source);
-  WingNamedPipeConnection **conn = user_data;
+  WingNamedPipeListener *listener;
+  GCancellable *cancellable;
+  gboolean accept_cancelled = FALSE;
   GError *error = NULL;
+  gint i;
+
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-finalize-pending-connect",
+                             "use-iocp", TRUE,
+                             "backlog", 4,
+                             NULL);
+  g_assert_no_error (error);
+
+  /* Arms the instances */
+  cancellable = g_cancellable_new ();
+  wing_named_pipe_listener_accept_async (listener, cancellable,
+                                         accept_cancelled_cb, &accept_cancelled);
+  g_cancellable_cancel (cancellable);
+
+  while (!accept_cancelled)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_object_unref (listener);
+
+  /* The first instance of the pipe can be created again once all the
+   * instances of the previous listener are closed */
+  for (i = 0; i < 100; i++)
+    {
+      listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-finalize-pending-connect",
+                                               NULL,
+                                               TRUE,
+                                               NULL,
+                                               &error);
+      if (listener != NULL)
+        break;
+
+      g_clear_error (&error);
+      g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+    }
 
-  *conn = wing_named_pipe_client_connect_finish (client, result, &error);
   g_assert_no_error (error);
+  g_assert (listener != NULL);
+
+  g_object_unref (listener);
+  g_object_unref (cancellable);
 }
 
-typedef struct
+static gboolean
+on_incoming (WingNamedPipeService    *service,
+             WingNamedPipeConnection *connection,
+             gpointer                 user_data)
 {
-  gchar data[256];
-  gboolean *read;
-} ReadData;
+  gint *n_incoming = user_data;
 
-#define MAX_ITERATIONS 100
-static const gchar *some_text = "This is some data to read and to write";
+  g_assert (WING_IS_NAMED_PIPE_CONNECTION (connection));
+
+  g_atomic_int_inc (n_incoming);
+  g_main_context_wakeup (NULL);
+
+  return TRUE;
+}
 
 static void
-on_some_text_read (GObject      *source,
-                   GAsyncResult *result,
-                   gpointer      user_data)
+service_incoming (TestData *test_data,
+                  guint     max_threads)
 {
-  ReadData *data = user_data;
-  gssize read;
+  WingNamedPipeService *service;
+  WingNamedPipeClient *client;
+  gint n_incoming = 0;
+  gboolean success_connected;
   GError *error = NULL;
+  guint i;
 
-  read = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  service = wing_named_pipe_service_new ("\\\\.\\pipe\\gtest-named-pipe-service",
+                                         NULL,
+                                         FALSE,
+                                         max_threads,
+                                         NULL,
+                                         &error);
+  g_assert (service != NULL);
   g_assert_no_error (error);
-  g_assert_cmpint (read, ==, strlen (some_text) + 1);
 
-  *data->read = TRUE;
-  g_free (data);
+  wing_named_pipe_listener_set_use_iocp (WING_NAMED_PIPE_LISTENER (service), test_data->use_iocp);
+
+  g_signal_connect (service, "incoming", G_CALLBACK (on_incoming), &n_incoming);
+  wing_named_pipe_service_start (service);
+  g_assert (wing_named_pipe_service_is_active (service));
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  /* The service accepts the clients without being re-armed */
+  for (i = 0; i < 3; i++)
+    {
+      success_connected = FALSE;
+
+      wing_named_pipe_client_connect_async (client,
+                                            "\\\\.\\pipe\\gtest-named-pipe-service",
+                                            WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                            NULL,
+                                            connected_cb,
+                                            &success_connected);
+
+      do
+        g_main_context_iteration (NULL, TRUE);
+      while (g_atomic_int_get (&n_incoming) <= (gint)i || !success_connected);
+    }
+
+  wing_named_pipe_service_stop (service);
+  g_assert (!wing_named_pipe_service_is_active (service));
+
+  /* Let the cancelled accept release the service */
+  while (g_main_context_iteration (NULL, FALSE));
+
+  g_object_unref (client);
+  g_object_unref (service);
 }
 
 static void
-on_some_text_written (GObject      *source,
-                      GAsyncResult *result,
-                      gpointer      user_data)
+test_service_incoming (gconstpointer user_data)
 {
-  gboolean *wrote = user_data;
-  gssize read;
-  GError *error = NULL;
+  service_incoming ((TestData *) user_data, 0);
+}
 
-  read = g_output_stream_write_finish (G_OUTPUT_STREAM (source), result, &error);
-  g_assert_no_error (error);
-  g_assert_cmpint (read, ==, strlen (some_text) + 1);
+static void
+test_service_incoming_threaded (gconstpointer user_data)
+{
+  service_incoming ((TestData *) user_data, 2);
+}
 
-  *wrote = TRUE;
+typedef struct
+{
+  GMutex mutex;
+  GMainContext *contexts[2];
+  gint n_incoming;
+} WorkersData;
+
+static gboolean
+on_incoming_worker (WingNamedPipeService    *service,
+                    WingNamedPipeConnection *connection,
+                    gpointer                 user_data)
+{
+  WorkersData *data = user_data;
+
+  g_mutex_lock (&data->mutex);
+  g_assert_cmpint (data->n_incoming, <, 2);
+  data->contexts[data->n_incoming++] = g_main_context_get_thread_default ();
+  g_mutex_unlock (&data->mutex);
+
+  g_main_context_wakeup (NULL);
+
+  return TRUE;
 }
 
 static void
-write_and_read (GIOStream *server_stream,
-                GIOStream *client_stream)
+test_service_workers (gconstpointer user_data)
 {
-  gint i;
-
+  WingNamedPipeService *service;
+  WingNamedPipeClient *client;
+  WorkersData data = { { 0 } };
+  gboolean success_connected;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+  guint i;
+
+  g_mutex_init (&data.mutex);
+
+  service = g_initable_new (WING_TYPE_NAMED_PIPE_SERVICE,
+                            NULL,
+                            &error,
+                            "pipe-name", "\\\\.\\pipe\\gtest-named-pipe-service-workers",
+                            "n-workers", 2,
+                            "worker-policy", WING_NAMED_PIPE_SERVICE_WORKER_ROUND_ROBIN,
+                            NULL);
+  g_assert (service != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (WING_NAMED_PIPE_LISTENER (service), test_data->use_iocp);
+
+  g_signal_connect (service, "incoming", G_CALLBACK (on_incoming_worker), &data);
+  wing_named_pipe_service_start (service);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  for (i = 0; i < 2; i++)
+    {
+      gint n_incoming;
+
+      success_connected = FALSE;
+
+      wing_named_pipe_client_connect_async (client,
+                                            "\\\\.\\pipe\\gtest-named-pipe-service-workers",
+                                            WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                            NULL,
+                                            connected_cb,
+                                            &success_connected);
+
+      do
+        {
+          g_main_context_iteration (NULL, TRUE);
+
+          g_mutex_lock (&data.mutex);
+          n_incoming = data.n_incoming;
+          g_mutex_unlock (&data.mutex);
+        }
+      while (n_incoming <= (gint)i || !success_connected);
+    }
+
+  /* Each connection was handled by its own worker */
+  g_assert (data.contexts[0] != NULL);
+  g_assert (data.contexts[1] != NULL);
+  g_assert (data.contexts[0] != data.contexts[1]);
+  g_assert (data.contexts[0] != g_main_context_default ());
+
+  wing_named_pipe_service_stop (service);
+
+  while (g_main_context_iteration (NULL, FALSE));
+
+  g_object_unref (client);
+  g_object_unref (service);
+  g_mutex_clear (&data.mutex);
+}
+
+typedef struct
+{
+  GMutex mutex;
+  gchar buffer[16];
+  gboolean incoming;
+  gssize nread;
+} OutliveData;
+
+static void
+worker_read_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  OutliveData *data = user_data;
+  GError *error = NULL;
+  gssize nread;
+
+  nread = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+
+  g_mutex_lock (&data->mutex);
+  data->nread = nread;
+  g_mutex_unlock (&data->mutex);
+
+  /* Drops the last connection of the worker from the worker itself */
+  g_object_unref (g_object_get_data (G_OBJECT (source), "connection"));
+
+  g_main_context_wakeup (NULL);
+}
+
+static gboolean
+on_incoming_outlive (WingNamedPipeService    *service,
+                     WingNamedPipeConnection *connection,
+                     gpointer                 user_data)
+{
+  OutliveData *data = user_data;
+  GInputStream *in;
+
+  in = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+  g_object_set_data (G_OBJECT (in), "connection", g_object_ref (connection));
+  g_input_stream_read_async (in, data->buffer, sizeof (data->buffer),
+                             G_PRIORITY_DEFAULT, NULL, worker_read_cb, data);
+
+  g_mutex_lock (&data->mutex);
+  data->incoming = TRUE;
+  g_mutex_unlock (&data->mutex);
+
+  g_main_context_wakeup (NULL);
+
+  return TRUE;
+}
+
+static void
+test_service_workers_outlive (gconstpointer user_data)
+{
+  WingNamedPipeService *service;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn;
+  OutliveData data = { { 0 } };
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+  gboolean incoming;
+  gssize nread;
+
+  g_mutex_init (&data.mutex);
+  data.nread = -1;
+
+  service = g_initable_new (WING_TYPE_NAMED_PIPE_SERVICE,
+                            NULL,
+                            &error,
+                            "pipe-name", "\\\\.\\pipe\\gtest-named-pipe-service-workers-outlive",
+                            "n-workers", 1,
+                            NULL);
+  g_assert (service != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (WING_NAMED_PIPE_LISTENER (service), test_data->use_iocp);
+
+  g_signal_connect (service, "incoming", G_CALLBACK (on_incoming_outlive), &data);
+  wing_named_pipe_service_start (service);
+
+  client = wing_named_pipe_client_new ();
+  conn = wing_named_pipe_client_connect (client,
+                                         "\\\\.\\pipe\\gtest-named-pipe-service-workers-outlive",
+                                         WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                         NULL,
+                                         &error);
+  g_assert_no_error (error);
+  g_assert (conn != NULL);
+
+  /* Let the service accept and hand the connection to the worker */
+  do
+    {
+      g_main_context_iteration (NULL, TRUE);
+
+      g_mutex_lock (&data.mutex);
+      incoming = data.incoming;
+      g_mutex_unlock (&data.mutex);
+    }
+  while (!incoming);
+
+  wing_named_pipe_service_stop (service);
+  g_object_unref (service);
+
+  /* The read pending on the worker still completes */
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (conn)),
+                             "hello", 5, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  do
+    {
+      g_main_context_iteration (NULL, TRUE);
+
+      g_mutex_lock (&data.mutex);
+      nread = data.nread;
+      g_mutex_unlock (&data.mutex);
+    }
+  while (nread < 0);
+
+  g_assert_cmpint (nread, ==, 5);
+  g_assert_cmpstr (data.buffer, ==, "hello");
+
+  g_object_unref (conn);
+  g_object_unref (client);
+  g_mutex_clear (&data.mutex);
+}
+
+static void
+pool_get_cb (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  WingNamedPipeConnection **connection = user_data;
+  GError *error = NULL;
+
+  *connection = wing_named_pipe_client_pool_get_finish (WING_NAMED_PIPE_CLIENT_POOL (source),
+                                                        result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_client_pool (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeClientPool *pool;
+  WingNamedPipeConnection *connection;
+  WingNamedPipeConnection *pooled;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-client-pool",
+                             "backlog", 8,
+                             NULL);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  pool = wing_named_pipe_client_pool_new (client);
+  wing_named_pipe_client_pool_set_max_connections (pool, 2);
+
+  g_assert (wing_named_pipe_client_pool_prewarm (pool,
+                                                 "\\\\.\\pipe\\gtest-client-pool",
+                                                 WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                 1,
+                                                 NULL,
+                                                 &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (wing_named_pipe_client_pool_get_n_idle (pool, "\\\\.\\pipe\\gtest-client-pool"), ==, 1);
+
+  /* The prewarmed connection is reused */
+  connection = wing_named_pipe_client_pool_get (pool,
+                                                "\\\\.\\pipe\\gtest-client-pool",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+  g_assert (connection != NULL);
+  g_assert_cmpuint (wing_named_pipe_client_pool_get_n_idle (pool, "\\\\.\\pipe\\gtest-client-pool"), ==, 0);
+
+  pooled = connection;
+  wing_named_pipe_client_pool_release (pool, connection);
+  g_assert_cmpuint (wing_named_pipe_client_pool_get_n_idle (pool, "\\\\.\\pipe\\gtest-client-pool"), ==, 1);
+
+  connection = wing_named_pipe_client_pool_get (pool,
+                                                "\\\\.\\pipe\\gtest-client-pool",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+  g_assert (connection == pooled);
+
+  /* A second connection is opened while the first one is in use */
+  pooled = wing_named_pipe_client_pool_get (pool,
+                                            "\\\\.\\pipe\\gtest-client-pool",
+                                            WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                            NULL,
+                                            &error);
+  g_assert_no_error (error);
+  g_assert (pooled != NULL && pooled != connection);
+
+  /* The limit is reached */
+  g_assert (wing_named_pipe_client_pool_get (pool,
+                                             "\\\\.\\pipe\\gtest-client-pool",
+                                             WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                             NULL,
+                                             &error) == NULL);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_BUSY);
+  g_clear_error (&error);
+
+  /* Dropping a connection frees its slot */
+  g_object_unref (pooled);
+  wing_named_pipe_client_pool_release (pool, connection);
+
+  connection = wing_named_pipe_client_pool_get (pool,
+                                                "\\\\.\\pipe\\gtest-client-pool",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+  g_object_unref (connection);
+
+  wing_named_pipe_client_pool_clear (pool);
+  g_assert_cmpuint (wing_named_pipe_client_pool_get_n_idle (pool, "\\\\.\\pipe\\gtest-client-pool"), ==, 0);
+
+  /* A request waiting for other flags gets the slot of a released
+   * connection, which is not kept idle */
+  wing_named_pipe_client_pool_set_max_connections (pool, 1);
+
+  connection = wing_named_pipe_client_pool_get (pool,
+                                                "\\\\.\\pipe\\gtest-client-pool",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  pooled = NULL;
+  wing_named_pipe_client_pool_get_async (pool,
+                                         "\\\\.\\pipe\\gtest-client-pool",
+                                         WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                         NULL,
+                                         pool_get_cb,
+                                         &pooled);
+
+  wing_named_pipe_client_pool_release (pool, connection);
+  g_assert_cmpuint (wing_named_pipe_client_pool_get_n_idle (pool, "\\\\.\\pipe\\gtest-client-pool"), ==, 0);
+
+  while (pooled == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  g_object_unref (pooled);
+
+  g_object_unref (pool);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_client_default_timeout (gconstpointer user_data)
+{
+  WingNamedPipeClient *client;
+  guint timeout;
+  TestData *test_data = (TestData *) user_data;
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  g_object_get (G_OBJECT (client), "timeout", &timeout, NULL);
+
+  g_assert_cmpuint (timeout, ==, NMPWAIT_WAIT_FOREVER);
+  g_object_unref (client);
+}
+
+static void
+accepted_read_write_cb (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  WingNamedPipeListener *listener = WING_NAMED_PIPE_LISTENER (source);
+  WingNamedPipeConnection **conn = user_data;
+  GError *error = NULL;
+
+  *conn = wing_named_pipe_listener_accept_finish (listener, result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+connected_read_write_cb (GObject      *source,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  WingNamedPipeClient *client = WING_NAMED_PIPE_CLIENT (source);
+  WingNamedPipeConnection **conn = user_data;
+  GError *error = NULL;
+
+  *conn = wing_named_pipe_client_connect_finish (client, result, &error);
+  g_assert_no_error (error);
+}
+
+typedef struct
+{
+  gchar data[256];
+  gboolean *read;
+} ReadData;
+
+#define MAX_ITERATIONS 100
+static const gchar *some_text = "This is some data to read and to write";
+
+static void
+on_some_text_read (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  ReadData *data = user_data;
+  gssize read;
+  GError *error = NULL;
+
+  read = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (read, ==, strlen (some_text) + 1);
+
+  *data->read = TRUE;
+  g_free (data);
+}
+
+static void
+on_some_text_written (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  gboolean *wrote = user_data;
+  gssize read;
+  GError *error = NULL;
+
+  read = g_output_stream_write_finish (G_OUTPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (read, ==, strlen (some_text) + 1);
+
+  *wrote = TRUE;
+}
+
+static void
+write_and_read (GIOStream *server_stream,
+                GIOStream *client_stream)
+{
+  gint i;
+
   for (i = 0; i < MAX_ITERATIONS; i++)
     {
       ReadData *data;
@@ -902,42 +1667,125 @@ test_read_write_several_connections (gconstpointer user_data)
   g_object_unref (listener);
 }
 
+#define N_PENDING_READS 100
+
 static void
-test_read_write_same_time_several_connections (gconstpointer user_data)
+pending_read_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  gint *n_done = user_data;
+  GError *error = NULL;
+
+  g_assert_cmpint (g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error), ==, 1);
+  g_assert_no_error (error);
+
+  (*n_done)++;
+}
+
+/* More reads pending at once than a main context can poll handles */
+static void
+test_many_pending_reads (gconstpointer user_data)
 {
   WingNamedPipeListener *listener;
-  GPtrArray *client_conns;
-  GPtrArray *server_conns;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_servers[N_PENDING_READS];
+  WingNamedPipeConnection *conn_clients[N_PENDING_READS];
+  gchar buffers[N_PENDING_READS];
+  gint n_done = 0;
   gint i;
   GError *error = NULL;
   TestData *test_data = (TestData *) user_data;
 
-  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-named-pipe-name-read-write-several",
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-many-pending-reads",
                                            NULL,
                                            FALSE,
                                            NULL,
                                            &error);
-  g_assert (listener != NULL);
   g_assert_no_error (error);
-
   wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
 
-  client_conns = g_ptr_array_new_with_free_func (g_object_unref);
-  server_conns = g_ptr_array_new_with_free_func (g_object_unref);
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
 
-  for (i = 0; i < MAX_ITERATIONS; i++)
+  for (i = 0; i < N_PENDING_READS; i++)
     {
-      WingNamedPipeClient *client;
-      WingNamedPipeConnection *conn_server = NULL;
-      WingNamedPipeConnection *conn_client = NULL;
+      conn_clients[i] = wing_named_pipe_client_connect (client,
+                                                        "\\\\.\\pipe\\gtest-many-pending-reads",
+                                                        WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                        NULL,
+                                                        &error);
+      g_assert_no_error (error);
 
-      wing_named_pipe_listener_accept_async (listener,
-                                             NULL,
-                                             accepted_read_write_cb,
-                                             &conn_server);
+      conn_servers[i] = wing_named_pipe_listener_accept (listener, NULL, &error);
+      g_assert_no_error (error);
 
-      client = wing_named_pipe_client_new ();
-      wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+      g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_servers[i])),
+                                 &buffers[i], 1, G_PRIORITY_DEFAULT,
+                                 NULL, pending_read_cb, &n_done);
+    }
+
+  /* Nothing to read yet */
+  while (g_main_context_iteration (NULL, FALSE));
+  g_assert_cmpint (n_done, ==, 0);
+
+  for (i = N_PENDING_READS - 1; i >= 0; i--)
+    {
+      g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn_clients[i])),
+                             "x", 1, NULL, &error);
+      g_assert_no_error (error);
+    }
+
+  while (n_done < N_PENDING_READS)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (i = 0; i < N_PENDING_READS; i++)
+    {
+      g_assert_cmpint (buffers[i], ==, 'x');
+      g_object_unref (conn_clients[i]);
+      g_object_unref (conn_servers[i]);
+    }
+
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_read_write_same_time_several_connections (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  GPtrArray *client_conns;
+  GPtrArray *server_conns;
+  gint i;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-named-pipe-name-read-write-several",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client_conns = g_ptr_array_new_with_free_func (g_object_unref);
+  server_conns = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < MAX_ITERATIONS; i++)
+    {
+      WingNamedPipeClient *client;
+      WingNamedPipeConnection *conn_server = NULL;
+      WingNamedPipeConnection *conn_client = NULL;
+
+      wing_named_pipe_listener_accept_async (listener,
+                                             NULL,
+                                             accepted_read_write_cb,
+                                             &conn_server);
+
+      client = wing_named_pipe_client_new ();
+      wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
 
       wing_named_pipe_client_connect_async (client,
                                             "\\\\.\\pipe\\gtest-named-pipe-name-read-write-several",
@@ -1053,6 +1901,1685 @@ test_cancel_read (gconstpointer user_data)
   g_object_unref (cancellable);
 }
 
+/* The source of the streams is kept from one operation to the next */
+static void
+test_reuse_async_source (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  GInputStream *in;
+  GOutputStream *out;
+  GCancellable *cancellable;
+  gchar buffer;
+  gint n_done = 0;
+  gint i;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-reuse-async-source",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-reuse-async-source",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  in = g_io_stream_get_input_stream (G_IO_STREAM (conn_server));
+  out = g_io_stream_get_output_stream (G_IO_STREAM (conn_client));
+  cancellable = g_cancellable_new ();
+
+  /* Half of the reads with the same cancellable, the others without */
+  for (i = 0; i < 10; i++)
+    {
+      g_input_stream_read_async (in, &buffer, 1, G_PRIORITY_DEFAULT,
+                                 i % 2 == 0 ? cancellable : NULL,
+                                 pending_read_cb, &n_done);
+
+      /* Let the read wait for the data */
+      while (g_main_context_iteration (NULL, FALSE));
+
+      g_output_stream_write (out, "x", 1, NULL, &error);
+      g_assert_no_error (error);
+
+      while (n_done <= i)
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+  /* Cancelled with no read pending, which must not keep the context
+   * busy */
+  g_cancellable_cancel (cancellable);
+  while (g_main_context_iteration (NULL, FALSE));
+
+  g_input_stream_read_async (in, &buffer, 1, G_PRIORITY_DEFAULT,
+                             NULL, pending_read_cb, &n_done);
+  g_output_stream_write (out, "x", 1, NULL, &error);
+  g_assert_no_error (error);
+
+  while (n_done <= i)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_object_unref (cancellable);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+read_at_cb (GObject      *source,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+  gssize *read = user_data;
+  GError *error = NULL;
+
+  *read = wing_input_stream_read_at_finish (WING_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+write_at_cb (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  gssize *written = user_data;
+  GError *error = NULL;
+
+  *written = wing_output_stream_write_at_finish (WING_OUTPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_file_seek_read_at (void)
+{
+  gchar *path;
+  HANDLE handle;
+  GInputStream *in;
+  GOutputStream *out;
+  gchar buffer[16];
+  gssize read = -1;
+  gssize written = -1;
+  GError *error = NULL;
+
+  path = g_build_filename (g_get_tmp_dir (), "gtest-wing-file-seek-read-at", NULL);
+  handle = CreateFileA (path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                        CREATE_ALWAYS, FILE_FLAG_OVERLAPPED | FILE_FLAG_DELETE_ON_CLOSE,
+                        NULL);
+  g_assert (handle != INVALID_HANDLE_VALUE);
+
+  in = wing_input_stream_new (handle, FALSE);
+  out = wing_output_stream_new (handle, TRUE);
+  g_assert (g_seekable_can_seek (G_SEEKABLE (in)));
+  g_assert (!g_seekable_can_truncate (G_SEEKABLE (in)));
+  g_assert (g_seekable_can_truncate (G_SEEKABLE (out)));
+
+  g_output_stream_write_all (out, "0123456789", 10, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (out)), ==, 10);
+
+  g_seekable_seek (G_SEEKABLE (in), 2, G_SEEK_SET, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_input_stream_read (in, buffer, 3, NULL, &error), ==, 3);
+  g_assert_no_error (error);
+  g_assert (memcmp (buffer, "234", 3) == 0);
+
+  /* The positional reads and writes leave the position alone */
+  g_assert_cmpint (wing_input_stream_read_at (WING_INPUT_STREAM (in), buffer, sizeof (buffer), 7, NULL, &error), ==, 3);
+  g_assert_no_error (error);
+  g_assert (memcmp (buffer, "789", 3) == 0);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (in)), ==, 5);
+
+  wing_output_stream_write_at_async (WING_OUTPUT_STREAM (out), "AB", 2, 0, G_PRIORITY_DEFAULT,
+                                     NULL, write_at_cb, &written);
+  while (written < 0)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpint (written, ==, 2);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (out)), ==, 10);
+
+  wing_input_stream_read_at_async (WING_INPUT_STREAM (in), buffer, 4, 0, G_PRIORITY_DEFAULT,
+                                   NULL, read_at_cb, &read);
+  while (read < 0)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpint (read, ==, 4);
+  g_assert (memcmp (buffer, "AB23", 4) == 0);
+
+  /* Past the end of the file */
+  g_assert_cmpint (wing_input_stream_read_at (WING_INPUT_STREAM (in), buffer, sizeof (buffer), 100, NULL, &error), ==, 0);
+  g_assert_no_error (error);
+
+  g_seekable_truncate (G_SEEKABLE (out), 5, NULL, &error);
+  g_assert_no_error (error);
+  g_seekable_seek (G_SEEKABLE (in), -1, G_SEEK_END, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_seekable_tell (G_SEEKABLE (in)), ==, 4);
+
+  g_object_unref (in);
+  g_object_unref (out);
+  g_free (path);
+}
+
+typedef struct
+{
+  GByteArray *data;
+  gsize chunk_size;
+  gint pending;
+  gboolean eof;
+} FileReaderData;
+
+static void
+file_reader_read_cb (GObject      *source,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  FileReaderData *data = user_data;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  bytes = wing_file_reader_read_finish (WING_FILE_READER (source), result, &error);
+  g_assert_no_error (error);
+  g_assert (bytes != NULL);
+
+  /* Only the last chunk may be short, the requests after it get nothing */
+  if (data->eof)
+    g_assert_cmpuint (g_bytes_get_size (bytes), ==, 0);
+  else if (g_bytes_get_size (bytes) < data->chunk_size)
+    data->eof = TRUE;
+
+  g_byte_array_append (data->data,
+                       g_bytes_get_data (bytes, NULL),
+                       g_bytes_get_size (bytes));
+  g_bytes_unref (bytes);
+
+  if (!data->eof)
+    {
+      data->pending++;
+      wing_file_reader_read_async (WING_FILE_READER (source), G_PRIORITY_DEFAULT,
+                                   NULL, file_reader_read_cb, data);
+    }
+
+  data->pending--;
+}
+
+static void
+test_file_reader (void)
+{
+  WingFileReader *reader;
+  FileReaderData data = { NULL, };
+  gchar *path;
+  gchar contents[10123];
+  gsize i;
+  GError *error = NULL;
+
+  for (i = 0; i < sizeof (contents); i++)
+    contents[i] = i % 251;
+
+  path = g_build_filename (g_get_tmp_dir (), "gtest-wing-file-reader", NULL);
+  g_file_set_contents (path, contents, sizeof (contents), &error);
+  g_assert_no_error (error);
+
+  reader = wing_file_reader_new (path, 3, 1000, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (wing_file_reader_get_n_reads (reader), ==, 3);
+  g_assert_cmpuint (wing_file_reader_get_file_size (reader), ==, sizeof (contents));
+
+  /* Rounded up to a multiple of the sector size */
+  data.chunk_size = wing_file_reader_get_chunk_size (reader);
+  g_assert_cmpuint (data.chunk_size, >=, 1000);
+  g_assert_cmpuint (data.chunk_size % 512, ==, 0);
+
+  /* Several requests pending at the same time are satisfied in order */
+  data.data = g_byte_array_new ();
+  data.pending = 2;
+  wing_file_reader_read_async (reader, G_PRIORITY_DEFAULT, NULL, file_reader_read_cb, &data);
+  wing_file_reader_read_async (reader, G_PRIORITY_DEFAULT, NULL, file_reader_read_cb, &data);
+
+  while (data.pending > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (data.data->len, ==, sizeof (contents));
+  g_assert (memcmp (data.data->data, contents, sizeof (contents)) == 0);
+
+  wing_file_reader_close (reader);
+  g_object_unref (reader);
+  g_byte_array_unref (data.data);
+
+  g_assert (DeleteFileA (path));
+  g_free (path);
+}
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+static void
+writev_all_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  gboolean *done = user_data;
+  gsize bytes_written;
+  GError *error = NULL;
+
+  g_output_stream_writev_all_finish (G_OUTPUT_STREAM (source), result, &bytes_written, &error);
+  g_assert_no_error (error);
+
+  *done = TRUE;
+}
+
+static void
+read_all_cb (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  gboolean *done = user_data;
+  gsize bytes_read;
+  GError *error = NULL;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source), result, &bytes_read, &error);
+  g_assert_no_error (error);
+
+  *done = TRUE;
+}
+
+static void
+test_writev (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  GOutputStream *out;
+  GInputStream *in;
+  GOutputVector vectors[4];
+  gchar header[8] = "HEADER";
+  gchar small[100];
+  gchar big[10000];
+  gchar trailer[16] = "TRAILER";
+  gchar *expected;
+  gchar *received;
+  gsize total, bytes_written, bytes_read;
+  gboolean written = FALSE;
+  gboolean read = FALSE;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  memset (small, 's', sizeof (small));
+  memset (big, 'b', sizeof (big));
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-writev",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-writev",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  out = g_io_stream_get_output_stream (G_IO_STREAM (conn_client));
+  in = g_io_stream_get_input_stream (G_IO_STREAM (conn_server));
+
+  vectors[0].buffer = header;
+  vectors[0].size = sizeof (header);
+  vectors[1].buffer = small;
+  vectors[1].size = sizeof (small);
+  vectors[2].buffer = big;
+  vectors[2].size = sizeof (big);
+  vectors[3].buffer = trailer;
+  vectors[3].size = sizeof (trailer);
+
+  total = sizeof (header) + sizeof (small) + sizeof (big) + sizeof (trailer);
+  expected = g_malloc (total);
+  memcpy (expected, header, sizeof (header));
+  memcpy (expected + sizeof (header), small, sizeof (small));
+  memcpy (expected + sizeof (header) + sizeof (small), big, sizeof (big));
+  memcpy (expected + sizeof (header) + sizeof (small) + sizeof (big), trailer, sizeof (trailer));
+
+  /* The small vectors fit in the pipe buffer */
+  g_output_stream_writev_all (out, vectors, 2, &bytes_written, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (bytes_written, ==, sizeof (header) + sizeof (small));
+
+  received = g_malloc (total);
+  g_input_stream_read_all (in, received, bytes_written, &bytes_read, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (bytes_read, ==, bytes_written);
+  g_assert (memcmp (received, expected, bytes_read) == 0);
+
+  g_output_stream_writev_all_async (out, vectors, G_N_ELEMENTS (vectors), G_PRIORITY_DEFAULT,
+                                    NULL, writev_all_cb, &written);
+  g_input_stream_read_all_async (in, received, total, G_PRIORITY_DEFAULT,
+                                 NULL, read_all_cb, &read);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (!written || !read);
+
+  g_assert (memcmp (received, expected, total) == 0);
+
+  g_free (received);
+  g_free (expected);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+#endif
+
+static void
+write_all_cb (GObject      *source,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  gboolean *done = user_data;
+  gsize bytes_written;
+  GError *error = NULL;
+
+  g_output_stream_write_all_finish (G_OUTPUT_STREAM (source), result, &bytes_written, &error);
+  g_assert_no_error (error);
+
+  *done = TRUE;
+}
+
+static void
+splice_cb (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  gssize *spliced = user_data;
+  GError *error = NULL;
+
+  *spliced = g_output_stream_splice_finish (G_OUTPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+relay_read_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  gboolean *done = user_data;
+  gsize bytes_read;
+  GError *error = NULL;
+
+  g_input_stream_read_all_finish (G_INPUT_STREAM (source), result, &bytes_read, &error);
+  g_assert_no_error (error);
+
+  *done = TRUE;
+}
+
+/* Relays the data written to a connection to another one */
+static void
+test_splice (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server[2];
+  WingNamedPipeConnection *conn_client[2];
+  guint8 *data;
+  guint8 *received;
+  gsize size = 300000;
+  gssize spliced = -1;
+  gboolean written = FALSE;
+  gboolean read = FALSE;
+  gsize i;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-splice",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  for (i = 0; i < 2; i++)
+    {
+      conn_client[i] = wing_named_pipe_client_connect (client,
+                                                       "\\\\.\\pipe\\gtest-splice",
+                                                       WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                       NULL,
+                                                       &error);
+      g_assert_no_error (error);
+
+      conn_server[i] = wing_named_pipe_listener_accept (listener, NULL, &error);
+      g_assert_no_error (error);
+    }
+
+  /* Larger than the ring of buffers of the splice */
+  data = g_malloc (size);
+  for (i = 0; i < size; i++)
+    data[i] = i % 251;
+  received = g_malloc0 (size);
+
+  g_output_stream_splice_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_server[1])),
+                                g_io_stream_get_input_stream (G_IO_STREAM (conn_server[0])),
+                                G_OUTPUT_STREAM_SPLICE_NONE,
+                                G_PRIORITY_DEFAULT,
+                                NULL,
+                                splice_cb,
+                                &spliced);
+
+  g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_client[0])),
+                                   data, size, G_PRIORITY_DEFAULT,
+                                   NULL, write_all_cb, &written);
+  g_input_stream_read_all_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_client[1])),
+                                 received, size, G_PRIORITY_DEFAULT,
+                                 NULL, relay_read_cb, &read);
+
+  while (!written || !read)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert (memcmp (data, received, size) == 0);
+
+  /* The splice is over once the writer goes away */
+  g_io_stream_close (G_IO_STREAM (conn_client[0]), NULL, &error);
+  g_assert_no_error (error);
+
+  while (spliced < 0)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpint (spliced, ==, size);
+
+  for (i = 0; i < 2; i++)
+    {
+      g_object_unref (conn_client[i]);
+      g_object_unref (conn_server[i]);
+    }
+  g_object_unref (client);
+  g_object_unref (listener);
+  g_free (data);
+  g_free (received);
+}
+
+static void
+splice_error_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GError **error = user_data;
+
+  g_assert_cmpint (g_output_stream_splice_finish (G_OUTPUT_STREAM (source), result, error), ==, -1);
+  g_assert (*error != NULL);
+}
+
+/* The write fails while the next read waits for a source with no data */
+static void
+test_splice_target_closed (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server[2];
+  WingNamedPipeConnection *conn_client[2];
+  gchar some_text[] = "Hello splice";
+  GError *splice_error = NULL;
+  gsize i;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-splice-target-closed",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  for (i = 0; i < 2; i++)
+    {
+      conn_client[i] = wing_named_pipe_client_connect (client,
+                                                       "\\\\.\\pipe\\gtest-splice-target-closed",
+                                                       WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                       NULL,
+                                                       &error);
+      g_assert_no_error (error);
+
+      conn_server[i] = wing_named_pipe_listener_accept (listener, NULL, &error);
+      g_assert_no_error (error);
+    }
+
+  /* The peer of the target goes away */
+  g_io_stream_close (G_IO_STREAM (conn_client[1]), NULL, &error);
+  g_assert_no_error (error);
+
+  g_output_stream_splice_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_server[1])),
+                                g_io_stream_get_input_stream (G_IO_STREAM (conn_server[0])),
+                                G_OUTPUT_STREAM_SPLICE_NONE,
+                                G_PRIORITY_DEFAULT,
+                                NULL,
+                                splice_error_cb,
+                                &splice_error);
+
+  /* Then the source gets some data and stays idle */
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (conn_client[0])),
+                             some_text, strlen (some_text), NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  while (splice_error == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* The failed write is reported, not the read cancelled after it */
+  g_assert (!g_error_matches (splice_error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+  g_error_free (splice_error);
+
+  for (i = 0; i < 2; i++)
+    {
+      g_object_unref (conn_client[i]);
+      g_object_unref (conn_server[i]);
+    }
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+typedef struct
+{
+  WingIocpReader *reader;
+  GByteArray *received;
+  gboolean eof;
+} ReaderData;
+
+static void
+reader_read_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  ReaderData *data = user_data;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  bytes = wing_iocp_reader_read_finish (WING_IOCP_READER (source), result, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (bytes), <=, wing_iocp_reader_get_buffer_size (data->reader));
+
+  if (g_bytes_get_size (bytes) == 0)
+    data->eof = TRUE;
+  else
+    {
+      g_byte_array_append (data->received,
+                           g_bytes_get_data (bytes, NULL),
+                           g_bytes_get_size (bytes));
+      wing_iocp_reader_read_async (data->reader, G_PRIORITY_DEFAULT, NULL, reader_read_cb, data);
+    }
+
+  g_bytes_unref (bytes);
+}
+
+static void
+test_iocp_reader (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  WingThreadPoolIo *thread_pool_io;
+  GOutputStream *out;
+  ReaderData data = { NULL, };
+  gchar *sent;
+  gsize i;
+  gboolean written = FALSE;
+  GError *error = NULL;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-iocp-reader",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-iocp-reader",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_get (conn_server, "threadpool-io", &thread_pool_io, NULL);
+  g_assert (thread_pool_io != NULL);
+
+  data.reader = wing_iocp_reader_new (thread_pool_io, 4, 1000);
+  g_assert_cmpuint (wing_iocp_reader_get_n_reads (data.reader), ==, 4);
+  data.received = g_byte_array_new ();
+  wing_thread_pool_io_unref (thread_pool_io);
+
+  sent = g_malloc (100000);
+  for (i = 0; i < 100000; i++)
+    sent[i] = (gchar) (i % 251);
+
+  wing_iocp_reader_read_async (data.reader, G_PRIORITY_DEFAULT, NULL, reader_read_cb, &data);
+
+  out = g_io_stream_get_output_stream (G_IO_STREAM (conn_client));
+  g_output_stream_write_all_async (out, sent, 100000, G_PRIORITY_DEFAULT,
+                                   NULL, write_all_cb, &written);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (!written || data.received->len < 100000);
+
+  g_assert (memcmp (data.received->data, sent, 100000) == 0);
+
+  /* Closing the client ends the data */
+  g_object_unref (conn_client);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (!data.eof);
+
+  g_assert_cmpuint (data.received->len, ==, 100000);
+
+  g_object_unref (data.reader);
+  g_byte_array_unref (data.received);
+  g_free (sent);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  GThread *thread;
+  gssize read;
+  gboolean done;
+} InlineData;
+
+static void
+inline_read_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  InlineData *data = user_data;
+  GError *error = NULL;
+  gssize read;
+
+  read = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+
+  g_mutex_lock (&data->mutex);
+  data->thread = g_thread_self ();
+  data->read = read;
+  data->done = TRUE;
+  g_cond_signal (&data->cond);
+  g_mutex_unlock (&data->mutex);
+}
+
+static void
+test_inline_completion (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  InlineData data = { 0, };
+  gchar buffer[32];
+  gchar some_text[] = "Hello inline";
+  GError *error = NULL;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-inline-completion",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-inline-completion",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_assert (!wing_named_pipe_connection_get_inline_completion (conn_server));
+  wing_named_pipe_connection_set_inline_completion (conn_server, TRUE);
+  g_assert (wing_named_pipe_connection_get_inline_completion (conn_server));
+
+  g_mutex_init (&data.mutex);
+  g_cond_init (&data.cond);
+
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                             buffer, sizeof (buffer), G_PRIORITY_DEFAULT,
+                             NULL, inline_read_cb, &data);
+
+  g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                         some_text, strlen (some_text), NULL, &error);
+  g_assert_no_error (error);
+
+  /* The callback runs without the main context being iterated */
+  g_mutex_lock (&data.mutex);
+  while (!data.done)
+    g_cond_wait (&data.cond, &data.mutex);
+  g_mutex_unlock (&data.mutex);
+
+  g_assert (data.thread != g_thread_self ());
+  g_assert_cmpint (data.read, ==, strlen (some_text));
+  g_assert (memcmp (buffer, some_text, data.read) == 0);
+
+  g_mutex_clear (&data.mutex);
+  g_cond_clear (&data.cond);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_thread_pool (void)
+{
+  WingThreadPool *pool;
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  WingThreadPool *conn_pool;
+  WingThreadPoolIo *thread_pool_io;
+  InlineData data = { 0, };
+  gchar buffer[32];
+  gchar some_text[] = "Hello private pool";
+  GError *error = NULL;
+
+  pool = wing_thread_pool_new (1, 2, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (wing_thread_pool_get_min_threads (pool), ==, 1);
+  g_assert_cmpuint (wing_thread_pool_get_max_threads (pool), ==, 2);
+
+  /* Set before the pipe is added, which binds the first instance */
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-thread-pool",
+                             "use-iocp", TRUE,
+                             "thread-pool", pool,
+                             "io-priority", G_PRIORITY_HIGH,
+                             NULL);
+  g_assert_no_error (error);
+  g_assert (wing_named_pipe_listener_get_thread_pool (listener) == pool);
+  g_assert_cmpint (wing_named_pipe_listener_get_io_priority (listener), ==, G_PRIORITY_HIGH);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+  wing_named_pipe_client_set_thread_pool (client, pool);
+  g_assert (wing_named_pipe_client_get_thread_pool (client) == pool);
+  wing_named_pipe_client_set_io_priority (client, G_PRIORITY_LOW);
+  g_assert_cmpint (wing_named_pipe_client_get_io_priority (client), ==, G_PRIORITY_LOW);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-thread-pool",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_get (conn_client, "thread-pool", &conn_pool, NULL);
+  g_assert (conn_pool == pool);
+  wing_thread_pool_unref (conn_pool);
+
+  /* Each end completes with the priority of its side */
+  g_object_get (conn_server, "threadpool-io", &thread_pool_io, NULL);
+  g_assert_cmpint (wing_thread_pool_io_get_io_priority (thread_pool_io), ==, G_PRIORITY_HIGH);
+  wing_thread_pool_io_unref (thread_pool_io);
+
+  g_object_get (conn_client, "threadpool-io", &thread_pool_io, NULL);
+  g_assert_cmpint (wing_thread_pool_io_get_io_priority (thread_pool_io), ==, G_PRIORITY_LOW);
+  wing_thread_pool_io_unref (thread_pool_io);
+
+  g_mutex_init (&data.mutex);
+  g_cond_init (&data.cond);
+
+  wing_named_pipe_connection_set_inline_completion (conn_server, TRUE);
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                             buffer, sizeof (buffer), G_PRIORITY_DEFAULT,
+                             NULL, inline_read_cb, &data);
+
+  g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                         some_text, strlen (some_text), NULL, &error);
+  g_assert_no_error (error);
+
+  g_mutex_lock (&data.mutex);
+  while (!data.done)
+    g_cond_wait (&data.cond, &data.mutex);
+  g_mutex_unlock (&data.mutex);
+
+  g_assert (data.thread != g_thread_self ());
+  g_assert_cmpint (data.read, ==, strlen (some_text));
+  g_assert (memcmp (buffer, some_text, data.read) == 0);
+
+  g_mutex_clear (&data.mutex);
+  g_cond_clear (&data.cond);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+
+  /* The thread pool I/O objects are closed from an idle */
+  while (g_main_context_iteration (NULL, FALSE));
+
+  g_assert (!wing_thread_pool_is_shut_down (pool));
+  wing_thread_pool_shutdown (pool);
+  g_assert (wing_thread_pool_is_shut_down (pool));
+
+  wing_thread_pool_unref (pool);
+}
+
+static void
+engine_read_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  gssize *read = user_data;
+  GError *error = NULL;
+
+  *read = g_input_stream_read_finish (G_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_completion_port_engine (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  WingThreadPoolIo *thread_pool_io;
+  gchar buffer[32];
+  gchar some_text[] = "Hello completion port";
+  gboolean written = FALSE;
+  gssize read = -1;
+  gint i;
+  GError *error = NULL;
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+  g_assert_cmpint (wing_thread_pool_io_get_default_engine (), ==, WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-completion-port-engine",
+                                           NULL, FALSE, NULL, &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-completion-port-engine",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  /* A pipe in byte mode does not queue the operations succeeding
+   * right away */
+  g_object_get (conn_server, "threadpool-io", &thread_pool_io, NULL);
+  g_assert_cmpint (wing_thread_pool_io_get_engine (thread_pool_io), ==, WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+  g_assert (wing_thread_pool_io_get_skip_completion_port_on_success (thread_pool_io));
+  wing_thread_pool_io_unref (thread_pool_io);
+
+  /* Each round trip either completes right away or through the port */
+  for (i = 0; i < 10; i++)
+    {
+      written = FALSE;
+      read = -1;
+
+      g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                                 buffer, sizeof (buffer), G_PRIORITY_DEFAULT,
+                                 NULL, engine_read_cb, &read);
+      g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                                       some_text, strlen (some_text), G_PRIORITY_DEFAULT,
+                                       NULL, write_all_cb, &written);
+
+      while (!written || read < 0)
+        g_main_context_iteration (NULL, TRUE);
+
+      g_assert_cmpint (read, ==, strlen (some_text));
+      g_assert (memcmp (buffer, some_text, read) == 0);
+    }
+
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+
+  /* The thread pool I/O objects are closed from an idle */
+  while (g_main_context_iteration (NULL, FALSE));
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_THREAD_POOL);
+}
+
+static void
+inline_write_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  InlineData *data = user_data;
+  GError *error = NULL;
+  gssize written;
+
+  written = g_output_stream_write_finish (G_OUTPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+
+  g_mutex_lock (&data->mutex);
+  data->thread = g_thread_self ();
+  data->read = written;
+  data->done = TRUE;
+  g_cond_signal (&data->cond);
+  g_mutex_unlock (&data->mutex);
+}
+
+static void
+wait_inline_data (InlineData *data)
+{
+  g_mutex_lock (&data->mutex);
+  while (!data->done)
+    g_cond_wait (&data->cond, &data->mutex);
+  data->done = FALSE;
+  g_mutex_unlock (&data->mutex);
+}
+
+static void
+test_inline_completion_port_engine (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  InlineData data = { 0, };
+  gchar buffer[32];
+  gchar some_text[] = "Hello inline port";
+  GError *error = NULL;
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-inline-completion-port-engine",
+                                           NULL, FALSE, NULL, &error);
+  g_assert_no_error (error);
+  wing_named_pipe_listener_set_use_iocp (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-inline-completion-port-engine",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_connection_set_inline_completion (conn_server, TRUE);
+
+  g_mutex_init (&data.mutex);
+  g_cond_init (&data.cond);
+
+  /* The data is already there, so the read succeeds right away and the
+   * port is skipped: the callback must still not run from this thread,
+   * before g_input_stream_read_async() returns */
+  g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                         some_text, strlen (some_text), NULL, &error);
+  g_assert_no_error (error);
+
+  g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                             buffer, sizeof (buffer), G_PRIORITY_DEFAULT,
+                             NULL, inline_read_cb, &data);
+  wait_inline_data (&data);
+
+  g_assert (data.thread != g_thread_self ());
+  g_assert_cmpint (data.read, ==, strlen (some_text));
+  g_assert (memcmp (buffer, some_text, data.read) == 0);
+
+  /* The pipe has room, so the write succeeds right away as well */
+  g_output_stream_write_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_server)),
+                               some_text, strlen (some_text), G_PRIORITY_DEFAULT,
+                               NULL, inline_write_cb, &data);
+  wait_inline_data (&data);
+
+  g_assert (data.thread != g_thread_self ());
+  g_assert_cmpint (data.read, ==, strlen (some_text));
+
+  g_mutex_clear (&data.mutex);
+  g_cond_clear (&data.cond);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+
+  /* The thread pool I/O objects are closed from an idle */
+  while (g_main_context_iteration (NULL, FALSE));
+
+  wing_thread_pool_io_set_default_engine (WING_THREAD_POOL_IO_ENGINE_THREAD_POOL);
+}
+
+static void
+receive_message_cb (GObject      *source,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  GBytes **message = user_data;
+  GError *error = NULL;
+
+  *message = wing_named_pipe_connection_receive_message_finish (WING_NAMED_PIPE_CONNECTION (source),
+                                                                result,
+                                                                &error);
+  g_assert_no_error (error);
+  g_assert (*message != NULL);
+}
+
+static gboolean
+pollable_ready_cb (GObject  *pollable,
+                   gpointer  user_data)
+{
+  gboolean *ready = user_data;
+
+  *ready = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_pollable (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  GPollableInputStream *in;
+  GPollableOutputStream *out;
+  GSource *source;
+  gchar buffer[16];
+  gboolean ready = FALSE;
+  gssize size;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-pollable",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-pollable",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  in = G_POLLABLE_INPUT_STREAM (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)));
+  out = G_POLLABLE_OUTPUT_STREAM (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)));
+
+  g_assert_true (g_pollable_input_stream_can_poll (in));
+  g_assert_true (g_pollable_output_stream_can_poll (out));
+
+  /* Nothing to read yet */
+  g_assert_false (g_pollable_input_stream_is_readable (in));
+  size = g_pollable_input_stream_read_nonblocking (in, buffer, sizeof (buffer), NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+  g_assert_cmpint (size, ==, -1);
+  g_clear_error (&error);
+
+  source = g_pollable_input_stream_create_source (in, NULL);
+  g_source_set_callback (source, (GSourceFunc) pollable_ready_cb, &ready, NULL);
+  g_source_attach (source, NULL);
+
+  /* The source waits with a zero-byte read, which the write completes */
+  g_assert_true (g_pollable_output_stream_is_writable (out));
+  size = g_pollable_output_stream_write_nonblocking (out, "pollable", 8, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, 8);
+
+  while (!ready)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+
+  g_assert_true (g_pollable_input_stream_is_readable (in));
+  size = g_pollable_input_stream_read_nonblocking (in, buffer, sizeof (buffer), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (size, ==, 8);
+  g_assert (memcmp (buffer, "pollable", 8) == 0);
+
+  /* The staged write is over once the data is read */
+  ready = FALSE;
+  source = g_pollable_output_stream_create_source (out, NULL);
+  g_source_set_callback (source, (GSourceFunc) pollable_ready_cb, &ready, NULL);
+  g_source_attach (source, NULL);
+
+  while (!ready)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+
+  g_assert_true (g_output_stream_flush (G_OUTPUT_STREAM (out), NULL, &error));
+  g_assert_no_error (error);
+
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+read_ready_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  GBytes **bytes = user_data;
+  GError *error = NULL;
+
+  *bytes = wing_iocp_input_stream_read_ready_finish (WING_IOCP_INPUT_STREAM (source), result, &error);
+  g_assert_no_error (error);
+  g_assert (*bytes != NULL);
+}
+
+static void
+test_read_ready (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  WingIocpInputStream *in;
+  GBytes *bytes = NULL;
+  gchar some_text[] = "Hello when ready";
+  GError *error = NULL;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-read-ready",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_set_use_iocp (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-read-ready",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  in = WING_IOCP_INPUT_STREAM (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)));
+
+  wing_iocp_input_stream_read_ready_async (in, G_PRIORITY_DEFAULT, NULL, read_ready_cb, &bytes);
+
+  /* While waiting for data the stream is busy */
+  g_assert (g_input_stream_has_pending (G_INPUT_STREAM (in)));
+
+  g_output_stream_write (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                         some_text, strlen (some_text), NULL, &error);
+  g_assert_no_error (error);
+
+  while (bytes == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, strlen (some_text));
+  g_assert (memcmp (g_bytes_get_data (bytes, NULL), some_text, strlen (some_text)) == 0);
+  g_clear_pointer (&bytes, g_bytes_unref);
+
+  /* The end of the stream gives empty bytes */
+  wing_iocp_input_stream_read_ready_async (in, G_PRIORITY_DEFAULT, NULL, read_ready_cb, &bytes);
+  g_object_unref (conn_client);
+
+  while (bytes == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, 0);
+  g_bytes_unref (bytes);
+
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+shared_memory_new_cb (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  WingSharedMemoryConnection **connection = user_data;
+  GError *error = NULL;
+
+  *connection = wing_shared_memory_connection_new_finish (result, &error);
+  g_assert_no_error (error);
+  g_assert (*connection != NULL);
+}
+
+static void
+test_shared_memory (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  WingSharedMemoryConnection *shm_server = NULL;
+  WingSharedMemoryConnection *shm_client;
+  GInputStream *in;
+  GOutputStream *out;
+  guint8 *data;
+  guint8 *received;
+  gsize size = 100000;
+  gsize bytes_read;
+  gboolean written = FALSE;
+  guint i;
+  GError *error = NULL;
+
+  listener = wing_named_pipe_listener_new ("\\\\.\\pipe\\gtest-shared-memory",
+                                           NULL,
+                                           FALSE,
+                                           NULL,
+                                           &error);
+  g_assert_no_error (error);
+
+  client = wing_named_pipe_client_new ();
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-shared-memory",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Both ends block during the setup */
+  wing_shared_memory_connection_new_async (conn_server, 5000, G_PRIORITY_DEFAULT,
+                                           NULL, shared_memory_new_cb, &shm_server);
+  shm_client = wing_shared_memory_connection_new (conn_client, 0, NULL, &error);
+  g_assert_no_error (error);
+
+  while (shm_server == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Rounded up to a power of two, and chosen by the server */
+  g_assert_cmpuint (wing_shared_memory_connection_get_ring_size (shm_server), ==, 8192);
+  g_assert_cmpuint (wing_shared_memory_connection_get_ring_size (shm_client), ==, 8192);
+  g_assert (wing_shared_memory_connection_get_pipe_connection (shm_server) == conn_server);
+
+  data = g_malloc (size);
+  for (i = 0; i < size; i++)
+    data[i] = i % 251;
+  received = g_malloc (size);
+
+  /* Much more than the ring holds, so the writer waits for the reader */
+  out = g_io_stream_get_output_stream (G_IO_STREAM (shm_client));
+  in = g_io_stream_get_input_stream (G_IO_STREAM (shm_server));
+
+  g_output_stream_write_all_async (out, data, size, G_PRIORITY_DEFAULT,
+                                   NULL, write_all_cb, &written);
+
+  g_input_stream_read_all (in, received, size, &bytes_read, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (bytes_read, ==, size);
+  g_assert (memcmp (data, received, size) == 0);
+
+  while (!written)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* And the other way */
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (shm_server)),
+                             data, 100, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_input_stream_read_all (g_io_stream_get_input_stream (G_IO_STREAM (shm_client)),
+                           received, 100, &bytes_read, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (bytes_read, ==, 100);
+  g_assert (memcmp (data, received, 100) == 0);
+
+  /* Closing the client gives the end of the stream to the server */
+  g_io_stream_close (G_IO_STREAM (shm_client), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_input_stream_read (in, received, size, NULL, &error), ==, 0);
+  g_assert_no_error (error);
+
+  g_free (data);
+  g_free (received);
+  g_object_unref (shm_client);
+  g_object_unref (shm_server);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_buffer_sizes (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  HANDLE handle;
+  DWORD out_size, in_size;
+  guint effective_in, effective_out;
+  guint8 *data;
+  gsize size = 65536;
+  gsize bytes_read;
+  gboolean written = FALSE;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+
+  /* Set at construction, so the first instance already uses them */
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-buffer-sizes",
+                             "in-buffer-size", 16384,
+                             "out-buffer-size", 32768,
+                             "use-iocp", test_data->use_iocp,
+                             NULL);
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (wing_named_pipe_listener_get_in_buffer_size (listener), ==, 16384);
+  g_assert_cmpuint (wing_named_pipe_listener_get_out_buffer_size (listener), ==, 32768);
+  g_assert (!wing_named_pipe_listener_get_adaptive_buffer_sizes (listener));
+  wing_named_pipe_listener_get_effective_buffer_sizes (listener, &effective_in, &effective_out);
+  g_assert_cmpuint (effective_in, ==, 16384);
+  g_assert_cmpuint (effective_out, ==, 32768);
+
+  wing_named_pipe_listener_set_adaptive_buffer_sizes (listener, TRUE);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-buffer-sizes",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_get (conn_server, "handle", &handle, NULL);
+  g_assert (GetNamedPipeInfo (handle, NULL, &out_size, &in_size, NULL));
+  g_assert_cmpuint (in_size, ==, 16384);
+  g_assert_cmpuint (out_size, ==, 32768);
+
+  /* The server only writes, in transfers larger than its output buffer */
+  data = g_malloc0 (size);
+
+  g_output_stream_write_all_async (g_io_stream_get_output_stream (G_IO_STREAM (conn_server)),
+                                   data, size, G_PRIORITY_DEFAULT,
+                                   NULL, write_all_cb, &written);
+
+  g_input_stream_read_all (g_io_stream_get_input_stream (G_IO_STREAM (conn_client)),
+                           data, size, &bytes_read, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (bytes_read, ==, size);
+
+  while (!written)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* The instances created from now on follow the traffic */
+  wing_named_pipe_listener_add_named_pipe (listener,
+                                           "\\\\.\\pipe\\gtest-buffer-sizes-2",
+                                           NULL,
+                                           FALSE,
+                                           &error);
+  g_assert_no_error (error);
+
+  wing_named_pipe_listener_get_effective_buffer_sizes (listener, &effective_in, &effective_out);
+  g_assert_cmpuint (effective_in, ==, 16384);
+  g_assert_cmpuint (effective_out, >=, size);
+  g_assert_cmpuint (effective_out, <=, 1024 * 1024);
+
+  g_free (data);
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_receive_message (gconstpointer user_data)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  GOutputStream *out;
+  GBytes *message = NULL;
+  guint8 big_message[6000];
+  const gchar *small_message = "some small message";
+  gchar buffer[64] = { 0 };
+  gssize nread;
+  GError *error = NULL;
+  TestData *test_data = (TestData *) user_data;
+  guint i;
+
+  for (i = 0; i < sizeof (big_message); i++)
+    big_message[i] = i % 256;
+
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-receive-message",
+                             "message-mode", TRUE,
+                             NULL);
+  g_assert (listener != NULL);
+  g_assert_no_error (error);
+  g_assert (wing_named_pipe_listener_get_message_mode (listener));
+
+  wing_named_pipe_listener_set_use_iocp (listener, test_data->use_iocp);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, test_data->use_iocp);
+  wing_named_pipe_client_set_message_mode (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-receive-message",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Each write is received as a separate message */
+  out = g_io_stream_get_output_stream (G_IO_STREAM (conn_client));
+  g_output_stream_write_all (out, big_message, sizeof (big_message), NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (out, small_message, strlen (small_message), NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (out, big_message, sizeof (big_message), NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  message = wing_named_pipe_connection_receive_message (conn_server, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (message), ==, sizeof (big_message));
+  g_assert (memcmp (g_bytes_get_data (message, NULL), big_message, sizeof (big_message)) == 0);
+  g_bytes_unref (message);
+
+  message = wing_named_pipe_connection_receive_message (conn_server, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (message), ==, strlen (small_message));
+  g_assert (memcmp (g_bytes_get_data (message, NULL), small_message, strlen (small_message)) == 0);
+  g_bytes_unref (message);
+  message = NULL;
+
+  wing_named_pipe_connection_receive_message_async (conn_server, NULL,
+                                                    receive_message_cb, &message);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (message == NULL);
+
+  g_assert_cmpuint (g_bytes_get_size (message), ==, sizeof (big_message));
+  g_assert (memcmp (g_bytes_get_data (message, NULL), big_message, sizeof (big_message)) == 0);
+  g_bytes_unref (message);
+  message = NULL;
+
+  /* A receive waiting for the message, which is longer than a chunk */
+  wing_named_pipe_connection_receive_message_async (conn_server, NULL,
+                                                    receive_message_cb, &message);
+
+  g_output_stream_write_all (out, big_message, sizeof (big_message), NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  do
+    g_main_context_iteration (NULL, TRUE);
+  while (message == NULL);
+
+  g_assert_cmpuint (g_bytes_get_size (message), ==, sizeof (big_message));
+  g_assert (memcmp (g_bytes_get_data (message, NULL), big_message, sizeof (big_message)) == 0);
+  g_bytes_unref (message);
+
+  /* The input stream can be read again once the receive is over */
+  g_output_stream_write_all (out, small_message, strlen (small_message), NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  nread = g_input_stream_read (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                               buffer, sizeof (buffer), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (nread, ==, strlen (small_message));
+  g_assert_cmpstr (buffer, ==, small_message);
+
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
+static void
+test_read_async_partial_message (void)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeClient *client;
+  WingNamedPipeConnection *conn_server;
+  WingNamedPipeConnection *conn_client;
+  guint8 message[100];
+  guint8 received[sizeof (message)];
+  gsize n_received = 0;
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < sizeof (message); i++)
+    message[i] = i;
+
+  listener = g_initable_new (WING_TYPE_NAMED_PIPE_LISTENER,
+                             NULL,
+                             &error,
+                             "pipe-name", "\\\\.\\pipe\\gtest-read-async-partial-message",
+                             "message-mode", TRUE,
+                             "use-iocp", TRUE,
+                             NULL);
+  g_assert_no_error (error);
+
+  client = wing_named_pipe_client_new ();
+  wing_named_pipe_client_set_use_iocp (client, TRUE);
+  wing_named_pipe_client_set_message_mode (client, TRUE);
+
+  conn_client = wing_named_pipe_client_connect (client,
+                                                "\\\\.\\pipe\\gtest-read-async-partial-message",
+                                                WING_NAMED_PIPE_CLIENT_GENERIC_READ | WING_NAMED_PIPE_CLIENT_GENERIC_WRITE,
+                                                NULL,
+                                                &error);
+  g_assert_no_error (error);
+
+  conn_server = wing_named_pipe_listener_accept (listener, NULL, &error);
+  g_assert_no_error (error);
+
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (conn_client)),
+                             message, sizeof (message), NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The message is waiting, so each read fails right away with
+   * ERROR_MORE_DATA until its last part, and still completes */
+  while (n_received < sizeof (message))
+    {
+      gssize read = -1;
+
+      g_input_stream_read_async (g_io_stream_get_input_stream (G_IO_STREAM (conn_server)),
+                                 received + n_received, 32, G_PRIORITY_DEFAULT,
+                                 NULL, engine_read_cb, &read);
+
+      while (read < 0)
+        g_main_context_iteration (NULL, TRUE);
+
+      g_assert_cmpint (read, ==, MIN (32, sizeof (message) - n_received));
+      n_received += read;
+    }
+
+  g_assert (memcmp (received, message, sizeof (message)) == 0);
+
+  g_object_unref (conn_client);
+  g_object_unref (conn_server);
+  g_object_unref (client);
+  g_object_unref (listener);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -1079,6 +3606,7 @@ main (int   argc,
   test_data_iocp_sync_async.read_write_fn = write_and_read_mix_sync_async;
 
   g_test_add_data_func ("/named-pipes/add-named-pipe", &test_data, test_add_named_pipe);
+  g_test_add_data_func ("/named-pipes/add-named-pipe-multiple-names", &test_data, test_add_named_pipe_multiple_names);
   g_test_add_data_func ("/named-pipes/add-named-pipe-multiple-instances-no-protect", &test_data, test_add_named_pipe_multiple_instances_no_protect);
   g_test_add_data_func ("/named-pipes/add-named-pipe-multiple-instances-protected", &test_data, test_add_named_pipe_multiple_instances_protected);
   g_test_add_data_func ("/named-pipes/connect-basic", &test_data, test_connect_basic);
@@ -1086,31 +3614,61 @@ main (int   argc,
   g_test_add_data_func ("/named-pipes/connect-before-accept-sync", &test_data, test_connect_before_accept_sync);
   g_test_add_data_func ("/named-pipes/connect-sync", &test_data, test_connect_sync);
   g_test_add_data_func ("/named-pipes/connect-sync-fails", &test_data, test_connect_sync_fails);
+  g_test_add_data_func ("/named-pipes/connect-backlog-sync", &test_data, test_connect_backlog_sync);
+  g_test_add_data_func ("/named-pipes/connect-async-busy", &test_data, test_connect_async_busy);
   g_test_add_data_func ("/named-pipes/accept-cancel", &test_data, test_accept_cancel);
   g_test_add_data_func ("/named-pipes/accept-fail-sync", &test_data, test_accept_fail_sync);
   g_test_add_data_func ("/named-pipes/connect-accept-cancel", &test_data, test_connect_accept_cancel);
   g_test_add_data_func ("/named-pipes/multi-client-basic", &test_data, test_multi_client_basic);
+  g_test_add_data_func ("/named-pipes/service-incoming", &test_data, test_service_incoming);
+  g_test_add_data_func ("/named-pipes/service-incoming-threaded", &test_data, test_service_incoming_threaded);
+  g_test_add_data_func ("/named-pipes/service-workers", &test_data, test_service_workers);
+  g_test_add_data_func ("/named-pipes/service-workers-outlive", &test_data, test_service_workers_outlive);
   g_test_add_data_func ("/named-pipes/client-default-timeout", &test_data, test_client_default_timeout);
+  g_test_add_data_func ("/named-pipes/client-pool", &test_data, test_client_pool);
   g_test_add_data_func ("/named-pipes/read-write-basic", &test_data, test_read_write_basic);
   g_test_add_data_func ("/named-pipes/read-write-several-connections", &test_data, test_read_write_several_connections);
   g_test_add_data_func ("/named-pipes/read-write-same-time-several-connections", &test_data, test_read_write_same_time_several_connections);
+  g_test_add_data_func ("/named-pipes/many-pending-reads", &test_data, test_many_pending_reads);
   g_test_add_data_func ("/named-pipes/read-write-mix-sync-async-basic", &test_data_sync_async, test_read_write_basic);
   g_test_add_data_func ("/named-pipes/read-write-mix-sync-async-several-connections", &test_data_sync_async, test_read_write_several_connections);
   g_test_add_data_func ("/named-pipes/read-write-mix-sync-async-same-time-several-connections", &test_data_sync_async, test_read_write_same_time_several_connections);
   g_test_add_data_func ("/named-pipes/test_cancel_read", &test_data_sync_async, test_cancel_read);
+  g_test_add_data_func ("/named-pipes/reuse-async-source", &test_data, test_reuse_async_source);
+  g_test_add_data_func ("/named-pipes/splice", &test_data, test_splice);
+  g_test_add_data_func ("/named-pipes/splice-target-closed", &test_data, test_splice_target_closed);
+  g_test_add_data_func ("/named-pipes/receive-message", &test_data, test_receive_message);
+  g_test_add_data_func ("/named-pipes/pollable", &test_data, test_pollable);
+  g_test_add_func ("/named-pipes/shared-memory", test_shared_memory);
+  g_test_add_func ("/file-streams/seek-read-at", test_file_seek_read_at);
+  g_test_add_func ("/file-streams/file-reader", test_file_reader);
+  g_test_add_data_func ("/named-pipes/buffer-sizes", &test_data, test_buffer_sizes);
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  g_test_add_data_func ("/named-pipes/writev", &test_data, test_writev);
+#endif
 
   /* I/O completion port tests */
   g_test_add_data_func ("/named-pipes-iocp/add-named-pipe", &test_data_iocp, test_add_named_pipe);
+  g_test_add_data_func ("/named-pipes-iocp/add-named-pipe-multiple-names", &test_data_iocp, test_add_named_pipe_multiple_names);
   g_test_add_data_func ("/named-pipes-iocp/connect-basic", &test_data_iocp, test_connect_basic);
   g_test_add_data_func ("/named-pipes-iocp/connect-before-accept", &test_data_iocp, test_connect_before_accept);
   g_test_add_data_func ("/named-pipes-iocp/connect-before-accept-sync", &test_data_iocp, test_connect_before_accept_sync);
   g_test_add_data_func ("/named-pipes-iocp/connect-sync", &test_data_iocp, test_connect_sync);
   g_test_add_data_func ("/named-pipes-iocp/connect-sync-fails", &test_data_iocp, test_connect_sync_fails);
+  g_test_add_data_func ("/named-pipes-iocp/connect-backlog-sync", &test_data_iocp, test_connect_backlog_sync);
+  g_test_add_data_func ("/named-pipes-iocp/connect-async-busy", &test_data_iocp, test_connect_async_busy);
   g_test_add_data_func ("/named-pipes-iocp/accept-cancel", &test_data_iocp, test_accept_cancel);
   g_test_add_data_func ("/named-pipes-iocp/accept-fail-sync", &test_data_iocp, test_accept_fail_sync);
   g_test_add_data_func ("/named-pipes-iocp/connect-accept-cancel", &test_data_iocp, test_connect_accept_cancel);
   g_test_add_data_func ("/named-pipes-iocp/multi-client-basic", &test_data_iocp, test_multi_client_basic);
+  g_test_add_func ("/named-pipes-iocp/many-pending-accepts", test_many_pending_accepts);
+  g_test_add_func ("/named-pipes-iocp/finalize-pending-connect", test_finalize_pending_connect);
+  g_test_add_data_func ("/named-pipes-iocp/service-incoming", &test_data_iocp, test_service_incoming);
+  g_test_add_data_func ("/named-pipes-iocp/service-incoming-threaded", &test_data_iocp, test_service_incoming_threaded);
+  g_test_add_data_func ("/named-pipes-iocp/service-workers", &test_data_iocp, test_service_workers);
+  g_test_add_data_func ("/named-pipes-iocp/service-workers-outlive", &test_data_iocp, test_service_workers_outlive);
   g_test_add_data_func ("/named-pipes-iocp/client-default-timeout", &test_data_iocp, test_client_default_timeout);
+  g_test_add_data_func ("/named-pipes-iocp/client-pool", &test_data_iocp, test_client_pool);
   g_test_add_data_func ("/named-pipes-iocp/read-write-basic", &test_data_iocp, test_read_write_basic);
   g_test_add_data_func ("/named-pipes-iocp/read-write-several-connections", &test_data_iocp, test_read_write_several_connections);
   g_test_add_data_func ("/named-pipes-iocp/read-write-same-time-several-connections", &test_data_iocp, test_read_write_same_time_several_connections);
@@ -1118,6 +3676,21 @@ main (int   argc,
   g_test_add_data_func ("/named-pipes-iocp/read-write-mix-sync-async-several-connections", &test_data_iocp_sync_async, test_read_write_several_connections);
   g_test_add_data_func ("/named-pipes-iocp/read-write-mix-sync-async-same-time-several-connections", &test_data_iocp_sync_async, test_read_write_same_time_several_connections);
   g_test_add_data_func ("/named-pipes-iocp/test_cancel_read", &test_data_iocp_sync_async, test_cancel_read);
+  g_test_add_data_func ("/named-pipes-iocp/receive-message", &test_data_iocp, test_receive_message);
+  g_test_add_func ("/named-pipes-iocp/read-async-partial-message", test_read_async_partial_message);
+  g_test_add_data_func ("/named-pipes-iocp/pollable", &test_data_iocp, test_pollable);
+  g_test_add_data_func ("/named-pipes-iocp/buffer-sizes", &test_data_iocp, test_buffer_sizes);
+  g_test_add_data_func ("/named-pipes-iocp/splice", &test_data_iocp, test_splice);
+  g_test_add_data_func ("/named-pipes-iocp/splice-target-closed", &test_data_iocp, test_splice_target_closed);
+  g_test_add_func ("/named-pipes-iocp/iocp-reader", test_iocp_reader);
+  g_test_add_func ("/named-pipes-iocp/inline-completion", test_inline_completion);
+  g_test_add_func ("/named-pipes-iocp/thread-pool", test_thread_pool);
+  g_test_add_func ("/named-pipes-iocp/completion-port-engine", test_completion_port_engine);
+  g_test_add_func ("/named-pipes-iocp/inline-completion-port-engine", test_inline_completion_port_engine);
+  g_test_add_func ("/named-pipes-iocp/read-ready", test_read_ready);
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  g_test_add_data_func ("/named-pipes-iocp/writev", &test_data_iocp, test_writev);
+#endif
 
   return g_test_run ();
 }
@@ -21,17 +21,24 @@
 #define WING_H
 
 #include <wing/wingversionmacros.h>
+#include <wing/wingenumtypes.h>
 #include <wing/wingeventwindow.h>
+#include <wing/wingfilereader.h>
 #include <wing/wingiocpinputstream.h>
 #include <wing/wingiocpoutputstream.h>
+#include <wing/wingiocpreader.h>
 #include <wing/winginputstream.h>
 #include <wing/wingnamedpipeclient.h>
+#include <wing/wingnamedpipeclientpool.h>
 #include <wing/wingnamedpipelistener.h>
 #include <wing/wingnamedpipeconnection.h>
+#include <wing/wingnamedpipeservice.h>
 #include <wing/wingoutputstream.h>
 #include <wing/wingservice.h>
 #include <wing/wingservicemanager.h>
+#include <wing/wingsharedmemoryconnection.h>
 #include <wing/wingsource.h>
+#include <wing/wingthreadpool.h>
 #include <wing/wingutils.h>
 #include <wing/wingcredentials.h>
 
@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_ASYNC_RESULT_PRIVATE_H
+#define WING_ASYNC_RESULT_PRIVATE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A #GAsyncResult which calls its callback right when it is returned,
+ * from whatever thread returns it, instead of going through the main
+ * context like #GTask. Used for the inline completion of the IOCP
+ * streams, see wing_thread_pool_io_set_inline_completion() */
+#define WING_TYPE_INLINE_RESULT (_wing_inline_result_get_type ())
+
+G_DECLARE_FINAL_TYPE (WingInlineResult, _wing_inline_result, WING, INLINE_RESULT, GObject)
+
+WingInlineResult   *_wing_inline_result_new               (gpointer             source_object,
+                                                           GCancellable        *cancellable,
+                                                           GAsyncReadyCallback  callback,
+                                                           gpointer             user_data);
+
+/* These work on both a #GTask and a #WingInlineResult */
+GCancellable       *_wing_async_result_get_cancellable    (gpointer             result);
+
+void                _wing_async_result_return_int         (gpointer             result,
+                                                           gssize               value);
+
+void                _wing_async_result_return_pointer     (gpointer             result,
+                                                           gpointer             value,
+                                                           GDestroyNotify       value_destroy);
+
+void                _wing_async_result_return_error       (gpointer             result,
+                                                           GError              *error);
+
+void                _wing_async_result_return_error_later (gpointer             result,
+                                                           GError              *error);
+
+gssize              _wing_async_result_propagate_int      (GAsyncResult        *result,
+                                                           GError             **error);
+
+gpointer            _wing_async_result_propagate_pointer  (GAsyncResult        *result,
+                                                           GError             **error);
+
+G_END_DECLS
+
+#endif /* WING_ASYNC_RESULT_PRIVATE_H */
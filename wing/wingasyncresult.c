@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingasyncresult-private.h"
+
+struct _WingInlineResult
+{
+  GObject parent_instance;
+
+  GObject *source_object;
+  GCancellable *cancellable;
+  GAsyncReadyCallback callback;
+  gpointer user_data;
+
+  gssize value;
+  gpointer pointer;
+  GDestroyNotify pointer_destroy;
+  GError *error;
+};
+
+static void wing_inline_result_iface_init (GAsyncResultIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingInlineResult, _wing_inline_result, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_RESULT,
+                                                wing_inline_result_iface_init))
+
+static void
+wing_inline_result_finalize (GObject *object)
+{
+  WingInlineResult *result = WING_INLINE_RESULT (object);
+
+  g_clear_object (&result->source_object);
+  g_clear_object (&result->cancellable);
+  g_clear_error (&result->error);
+
+  /* Not propagated */
+  if (result->pointer != NULL && result->pointer_destroy != NULL)
+    result->pointer_destroy (result->pointer);
+
+  G_OBJECT_CLASS (_wing_inline_result_parent_class)->finalize (object);
+}
+
+static void
+_wing_inline_result_class_init (WingInlineResultClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = wing_inline_result_finalize;
+}
+
+static void
+_wing_inline_result_init (WingInlineResult *result)
+{
+}
+
+static gpointer
+wing_inline_result_get_user_data (GAsyncResult *res)
+{
+  return WING_INLINE_RESULT (res)->user_data;
+}
+
+static GObject *
+wing_inline_result_ref_source_object (GAsyncResult *res)
+{
+  WingInlineResult *result = WING_INLINE_RESULT (res);
+
+  return result->source_object != NULL ? g_object_ref (result->source_object) : NULL;
+}
+
+static gboolean
+wing_inline_result_is_tagged (GAsyncResult *res,
+                              gpointer      source_tag)
+{
+  return FALSE;
+}
+
+static void
+wing_inline_result_iface_init (GAsyncResultIface *iface)
+{
+  iface->get_user_data = wing_inline_result_get_user_data;
+  iface->get_source_object = wing_inline_result_ref_source_object;
+  iface->is_tagged = wing_inline_result_is_tagged;
+}
+
+WingInlineResult *
+_wing_inline_result_new (gpointer             source_object,
+                         GCancellable        *cancellable,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  WingInlineResult *result;
+
+  result = g_object_new (WING_TYPE_INLINE_RESULT, NULL);
+  result->source_object = source_object != NULL ? g_object_ref (source_object) : NULL;
+  result->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+  result->callback = callback;
+  result->user_data = user_data;
+
+  return result;
+}
+
+static void
+wing_inline_result_complete (WingInlineResult *result)
+{
+  /* As a GTask does, a cancelled operation reports the cancellation */
+  if (g_cancellable_is_cancelled (result->cancellable))
+    {
+      g_clear_error (&result->error);
+      g_cancellable_set_error_if_cancelled (result->cancellable, &result->error);
+    }
+
+  if (result->callback != NULL)
+    result->callback (result->source_object, G_ASYNC_RESULT (result), result->user_data);
+}
+
+GCancellable *
+_wing_async_result_get_cancellable (gpointer result)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    return WING_INLINE_RESULT (result)->cancellable;
+
+  return g_task_get_cancellable (G_TASK (result));
+}
+
+void
+_wing_async_result_return_int (gpointer result,
+                               gssize   value)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WING_INLINE_RESULT (result)->value = value;
+      wing_inline_result_complete (result);
+    }
+  else
+    g_task_return_int (G_TASK (result), value);
+}
+
+void
+_wing_async_result_return_pointer (gpointer       result,
+                                   gpointer       value,
+                                   GDestroyNotify value_destroy)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WingInlineResult *inline_result = WING_INLINE_RESULT (result);
+
+      inline_result->pointer = value;
+      inline_result->pointer_destroy = value_destroy;
+      wing_inline_result_complete (inline_result);
+    }
+  else
+    g_task_return_pointer (G_TASK (result), value, value_destroy);
+}
+
+void
+_wing_async_result_return_error (gpointer  result,
+                                 GError   *error)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WING_INLINE_RESULT (result)->error = error;
+      wing_inline_result_complete (result);
+    }
+  else
+    g_task_return_error (G_TASK (result), error);
+}
+
+/* For the errors found before the operation is started: even with
+ * inline completion, the callback is not called before the function
+ * starting the operation returns */
+void
+_wing_async_result_return_error_later (gpointer  result,
+                                       GError   *error)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WingInlineResult *inline_result = WING_INLINE_RESULT (result);
+      GTask *task;
+
+      task = g_task_new (inline_result->source_object,
+                         inline_result->cancellable,
+                         inline_result->callback,
+                         inline_result->user_data);
+      g_task_return_error (task, error);
+      g_object_unref (task);
+    }
+  else
+    g_task_return_error (G_TASK (result), error);
+}
+
+gssize
+_wing_async_result_propagate_int (GAsyncResult  *result,
+                                  GError       **error)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WingInlineResult *inline_result = WING_INLINE_RESULT (result);
+
+      if (inline_result->error != NULL)
+        {
+          g_propagate_error (error, inline_result->error);
+          inline_result->error = NULL;
+          return -1;
+        }
+
+      return inline_result->value;
+    }
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+gpointer
+_wing_async_result_propagate_pointer (GAsyncResult  *result,
+                                      GError       **error)
+{
+  if (WING_IS_INLINE_RESULT (result))
+    {
+      WingInlineResult *inline_result = WING_INLINE_RESULT (result);
+      gpointer value;
+
+      if (inline_result->error != NULL)
+        {
+          g_propagate_error (error, inline_result->error);
+          inline_result->error = NULL;
+          return NULL;
+        }
+
+      value = inline_result->pointer;
+      inline_result->pointer = NULL;
+
+      return value;
+    }
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
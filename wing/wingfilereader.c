@@ -0,0 +1,653 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingfilereader.h"
+#include "wingthreadpoolio.h"
+#include "wingorderedreads-private.h"
+#include "wingutils.h"
+
+#include <windows.h>
+
+/**
+ * SECTION:wingfilereader
+ * @short_description: Reads a file sequentially bypassing the file cache
+ * @see_also: #WingIocpReader, #WingThreadPoolIo
+ *
+ * #WingFileReader reads a whole file in chunks of
+ * #WingFileReader:chunk-size bytes, keeping up to #WingFileReader:n-reads
+ * of them in flight on a #WingThreadPoolIo and handing them out in the
+ * order of the file, one for each call to wing_file_reader_read_async().
+ *
+ * The file is opened without buffering, so that streaming a large file
+ * neither goes through nor evicts the system file cache. The chunks are
+ * read into page aligned buffers at offsets which are multiples of the
+ * sector size, as required for such reads, and the buffers are reused
+ * once the #GBytes handed out are freed.
+ *
+ * The reader has to be used from the thread-default main context at
+ * the time it was created. It keeps itself alive while reads are in
+ * flight: call wing_file_reader_close() to stop reading before the end
+ * of the file is reached.
+ */
+
+#define DEFAULT_N_READS 4
+#define MAX_N_READS 64
+#define DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+/* When the sector size of the volume cannot be found */
+#define DEFAULT_SECTOR_SIZE 4096
+
+typedef struct
+{
+  /* Must be the first member, the list header has to be aligned */
+  SLIST_HEADER free_buffers;
+
+  volatile gint ref_count;
+  gsize buffer_size;
+  guint max_free;
+} BufferPool;
+
+typedef struct
+{
+  BufferPool *pool;
+  gpointer buffer;
+} Chunk;
+
+struct _WingFileReader
+{
+  GObject parent_instance;
+
+  gchar *filename;
+  guint n_reads;
+  gsize chunk_size;
+  guint64 file_size;
+
+  WingThreadPoolIo *thread_pool_io;
+  BufferPool *pool;
+
+  /* The read with sequence number n reads the chunk at n * chunk_size */
+  WingOrderedReads *reads;
+};
+
+enum
+{
+  PROP_0,
+  PROP_FILENAME,
+  PROP_N_READS,
+  PROP_CHUNK_SIZE,
+  LAST_PROP
+};
+
+static GParamSpec *props[LAST_PROP];
+
+static void wing_file_reader_initable_iface_init (GInitableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingFileReader, wing_file_reader, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+                                                wing_file_reader_initable_iface_init))
+
+static BufferPool *
+buffer_pool_new (gsize buffer_size,
+                 guint max_free)
+{
+  BufferPool *pool;
+
+  pool = _aligned_malloc (sizeof (BufferPool), MEMORY_ALLOCATION_ALIGNMENT);
+  if (pool == NULL)
+    g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes",
+             G_STRLOC, sizeof (BufferPool));
+
+  InitializeSListHead (&pool->free_buffers);
+  pool->ref_count = 1;
+  pool->buffer_size = buffer_size;
+  pool->max_free = max_free;
+
+  return pool;
+}
+
+static BufferPool *
+buffer_pool_ref (BufferPool *pool)
+{
+  g_atomic_int_inc (&pool->ref_count);
+
+  return pool;
+}
+
+static void
+buffer_pool_unref (BufferPool *pool)
+{
+  gpointer buffer;
+
+  if (!g_atomic_int_dec_and_test (&pool->ref_count))
+    return;
+
+  while ((buffer = InterlockedPopEntrySList (&pool->free_buffers)) != NULL)
+    VirtualFree (buffer, 0, MEM_RELEASE);
+
+  _aligned_free (pool);
+}
+
+/* While in the pool, a buffer holds its own list entry */
+static gpointer
+buffer_pool_acquire (BufferPool *pool)
+{
+  gpointer buffer;
+
+  buffer = InterlockedPopEntrySList (&pool->free_buffers);
+  if (buffer == NULL)
+    {
+      /* Page aligned, which is enough for any device */
+      buffer = VirtualAlloc (NULL, pool->buffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+      if (buffer == NULL)
+        g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes",
+                 G_STRLOC, pool->buffer_size);
+    }
+
+  return buffer;
+}
+
+/* Can be called from any thread */
+static void
+buffer_pool_release (BufferPool *pool,
+                     gpointer    buffer)
+{
+  /* The depth is only a hint, going a little over the limit is harmless */
+  if (QueryDepthSList (&pool->free_buffers) < pool->max_free)
+    InterlockedPushEntrySList (&pool->free_buffers, buffer);
+  else
+    VirtualFree (buffer, 0, MEM_RELEASE);
+}
+
+static void
+chunk_free (gpointer user_data)
+{
+  Chunk *chunk = user_data;
+
+  buffer_pool_release (chunk->pool, chunk->buffer);
+  buffer_pool_unref (chunk->pool);
+  g_slice_free (Chunk, chunk);
+}
+
+static void
+wing_file_reader_finalize (GObject *object)
+{
+  WingFileReader *reader = WING_FILE_READER (object);
+
+  /* Gives the buffers back to the pool */
+  g_clear_pointer (&reader->reads, _wing_ordered_reads_free);
+
+  if (reader->thread_pool_io != NULL)
+    {
+      wing_thread_pool_io_close_handle (reader->thread_pool_io, NULL);
+      wing_thread_pool_io_unref (reader->thread_pool_io);
+    }
+
+  g_clear_pointer (&reader->pool, buffer_pool_unref);
+  g_free (reader->filename);
+
+  G_OBJECT_CLASS (wing_file_reader_parent_class)->finalize (object);
+}
+
+static void
+wing_file_reader_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  WingFileReader *reader = WING_FILE_READER (object);
+
+  switch (prop_id)
+    {
+    case PROP_FILENAME:
+      g_value_set_string (value, reader->filename);
+      break;
+    case PROP_N_READS:
+      g_value_set_uint (value, reader->n_reads);
+      break;
+    case PROP_CHUNK_SIZE:
+      g_value_set_uint (value, (guint) reader->chunk_size);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+wing_file_reader_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  WingFileReader *reader = WING_FILE_READER (object);
+
+  switch (prop_id)
+    {
+    case PROP_FILENAME:
+      reader->filename = g_value_dup_string (value);
+      break;
+    case PROP_N_READS:
+      reader->n_reads = g_value_get_uint (value);
+      break;
+    case PROP_CHUNK_SIZE:
+      reader->chunk_size = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+wing_file_reader_class_init (WingFileReaderClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = wing_file_reader_finalize;
+  gobject_class->get_property = wing_file_reader_get_property;
+  gobject_class->set_property = wing_file_reader_set_property;
+
+  /**
+   * WingFileReader:filename:
+   *
+   * The name of the file to read, in UTF-8.
+   */
+  props[PROP_FILENAME] =
+    g_param_spec_string ("filename",
+                         "Filename",
+                         "The name of the file to read",
+                         NULL,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingFileReader:n-reads:
+   *
+   * The number of reads kept in flight.
+   */
+  props[PROP_N_READS] =
+    g_param_spec_uint ("n-reads",
+                       "Number of reads",
+                       "The number of reads kept in flight",
+                       1, MAX_N_READS,
+                       DEFAULT_N_READS,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingFileReader:chunk-size:
+   *
+   * The size of the chunks read, rounded up to a multiple of the
+   * sector size of the volume once the file is opened.
+   */
+  props[PROP_CHUNK_SIZE] =
+    g_param_spec_uint ("chunk-size",
+                       "Chunk size",
+                       "The size of the chunks read",
+                       1, G_MAXINT,
+                       DEFAULT_CHUNK_SIZE,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, LAST_PROP, props);
+}
+
+static void
+wing_file_reader_init (WingFileReader *reader)
+{
+}
+
+static gpointer
+acquire_buffer (gpointer owner)
+{
+  WingFileReader *reader = owner;
+
+  return buffer_pool_acquire (reader->pool);
+}
+
+static void
+release_buffer (gpointer owner,
+                gpointer buffer)
+{
+  WingFileReader *reader = owner;
+
+  buffer_pool_release (reader->pool, buffer);
+}
+
+/* The buffer goes back to the pool once the bytes are freed */
+static GBytes *
+wrap_buffer (gpointer owner,
+             gpointer buffer,
+             gsize    size)
+{
+  WingFileReader *reader = owner;
+  Chunk *chunk;
+
+  chunk = g_slice_new (Chunk);
+  chunk->pool = buffer_pool_ref (reader->pool);
+  chunk->buffer = buffer;
+
+  return g_bytes_new_with_free_func (buffer, size, chunk_free, chunk);
+}
+
+/* The file is read up to its size when it was opened */
+static gboolean
+get_offset (gpointer  owner,
+            guint64   seq,
+            guint64  *offset)
+{
+  WingFileReader *reader = owner;
+
+  *offset = seq * reader->chunk_size;
+
+  return *offset < reader->file_size;
+}
+
+static WingOrderedReadStatus
+check_result (gpointer owner,
+              DWORD    result,
+              DWORD    transferred)
+{
+  switch (result)
+    {
+    case NO_ERROR:
+      /* The file was truncated meanwhile */
+      return transferred > 0 ? WING_ORDERED_READ_DATA : WING_ORDERED_READ_EOF;
+    case ERROR_HANDLE_EOF:
+      return WING_ORDERED_READ_EOF;
+    default:
+      return WING_ORDERED_READ_ERROR;
+    }
+}
+
+static const WingOrderedReadsHooks reads_hooks =
+{
+  acquire_buffer,
+  release_buffer,
+  wrap_buffer,
+  get_offset,
+  check_result
+};
+
+static DWORD
+get_sector_size (const wchar_t *wfilename)
+{
+  wchar_t volume[MAX_PATH];
+  DWORD sectors_per_cluster, bytes_per_sector, free_clusters, total_clusters;
+
+  if (!GetVolumePathNameW (wfilename, volume, G_N_ELEMENTS (volume)) ||
+      !GetDiskFreeSpaceW (volume, &sectors_per_cluster, &bytes_per_sector,
+                          &free_clusters, &total_clusters) ||
+      bytes_per_sector == 0)
+    return DEFAULT_SECTOR_SIZE;
+
+  return bytes_per_sector;
+}
+
+static gboolean
+wing_file_reader_initable_init (GInitable     *initable,
+                                GCancellable  *cancellable,
+                                GError       **error)
+{
+  WingFileReader *reader;
+  wchar_t *wfilename;
+  HANDLE handle;
+  LARGE_INTEGER size;
+  DWORD sector_size;
+  gchar *error_message;
+
+  g_return_val_if_fail (WING_IS_FILE_READER (initable), FALSE);
+
+  reader = WING_FILE_READER (initable);
+
+  if (reader->filename == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "No file to read");
+      return FALSE;
+    }
+
+  wfilename = g_utf8_to_utf16 (reader->filename, -1, NULL, NULL, error);
+  if (wfilename == NULL)
+    return FALSE;
+
+  handle = CreateFileW (wfilename,
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    {
+      int errsv = GetLastError ();
+      gchar *emsg = g_win32_error_message (errsv);
+
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_win32_error (errsv),
+                   "Error opening file %s: %s",
+                   reader->filename, emsg);
+      g_free (emsg);
+      g_free (wfilename);
+      return FALSE;
+    }
+
+  /* The offsets and sizes of the reads must be multiples of it */
+  sector_size = get_sector_size (wfilename);
+  g_free (wfilename);
+
+  if (!GetFileSizeEx (handle, &size))
+    {
+      int errsv = GetLastError ();
+      gchar *emsg = g_win32_error_message (errsv);
+
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_win32_error (errsv),
+                   "Error getting the size of file %s: %s",
+                   reader->filename, emsg);
+      g_free (emsg);
+      CloseHandle (handle);
+      return FALSE;
+    }
+
+  reader->thread_pool_io = wing_thread_pool_io_new (handle);
+  if (reader->thread_pool_io == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Could not bind file %s to the thread pool",
+                   reader->filename);
+      CloseHandle (handle);
+      return FALSE;
+    }
+
+  reader->file_size = size.QuadPart;
+  reader->chunk_size = (reader->chunk_size + sector_size - 1) / sector_size * sector_size;
+
+  /* The chunks handed out and not yet freed come back to the pool */
+  reader->pool = buffer_pool_new (reader->chunk_size, reader->n_reads * 2);
+
+  error_message = g_strdup_printf ("Error reading from file %s", reader->filename);
+  reader->reads = _wing_ordered_reads_new (reader, &reads_hooks,
+                                           reader->thread_pool_io,
+                                           reader->n_reads,
+                                           reader->chunk_size,
+                                           error_message);
+  g_free (error_message);
+
+  return TRUE;
+}
+
+static void
+wing_file_reader_initable_iface_init (GInitableIface *iface)
+{
+  iface->init = wing_file_reader_initable_init;
+}
+
+/**
+ * wing_file_reader_new:
+ * @filename: the name of the file to read, in UTF-8.
+ * @n_reads: the number of reads to keep in flight, or 0 for the default.
+ * @chunk_size: the size of the chunks to read, or 0 for the default.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Opens @filename for a #WingFileReader. @chunk_size is rounded up to a
+ * multiple of the sector size of the volume holding the file.
+ *
+ * Returns: a new #WingFileReader, or %NULL on error
+ */
+WingFileReader *
+wing_file_reader_new (const gchar  *filename,
+                      guint         n_reads,
+                      gsize         chunk_size,
+                      GError      **error)
+{
+  g_return_val_if_fail (filename != NULL, NULL);
+  g_return_val_if_fail (n_reads <= MAX_N_READS, NULL);
+  g_return_val_if_fail (chunk_size <= G_MAXINT, NULL);
+
+  return g_initable_new (WING_TYPE_FILE_READER,
+                         NULL,
+                         error,
+                         "filename", filename,
+                         "n-reads", n_reads > 0 ? n_reads : DEFAULT_N_READS,
+                         "chunk-size", (guint) (chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE),
+                         NULL);
+}
+
+/**
+ * wing_file_reader_read_async:
+ * @reader: a #WingFileReader.
+ * @io_priority: the I/O priority of the request.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Requests the next chunk of the file, starting the reads if they were
+ * not yet. Several requests may be pending at the same time, they are
+ * satisfied in order.
+ *
+ * Cancelling a request does not lose any data: the chunk it would have
+ * received goes to the next request.
+ */
+void
+wing_file_reader_read_async (WingFileReader      *reader,
+                             int                  io_priority,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (WING_IS_FILE_READER (reader));
+
+  task = g_task_new (reader, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_file_reader_read_async);
+  g_task_set_priority (task, io_priority);
+
+  _wing_ordered_reads_queue (reader->reads, task);
+}
+
+/**
+ * wing_file_reader_read_finish:
+ * @reader: a #WingFileReader.
+ * @result: a #GAsyncResult.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Finishes a request started with wing_file_reader_read_async().
+ *
+ * Returns: (transfer full): the next chunk of the file, empty once the
+ * end of the file has been reached, or %NULL on error. Only the last
+ * chunk may be shorter than #WingFileReader:chunk-size.
+ */
+GBytes *
+wing_file_reader_read_finish (WingFileReader  *reader,
+                              GAsyncResult    *result,
+                              GError         **error)
+{
+  g_return_val_if_fail (WING_IS_FILE_READER (reader), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, reader), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * wing_file_reader_close:
+ * @reader: a #WingFileReader.
+ *
+ * Cancels the reads in flight and fails the pending requests with
+ * %G_IO_ERROR_CLOSED. The chunks already read and not yet handed out
+ * are dropped. The file is closed once @reader is freed.
+ */
+void
+wing_file_reader_close (WingFileReader *reader)
+{
+  g_return_if_fail (WING_IS_FILE_READER (reader));
+
+  _wing_ordered_reads_close (reader->reads);
+}
+
+/**
+ * wing_file_reader_get_n_reads:
+ * @reader: a #WingFileReader.
+ *
+ * Gets the number of reads kept in flight by @reader.
+ *
+ * Returns: the number of reads.
+ */
+guint
+wing_file_reader_get_n_reads (WingFileReader *reader)
+{
+  g_return_val_if_fail (WING_IS_FILE_READER (reader), 0);
+
+  return reader->n_reads;
+}
+
+/**
+ * wing_file_reader_get_chunk_size:
+ * @reader: a #WingFileReader.
+ *
+ * Gets the size of the chunks read by @reader, which is a multiple of
+ * the sector size of the volume.
+ *
+ * Returns: the chunk size.
+ */
+gsize
+wing_file_reader_get_chunk_size (WingFileReader *reader)
+{
+  g_return_val_if_fail (WING_IS_FILE_READER (reader), 0);
+
+  return reader->chunk_size;
+}
+
+/**
+ * wing_file_reader_get_file_size:
+ * @reader: a #WingFileReader.
+ *
+ * Gets the size of the file when it was opened, up to which it is read.
+ *
+ * Returns: the file size.
+ */
+guint64
+wing_file_reader_get_file_size (WingFileReader *reader)
+{
+  g_return_val_if_fail (WING_IS_FILE_READER (reader), 0);
+
+  return reader->file_size;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_FILE_READER_H
+#define WING_FILE_READER_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_FILE_READER (wing_file_reader_get_type ())
+
+WING_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (WingFileReader, wing_file_reader, WING, FILE_READER, GObject)
+
+WING_AVAILABLE_IN_ALL
+WingFileReader           *wing_file_reader_new                 (const gchar       *filename,
+                                                                guint              n_reads,
+                                                                gsize              chunk_size,
+                                                                GError           **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_file_reader_read_async          (WingFileReader    *reader,
+                                                                int                io_priority,
+                                                                GCancellable      *cancellable,
+                                                                GAsyncReadyCallback callback,
+                                                                gpointer           user_data);
+
+WING_AVAILABLE_IN_ALL
+GBytes                   *wing_file_reader_read_finish         (WingFileReader    *reader,
+                                                                GAsyncResult      *result,
+                                                                GError           **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_file_reader_close               (WingFileReader    *reader);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_file_reader_get_n_reads         (WingFileReader    *reader);
+
+WING_AVAILABLE_IN_ALL
+gsize                     wing_file_reader_get_chunk_size      (WingFileReader    *reader);
+
+WING_AVAILABLE_IN_ALL
+guint64                   wing_file_reader_get_file_size       (WingFileReader    *reader);
+
+G_END_DECLS
+
+#endif /* WING_FILE_READER_H */
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_INPUT_STREAM_PRIVATE_H
+#define WING_INPUT_STREAM_PRIVATE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Reads from a pipe in message mode with the overlapped structure and
+ * the task source of the stream, which must be marked as pending. The
+ * read is over once the end of the message is reached or @count bytes
+ * are read, and *@errsv is set to %ERROR_MORE_DATA in the latter case */
+void            _wing_input_stream_read_message_async   (gpointer              stream,
+                                                         void                 *buffer,
+                                                         gsize                 count,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+
+/* Returns the number of bytes read, or -1 on error. *@errsv is the
+ * Win32 error code the read is over with, which is not reported as
+ * a #GError */
+gssize          _wing_input_stream_read_message_finish  (gpointer              stream,
+                                                         GAsyncResult         *result,
+                                                         int                  *errsv,
+                                                         GError              **error);
+
+G_END_DECLS
+
+#endif /* WING_INPUT_STREAM_PRIVATE_H */
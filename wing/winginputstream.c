@@ -22,8 +22,13 @@
  */
 
 #include "winginputstream.h"
+#include "winginputstream-private.h"
 #include "wingutils.h"
-#include "wingsource.h"
+#include "wingutils-private.h"
+#include "wingpollable-private.h"
+#include "wingpipestats-private.h"
+#include "wingtasksource-private.h"
+#include "wingpositionalio-private.h"
 
 #include <windows.h>
 
@@ -34,14 +39,23 @@
  *
  * #WingInputStream implements #GInputStream for reading from a
  * Windows file handle.
+ *
+ * On a disk file, the stream implements #GSeekable, and
+ * wing_input_stream_read_at() and wing_input_stream_read_at_async()
+ * read at a given offset without moving the position of the stream,
+ * which lets several of them run at the same time on the handle.
  */
 
 typedef struct {
   HANDLE handle;
   gboolean close_handle;
-  DWORD64 current_offset;
+  gboolean is_disk;
+  goffset current_offset;
 
   OVERLAPPED overlap;
+  WingTaskSource task_source;
+
+  WingPipeStats *stats;
 } WingInputStreamPrivate;
 
 enum {
@@ -53,7 +67,15 @@ enum {
 
 static GParamSpec *props[LAST_PROP];
 
-G_DEFINE_TYPE_WITH_PRIVATE (WingInputStream, wing_input_stream, G_TYPE_INPUT_STREAM)
+static void wing_input_stream_pollable_iface_init (GPollableInputStreamInterface *iface);
+static void wing_input_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingInputStream, wing_input_stream, G_TYPE_INPUT_STREAM,
+                         G_ADD_PRIVATE (WingInputStream)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_INPUT_STREAM,
+                                                wing_input_stream_pollable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                wing_input_stream_seekable_iface_init))
 
 static void
 wing_input_stream_finalize (GObject *object)
@@ -64,9 +86,13 @@ wing_input_stream_finalize (GObject *object)
   wing_stream = WING_INPUT_STREAM (object);
   priv = wing_input_stream_get_instance_private (wing_stream);
 
+  _wing_task_source_clear (&priv->task_source);
+
   if (priv->overlap.hEvent != INVALID_HANDLE_VALUE)
     CloseHandle (priv->overlap.hEvent);
 
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+
   G_OBJECT_CLASS (wing_input_stream_parent_class)->finalize (object);
 }
 
@@ -86,6 +112,9 @@ wing_input_stream_set_property (GObject         *object,
     {
     case PROP_HANDLE:
       priv->handle = g_value_get_pointer (value);
+      /* The type does not change, no need to ask on each read */
+      priv->is_disk = priv->handle != NULL &&
+                      GetFileType (priv->handle) == FILE_TYPE_DISK;
       break;
     case PROP_CLOSE_HANDLE:
       priv->close_handle = g_value_get_boolean (value);
@@ -146,7 +175,7 @@ wing_input_stream_read (GInputStream  *stream,
   else
     nbytes = count;
 
-  overlap.hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+  overlap.hEvent = _wing_event_acquire ();
   g_return_val_if_fail (overlap.hEvent != NULL, -1);
 
   overlap.OffsetHigh = (DWORD)(priv->current_offset >> 32);
@@ -157,10 +186,8 @@ wing_input_stream_read (GInputStream  *stream,
     {
       retval = nread;
 
-      if (GetFileType (priv->handle) == FILE_TYPE_DISK)
-        {
-          priv->current_offset += nread;
-        }
+      if (priv->is_disk)
+        priv->current_offset += nread;
     }
   else
     {
@@ -172,10 +199,8 @@ wing_input_stream_read (GInputStream  *stream,
         {
           retval = nread;
 
-          if (GetFileType (priv->handle) == FILE_TYPE_DISK)
-            {
-              priv->current_offset += nread;
-            }
+          if (priv->is_disk)
+            priv->current_offset += nread;
             
           goto end;
         }
@@ -217,7 +242,9 @@ wing_input_stream_read (GInputStream  *stream,
     }
 
 end:
-  CloseHandle (overlap.hEvent);
+  _wing_event_release (overlap.hEvent);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, retval);
+
   return retval;
 }
 
@@ -253,53 +280,87 @@ wing_input_stream_close (GInputStream  *stream,
   return TRUE;
 }
 
+static void
+read_message_return (WingInputStream *wing_stream,
+                     GTask           *task,
+                     DWORD            nread,
+                     int              errsv)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (wing_stream);
+
+  if (errsv == NO_ERROR || errsv == ERROR_MORE_DATA)
+    _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, nread);
+
+  g_task_set_task_data (task, GINT_TO_POINTER (errsv), NULL);
+  g_task_return_int (task, nread);
+}
+
 static gboolean
-read_async_ready (HANDLE   handle,
-                  gpointer user_data)
+read_async_ready (gpointer user_data)
 {
-  WingInputStream *wing_stream;
+  WingInputStream *wing_stream = user_data;
   WingInputStreamPrivate *priv;
-  GTask *task = user_data;
+  GTask *task;
   GCancellable *cancellable;
   DWORD nread;
   gboolean result;
+  int errsv;
 
-  wing_stream = g_task_get_source_object (task);
   priv = wing_input_stream_get_instance_private (wing_stream);
+  task = _wing_task_source_get_task (&priv->task_source);
 
   cancellable = g_task_get_cancellable (task);
   if (cancellable != NULL && g_cancellable_is_cancelled (cancellable))
     {
+      /* The overlapped structure is reused by the next operation, and
+       * the abort signals the event again */
       CancelIo (priv->handle);
+      GetOverlappedResult (priv->handle, &priv->overlap, &nread, TRUE);
       ResetEvent (priv->overlap.hEvent);
 
+      task = _wing_task_source_steal_task (&priv->task_source);
       g_task_return_new_error (task, G_IO_ERROR,
                                G_IO_ERROR_CANCELLED,
                                "Error reading from handle: the operation is cancelled");
       g_object_unref (task);
 
-      return G_SOURCE_REMOVE;
+      return G_SOURCE_CONTINUE;
     }
 
   result = GetOverlappedResult (priv->overlap.hEvent, &priv->overlap, &nread, FALSE);
   if (!result && GetLastError () == ERROR_IO_INCOMPLETE)
     {
-      /* Try again to wait for the event to get ready */
+      /* Woken up by an earlier operation. The event is reset not to spin,
+       * then looked at again not to miss the completion of this one */
       ResetEvent (priv->overlap.hEvent);
-      return G_SOURCE_CONTINUE;
+      result = GetOverlappedResult (priv->overlap.hEvent, &priv->overlap, &nread, FALSE);
+      if (!result && GetLastError () == ERROR_IO_INCOMPLETE)
+        return G_SOURCE_CONTINUE;
     }
 
+  errsv = result ? NO_ERROR : GetLastError ();
+
   ResetEvent (priv->overlap.hEvent);
-  
-  if (GetFileType (priv->handle) == FILE_TYPE_DISK)
+  task = _wing_task_source_steal_task (&priv->task_source);
+
+  if (g_task_get_source_tag (task) == _wing_input_stream_read_message_async)
     {
-      priv->current_offset += nread;
+      read_message_return (wing_stream, task, (DWORD) priv->overlap.InternalHigh, errsv);
+      g_object_unref (task);
+
+      return G_SOURCE_CONTINUE;
     }
+  
+  if (priv->is_disk)
+    priv->current_offset += nread;
 
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, nread);
   g_task_return_int (task, nread);
   g_object_unref (task);
 
-  return G_SOURCE_REMOVE;
+  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -337,13 +398,12 @@ wing_input_stream_read_async (GInputStream        *stream,
   if (res)
     {
       ResetEvent (priv->overlap.hEvent);
+      _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, nread);
       g_task_return_int (task, nread);
       g_object_unref (task);
 
-      if (GetFileType (priv->handle) == FILE_TYPE_DISK)
-        {
-          priv->current_offset += nread;
-        }
+      if (priv->is_disk)
+        priv->current_offset += nread;
       
       return;
     }
@@ -352,13 +412,7 @@ wing_input_stream_read_async (GInputStream        *stream,
 
   if (errsv == ERROR_IO_PENDING)
     {
-      GSource *handle_source;
-
-      handle_source = wing_create_source (priv->overlap.hEvent, G_IO_IN, cancellable);
-      g_task_attach_source (task, handle_source,
-                            (GSourceFunc)read_async_ready);
-      g_source_unref (handle_source);
-      
+      _wing_task_source_wait (&priv->task_source, priv->overlap.hEvent, task);
       return;
     }
 
@@ -369,6 +423,7 @@ wing_input_stream_read_async (GInputStream        *stream,
        * parameter specifies, ReadFile returns FALSE and
        * GetLastError returns ERROR_MORE_DATA */
       ResetEvent (priv->overlap.hEvent);
+      _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, nread);
       g_task_return_int (task, nread);
       return;
     }
@@ -394,6 +449,132 @@ wing_input_stream_read_async (GInputStream        *stream,
   g_free (emsg);
 }
 
+static gboolean
+wing_input_stream_pollable_can_poll (GPollableInputStream *pollable)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (pollable));
+
+  return _wing_pollable_can_poll (priv->handle);
+}
+
+static gboolean
+wing_input_stream_pollable_is_readable (GPollableInputStream *pollable)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (pollable));
+
+  return _wing_pollable_is_readable (priv->handle);
+}
+
+static GSource *
+wing_input_stream_pollable_create_source (GPollableInputStream *pollable,
+                                          GCancellable         *cancellable)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (pollable));
+
+  return _wing_pollable_create_read_source (G_INPUT_STREAM (pollable),
+                                            priv->handle,
+                                            cancellable);
+}
+
+static gssize
+wing_input_stream_pollable_read_nonblocking (GPollableInputStream  *pollable,
+                                             void                  *buffer,
+                                             gsize                  count,
+                                             GError               **error)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (pollable));
+
+  return _wing_pollable_read_nonblocking (G_INPUT_STREAM (pollable),
+                                          priv->handle,
+                                          buffer, count, error);
+}
+
+static void
+wing_input_stream_pollable_iface_init (GPollableInputStreamInterface *iface)
+{
+  iface->can_poll = wing_input_stream_pollable_can_poll;
+  iface->is_readable = wing_input_stream_pollable_is_readable;
+  iface->create_source = wing_input_stream_pollable_create_source;
+  iface->read_nonblocking = wing_input_stream_pollable_read_nonblocking;
+}
+
+static goffset
+wing_input_stream_tell (GSeekable *seekable)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (seekable));
+
+  return priv->current_offset;
+}
+
+static gboolean
+wing_input_stream_can_seek (GSeekable *seekable)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (seekable));
+
+  return priv->is_disk;
+}
+
+static gboolean
+wing_input_stream_seek (GSeekable     *seekable,
+                        goffset        offset,
+                        GSeekType      type,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (seekable));
+
+  if (!priv->is_disk)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Seek not supported on stream");
+      return FALSE;
+    }
+
+  return _wing_positional_io_seek (priv->handle, &priv->current_offset,
+                                   offset, type, error);
+}
+
+static gboolean
+wing_input_stream_can_truncate (GSeekable *seekable)
+{
+  return FALSE;
+}
+
+static gboolean
+wing_input_stream_truncate (GSeekable     *seekable,
+                            goffset        offset,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Truncate not supported on stream");
+  return FALSE;
+}
+
+static void
+wing_input_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = wing_input_stream_tell;
+  iface->can_seek = wing_input_stream_can_seek;
+  iface->seek = wing_input_stream_seek;
+  iface->can_truncate = wing_input_stream_can_truncate;
+  iface->truncate_fn = wing_input_stream_truncate;
+}
+
 static void
 wing_input_stream_class_init (WingInputStreamClass *klass)
 {
@@ -445,6 +626,7 @@ wing_input_stream_init (WingInputStream *wing_stream)
   priv = wing_input_stream_get_instance_private (wing_stream);
   priv->handle = NULL;
   priv->close_handle = TRUE;
+  _wing_task_source_init (&priv->task_source, read_async_ready, wing_stream);
   priv->overlap.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
   g_return_if_fail (priv->overlap.hEvent != INVALID_HANDLE_VALUE);
 }
@@ -542,3 +724,216 @@ wing_input_stream_get_handle (WingInputStream *stream)
 
   return priv->handle;
 }
+
+static gboolean
+check_read_at (WingInputStream  *stream,
+               GError          **error)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (stream);
+
+  if (g_input_stream_is_closed (G_INPUT_STREAM (stream)))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           "Stream is already closed");
+      return FALSE;
+    }
+
+  if (!priv->is_disk)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Reading at an offset is only supported on disk files");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * wing_input_stream_read_at:
+ * @stream: a #WingInputStream on a disk file
+ * @buffer: (array length=count) (element-type guint8): a buffer to
+ *     read data into
+ * @count: the number of bytes that will be read from the stream
+ * @offset: the offset in the file to read from
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @error: location to store the error occurring, or %NULL to ignore
+ *
+ * Reads up to @count bytes from the file of @stream at @offset, as
+ * pread() does. The position of @stream is neither used nor moved, and
+ * the stream is not marked as having a pending operation, so that
+ * several reads at different offsets may run at the same time.
+ *
+ * Returns: the number of bytes read, 0 at the end of the file, or -1
+ * on error
+ */
+gssize
+wing_input_stream_read_at (WingInputStream  *stream,
+                           void             *buffer,
+                           gsize             count,
+                           goffset           offset,
+                           GCancellable     *cancellable,
+                           GError          **error)
+{
+  WingInputStreamPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_INPUT_STREAM (stream), -1);
+  g_return_val_if_fail (buffer != NULL || count == 0, -1);
+  g_return_val_if_fail (offset >= 0, -1);
+
+  priv = wing_input_stream_get_instance_private (stream);
+
+  if (!check_read_at (stream, error))
+    return -1;
+
+  return _wing_positional_io (priv->handle, FALSE, buffer, count,
+                              offset, cancellable, error);
+}
+
+/**
+ * wing_input_stream_read_at_async:
+ * @stream: a #WingInputStream on a disk file
+ * @buffer: (array length=count) (element-type guint8): a buffer to
+ *     read data into, which must stay valid until the read is over
+ * @count: the number of bytes that will be read from the stream
+ * @offset: the offset in the file to read from
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): callback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Starts reading up to @count bytes from the file of @stream at
+ * @offset. See wing_input_stream_read_at(), any number of these reads
+ * may be pending at once.
+ */
+void
+wing_input_stream_read_at_async (WingInputStream     *stream,
+                                 void                *buffer,
+                                 gsize                count,
+                                 goffset              offset,
+                                 int                  io_priority,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  WingInputStreamPrivate *priv;
+  GTask *task;
+  GError *error = NULL;
+
+  g_return_if_fail (WING_IS_INPUT_STREAM (stream));
+  g_return_if_fail (buffer != NULL || count == 0);
+  g_return_if_fail (offset >= 0);
+
+  priv = wing_input_stream_get_instance_private (stream);
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_input_stream_read_at_async);
+  g_task_set_priority (task, io_priority);
+
+  if (!check_read_at (stream, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  _wing_positional_io_async (priv->handle, FALSE, buffer, count, offset, task);
+}
+
+/**
+ * wing_input_stream_read_at_finish:
+ * @stream: a #WingInputStream
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occurring, or %NULL to ignore
+ *
+ * Finishes a read started with wing_input_stream_read_at_async().
+ *
+ * Returns: the number of bytes read, 0 at the end of the file, or -1
+ * on error
+ */
+gssize
+wing_input_stream_read_at_finish (WingInputStream  *stream,
+                                  GAsyncResult     *result,
+                                  GError          **error)
+{
+  g_return_val_if_fail (WING_IS_INPUT_STREAM (stream), -1);
+  g_return_val_if_fail (g_task_is_valid (result, stream), -1);
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+void
+_wing_input_stream_set_pipe_stats (gpointer       stream,
+                                   WingPipeStats *stats)
+{
+  WingInputStreamPrivate *priv;
+
+  priv = wing_input_stream_get_instance_private (WING_INPUT_STREAM (stream));
+
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+  if (stats != NULL)
+    priv->stats = _wing_pipe_stats_ref (stats);
+}
+
+void
+_wing_input_stream_read_message_async (gpointer             stream,
+                                       void                *buffer,
+                                       gsize                count,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+  WingInputStream *wing_stream = WING_INPUT_STREAM (stream);
+  WingInputStreamPrivate *priv;
+  GTask *task;
+  DWORD nread = 0;
+  BOOL res;
+  int errsv;
+
+  priv = wing_input_stream_get_instance_private (wing_stream);
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _wing_input_stream_read_message_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  ResetEvent (priv->overlap.hEvent);
+  priv->overlap.OffsetHigh = 0;
+  priv->overlap.Offset = 0;
+
+  res = ReadFile (priv->handle, buffer, (DWORD) MIN (count, G_MAXINT), &nread, &priv->overlap);
+  errsv = res ? NO_ERROR : GetLastError ();
+
+  if (errsv == ERROR_IO_PENDING)
+    {
+      _wing_task_source_wait (&priv->task_source, priv->overlap.hEvent, task);
+      return;
+    }
+
+  /* Set for the successful and for the partial reads */
+  ResetEvent (priv->overlap.hEvent);
+  read_message_return (wing_stream, task, (DWORD) priv->overlap.InternalHigh, errsv);
+  g_object_unref (task);
+}
+
+gssize
+_wing_input_stream_read_message_finish (gpointer       stream,
+                                        GAsyncResult  *result,
+                                        int           *errsv,
+                                        GError       **error)
+{
+  gssize nread;
+
+  g_return_val_if_fail (g_task_is_valid (result, stream), -1);
+
+  nread = g_task_propagate_int (G_TASK (result), error);
+  if (nread >= 0)
+    *errsv = GPOINTER_TO_INT (g_task_get_task_data (G_TASK (result)));
+
+  return nread;
+}
@@ -59,6 +59,29 @@ gboolean       wing_input_stream_get_close_handle (WingInputStream *stream);
 WING_AVAILABLE_IN_ALL
 void          *wing_input_stream_get_handle       (WingInputStream *stream);
 
+WING_AVAILABLE_IN_ALL
+gssize         wing_input_stream_read_at          (WingInputStream    *stream,
+                                                   void               *buffer,
+                                                   gsize               count,
+                                                   goffset             offset,
+                                                   GCancellable       *cancellable,
+                                                   GError            **error);
+
+WING_AVAILABLE_IN_ALL
+void           wing_input_stream_read_at_async    (WingInputStream    *stream,
+                                                   void               *buffer,
+                                                   gsize               count,
+                                                   goffset             offset,
+                                                   int                 io_priority,
+                                                   GCancellable       *cancellable,
+                                                   GAsyncReadyCallback callback,
+                                                   gpointer            user_data);
+
+WING_AVAILABLE_IN_ALL
+gssize         wing_input_stream_read_at_finish   (WingInputStream    *stream,
+                                                   GAsyncResult       *result,
+                                                   GError            **error);
+
 G_END_DECLS
 
 #endif /* __WING_INPUT_STREAM_H__ */
@@ -0,0 +1,42 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_IOCP_ENGINE_PRIVATE_H
+#define WING_IOCP_ENGINE_PRIVATE_H
+
+#include <glib.h>
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* Binds @handle to the completion port shared by the whole process,
+ * whose worker threads run the callback of the #WingOverlappedData of
+ * each completion. *@skip_port_on_success tells whether the operations
+ * succeeding right away still queue a completion. Returns FALSE with the
+ * last error set on failure */
+gboolean        _wing_iocp_engine_bind          (HANDLE    handle,
+                                                 gboolean *skip_port_on_success);
+
+/* Queues a completion for @overlapped, whose operation is already over
+ * with the status left in it, as if the port delivered it. Returns FALSE
+ * with the last error set on failure */
+gboolean        _wing_iocp_engine_post          (OVERLAPPED *overlapped,
+                                                 DWORD       number_of_bytes);
+
+G_END_DECLS
+
+#endif /* WING_IOCP_ENGINE_PRIVATE_H */
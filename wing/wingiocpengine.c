@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingiocpengine-private.h"
+#include "wingutils.h"
+
+#include <windows.h>
+
+/* The completion port engine of #WingThreadPoolIo: one completion port
+ * for the process, and as many worker threads as processors, each one
+ * dequeuing up to MAX_ENTRIES completions per call. The port and the
+ * threads live as long as the process */
+
+#define MAX_ENTRIES 64
+
+typedef ULONG (WINAPI fRtlNtStatusToDosError) (LONG);
+
+typedef struct
+{
+  HANDLE port;
+  fRtlNtStatusToDosError *nt_status_to_dos_error;
+} IocpEngine;
+
+static gpointer
+worker_thread (gpointer user_data)
+{
+  IocpEngine *engine = user_data;
+  OVERLAPPED_ENTRY entries[MAX_ENTRIES];
+  ULONG n_entries;
+  ULONG i;
+
+  while (GetQueuedCompletionStatusEx (engine->port, entries, MAX_ENTRIES,
+                                      &n_entries, INFINITE, FALSE))
+    {
+      for (i = 0; i < n_entries; i++)
+        {
+          WingOverlappedData *overlapped = (WingOverlappedData *) entries[i].lpOverlapped;
+          ULONG result;
+
+          /* The status of the operation is left in the overlapped */
+          result = engine->nt_status_to_dos_error ((LONG) overlapped->overlapped.Internal);
+
+          overlapped->callback (NULL,
+                                NULL,
+                                overlapped,
+                                result,
+                                entries[i].dwNumberOfBytesTransferred,
+                                NULL,
+                                overlapped->user_data);
+        }
+    }
+
+  {
+    gchar *emsg = g_win32_error_message (GetLastError ());
+
+    g_warning ("Failed to dequeue completions: %s", emsg);
+    g_free (emsg);
+  }
+
+  return NULL;
+}
+
+static IocpEngine *
+iocp_engine_new (void)
+{
+  IocpEngine *engine;
+  HMODULE ntdll;
+  guint n_threads;
+  guint i;
+
+  engine = g_new0 (IocpEngine, 1);
+
+  ntdll = GetModuleHandleW (L"ntdll.dll");
+  engine->nt_status_to_dos_error = (fRtlNtStatusToDosError *) GetProcAddress (ntdll, "RtlNtStatusToDosError");
+  if (engine->nt_status_to_dos_error == NULL)
+    {
+      g_free (engine);
+      return NULL;
+    }
+
+  n_threads = wing_get_n_processors ();
+
+  engine->port = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, n_threads);
+  if (engine->port == NULL)
+    {
+      g_free (engine);
+      return NULL;
+    }
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_unref (g_thread_new ("wing-iocp-worker", worker_thread, engine));
+
+  return engine;
+}
+
+static IocpEngine *
+get_engine (void)
+{
+  static IocpEngine *engine;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      engine = iocp_engine_new ();
+      if (engine == NULL)
+        {
+          gchar *emsg = g_win32_error_message (GetLastError ());
+
+          g_warning ("Failed to create the completion port engine: %s", emsg);
+          g_free (emsg);
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return engine;
+}
+
+gboolean
+_wing_iocp_engine_bind (HANDLE    handle,
+                        gboolean *skip_port_on_success)
+{
+  IocpEngine *engine;
+  DWORD flags;
+
+  engine = get_engine ();
+  if (engine == NULL)
+    {
+      SetLastError (ERROR_NOT_SUPPORTED);
+      return FALSE;
+    }
+
+  if (CreateIoCompletionPort (handle, engine->port, 0, 0) == NULL)
+    return FALSE;
+
+  /* A read of part of a message fails with ERROR_MORE_DATA, which may or
+   * may not be queued, so the port is only skipped for byte streams */
+  *skip_port_on_success = FALSE;
+  if (!GetNamedPipeInfo (handle, &flags, NULL, NULL, NULL) ||
+      (flags & PIPE_TYPE_MESSAGE) == 0)
+    *skip_port_on_success = SetFileCompletionNotificationModes (handle, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS);
+
+  return TRUE;
+}
+
+gboolean
+_wing_iocp_engine_post (OVERLAPPED *overlapped,
+                        DWORD       number_of_bytes)
+{
+  IocpEngine *engine;
+
+  engine = get_engine ();
+  if (engine == NULL)
+    {
+      SetLastError (ERROR_NOT_SUPPORTED);
+      return FALSE;
+    }
+
+  return PostQueuedCompletionStatus (engine->port, number_of_bytes, 0, overlapped);
+}
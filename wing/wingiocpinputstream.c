@@ -23,8 +23,14 @@
 
 #include "wingiocpinputstream.h"
 #include "wingutils.h"
+#include "wingutils-private.h"
+#include "wingpollable-private.h"
+#include "wingpipestats-private.h"
+#include "wingasyncresult-private.h"
+#include "wingthreadpoolio-private.h"
 
 #include <windows.h>
+#include <string.h>
 
 /**
  * SECTION:wingiocpinputstream
@@ -38,6 +44,8 @@
 typedef struct {
   gboolean close_handle;
   WingThreadPoolIo *thread_pool_io;
+
+  WingPipeStats *stats;
 } WingIocpInputStreamPrivate;
 
 enum {
@@ -49,7 +57,12 @@ enum {
 
 static GParamSpec *props[LAST_PROP];
 
-G_DEFINE_TYPE_WITH_PRIVATE (WingIocpInputStream, wing_iocp_input_stream, G_TYPE_INPUT_STREAM)
+static void wing_iocp_input_stream_pollable_iface_init (GPollableInputStreamInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingIocpInputStream, wing_iocp_input_stream, G_TYPE_INPUT_STREAM,
+                         G_ADD_PRIVATE (WingIocpInputStream)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_INPUT_STREAM,
+                                                wing_iocp_input_stream_pollable_iface_init))
 
 static void
 wing_iocp_input_stream_finalize (GObject *object)
@@ -68,6 +81,8 @@ wing_iocp_input_stream_finalize (GObject *object)
       wing_thread_pool_io_unref (priv->thread_pool_io);
     }
 
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+
   G_OBJECT_CLASS (wing_iocp_input_stream_parent_class)->finalize (object);
 }
 
@@ -156,30 +171,39 @@ threadpool_io_completion (PTP_CALLBACK_INSTANCE instance,
                           gpointer              user_data)
 {
   WingOverlappedData *overlapped_data = overlapped;
-  GTask *task;
-
-  task = G_TASK (user_data);
-
-  if (result == NO_ERROR)
+  WingPipeStats *stats;
+  GCancellable *cancellable;
+
+  /* The stream, which owns the stats, is kept alive by the result */
+  stats = ((WingPooledOverlapped *) overlapped_data)->extra[0];
+
+  /* With inline completion the callback runs right from the return
+   * below, so everything is released beforehand */
+  cancellable = _wing_async_result_get_cancellable (user_data);
+  if (cancellable != NULL)
+    g_cancellable_disconnect (cancellable, overlapped_data->cancellable_id);
+  _wing_overlapped_data_release (overlapped);
+
+  /* As for the sync read, a message longer than the buffer of a pipe in
+   * message mode is returned in several reads */
+  if (result == NO_ERROR || result == ERROR_MORE_DATA)
     {
-      g_task_return_int (task, number_of_bytes_transferred);
+      _wing_pipe_stats_add (stats, WING_PIPE_STATS_READ, number_of_bytes_transferred);
+      _wing_async_result_return_int (user_data, number_of_bytes_transferred);
     }
   else
     {
       gchar *emsg = g_win32_error_message (result);
 
-      g_task_return_new_error (task, G_IO_ERROR,
-                               g_io_error_from_win32_error (result),
-                               "Error reading from handle: %s",
-                               emsg);
+      _wing_async_result_return_error (user_data,
+                                       g_error_new (G_IO_ERROR,
+                                                    g_io_error_from_win32_error (result),
+                                                    "Error reading from handle: %s",
+                                                    emsg));
       g_free (emsg);
     }
 
-  if (g_task_get_cancellable (task) != NULL)
-    g_cancellable_disconnect (g_task_get_cancellable (task),
-                              overlapped_data->cancellable_id);
-  g_object_unref (task);
-  g_slice_free (WingOverlappedData, overlapped);
+  g_object_unref (user_data);
 }
 
 static void
@@ -204,7 +228,7 @@ wing_iocp_input_stream_read_async (GInputStream        *stream,
                                    GAsyncReadyCallback  callback,
                                    gpointer             user_data)
 {
-  GTask *task;
+  gpointer result;
   WingOverlappedData *overlapped;
   WingIocpInputStream *wing_stream;
   WingIocpInputStreamPrivate *priv;
@@ -213,32 +237,43 @@ wing_iocp_input_stream_read_async (GInputStream        *stream,
   wing_stream = WING_IOCP_INPUT_STREAM (stream);
   priv = wing_iocp_input_stream_get_instance_private (wing_stream);
 
-  task = g_task_new (stream, cancellable, callback, user_data);
-  g_task_set_priority (task, io_priority);
+  if (wing_thread_pool_io_get_inline_completion (priv->thread_pool_io))
+    result = _wing_inline_result_new (stream, cancellable, callback, user_data);
+  else
+    {
+      result = g_task_new (stream, cancellable, callback, user_data);
+      g_task_set_priority (result, io_priority);
+    }
 
-  if (g_task_return_error_if_cancelled (task))
+  if (g_cancellable_is_cancelled (cancellable))
     {
-      g_object_unref (task);
+      GError *error = NULL;
+
+      g_cancellable_set_error_if_cancelled (cancellable, &error);
+      _wing_async_result_return_error_later (result, error);
+      g_object_unref (result);
       return;
     }
 
   handle = wing_thread_pool_get_handle (priv->thread_pool_io);
   if (handle == INVALID_HANDLE_VALUE)
     {
-      g_task_return_new_error (task, G_IO_ERROR,
-                               G_IO_ERROR_CLOSED,
-                               "Error reading from handle: the handle is closed");
-      g_object_unref (task);
+      _wing_async_result_return_error_later (result,
+                                             g_error_new_literal (G_IO_ERROR,
+                                                                  G_IO_ERROR_CLOSED,
+                                                                  "Error reading from handle: the handle is closed"));
+      g_object_unref (result);
 
       return;
     }
 
-  overlapped = g_slice_new0 (WingOverlappedData);
-  overlapped->user_data = task;
+  overlapped = _wing_overlapped_data_acquire ();
+  overlapped->user_data = result;
   overlapped->callback = threadpool_io_completion;
+  ((WingPooledOverlapped *) overlapped)->extra[0] = priv->stats;
 
-  if (g_task_get_cancellable (task) != NULL)
-    overlapped->cancellable_id = g_cancellable_connect (g_task_get_cancellable (task),
+  if (cancellable != NULL)
+    overlapped->cancellable_id = g_cancellable_connect (cancellable,
                                                         G_CALLBACK (on_cancellable_cancelled),
                                                         wing_stream, NULL);
 
@@ -249,25 +284,40 @@ wing_iocp_input_stream_read_async (GInputStream        *stream,
       int errsv;
 
       errsv = GetLastError ();
-      if (errsv != NO_ERROR && errsv != ERROR_IO_PENDING)
+
+      /* A message longer than the buffer completes through the port too */
+      if (errsv != NO_ERROR && errsv != ERROR_IO_PENDING &&
+          errsv != ERROR_MORE_DATA)
         {
           gchar *emsg = g_win32_error_message (errsv);
 
-          g_task_return_new_error (task, G_IO_ERROR,
-                                   g_io_error_from_win32_error (errsv),
-                                   "Error reading from handle: %s",
-                                   emsg);
-          g_free (emsg);
-
           wing_thread_pool_io_cancel (priv->thread_pool_io);
 
-          if (g_task_get_cancellable (task) != NULL)
-            g_cancellable_disconnect (g_task_get_cancellable (task),
-                                      overlapped->cancellable_id);
-          g_object_unref (task);
-          g_slice_free (WingOverlappedData, overlapped);
+          if (cancellable != NULL)
+            g_cancellable_disconnect (cancellable, overlapped->cancellable_id);
+          _wing_overlapped_data_release (overlapped);
+
+          _wing_async_result_return_error_later (result,
+                                                 g_error_new (G_IO_ERROR,
+                                                              g_io_error_from_win32_error (errsv),
+                                                              "Error reading from handle: %s",
+                                                              emsg));
+          g_free (emsg);
+          g_object_unref (result);
         }
     }
+  else if (WING_IS_INLINE_RESULT (result))
+    _wing_thread_pool_io_complete_sync_later (priv->thread_pool_io, overlapped);
+  else
+    _wing_thread_pool_io_complete_sync (priv->thread_pool_io, overlapped);
+}
+
+static gssize
+wing_iocp_input_stream_read_finish (GInputStream  *stream,
+                                    GAsyncResult  *result,
+                                    GError       **error)
+{
+  return _wing_async_result_propagate_int (result, error);
 }
 
 static gssize
@@ -284,6 +334,7 @@ wing_iocp_input_stream_read (GInputStream  *stream,
   OVERLAPPED overlap = { 0, };
   gssize retval = -1;
   HANDLE handle;
+  HANDLE event;
 
   wing_stream = WING_IOCP_INPUT_STREAM (stream);
   priv = wing_iocp_input_stream_get_instance_private (wing_stream);
@@ -296,8 +347,10 @@ wing_iocp_input_stream_read (GInputStream  *stream,
   else
     nbytes = (DWORD) count;
 
-  overlap.hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
-  g_return_val_if_fail (overlap.hEvent != NULL, -1);
+  event = _wing_event_acquire ();
+  g_return_val_if_fail (event != NULL, -1);
+
+  overlap.hEvent = event;
 
   handle = wing_thread_pool_get_handle (priv->thread_pool_io);
 
@@ -364,11 +417,69 @@ wing_iocp_input_stream_read (GInputStream  *stream,
     }
 
 end:
-  CloseHandle (overlap.hEvent);
+  _wing_event_release (event);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, retval);
 
   return retval;
 }
 
+static gboolean
+wing_iocp_input_stream_pollable_can_poll (GPollableInputStream *pollable)
+{
+  WingIocpInputStreamPrivate *priv;
+
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (pollable));
+
+  return _wing_pollable_can_poll (wing_thread_pool_get_handle (priv->thread_pool_io));
+}
+
+static gboolean
+wing_iocp_input_stream_pollable_is_readable (GPollableInputStream *pollable)
+{
+  WingIocpInputStreamPrivate *priv;
+
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (pollable));
+
+  return _wing_pollable_is_readable (wing_thread_pool_get_handle (priv->thread_pool_io));
+}
+
+static GSource *
+wing_iocp_input_stream_pollable_create_source (GPollableInputStream *pollable,
+                                               GCancellable         *cancellable)
+{
+  WingIocpInputStreamPrivate *priv;
+
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (pollable));
+
+  return _wing_pollable_create_read_source (G_INPUT_STREAM (pollable),
+                                            wing_thread_pool_get_handle (priv->thread_pool_io),
+                                            cancellable);
+}
+
+static gssize
+wing_iocp_input_stream_pollable_read_nonblocking (GPollableInputStream  *pollable,
+                                                  void                  *buffer,
+                                                  gsize                  count,
+                                                  GError               **error)
+{
+  WingIocpInputStreamPrivate *priv;
+
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (pollable));
+
+  return _wing_pollable_read_nonblocking (G_INPUT_STREAM (pollable),
+                                          wing_thread_pool_get_handle (priv->thread_pool_io),
+                                          buffer, count, error);
+}
+
+static void
+wing_iocp_input_stream_pollable_iface_init (GPollableInputStreamInterface *iface)
+{
+  iface->can_poll = wing_iocp_input_stream_pollable_can_poll;
+  iface->is_readable = wing_iocp_input_stream_pollable_is_readable;
+  iface->create_source = wing_iocp_input_stream_pollable_create_source;
+  iface->read_nonblocking = wing_iocp_input_stream_pollable_read_nonblocking;
+}
+
 static void
 wing_iocp_input_stream_class_init (WingIocpInputStreamClass *klass)
 {
@@ -381,6 +492,7 @@ wing_iocp_input_stream_class_init (WingIocpInputStreamClass *klass)
 
   stream_class->close_fn = wing_iocp_input_stream_close;
   stream_class->read_async = wing_iocp_input_stream_read_async;
+  stream_class->read_finish = wing_iocp_input_stream_read_finish;
   stream_class->read_fn = wing_iocp_input_stream_read;
 
   /**
@@ -517,3 +629,280 @@ wing_iocp_input_stream_get_handle (WingIocpInputStream *stream)
 
   return wing_thread_pool_get_handle (priv->thread_pool_io);
 }
+
+static void
+ready_return_error (gpointer result,
+                    DWORD    errsv)
+{
+  gchar *emsg = g_win32_error_message (errsv);
+
+  _wing_async_result_return_error (result,
+                                   g_error_new (G_IO_ERROR,
+                                                g_io_error_from_win32_error (errsv),
+                                                "Error reading from handle: %s",
+                                                emsg));
+  g_free (emsg);
+}
+
+static void
+ready_data_completion (PTP_CALLBACK_INSTANCE instance,
+                       PVOID                 ctxt,
+                       PVOID                 overlapped,
+                       ULONG                 result,
+                       ULONG_PTR             number_of_bytes_transferred,
+                       PTP_IO                threadpool_io,
+                       gpointer              user_data)
+{
+  WingOverlappedData *overlapped_data = overlapped;
+  WingIocpInputStreamPrivate *priv;
+  GInputStream *stream;
+  GCancellable *cancellable;
+  gpointer buffer;
+
+  stream = ((WingPooledOverlapped *) overlapped_data)->extra[0];
+  buffer = ((WingPooledOverlapped *) overlapped_data)->extra[1];
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (stream));
+
+  cancellable = _wing_async_result_get_cancellable (user_data);
+  if (cancellable != NULL)
+    g_cancellable_disconnect (cancellable, overlapped_data->cancellable_id);
+  _wing_overlapped_data_release (overlapped);
+
+  g_input_stream_clear_pending (stream);
+
+  if ((result == NO_ERROR || result == ERROR_MORE_DATA) && number_of_bytes_transferred > 0)
+    {
+      _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_READ, number_of_bytes_transferred);
+      _wing_async_result_return_pointer (user_data,
+                                         g_bytes_new_with_free_func (buffer, number_of_bytes_transferred,
+                                                                     _wing_read_buffer_release,
+                                                                     buffer),
+                                         (GDestroyNotify) g_bytes_unref);
+    }
+  else
+    {
+      _wing_read_buffer_release (buffer);
+
+      /* As for the other reads, a zero-length message reads as the end */
+      if (result == NO_ERROR || result == ERROR_MORE_DATA ||
+          result == ERROR_BROKEN_PIPE || result == ERROR_HANDLE_EOF)
+        _wing_async_result_return_pointer (user_data, g_bytes_new (NULL, 0),
+                                           (GDestroyNotify) g_bytes_unref);
+      else
+        ready_return_error (user_data, result);
+    }
+
+  g_object_unref (user_data);
+}
+
+static void
+ready_read_completion (PTP_CALLBACK_INSTANCE instance,
+                       PVOID                 ctxt,
+                       PVOID                 overlapped,
+                       ULONG                 result,
+                       ULONG_PTR             number_of_bytes_transferred,
+                       PTP_IO                threadpool_io,
+                       gpointer              user_data)
+{
+  WingOverlappedData *overlapped_data = overlapped;
+  WingIocpInputStreamPrivate *priv;
+  GInputStream *stream;
+  gpointer buffer;
+  HANDLE handle = INVALID_HANDLE_VALUE;
+  int errsv;
+
+  stream = ((WingPooledOverlapped *) overlapped_data)->extra[0];
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (stream));
+
+  /* The data is read into the pooled buffer with an overlapped read as
+   * well, since it may be gone or be a zero-length message, and the
+   * read completes through ready_data_completion() */
+  buffer = _wing_read_buffer_acquire ();
+  ((WingPooledOverlapped *) overlapped_data)->extra[1] = buffer;
+  overlapped_data->callback = ready_data_completion;
+
+  /* A message longer than the zero bytes asked for gives ERROR_MORE_DATA */
+  if (result != NO_ERROR && result != ERROR_MORE_DATA)
+    {
+      ready_data_completion (NULL, NULL, overlapped, result, 0, NULL, user_data);
+      return;
+    }
+
+  if (priv->thread_pool_io != NULL)
+    handle = wing_thread_pool_get_handle (priv->thread_pool_io);
+  if (handle == INVALID_HANDLE_VALUE)
+    {
+      ready_data_completion (NULL, NULL, overlapped, ERROR_INVALID_HANDLE, 0, NULL, user_data);
+      return;
+    }
+
+  memset (&overlapped_data->overlapped, 0, sizeof (overlapped_data->overlapped));
+
+  wing_thread_pool_io_start (priv->thread_pool_io);
+
+  if (ReadFile (handle, buffer, WING_READ_BUFFER_SIZE, NULL, (OVERLAPPED *)overlapped))
+    {
+      _wing_thread_pool_io_complete_sync (priv->thread_pool_io, overlapped_data);
+      return;
+    }
+
+  /* These complete through the port as well */
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_PENDING || errsv == ERROR_MORE_DATA)
+    return;
+
+  wing_thread_pool_io_cancel (priv->thread_pool_io);
+  ready_data_completion (NULL, NULL, overlapped, errsv, 0, NULL, user_data);
+}
+
+/**
+ * wing_iocp_input_stream_read_ready_async:
+ * @stream: a #WingIocpInputStream
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): callback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Reads the data available from @stream as soon as there is some.
+ *
+ * Unlike g_input_stream_read_async(), no buffer is held while waiting:
+ * the request posts a zero-byte read, which completes when data arrives,
+ * and only then takes a buffer from a pool shared by all the streams.
+ * This keeps the memory of many idle connections down to a few bytes
+ * each.
+ *
+ * The data returned by wing_iocp_input_stream_read_ready_finish() lives
+ * in the pooled buffer, up to 64 KiB, which is given back when the
+ * #GBytes is freed: copy what has to be kept for long.
+ *
+ * As with the other async functions, @callback is called from the
+ * thread-default main context of the caller, or right from the thread
+ * pool with inline completion, see wing_thread_pool_io_set_inline_completion().
+ */
+void
+wing_iocp_input_stream_read_ready_async (WingIocpInputStream *stream,
+                                         int                  io_priority,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  static gchar dummy;
+  WingIocpInputStreamPrivate *priv;
+  WingOverlappedData *overlapped;
+  gpointer result;
+  HANDLE handle;
+  GError *error = NULL;
+
+  g_return_if_fail (WING_IS_IOCP_INPUT_STREAM (stream));
+
+  priv = wing_iocp_input_stream_get_instance_private (stream);
+
+  if (priv->thread_pool_io != NULL &&
+      wing_thread_pool_io_get_inline_completion (priv->thread_pool_io))
+    result = _wing_inline_result_new (stream, cancellable, callback, user_data);
+  else
+    {
+      result = g_task_new (stream, cancellable, callback, user_data);
+      g_task_set_priority (result, io_priority);
+    }
+
+  if (!g_input_stream_set_pending (G_INPUT_STREAM (stream), &error) ||
+      g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      _wing_async_result_return_error_later (result, error);
+      g_object_unref (result);
+      return;
+    }
+
+  handle = wing_thread_pool_get_handle (priv->thread_pool_io);
+  if (handle == INVALID_HANDLE_VALUE)
+    {
+      g_input_stream_clear_pending (G_INPUT_STREAM (stream));
+      _wing_async_result_return_error_later (result,
+                                             g_error_new_literal (G_IO_ERROR,
+                                                                  G_IO_ERROR_CLOSED,
+                                                                  "Error reading from handle: the handle is closed"));
+      g_object_unref (result);
+      return;
+    }
+
+  overlapped = _wing_overlapped_data_acquire ();
+  overlapped->user_data = result;
+  overlapped->callback = ready_read_completion;
+  ((WingPooledOverlapped *) overlapped)->extra[0] = stream;
+
+  if (cancellable != NULL)
+    overlapped->cancellable_id = g_cancellable_connect (cancellable,
+                                                        G_CALLBACK (on_cancellable_cancelled),
+                                                        stream, NULL);
+
+  wing_thread_pool_io_start (priv->thread_pool_io);
+
+  if (!ReadFile (handle, &dummy, 0, NULL, (OVERLAPPED *)overlapped))
+    {
+      int errsv;
+
+      errsv = GetLastError ();
+
+      /* These complete through the port as well */
+      if (errsv != NO_ERROR && errsv != ERROR_IO_PENDING &&
+          errsv != ERROR_MORE_DATA)
+        {
+          gchar *emsg = g_win32_error_message (errsv);
+
+          wing_thread_pool_io_cancel (priv->thread_pool_io);
+
+          if (cancellable != NULL)
+            g_cancellable_disconnect (cancellable, overlapped->cancellable_id);
+          _wing_overlapped_data_release (overlapped);
+
+          g_input_stream_clear_pending (G_INPUT_STREAM (stream));
+          _wing_async_result_return_error_later (result,
+                                                 g_error_new (G_IO_ERROR,
+                                                              g_io_error_from_win32_error (errsv),
+                                                              "Error reading from handle: %s",
+                                                              emsg));
+          g_free (emsg);
+          g_object_unref (result);
+        }
+    }
+  else if (WING_IS_INLINE_RESULT (result))
+    _wing_thread_pool_io_complete_sync_later (priv->thread_pool_io, overlapped);
+  else
+    _wing_thread_pool_io_complete_sync (priv->thread_pool_io, overlapped);
+}
+
+/**
+ * wing_iocp_input_stream_read_ready_finish:
+ * @stream: a #WingIocpInputStream
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occurring, or %NULL to
+ *   ignore
+ *
+ * Finishes a read started with wing_iocp_input_stream_read_ready_async().
+ *
+ * Returns: (transfer full): the data read, empty at the end of the
+ *   stream, or %NULL on error
+ */
+GBytes *
+wing_iocp_input_stream_read_ready_finish (WingIocpInputStream  *stream,
+                                          GAsyncResult         *result,
+                                          GError              **error)
+{
+  g_return_val_if_fail (WING_IS_IOCP_INPUT_STREAM (stream), NULL);
+
+  return _wing_async_result_propagate_pointer (result, error);
+}
+
+void
+_wing_iocp_input_stream_set_pipe_stats (gpointer       stream,
+                                        WingPipeStats *stats)
+{
+  WingIocpInputStreamPrivate *priv;
+
+  priv = wing_iocp_input_stream_get_instance_private (WING_IOCP_INPUT_STREAM (stream));
+
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+  if (stats != NULL)
+    priv->stats = _wing_pipe_stats_ref (stats);
+}
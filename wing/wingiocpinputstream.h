@@ -63,6 +63,18 @@ gboolean       wing_iocp_input_stream_get_close_handle (WingIocpInputStream *str
 WING_AVAILABLE_IN_ALL
 void          *wing_iocp_input_stream_get_handle       (WingIocpInputStream *stream);
 
+WING_AVAILABLE_IN_ALL
+void           wing_iocp_input_stream_read_ready_async (WingIocpInputStream *stream,
+                                                        int                  io_priority,
+                                                        GCancellable        *cancellable,
+                                                        GAsyncReadyCallback  callback,
+                                                        gpointer             user_data);
+
+WING_AVAILABLE_IN_ALL
+GBytes        *wing_iocp_input_stream_read_ready_finish (WingIocpInputStream  *stream,
+                                                         GAsyncResult         *result,
+                                                         GError              **error);
+
 G_END_DECLS
 
 #endif /* __WING_IOCP_INPUT_STREAM_H__ */
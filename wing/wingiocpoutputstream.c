@@ -23,6 +23,13 @@
 
 #include "wingiocpoutputstream.h"
 #include "wingutils.h"
+#include "wingutils-private.h"
+#include "wingpollable-private.h"
+#include "wingpipestats-private.h"
+#include "wingasyncresult-private.h"
+#include "wingoutputvectors-private.h"
+#include "wingthreadpoolio-private.h"
+#include "wingsplice-private.h"
 
 #include <windows.h>
 
@@ -38,6 +45,10 @@
 typedef struct {
   gboolean close_handle;
   WingThreadPoolIo *thread_pool_io;
+
+  WingPollableWriter *writer;
+
+  WingPipeStats *stats;
 } WingIocpOutputStreamPrivate;
 
 enum {
@@ -49,7 +60,12 @@ enum {
 
 static GParamSpec *props[LAST_PROP];
 
-G_DEFINE_TYPE_WITH_PRIVATE (WingIocpOutputStream, wing_iocp_output_stream, G_TYPE_OUTPUT_STREAM)
+static void wing_iocp_output_stream_pollable_iface_init (GPollableOutputStreamInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingIocpOutputStream, wing_iocp_output_stream, G_TYPE_OUTPUT_STREAM,
+                         G_ADD_PRIVATE (WingIocpOutputStream)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_OUTPUT_STREAM,
+                                                wing_iocp_output_stream_pollable_iface_init))
 
 static void
 wing_iocp_output_stream_finalize (GObject *object)
@@ -60,6 +76,9 @@ wing_iocp_output_stream_finalize (GObject *object)
   wing_stream = WING_IOCP_OUTPUT_STREAM (object);
   priv = wing_iocp_output_stream_get_instance_private (wing_stream);
 
+  if (priv->writer != NULL)
+    _wing_pollable_writer_free (priv->writer, wing_thread_pool_get_handle (priv->thread_pool_io));
+
   if (priv->thread_pool_io)
     {
       if (priv->close_handle)
@@ -68,6 +87,8 @@ wing_iocp_output_stream_finalize (GObject *object)
       wing_thread_pool_io_unref (priv->thread_pool_io);
     }
 
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+
   G_OBJECT_CLASS (wing_iocp_output_stream_parent_class)->finalize (object);
 }
 
@@ -136,6 +157,13 @@ wing_iocp_output_stream_close (GOutputStream  *stream,
   wing_stream = WING_IOCP_OUTPUT_STREAM (stream);
   priv = wing_iocp_output_stream_get_instance_private (wing_stream);
 
+  /* GOutputStream flushed it before closing */
+  if (priv->writer != NULL)
+    {
+      _wing_pollable_writer_free (priv->writer, wing_thread_pool_get_handle (priv->thread_pool_io));
+      priv->writer = NULL;
+    }
+
   if (!priv->close_handle)
     return TRUE;
 
@@ -157,29 +185,37 @@ threadpool_io_completion (PTP_CALLBACK_INSTANCE instance,
                           gpointer              user_data)
 {
   WingOverlappedData *overlapped_data = overlapped;
-  GTask *task;
+  WingPipeStats *stats;
+  GCancellable *cancellable;
+
+  /* The stream, which owns the stats, is kept alive by the result */
+  stats = ((WingPooledOverlapped *) overlapped_data)->extra[0];
+
+  /* With inline completion the callback runs right from the return
+   * below, so everything is released beforehand */
+  cancellable = _wing_async_result_get_cancellable (user_data);
+  if (cancellable != NULL)
+    g_cancellable_disconnect (cancellable, overlapped_data->cancellable_id);
+  _wing_overlapped_data_release (overlapped);
 
-  task = G_TASK (user_data);
   if (result == NO_ERROR)
     {
-      g_task_return_int (task, number_of_bytes_transferred);
+      _wing_pipe_stats_add (stats, WING_PIPE_STATS_WRITE, number_of_bytes_transferred);
+      _wing_async_result_return_int (user_data, number_of_bytes_transferred);
     }
   else
     {
       gchar *emsg = g_win32_error_message (result);
 
-      g_task_return_new_error (task, G_IO_ERROR,
-                               g_io_error_from_win32_error (result),
-                               "Error writing to handle: %s",
-                               emsg);
+      _wing_async_result_return_error (user_data,
+                                       g_error_new (G_IO_ERROR,
+                                                    g_io_error_from_win32_error (result),
+                                                    "Error writing to handle: %s",
+                                                    emsg));
       g_free (emsg);
     }
 
-  if (g_task_get_cancellable (task) != NULL)
-    g_cancellable_disconnect (g_task_get_cancellable (task),
-                              overlapped_data->cancellable_id);
-  g_object_unref (task);
-  g_slice_free (WingOverlappedData, overlapped);
+  g_object_unref (user_data);
 }
 
 static void
@@ -204,7 +240,7 @@ wing_iocp_output_stream_write_async (GOutputStream       *stream,
                                      GAsyncReadyCallback  callback,
                                      gpointer             user_data)
 {
-  GTask *task;
+  gpointer result;
   WingOverlappedData *overlapped;
   WingIocpOutputStream *wing_stream;
   WingIocpOutputStreamPrivate *priv;
@@ -213,32 +249,43 @@ wing_iocp_output_stream_write_async (GOutputStream       *stream,
   wing_stream = WING_IOCP_OUTPUT_STREAM (stream);
   priv = wing_iocp_output_stream_get_instance_private (wing_stream);
 
-  task = g_task_new (stream, cancellable, callback, user_data);
-  g_task_set_priority (task, io_priority);
+  if (wing_thread_pool_io_get_inline_completion (priv->thread_pool_io))
+    result = _wing_inline_result_new (stream, cancellable, callback, user_data);
+  else
+    {
+      result = g_task_new (stream, cancellable, callback, user_data);
+      g_task_set_priority (result, io_priority);
+    }
 
-  if (g_task_return_error_if_cancelled (task))
+  if (g_cancellable_is_cancelled (cancellable))
     {
-      g_object_unref (task);
+      GError *error = NULL;
+
+      g_cancellable_set_error_if_cancelled (cancellable, &error);
+      _wing_async_result_return_error_later (result, error);
+      g_object_unref (result);
       return;
     }
 
   handle = wing_thread_pool_get_handle (priv->thread_pool_io);
   if (handle == INVALID_HANDLE_VALUE)
     {
-      g_task_return_new_error (task, G_IO_ERROR,
-                               G_IO_ERROR_CLOSED,
-                               "Error writing to handle: the handle is closed");
-      g_object_unref (task);
+      _wing_async_result_return_error_later (result,
+                                             g_error_new_literal (G_IO_ERROR,
+                                                                  G_IO_ERROR_CLOSED,
+                                                                  "Error writing to handle: the handle is closed"));
+      g_object_unref (result);
 
       return;
     }
 
-  overlapped = g_slice_new0 (WingOverlappedData);
-  overlapped->user_data = task;
+  overlapped = _wing_overlapped_data_acquire ();
+  overlapped->user_data = result;
   overlapped->callback = threadpool_io_completion;
+  ((WingPooledOverlapped *) overlapped)->extra[0] = priv->stats;
 
-  if (g_task_get_cancellable (task) != NULL)
-    overlapped->cancellable_id = g_cancellable_connect (g_task_get_cancellable (task),
+  if (cancellable != NULL)
+    overlapped->cancellable_id = g_cancellable_connect (cancellable,
                                                         G_CALLBACK (on_cancellable_cancelled),
                                                         wing_stream, NULL);
 
@@ -253,21 +300,33 @@ wing_iocp_output_stream_write_async (GOutputStream       *stream,
         {
           gchar *emsg = g_win32_error_message (errsv);
 
-          g_task_return_new_error (task, G_IO_ERROR,
-                                   g_io_error_from_win32_error (errsv),
-                                   "Error writing to handle: %s",
-                                   emsg);
-          g_free (emsg);
-
           wing_thread_pool_io_cancel (priv->thread_pool_io);
 
-          if (g_task_get_cancellable (task) != NULL)
-            g_cancellable_disconnect (g_task_get_cancellable (task),
-                                      overlapped->cancellable_id);
-          g_object_unref (task);
-          g_slice_free (WingOverlappedData, overlapped);
+          if (cancellable != NULL)
+            g_cancellable_disconnect (cancellable, overlapped->cancellable_id);
+          _wing_overlapped_data_release (overlapped);
+
+          _wing_async_result_return_error_later (result,
+                                                 g_error_new (G_IO_ERROR,
+                                                              g_io_error_from_win32_error (errsv),
+                                                              "Error writing to handle: %s",
+                                                              emsg));
+          g_free (emsg);
+          g_object_unref (result);
         }
     }
+  else if (WING_IS_INLINE_RESULT (result))
+    _wing_thread_pool_io_complete_sync_later (priv->thread_pool_io, overlapped);
+  else
+    _wing_thread_pool_io_complete_sync (priv->thread_pool_io, overlapped);
+}
+
+static gssize
+wing_iocp_output_stream_write_finish (GOutputStream  *stream,
+                                      GAsyncResult  *result,
+                                      GError       **error)
+{
+  return _wing_async_result_propagate_int (result, error);
 }
 
 static gssize
@@ -284,6 +343,7 @@ wing_iocp_output_stream_write (GOutputStream  *stream,
   OVERLAPPED overlap = { 0, };
   gssize retval = -1;
   HANDLE handle;
+  HANDLE event;
 
   wing_stream = WING_IOCP_OUTPUT_STREAM (stream);
   priv = wing_iocp_output_stream_get_instance_private (wing_stream);
@@ -296,8 +356,10 @@ wing_iocp_output_stream_write (GOutputStream  *stream,
   else
     nbytes = (DWORD) count;
 
-  overlap.hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
-  g_return_val_if_fail (overlap.hEvent != NULL, -1);
+  event = _wing_event_acquire ();
+  g_return_val_if_fail (event != NULL, -1);
+
+  overlap.hEvent = event;
 
   handle = wing_thread_pool_get_handle (priv->thread_pool_io);
 
@@ -350,11 +412,99 @@ wing_iocp_output_stream_write (GOutputStream  *stream,
     }
 
 end:
-  CloseHandle (overlap.hEvent);
+  _wing_event_release (event);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, retval);
 
   return retval;
 }
 
+static gboolean
+wing_iocp_output_stream_flush (GOutputStream  *stream,
+                               GCancellable   *cancellable,
+                               GError        **error)
+{
+  WingIocpOutputStreamPrivate *priv;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (stream));
+
+  if (priv->writer == NULL)
+    return TRUE;
+
+  return _wing_pollable_writer_flush (priv->writer,
+                                      wing_thread_pool_get_handle (priv->thread_pool_io),
+                                      cancellable, error);
+}
+
+static gboolean
+wing_iocp_output_stream_pollable_can_poll (GPollableOutputStream *pollable)
+{
+  WingIocpOutputStreamPrivate *priv;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (pollable));
+
+  return _wing_pollable_can_poll (wing_thread_pool_get_handle (priv->thread_pool_io));
+}
+
+static gboolean
+wing_iocp_output_stream_pollable_is_writable (GPollableOutputStream *pollable)
+{
+  WingIocpOutputStreamPrivate *priv;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (pollable));
+
+  return priv->writer == NULL || _wing_pollable_writer_is_writable (priv->writer);
+}
+
+static WingPollableWriter *
+wing_iocp_output_stream_pollable_get_writer (WingIocpOutputStreamPrivate *priv)
+{
+  if (priv->writer == NULL)
+    priv->writer = _wing_pollable_writer_new ();
+
+  return priv->writer;
+}
+
+static GSource *
+wing_iocp_output_stream_pollable_create_source (GPollableOutputStream *pollable,
+                                                GCancellable          *cancellable)
+{
+  WingIocpOutputStreamPrivate *priv;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (pollable));
+
+  return _wing_pollable_writer_create_source (wing_iocp_output_stream_pollable_get_writer (priv),
+                                              G_OUTPUT_STREAM (pollable),
+                                              cancellable);
+}
+
+static gssize
+wing_iocp_output_stream_pollable_write_nonblocking (GPollableOutputStream  *pollable,
+                                                    const void             *buffer,
+                                                    gsize                   count,
+                                                    GError                **error)
+{
+  WingIocpOutputStreamPrivate *priv;
+  gssize written;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (pollable));
+
+  written = _wing_pollable_writer_write (wing_iocp_output_stream_pollable_get_writer (priv),
+                                         wing_thread_pool_get_handle (priv->thread_pool_io),
+                                         buffer, count, error);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, written);
+
+  return written;
+}
+
+static void
+wing_iocp_output_stream_pollable_iface_init (GPollableOutputStreamInterface *iface)
+{
+  iface->can_poll = wing_iocp_output_stream_pollable_can_poll;
+  iface->is_writable = wing_iocp_output_stream_pollable_is_writable;
+  iface->create_source = wing_iocp_output_stream_pollable_create_source;
+  iface->write_nonblocking = wing_iocp_output_stream_pollable_write_nonblocking;
+}
+
 static void
 wing_iocp_output_stream_class_init (WingIocpOutputStreamClass *klass)
 {
@@ -366,8 +516,17 @@ wing_iocp_output_stream_class_init (WingIocpOutputStreamClass *klass)
   gobject_class->set_property = wing_iocp_output_stream_set_property;
 
   stream_class->close_fn = wing_iocp_output_stream_close;
+  stream_class->flush = wing_iocp_output_stream_flush;
   stream_class->write_async = wing_iocp_output_stream_write_async;
+  stream_class->write_finish = wing_iocp_output_stream_write_finish;
   stream_class->write_fn = wing_iocp_output_stream_write;
+  stream_class->splice_async = _wing_output_stream_splice_async;
+  stream_class->splice_finish = _wing_output_stream_splice_finish;
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  stream_class->writev_fn = _wing_output_stream_writev;
+  stream_class->writev_async = _wing_output_stream_writev_async;
+  stream_class->writev_finish = _wing_output_stream_writev_finish;
+#endif
 
   /**
    * WingIocpOutputStream:close-handle:
@@ -504,3 +663,16 @@ wing_iocp_output_stream_get_handle (WingIocpOutputStream *stream)
 
   return wing_thread_pool_get_handle (priv->thread_pool_io);
 }
+
+void
+_wing_iocp_output_stream_set_pipe_stats (gpointer       stream,
+                                         WingPipeStats *stats)
+{
+  WingIocpOutputStreamPrivate *priv;
+
+  priv = wing_iocp_output_stream_get_instance_private (WING_IOCP_OUTPUT_STREAM (stream));
+
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+  if (stats != NULL)
+    priv->stats = _wing_pipe_stats_ref (stats);
+}
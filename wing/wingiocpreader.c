@@ -0,0 +1,390 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingiocpreader.h"
+#include "wingutils.h"
+#include "wingorderedreads-private.h"
+
+#include <windows.h>
+
+/**
+ * SECTION:wingiocpreader
+ * @short_description: Reads a handle with several reads in flight
+ * @see_also: #WingIocpInputStream, #WingThreadPoolIo
+ *
+ * #WingIocpReader keeps up to #WingIocpReader:n-reads overlapped reads
+ * posted on a #WingThreadPoolIo, so that the handle is read again as
+ * soon as a read completes instead of waiting for the caller to ask for
+ * more. The data is handed out in the order it was read, one buffer of
+ * at most #WingIocpReader:buffer-size bytes for each call to
+ * wing_iocp_reader_read_async().
+ *
+ * The reads start with the first call to wing_iocp_reader_read_async().
+ * From then on no other read must be made on the handle, neither with
+ * the #WingIocpInputStream of the connection.
+ *
+ * The reader has to be used from the thread-default main context at
+ * the time it was created. It keeps itself alive while reads are in
+ * flight: call wing_iocp_reader_close() to stop reading before the end
+ * of the data is reached.
+ */
+
+#define DEFAULT_N_READS 4
+#define MAX_N_READS 64
+#define DEFAULT_BUFFER_SIZE 65536
+
+struct _WingIocpReader
+{
+  GObject parent_instance;
+
+  WingThreadPoolIo *thread_pool_io;
+  guint n_reads;
+  gsize buffer_size;
+
+  WingOrderedReads *reads;
+};
+
+enum
+{
+  PROP_0,
+  PROP_THREADPOOL_IO,
+  PROP_N_READS,
+  PROP_BUFFER_SIZE,
+  LAST_PROP
+};
+
+static GParamSpec *props[LAST_PROP];
+
+G_DEFINE_TYPE (WingIocpReader, wing_iocp_reader, G_TYPE_OBJECT)
+
+static void
+wing_iocp_reader_finalize (GObject *object)
+{
+  WingIocpReader *reader = WING_IOCP_READER (object);
+
+  g_clear_pointer (&reader->reads, _wing_ordered_reads_free);
+  g_clear_pointer (&reader->thread_pool_io, wing_thread_pool_io_unref);
+
+  G_OBJECT_CLASS (wing_iocp_reader_parent_class)->finalize (object);
+}
+
+static gpointer
+acquire_buffer (gpointer owner)
+{
+  WingIocpReader *reader = owner;
+
+  return g_malloc (reader->buffer_size);
+}
+
+static void
+release_buffer (gpointer owner,
+                gpointer buffer)
+{
+  g_free (buffer);
+}
+
+static GBytes *
+wrap_buffer (gpointer owner,
+             gpointer buffer,
+             gsize    size)
+{
+  return g_bytes_new_take (buffer, size);
+}
+
+/* The empty reads are dropped, they would look like the end of the data */
+static WingOrderedReadStatus
+check_result (gpointer owner,
+              DWORD    result,
+              DWORD    transferred)
+{
+  switch (result)
+    {
+    case NO_ERROR:
+    case ERROR_MORE_DATA:
+      return transferred > 0 ? WING_ORDERED_READ_DATA : WING_ORDERED_READ_SKIP;
+    case ERROR_HANDLE_EOF:
+    case ERROR_BROKEN_PIPE:
+      return WING_ORDERED_READ_EOF;
+    default:
+      return WING_ORDERED_READ_ERROR;
+    }
+}
+
+static const WingOrderedReadsHooks reads_hooks =
+{
+  acquire_buffer,
+  release_buffer,
+  wrap_buffer,
+  NULL,
+  check_result
+};
+
+static void
+wing_iocp_reader_constructed (GObject *object)
+{
+  WingIocpReader *reader = WING_IOCP_READER (object);
+
+  reader->reads = _wing_ordered_reads_new (reader, &reads_hooks,
+                                           reader->thread_pool_io,
+                                           reader->n_reads,
+                                           reader->buffer_size,
+                                           "Error reading from handle");
+
+  G_OBJECT_CLASS (wing_iocp_reader_parent_class)->constructed (object);
+}
+
+static void
+wing_iocp_reader_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  WingIocpReader *reader = WING_IOCP_READER (object);
+
+  switch (prop_id)
+    {
+    case PROP_THREADPOOL_IO:
+      g_value_set_boxed (value, reader->thread_pool_io);
+      break;
+    case PROP_N_READS:
+      g_value_set_uint (value, reader->n_reads);
+      break;
+    case PROP_BUFFER_SIZE:
+      g_value_set_uint (value, (guint) reader->buffer_size);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+wing_iocp_reader_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  WingIocpReader *reader = WING_IOCP_READER (object);
+
+  switch (prop_id)
+    {
+    case PROP_THREADPOOL_IO:
+      reader->thread_pool_io = g_value_dup_boxed (value);
+      break;
+    case PROP_N_READS:
+      reader->n_reads = g_value_get_uint (value);
+      break;
+    case PROP_BUFFER_SIZE:
+      reader->buffer_size = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+wing_iocp_reader_class_init (WingIocpReaderClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = wing_iocp_reader_finalize;
+  gobject_class->constructed = wing_iocp_reader_constructed;
+  gobject_class->get_property = wing_iocp_reader_get_property;
+  gobject_class->set_property = wing_iocp_reader_set_property;
+
+  /**
+   * WingIocpReader:threadpool-io:
+   *
+   * The threadpool I/O object of the handle to read.
+   */
+  props[PROP_THREADPOOL_IO] =
+    g_param_spec_boxed ("threadpool-io",
+                        "Threadpool I/O object",
+                        "The threadpool I/O object of the handle to read",
+                        WING_TYPE_THREAD_POOL_IO,
+                        G_PARAM_READWRITE |
+                        G_PARAM_CONSTRUCT_ONLY |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingIocpReader:n-reads:
+   *
+   * The number of reads kept in flight.
+   */
+  props[PROP_N_READS] =
+    g_param_spec_uint ("n-reads",
+                       "Number of reads",
+                       "The number of reads kept in flight",
+                       1, MAX_N_READS,
+                       DEFAULT_N_READS,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingIocpReader:buffer-size:
+   *
+   * The size of the buffer of each read.
+   */
+  props[PROP_BUFFER_SIZE] =
+    g_param_spec_uint ("buffer-size",
+                       "Buffer size",
+                       "The size of the buffer of each read",
+                       1, G_MAXINT,
+                       DEFAULT_BUFFER_SIZE,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, LAST_PROP, props);
+}
+
+static void
+wing_iocp_reader_init (WingIocpReader *reader)
+{
+}
+
+/**
+ * wing_iocp_reader_new:
+ * @thread_pool_io: the #WingThreadPoolIo of the handle to read.
+ * @n_reads: the number of reads to keep in flight, or 0 for the default.
+ * @buffer_size: the size of the buffer of each read, or 0 for the default.
+ *
+ * Creates a new #WingIocpReader for the handle of @thread_pool_io.
+ * The #WingThreadPoolIo of a #WingNamedPipeConnection is its
+ * #WingNamedPipeConnection:threadpool-io property.
+ *
+ * Returns: a new #WingIocpReader
+ */
+WingIocpReader *
+wing_iocp_reader_new (WingThreadPoolIo *thread_pool_io,
+                      guint             n_reads,
+                      gsize             buffer_size)
+{
+  g_return_val_if_fail (thread_pool_io != NULL, NULL);
+  g_return_val_if_fail (n_reads <= MAX_N_READS, NULL);
+  g_return_val_if_fail (buffer_size <= G_MAXINT, NULL);
+
+  return g_object_new (WING_TYPE_IOCP_READER,
+                       "threadpool-io", thread_pool_io,
+                       "n-reads", n_reads > 0 ? n_reads : DEFAULT_N_READS,
+                       "buffer-size", (guint) (buffer_size > 0 ? buffer_size : DEFAULT_BUFFER_SIZE),
+                       NULL);
+}
+
+/**
+ * wing_iocp_reader_read_async:
+ * @reader: a #WingIocpReader.
+ * @io_priority: the I/O priority of the request.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Requests the next buffer read from the handle, starting the reads if
+ * they were not yet. Several requests may be pending at the same time,
+ * they are satisfied in order.
+ *
+ * Cancelling a request does not lose any data: the buffer it would have
+ * received goes to the next request.
+ */
+void
+wing_iocp_reader_read_async (WingIocpReader      *reader,
+                             int                  io_priority,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (WING_IS_IOCP_READER (reader));
+
+  task = g_task_new (reader, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_iocp_reader_read_async);
+  g_task_set_priority (task, io_priority);
+
+  _wing_ordered_reads_queue (reader->reads, task);
+}
+
+/**
+ * wing_iocp_reader_read_finish:
+ * @reader: a #WingIocpReader.
+ * @result: a #GAsyncResult.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Finishes a request started with wing_iocp_reader_read_async().
+ *
+ * Returns: (transfer full): the data read, empty once the end of the
+ * data has been reached, or %NULL on error.
+ */
+GBytes *
+wing_iocp_reader_read_finish (WingIocpReader  *reader,
+                              GAsyncResult    *result,
+                              GError         **error)
+{
+  g_return_val_if_fail (WING_IS_IOCP_READER (reader), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, reader), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * wing_iocp_reader_close:
+ * @reader: a #WingIocpReader.
+ *
+ * Cancels the reads in flight and fails the pending requests with
+ * %G_IO_ERROR_CLOSED. The data already read and not yet handed out is
+ * dropped. The handle is left open.
+ */
+void
+wing_iocp_reader_close (WingIocpReader *reader)
+{
+  g_return_if_fail (WING_IS_IOCP_READER (reader));
+
+  _wing_ordered_reads_close (reader->reads);
+}
+
+/**
+ * wing_iocp_reader_get_n_reads:
+ * @reader: a #WingIocpReader.
+ *
+ * Gets the number of reads kept in flight by @reader.
+ *
+ * Returns: the number of reads.
+ */
+guint
+wing_iocp_reader_get_n_reads (WingIocpReader *reader)
+{
+  g_return_val_if_fail (WING_IS_IOCP_READER (reader), 0);
+
+  return reader->n_reads;
+}
+
+/**
+ * wing_iocp_reader_get_buffer_size:
+ * @reader: a #WingIocpReader.
+ *
+ * Gets the size of the buffer of each read of @reader.
+ *
+ * Returns: the buffer size.
+ */
+gsize
+wing_iocp_reader_get_buffer_size (WingIocpReader *reader)
+{
+  g_return_val_if_fail (WING_IS_IOCP_READER (reader), 0);
+
+  return reader->buffer_size;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_IOCP_READER_H
+#define WING_IOCP_READER_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+#include <wing/wingthreadpoolio.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_IOCP_READER (wing_iocp_reader_get_type ())
+
+WING_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (WingIocpReader, wing_iocp_reader, WING, IOCP_READER, GObject)
+
+WING_AVAILABLE_IN_ALL
+WingIocpReader           *wing_iocp_reader_new                 (WingThreadPoolIo  *thread_pool_io,
+                                                                guint              n_reads,
+                                                                gsize              buffer_size);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_iocp_reader_read_async          (WingIocpReader    *reader,
+                                                                int                io_priority,
+                                                                GCancellable      *cancellable,
+                                                                GAsyncReadyCallback callback,
+                                                                gpointer           user_data);
+
+WING_AVAILABLE_IN_ALL
+GBytes                   *wing_iocp_reader_read_finish         (WingIocpReader    *reader,
+                                                                GAsyncResult      *result,
+                                                                GError           **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_iocp_reader_close               (WingIocpReader    *reader);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_iocp_reader_get_n_reads         (WingIocpReader    *reader);
+
+WING_AVAILABLE_IN_ALL
+gsize                     wing_iocp_reader_get_buffer_size     (WingIocpReader    *reader);
+
+G_END_DECLS
+
+#endif /* WING_IOCP_READER_H */
@@ -42,6 +42,9 @@ typedef struct
 {
   guint timeout;
   gboolean use_iocp;
+  gboolean message_mode;
+  WingThreadPool *thread_pool;
+  gint io_priority;
 } WingNamedPipeClientPrivate;
 
 enum
@@ -49,6 +52,9 @@ enum
   PROP_0,
   PROP_TIMEOUT,
   PROP_USE_IOCP,
+  PROP_MESSAGE_MODE,
+  PROP_THREAD_POOL,
+  PROP_IO_PRIORITY,
   LAST_PROP
 };
 
@@ -56,6 +62,19 @@ static GParamSpec *props[LAST_PROP];
 
 G_DEFINE_TYPE_WITH_PRIVATE (WingNamedPipeClient, wing_named_pipe_client, G_TYPE_OBJECT)
 
+static void
+wing_named_pipe_client_finalize (GObject *object)
+{
+  WingNamedPipeClient *client = WING_NAMED_PIPE_CLIENT (object);
+  WingNamedPipeClientPrivate *priv;
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  g_clear_pointer (&priv->thread_pool, wing_thread_pool_unref);
+
+  G_OBJECT_CLASS (wing_named_pipe_client_parent_class)->finalize (object);
+}
+
 static void
 wing_named_pipe_client_get_property (GObject    *object,
                                      guint       prop_id,
@@ -77,6 +96,18 @@ wing_named_pipe_client_get_property (GObject    *object,
         g_value_set_boolean (value, priv->use_iocp);
         break;
 
+    case PROP_MESSAGE_MODE:
+      g_value_set_boolean (value, priv->message_mode);
+      break;
+
+    case PROP_THREAD_POOL:
+      g_value_set_boxed (value, priv->thread_pool);
+      break;
+
+    case PROP_IO_PRIORITY:
+      g_value_set_int (value, priv->io_priority);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -104,6 +135,18 @@ wing_named_pipe_client_set_property (GObject      *object,
       priv->use_iocp = g_value_get_boolean (value);
       break;
 
+    case PROP_MESSAGE_MODE:
+      priv->message_mode = g_value_get_boolean (value);
+      break;
+
+    case PROP_THREAD_POOL:
+      wing_named_pipe_client_set_thread_pool (client, g_value_get_boxed (value));
+      break;
+
+    case PROP_IO_PRIORITY:
+      wing_named_pipe_client_set_io_priority (client, g_value_get_int (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -115,6 +158,7 @@ wing_named_pipe_client_class_init (WingNamedPipeClientClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->finalize = wing_named_pipe_client_finalize;
   object_class->get_property = wing_named_pipe_client_get_property;
   object_class->set_property = wing_named_pipe_client_set_property;
 
@@ -143,6 +187,52 @@ wing_named_pipe_client_class_init (WingNamedPipeClientClass *klass)
                           G_PARAM_WRITABLE |
                           G_PARAM_STATIC_STRINGS);
 
+  /**
+   * WingNamedPipeClient:message-mode:
+   *
+   * Whether to read from the pipe in message mode. The pipe must have
+   * been created in message mode by the server.
+   */
+  props[PROP_MESSAGE_MODE] =
+    g_param_spec_boolean ("message-mode",
+                          "Message mode",
+                          "Whether to read from the pipe in message mode",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeClient:thread-pool:
+   *
+   * The #WingThreadPool to run the completions of the async I/O of the
+   * connections on, when using I/O completion port. %NULL for the
+   * default thread pool of the process.
+   */
+  props[PROP_THREAD_POOL] =
+    g_param_spec_boxed ("thread-pool",
+                        "Thread pool",
+                        "The thread pool to run the completions of the async I/O on",
+                        WING_TYPE_THREAD_POOL,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeClient:io-priority:
+   *
+   * The I/O priority the completions of the async I/O of the connections
+   * run with on the thread pool, when using I/O completion port.
+   */
+  props[PROP_IO_PRIORITY] =
+    g_param_spec_int ("io-priority",
+                      "I/O priority",
+                      "The I/O priority of the completions of the async I/O",
+                      G_MININT,
+                      G_MAXINT,
+                      G_PRIORITY_DEFAULT,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT |
+                      G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, LAST_PROP, props);
 }
 
@@ -166,6 +256,109 @@ wing_named_pipe_client_new (void)
                        NULL);
 }
 
+/* Opens the pipe, returns INVALID_HANDLE_VALUE with @busy set to %TRUE
+ * and no error if all the instances of the pipe are busy */
+static HANDLE
+open_pipe (WingNamedPipeClient       *client,
+           const gchar               *pipe_name,
+           const gunichar2           *pipe_namew,
+           WingNamedPipeClientFlags   flags,
+           gboolean                  *busy,
+           GError                   **error)
+{
+  WingNamedPipeClientPrivate *priv;
+  HANDLE handle;
+  DWORD pipe_flags = 0;
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  *busy = FALSE;
+
+  if (flags & WING_NAMED_PIPE_CLIENT_GENERIC_READ)
+    pipe_flags |= GENERIC_READ;
+
+  if (flags & WING_NAMED_PIPE_CLIENT_GENERIC_WRITE)
+    pipe_flags |= GENERIC_WRITE;
+
+  /* Needed to change the read mode of the pipe */
+  if (priv->message_mode)
+    pipe_flags |= FILE_WRITE_ATTRIBUTES;
+
+  handle = CreateFileW (pipe_namew,
+                        pipe_flags,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                        NULL);
+
+  if (handle == INVALID_HANDLE_VALUE)
+    {
+      int errsv;
+      gchar *err;
+
+      errsv = GetLastError ();
+      if (errsv == ERROR_PIPE_BUSY)
+        {
+          *busy = TRUE;
+          return INVALID_HANDLE_VALUE;
+        }
+
+      err = g_win32_error_message (errsv);
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_win32_error (errsv),
+                   "Could not create file for named pipe '%s': %s",
+                   pipe_name, err);
+      g_free (err);
+
+      return INVALID_HANDLE_VALUE;
+    }
+
+  if (priv->message_mode)
+    {
+      DWORD mode = PIPE_READMODE_MESSAGE;
+
+      if (!SetNamedPipeHandleState (handle, &mode, NULL, NULL))
+        {
+          int errsv;
+          gchar *err;
+
+          errsv = GetLastError ();
+          err = g_win32_error_message (errsv);
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_win32_error (errsv),
+                       "Could not set message mode on named pipe '%s': %s",
+                       pipe_name, err);
+          g_free (err);
+
+          CloseHandle (handle);
+
+          return INVALID_HANDLE_VALUE;
+        }
+    }
+
+  return handle;
+}
+
+static WingNamedPipeConnection *
+create_connection (WingNamedPipeClient *client,
+                   const gchar         *pipe_name,
+                   HANDLE               handle)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  return g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
+                       "pipe-name", pipe_name,
+                       "handle", handle,
+                       "close-handle", TRUE,
+                       "use-iocp", priv->use_iocp,
+                       "thread-pool", priv->thread_pool,
+                       "io-priority", priv->io_priority,
+                       NULL);
+}
+
 /**
  * wing_named_pipe_client_connect:
  * @client: a #WingNamedPipeClient.
@@ -193,7 +386,6 @@ wing_named_pipe_client_connect (WingNamedPipeClient     *client,
   HANDLE handle = INVALID_HANDLE_VALUE;
   WingNamedPipeConnection *connection = NULL;
   gunichar2 *pipe_namew;
-  DWORD pipe_flags = 0;
 
   g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT (client), NULL);
   g_return_val_if_fail (pipe_name != NULL, NULL);
@@ -208,41 +400,15 @@ wing_named_pipe_client_connect (WingNamedPipeClient     *client,
 
   while (TRUE)
     {
+      gboolean busy;
+
       if (g_cancellable_set_error_if_cancelled (cancellable, error))
         break;
 
-      if (flags & WING_NAMED_PIPE_CLIENT_GENERIC_READ)
-        pipe_flags |= GENERIC_READ;
-
-      if (flags & WING_NAMED_PIPE_CLIENT_GENERIC_WRITE)
-        pipe_flags |= GENERIC_WRITE;
-
-      handle = CreateFileW (pipe_namew,
-                            pipe_flags,
-                            FILE_SHARE_READ | FILE_SHARE_WRITE,
-                            NULL,
-                            OPEN_EXISTING,
-                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-                            NULL);
-
-      if (handle != INVALID_HANDLE_VALUE)
+      handle = open_pipe (client, pipe_name, pipe_namew, flags, &busy, error);
+      if (handle != INVALID_HANDLE_VALUE || !busy)
         break;
 
-      if (GetLastError () != ERROR_PIPE_BUSY)
-        {
-          int errsv;
-          gchar *err;
-
-          errsv = GetLastError ();
-          err = g_win32_error_message (errsv);
-          g_set_error (error, G_IO_ERROR,
-                       g_io_error_from_win32_error (errsv),
-                       "Could not create file for named pipe '%s': %s",
-                       pipe_name, err);
-          g_free (err);
-          break;
-        }
-
       if (!WaitNamedPipeW (pipe_namew, priv->timeout))
         {
           int errsv;
@@ -262,60 +428,134 @@ wing_named_pipe_client_connect (WingNamedPipeClient     *client,
   g_free (pipe_namew);
 
   if (handle != INVALID_HANDLE_VALUE)
-    connection = g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
-                               "pipe-name", pipe_name,
-                               "handle", handle,
-                               "close-handle", TRUE,
-                               "use-iocp", priv->use_iocp,
-                               NULL);
+    connection = create_connection (client, pipe_name, handle);
 
   return connection;
 }
 
+/* Bounds of the delay between two attempts to open a busy pipe */
+#define MIN_RETRY_DELAY_MS 2
+#define MAX_RETRY_DELAY_MS 500
+
+/* The timeout used by WaitNamedPipe for NMPWAIT_USE_DEFAULT_WAIT */
+#define DEFAULT_WAIT_MS 50
+
 typedef struct
 {
   gchar                      *pipe_name;
+  gunichar2                  *pipe_namew;
   WingNamedPipeClientFlags    flags;
+  gint64                      deadline;
+  guint                       retry_delay;
 } PipeAsyncTaskData;
 
-static PipeAsyncTaskData*
-create_pipe_async_task_data(const gchar                 *pipe_name,
-                            WingNamedPipeClientFlags     flags)
+static PipeAsyncTaskData *
+create_pipe_async_task_data (WingNamedPipeClient      *client,
+                             const gchar              *pipe_name,
+                             WingNamedPipeClientFlags  flags)
 {
-  PipeAsyncTaskData *task_data = g_new0(PipeAsyncTaskData, 1);
-  task_data->pipe_name = g_strdup(pipe_name);
+  WingNamedPipeClientPrivate *priv;
+  PipeAsyncTaskData *task_data;
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  task_data = g_new0 (PipeAsyncTaskData, 1);
+  task_data->pipe_name = g_strdup (pipe_name);
+  task_data->pipe_namew = g_utf8_to_utf16 (pipe_name, -1, NULL, NULL, NULL);
   task_data->flags = flags;
+  task_data->retry_delay = MIN_RETRY_DELAY_MS;
+
+  if (priv->timeout == NMPWAIT_WAIT_FOREVER)
+    task_data->deadline = -1;
+  else if (priv->timeout == NMPWAIT_USE_DEFAULT_WAIT)
+    task_data->deadline = g_get_monotonic_time () + DEFAULT_WAIT_MS * G_TIME_SPAN_MILLISECOND;
+  else
+    task_data->deadline = g_get_monotonic_time () + priv->timeout * G_TIME_SPAN_MILLISECOND;
+
   return task_data;
 }
 
 static void
-free_pipe_async_task_data(PipeAsyncTaskData *task_data)
+free_pipe_async_task_data (PipeAsyncTaskData *task_data)
 {
-  g_free(task_data->pipe_name);
-  g_free(task_data);
+  g_free (task_data->pipe_name);
+  g_free (task_data->pipe_namew);
+  g_free (task_data);
+}
+
+static void client_connect_attempt (GTask *task);
+
+static gboolean
+client_connect_retry (gpointer user_data)
+{
+  GTask *task = user_data;
+
+  if (!g_task_return_error_if_cancelled (task))
+    client_connect_attempt (task);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
-client_connect_thread (GTask        *task,
-                       gpointer      source_object,
-                       gpointer      task_data,
-                       GCancellable *cancellable)
+client_connect_attempt (GTask *task)
 {
-  WingNamedPipeClient *client = WING_NAMED_PIPE_CLIENT (source_object);
-  PipeAsyncTaskData *data = (PipeAsyncTaskData*)task_data;
-  WingNamedPipeConnection *connection;
+  WingNamedPipeClient *client = g_task_get_source_object (task);
+  PipeAsyncTaskData *data = g_task_get_task_data (task);
+  GSource *source;
+  HANDLE handle;
+  gboolean busy;
+  guint delay;
   GError *error = NULL;
 
-  connection = wing_named_pipe_client_connect (client, (const gchar *)data->pipe_name,
-                                               data->flags,
-                                               cancellable, &error);
+  handle = open_pipe (client, data->pipe_name, data->pipe_namew, data->flags, &busy, &error);
+  if (handle != INVALID_HANDLE_VALUE)
+    {
+      g_task_return_pointer (task, create_connection (client, data->pipe_name, handle),
+                             (GDestroyNotify)g_object_unref);
+      return;
+    }
 
-  if (connection == NULL)
-    g_task_return_error (task, error);
-  else
-    g_task_return_pointer (task, connection, (GDestroyNotify)g_object_unref);
+  if (!busy)
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  /* Wait half the delay plus a random part of the other half, so that
+   * the clients waiting for the same pipe do not retry all together */
+  delay = data->retry_delay / 2 + g_random_int_range (0, data->retry_delay / 2 + 1);
+  data->retry_delay = MIN (data->retry_delay * 2, MAX_RETRY_DELAY_MS);
+
+  if (data->deadline >= 0)
+    {
+      gint64 remaining;
+
+      remaining = (data->deadline - g_get_monotonic_time ()) / G_TIME_SPAN_MILLISECOND;
+      if (remaining <= 0)
+        {
+          g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                   "Failed to wait for named pipe '%s': the timeout expired",
+                                   data->pipe_name);
+          return;
+        }
 
-  g_object_unref(task);
+      delay = MIN (delay, (guint) remaining);
+    }
+
+  source = g_timeout_source_new (delay);
+
+  if (g_task_get_cancellable (task) != NULL)
+    {
+      GSource *cancellable_source;
+
+      cancellable_source = g_cancellable_source_new (g_task_get_cancellable (task));
+      g_source_set_dummy_callback (cancellable_source);
+      g_source_add_child_source (source, cancellable_source);
+      g_source_unref (cancellable_source);
+    }
+
+  g_task_attach_source (task, source, client_connect_retry);
+  g_source_unref (source);
 }
 
 /**
@@ -328,6 +568,11 @@ client_connect_thread (GTask        *task,
  *
  * This is the asynchronous version of wing_named_pipe_client_connect().
  *
+ * No thread is blocked while the pipe is busy: the connection is retried
+ * from the thread-default main context with an exponential backoff,
+ * randomized to spread the retries of many clients, until the pipe is
+ * available or the timeout of @client expires.
+ *
  * When the operation is finished @callback will be
  * called. You can then call wing_named_pipe_client_connect_finish() to get
  * the result of the operation.
@@ -346,10 +591,13 @@ wing_named_pipe_client_connect_async (WingNamedPipeClient       *client,
   g_return_if_fail (pipe_name != NULL);
 
   task = g_task_new (client, cancellable, callback, user_data);
-  g_task_set_task_data (task, create_pipe_async_task_data(pipe_name, flags),
+  g_task_set_task_data (task, create_pipe_async_task_data (client, pipe_name, flags),
                         (GDestroyNotify)free_pipe_async_task_data);
 
-  g_task_run_in_thread (task, client_connect_thread);
+  if (!g_task_return_error_if_cancelled (task))
+    client_connect_attempt (task);
+
+  g_object_unref (task);
 }
 
 /**
@@ -390,3 +638,151 @@ wing_named_pipe_client_set_use_iocp (WingNamedPipeClient *client,
       g_object_notify_by_pspec (G_OBJECT (client), props[PROP_USE_IOCP]);
     }
 }
+
+/**
+ * wing_named_pipe_client_set_message_mode:
+ * @client: a #WingNamedPipeClient
+ * @message_mode: whether to read from the pipe in message mode
+ *
+ * Sets whether the connections read from the pipe in message mode.
+ * The named pipe must have been created in message mode, see
+ * wing_named_pipe_listener_set_message_mode().
+ */
+void
+wing_named_pipe_client_set_message_mode (WingNamedPipeClient *client,
+                                         gboolean             message_mode)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT (client));
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  message_mode = !!message_mode;
+
+  if (priv->message_mode != message_mode)
+    {
+      priv->message_mode = message_mode;
+      g_object_notify_by_pspec (G_OBJECT (client), props[PROP_MESSAGE_MODE]);
+    }
+}
+
+/**
+ * wing_named_pipe_client_get_message_mode:
+ * @client: a #WingNamedPipeClient
+ *
+ * Gets whether the connections read from the pipe in message mode.
+ *
+ * Returns: %TRUE if the connections read in message mode
+ */
+gboolean
+wing_named_pipe_client_get_message_mode (WingNamedPipeClient *client)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT (client), FALSE);
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  return priv->message_mode;
+}
+
+/**
+ * wing_named_pipe_client_set_thread_pool:
+ * @client: a #WingNamedPipeClient
+ * @thread_pool: (nullable): a #WingThreadPool, or %NULL
+ *
+ * Sets the thread pool to run the completions of the async I/O of the
+ * connections on, when using I/O completion port. %NULL goes back to
+ * the default thread pool of the process. It applies to the connections
+ * created afterwards.
+ */
+void
+wing_named_pipe_client_set_thread_pool (WingNamedPipeClient *client,
+                                        WingThreadPool      *thread_pool)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT (client));
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  if (priv->thread_pool == thread_pool)
+    return;
+
+  g_clear_pointer (&priv->thread_pool, wing_thread_pool_unref);
+  if (thread_pool != NULL)
+    priv->thread_pool = wing_thread_pool_ref (thread_pool);
+
+  g_object_notify_by_pspec (G_OBJECT (client), props[PROP_THREAD_POOL]);
+}
+
+/**
+ * wing_named_pipe_client_get_thread_pool:
+ * @client: a #WingNamedPipeClient
+ *
+ * Gets the thread pool the connections run the completions of their
+ * async I/O on.
+ *
+ * Returns: (transfer none) (nullable): the #WingThreadPool, or %NULL
+ * for the default thread pool of the process
+ */
+WingThreadPool *
+wing_named_pipe_client_get_thread_pool (WingNamedPipeClient *client)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT (client), NULL);
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  return priv->thread_pool;
+}
+
+/**
+ * wing_named_pipe_client_set_io_priority:
+ * @client: a #WingNamedPipeClient
+ * @io_priority: the I/O priority of the completions
+ *
+ * Sets the I/O priority the completions of the async I/O of the
+ * connections run with on the thread pool, when using I/O completion
+ * port, see wing_thread_pool_io_new_full(). It applies to the
+ * connections created afterwards.
+ */
+void
+wing_named_pipe_client_set_io_priority (WingNamedPipeClient *client,
+                                        int                  io_priority)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT (client));
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  if (priv->io_priority != io_priority)
+    {
+      priv->io_priority = io_priority;
+      g_object_notify_by_pspec (G_OBJECT (client), props[PROP_IO_PRIORITY]);
+    }
+}
+
+/**
+ * wing_named_pipe_client_get_io_priority:
+ * @client: a #WingNamedPipeClient
+ *
+ * Gets the I/O priority the completions of the async I/O of the
+ * connections run with.
+ *
+ * Returns: the I/O priority
+ */
+int
+wing_named_pipe_client_get_io_priority (WingNamedPipeClient *client)
+{
+  WingNamedPipeClientPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT (client), G_PRIORITY_DEFAULT);
+
+  priv = wing_named_pipe_client_get_instance_private (client);
+
+  return priv->io_priority;
+}
@@ -20,6 +20,7 @@
 
 #include <gio/gio.h>
 #include <wing/wingnamedpipeconnection.h>
+#include <wing/wingthreadpool.h>
 #include <wing/wingversionmacros.h>
 
 G_BEGIN_DECLS
@@ -84,6 +85,27 @@ WING_AVAILABLE_IN_ALL
 void                      wing_named_pipe_client_set_use_iocp     (WingNamedPipeClient      *client,
                                                                    gboolean                  use_iocp);
 
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_set_message_mode (WingNamedPipeClient      *client,
+                                                                   gboolean                  message_mode);
+
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_client_get_message_mode (WingNamedPipeClient      *client);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_set_thread_pool  (WingNamedPipeClient      *client,
+                                                                   WingThreadPool           *thread_pool);
+
+WING_AVAILABLE_IN_ALL
+WingThreadPool           *wing_named_pipe_client_get_thread_pool  (WingNamedPipeClient      *client);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_set_io_priority  (WingNamedPipeClient      *client,
+                                                                   int                       io_priority);
+
+WING_AVAILABLE_IN_ALL
+int                       wing_named_pipe_client_get_io_priority  (WingNamedPipeClient      *client);
+
 G_END_DECLS
 
 #endif /* WING_NAMED_PIPE_CLIENT_H */
@@ -0,0 +1,1132 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingnamedpipeclientpool.h"
+
+#include <windows.h>
+
+/**
+ * SECTION:wingnamedpipeclientpool
+ * @short_description: Reuses the connections to named pipes
+ * @include: gio/gio.h
+ * @see_also: #WingNamedPipeClient
+ *
+ * #WingNamedPipeClientPool keeps the connections made by a
+ * #WingNamedPipeClient once they are no longer used, and hands them out
+ * again for the same pipe name, so that the requests do not pay for
+ * opening the pipe and creating the connection each time.
+ *
+ * A connection is taken with wing_named_pipe_client_pool_get() and
+ * given back with wing_named_pipe_client_pool_release() once the
+ * exchange with the server is over. Dropping the connection instead
+ * closes it as usual.
+ *
+ * The idle connections are checked before being handed out: the ones
+ * closed by the server, or with unread data waiting, are discarded.
+ * The ones idle for longer than #WingNamedPipeClientPool:idle-timeout
+ * are not closed by a timer: they are closed the next time a connection
+ * to their pipe is taken from or released to the pool.
+ *
+ * #WingNamedPipeClientPool can be used from several threads.
+ */
+
+#define DEFAULT_MAX_IDLE 4
+#define DEFAULT_IDLE_TIMEOUT 60
+
+struct _WingNamedPipeClientPool
+{
+  GObject parent_instance;
+
+  WingNamedPipeClient *client;
+  guint max_idle;
+  guint max_connections;
+  guint idle_timeout;
+
+  GMutex mutex;
+  GHashTable *buckets;
+  GHashTable *connections;
+};
+
+typedef struct
+{
+  gchar *pipe_name;
+
+  /* PooledConnection, the most recently released first */
+  GQueue idle;
+
+  /* The connections alive or being opened */
+  guint n_connections;
+
+  /* The async requests waiting for a connection, see max-connections */
+  GQueue waiters;
+} PoolBucket;
+
+typedef struct
+{
+  WingNamedPipeConnection *connection;
+  PoolBucket *bucket;
+  WingNamedPipeClientFlags flags;
+
+  /* The pool holds a reference on the idle connections */
+  gboolean idle;
+  gint64 idle_since;
+} PooledConnection;
+
+typedef struct
+{
+  gchar *pipe_name;
+  WingNamedPipeClientFlags flags;
+  GSource *cancellable_source;
+} GetData;
+
+enum
+{
+  PROP_0,
+  PROP_CLIENT,
+  PROP_MAX_IDLE,
+  PROP_MAX_CONNECTIONS,
+  PROP_IDLE_TIMEOUT,
+  LAST_PROP
+};
+
+static GParamSpec *props[LAST_PROP];
+
+G_DEFINE_TYPE (WingNamedPipeClientPool, wing_named_pipe_client_pool, G_TYPE_OBJECT)
+
+static void
+pool_bucket_free (PoolBucket *bucket)
+{
+  g_free (bucket->pipe_name);
+  g_queue_clear (&bucket->idle);
+  g_queue_clear (&bucket->waiters);
+  g_slice_free (PoolBucket, bucket);
+}
+
+static void
+get_data_free (GetData *data)
+{
+  g_free (data->pipe_name);
+  g_clear_pointer (&data->cancellable_source, g_source_unref);
+  g_slice_free (GetData, data);
+}
+
+static void connection_finalized (gpointer  user_data,
+                                  GObject  *where_the_object_was);
+
+static void
+wing_named_pipe_client_pool_finalize (GObject *object)
+{
+  WingNamedPipeClientPool *pool = WING_NAMED_PIPE_CLIENT_POOL (object);
+  GHashTableIter iter;
+  PooledConnection *pooled;
+
+  /* The connections in use outlive the pool */
+  g_hash_table_iter_init (&iter, pool->connections);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &pooled))
+    {
+      g_object_weak_unref (G_OBJECT (pooled->connection), connection_finalized, pool);
+
+      if (pooled->idle)
+        g_object_unref (pooled->connection);
+
+      g_slice_free (PooledConnection, pooled);
+    }
+
+  g_hash_table_unref (pool->connections);
+  g_hash_table_unref (pool->buckets);
+  g_mutex_clear (&pool->mutex);
+
+  g_clear_object (&pool->client);
+
+  G_OBJECT_CLASS (wing_named_pipe_client_pool_parent_class)->finalize (object);
+}
+
+static void
+wing_named_pipe_client_pool_get_property (GObject    *object,
+                                          guint       prop_id,
+                                          GValue     *value,
+                                          GParamSpec *pspec)
+{
+  WingNamedPipeClientPool *pool = WING_NAMED_PIPE_CLIENT_POOL (object);
+
+  switch (prop_id)
+    {
+    case PROP_CLIENT:
+      g_value_set_object (value, pool->client);
+      break;
+
+    case PROP_MAX_IDLE:
+      g_value_set_uint (value, pool->max_idle);
+      break;
+
+    case PROP_MAX_CONNECTIONS:
+      g_value_set_uint (value, pool->max_connections);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      g_value_set_uint (value, pool->idle_timeout);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+wing_named_pipe_client_pool_set_property (GObject      *object,
+                                          guint         prop_id,
+                                          const GValue *value,
+                                          GParamSpec   *pspec)
+{
+  WingNamedPipeClientPool *pool = WING_NAMED_PIPE_CLIENT_POOL (object);
+
+  switch (prop_id)
+    {
+    case PROP_CLIENT:
+      pool->client = g_value_dup_object (value);
+      break;
+
+    case PROP_MAX_IDLE:
+      wing_named_pipe_client_pool_set_max_idle (pool, g_value_get_uint (value));
+      break;
+
+    case PROP_MAX_CONNECTIONS:
+      wing_named_pipe_client_pool_set_max_connections (pool, g_value_get_uint (value));
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      wing_named_pipe_client_pool_set_idle_timeout (pool, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+wing_named_pipe_client_pool_constructed (GObject *object)
+{
+  WingNamedPipeClientPool *pool = WING_NAMED_PIPE_CLIENT_POOL (object);
+
+  if (pool->client == NULL)
+    pool->client = wing_named_pipe_client_new ();
+
+  G_OBJECT_CLASS (wing_named_pipe_client_pool_parent_class)->constructed (object);
+}
+
+static void
+wing_named_pipe_client_pool_class_init (WingNamedPipeClientPoolClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = wing_named_pipe_client_pool_finalize;
+  object_class->get_property = wing_named_pipe_client_pool_get_property;
+  object_class->set_property = wing_named_pipe_client_pool_set_property;
+  object_class->constructed = wing_named_pipe_client_pool_constructed;
+
+  /**
+   * WingNamedPipeClientPool:client:
+   *
+   * The #WingNamedPipeClient used to open the connections.
+   */
+  props[PROP_CLIENT] =
+    g_param_spec_object ("client",
+                         "Client",
+                         "The client used to open the connections",
+                         WING_TYPE_NAMED_PIPE_CLIENT,
+                         G_PARAM_READWRITE |
+                         G_PARAM_CONSTRUCT_ONLY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeClientPool:max-idle:
+   *
+   * The maximum number of idle connections kept for each pipe name.
+   */
+  props[PROP_MAX_IDLE] =
+    g_param_spec_uint ("max-idle",
+                       "Max idle",
+                       "The maximum number of idle connections for each pipe name",
+                       0,
+                       G_MAXUINT,
+                       DEFAULT_MAX_IDLE,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeClientPool:max-connections:
+   *
+   * The maximum number of connections, idle or in use, for each pipe
+   * name, or 0 for no limit. Once it is reached, the async requests
+   * wait for a connection to be released or closed, and the sync ones
+   * fail with %G_IO_ERROR_BUSY.
+   */
+  props[PROP_MAX_CONNECTIONS] =
+    g_param_spec_uint ("max-connections",
+                       "Max connections",
+                       "The maximum number of connections for each pipe name",
+                       0,
+                       G_MAXUINT,
+                       0,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeClientPool:idle-timeout:
+   *
+   * The time in seconds after which an idle connection is closed,
+   * or 0 to keep the idle connections until they are used. The
+   * connections are closed on the next get or release for their pipe.
+   */
+  props[PROP_IDLE_TIMEOUT] =
+    g_param_spec_uint ("idle-timeout",
+                       "Idle timeout",
+                       "The time in seconds after which an idle connection is closed",
+                       0,
+                       G_MAXUINT,
+                       DEFAULT_IDLE_TIMEOUT,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, LAST_PROP, props);
+}
+
+static void
+wing_named_pipe_client_pool_init (WingNamedPipeClientPool *pool)
+{
+  g_mutex_init (&pool->mutex);
+  pool->buckets = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         NULL, (GDestroyNotify) pool_bucket_free);
+  pool->connections = g_hash_table_new (NULL, NULL);
+}
+
+/**
+ * wing_named_pipe_client_pool_new:
+ * @client: (allow-none): the #WingNamedPipeClient opening the connections,
+ *     or %NULL to use a default one
+ *
+ * Creates a new #WingNamedPipeClientPool.
+ *
+ * Returns: a #WingNamedPipeClientPool.
+ *     Free the returned object with g_object_unref().
+ */
+WingNamedPipeClientPool *
+wing_named_pipe_client_pool_new (WingNamedPipeClient *client)
+{
+  g_return_val_if_fail (client == NULL || WING_IS_NAMED_PIPE_CLIENT (client), NULL);
+
+  return g_object_new (WING_TYPE_NAMED_PIPE_CLIENT_POOL,
+                       "client", client,
+                       NULL);
+}
+
+/* Must be called with the pool lock held */
+static PoolBucket *
+get_bucket (WingNamedPipeClientPool *pool,
+            const gchar             *pipe_name)
+{
+  PoolBucket *bucket;
+
+  bucket = g_hash_table_lookup (pool->buckets, pipe_name);
+  if (bucket == NULL)
+    {
+      bucket = g_slice_new0 (PoolBucket);
+      bucket->pipe_name = g_strdup (pipe_name);
+      g_queue_init (&bucket->idle);
+      g_queue_init (&bucket->waiters);
+
+      g_hash_table_insert (pool->buckets, bucket->pipe_name, bucket);
+    }
+
+  return bucket;
+}
+
+static gboolean
+connection_is_healthy (WingNamedPipeConnection *connection)
+{
+  HANDLE handle;
+  DWORD available;
+
+  if (g_io_stream_is_closed (G_IO_STREAM (connection)) ||
+      g_io_stream_has_pending (G_IO_STREAM (connection)))
+    return FALSE;
+
+  g_object_get (connection, "handle", &handle, NULL);
+
+  /* Fails once the server closed its end. The data left unread
+   * would be received by the next user of the connection */
+  return PeekNamedPipe (handle, NULL, 0, NULL, &available, NULL) && available == 0;
+}
+
+/* Must be called with the pool lock held. The connections are added to
+ * @dropped, to be unreferenced once the lock is released */
+static void
+drop_idle (PooledConnection  *pooled,
+           GSList           **dropped)
+{
+  g_queue_remove (&pooled->bucket->idle, pooled);
+  pooled->idle = FALSE;
+
+  *dropped = g_slist_prepend (*dropped, pooled->connection);
+}
+
+/* Must be called with the pool lock held */
+static void
+reap_bucket (WingNamedPipeClientPool  *pool,
+             PoolBucket               *bucket,
+             GSList                  **dropped)
+{
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  /* The oldest idle connections are at the tail */
+  while (pool->idle_timeout != 0 && !g_queue_is_empty (&bucket->idle))
+    {
+      PooledConnection *pooled = g_queue_peek_tail (&bucket->idle);
+
+      if (now - pooled->idle_since < pool->idle_timeout * G_TIME_SPAN_SECOND)
+        break;
+
+      drop_idle (pooled, dropped);
+    }
+
+  /* Applies a lower max-idle as well */
+  while (g_queue_get_length (&bucket->idle) > pool->max_idle)
+    drop_idle (g_queue_peek_tail (&bucket->idle), dropped);
+}
+
+/* Must be called with the pool lock held */
+static WingNamedPipeConnection *
+take_idle (WingNamedPipeClientPool   *pool,
+           PoolBucket                *bucket,
+           WingNamedPipeClientFlags   flags,
+           GSList                   **dropped)
+{
+  GList *l, *next;
+
+  reap_bucket (pool, bucket, dropped);
+
+  for (l = bucket->idle.head; l != NULL; l = next)
+    {
+      PooledConnection *pooled = l->data;
+
+      next = l->next;
+
+      if (pooled->flags != flags)
+        continue;
+
+      if (!connection_is_healthy (pooled->connection))
+        {
+          drop_idle (pooled, dropped);
+          continue;
+        }
+
+      g_queue_delete_link (&bucket->idle, l);
+      pooled->idle = FALSE;
+
+      /* The reference of the pool goes to the caller */
+      return pooled->connection;
+    }
+
+  return NULL;
+}
+
+/* Must be called with the pool lock held */
+static gboolean
+reserve_connection (WingNamedPipeClientPool *pool,
+                    PoolBucket              *bucket)
+{
+  if (pool->max_connections != 0 &&
+      bucket->n_connections >= pool->max_connections)
+    return FALSE;
+
+  bucket->n_connections++;
+
+  return TRUE;
+}
+
+/* Must be called with the pool lock held. Returns the waiter the slot
+ * is given to, which has to be started once the lock is released */
+static GTask *
+release_reservation (WingNamedPipeClientPool *pool,
+                     PoolBucket              *bucket)
+{
+  GTask *task;
+
+  bucket->n_connections--;
+
+  task = g_queue_pop_head (&bucket->waiters);
+  if (task != NULL)
+    {
+      GetData *data = g_task_get_task_data (task);
+
+      g_source_destroy (data->cancellable_source);
+      bucket->n_connections++;
+    }
+
+  return task;
+}
+
+/* Must be called with the pool lock held */
+static PooledConnection *
+add_connection (WingNamedPipeClientPool  *pool,
+                PoolBucket               *bucket,
+                WingNamedPipeConnection  *connection,
+                WingNamedPipeClientFlags  flags)
+{
+  PooledConnection *pooled;
+
+  pooled = g_slice_new0 (PooledConnection);
+  pooled->connection = connection;
+  pooled->bucket = bucket;
+  pooled->flags = flags;
+
+  g_hash_table_insert (pool->connections, connection, pooled);
+  g_object_weak_ref (G_OBJECT (connection), connection_finalized, pool);
+
+  return pooled;
+}
+
+static void
+drop_connections (GSList *dropped)
+{
+  g_slist_free_full (dropped, g_object_unref);
+}
+
+static void start_waiter (WingNamedPipeClientPool *pool,
+                          GTask                   *task);
+
+static void
+connection_finalized (gpointer  user_data,
+                      GObject  *where_the_object_was)
+{
+  WingNamedPipeClientPool *pool = user_data;
+  PooledConnection *pooled;
+  GTask *waiter;
+
+  g_mutex_lock (&pool->mutex);
+
+  pooled = g_hash_table_lookup (pool->connections, where_the_object_was);
+  g_hash_table_remove (pool->connections, where_the_object_was);
+
+  waiter = release_reservation (pool, pooled->bucket);
+
+  g_mutex_unlock (&pool->mutex);
+
+  g_slice_free (PooledConnection, pooled);
+
+  if (waiter != NULL)
+    start_waiter (pool, waiter);
+}
+
+static void
+pool_connected_cb (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GTask *task = user_data;
+  WingNamedPipeClientPool *pool = g_task_get_source_object (task);
+  GetData *data = g_task_get_task_data (task);
+  WingNamedPipeConnection *connection;
+  PoolBucket *bucket;
+  GTask *waiter = NULL;
+  GError *error = NULL;
+
+  connection = wing_named_pipe_client_connect_finish (WING_NAMED_PIPE_CLIENT (source),
+                                                      result, &error);
+
+  g_mutex_lock (&pool->mutex);
+
+  bucket = get_bucket (pool, data->pipe_name);
+  if (connection != NULL)
+    add_connection (pool, bucket, connection, data->flags);
+  else
+    waiter = release_reservation (pool, bucket);
+
+  g_mutex_unlock (&pool->mutex);
+
+  if (connection != NULL)
+    g_task_return_pointer (task, connection, g_object_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+
+  if (waiter != NULL)
+    start_waiter (pool, waiter);
+}
+
+static gboolean
+waiter_connect (gpointer user_data)
+{
+  GTask *task = user_data;
+  WingNamedPipeClientPool *pool = g_task_get_source_object (task);
+  GetData *data = g_task_get_task_data (task);
+
+  wing_named_pipe_client_connect_async (pool->client,
+                                        data->pipe_name,
+                                        data->flags,
+                                        g_task_get_cancellable (task),
+                                        pool_connected_cb,
+                                        task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+start_waiter (WingNamedPipeClientPool *pool,
+              GTask                   *task)
+{
+  /* The connection is opened from the context of the request */
+  g_main_context_invoke (g_task_get_context (task), waiter_connect, task);
+}
+
+static gboolean
+waiter_cancelled (GCancellable *cancellable,
+                  gpointer      user_data)
+{
+  GTask *task = user_data;
+  WingNamedPipeClientPool *pool = g_task_get_source_object (task);
+  GetData *data = g_task_get_task_data (task);
+  gboolean removed;
+
+  g_mutex_lock (&pool->mutex);
+  removed = g_queue_remove (&get_bucket (pool, data->pipe_name)->waiters, task);
+  g_mutex_unlock (&pool->mutex);
+
+  if (removed)
+    {
+      g_task_return_error_if_cancelled (task);
+      g_object_unref (task);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * wing_named_pipe_client_pool_get:
+ * @pool: a #WingNamedPipeClientPool.
+ * @pipe_name: a pipe name.
+ * @flags: requested access to the pipe (read, write, both or none).
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @error: #GError for error reporting, or %NULL to ignore.
+ *
+ * Gets an idle connection to @pipe_name opened with the same @flags,
+ * or opens a new one with wing_named_pipe_client_connect() if there is
+ * none. Once #WingNamedPipeClientPool:max-connections is reached, fails
+ * with %G_IO_ERROR_BUSY.
+ *
+ * Give the connection back with wing_named_pipe_client_pool_release()
+ * to let it be reused.
+ *
+ * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
+ */
+WingNamedPipeConnection *
+wing_named_pipe_client_pool_get (WingNamedPipeClientPool  *pool,
+                                 const gchar              *pipe_name,
+                                 WingNamedPipeClientFlags  flags,
+                                 GCancellable             *cancellable,
+                                 GError                  **error)
+{
+  WingNamedPipeConnection *connection;
+  PoolBucket *bucket;
+  GSList *dropped = NULL;
+  gboolean reserved = FALSE;
+  GTask *waiter = NULL;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), NULL);
+  g_return_val_if_fail (pipe_name != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_mutex_lock (&pool->mutex);
+
+  bucket = get_bucket (pool, pipe_name);
+  connection = take_idle (pool, bucket, flags, &dropped);
+  if (connection == NULL)
+    reserved = reserve_connection (pool, bucket);
+
+  g_mutex_unlock (&pool->mutex);
+
+  drop_connections (dropped);
+
+  if (connection != NULL)
+    return connection;
+
+  if (!reserved)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                   "Too many connections to named pipe '%s'",
+                   pipe_name);
+      return NULL;
+    }
+
+  connection = wing_named_pipe_client_connect (pool->client, pipe_name, flags,
+                                               cancellable, error);
+
+  g_mutex_lock (&pool->mutex);
+
+  if (connection != NULL)
+    add_connection (pool, bucket, connection, flags);
+  else
+    waiter = release_reservation (pool, bucket);
+
+  g_mutex_unlock (&pool->mutex);
+
+  if (waiter != NULL)
+    start_waiter (pool, waiter);
+
+  return connection;
+}
+
+/**
+ * wing_named_pipe_client_pool_get_async:
+ * @pool: a #WingNamedPipeClientPool
+ * @pipe_name: a pipe name.
+ * @flags: requested access to the pipe (read, write, both or none).
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback
+ * @user_data: (closure): user data for the callback
+ *
+ * This is the asynchronous version of wing_named_pipe_client_pool_get().
+ * Once #WingNamedPipeClientPool:max-connections is reached, the request
+ * waits until a connection to @pipe_name is released or closed.
+ *
+ * When the operation is finished @callback will be called. You can then
+ * call wing_named_pipe_client_pool_get_finish() to get the result of the
+ * operation.
+ */
+void
+wing_named_pipe_client_pool_get_async (WingNamedPipeClientPool  *pool,
+                                       const gchar              *pipe_name,
+                                       WingNamedPipeClientFlags  flags,
+                                       GCancellable             *cancellable,
+                                       GAsyncReadyCallback       callback,
+                                       gpointer                  user_data)
+{
+  WingNamedPipeConnection *connection;
+  PoolBucket *bucket;
+  GetData *data;
+  GSList *dropped = NULL;
+  gboolean reserved = FALSE;
+  GTask *task;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+  g_return_if_fail (pipe_name != NULL);
+
+  task = g_task_new (pool, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_named_pipe_client_pool_get_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  data = g_slice_new0 (GetData);
+  data->pipe_name = g_strdup (pipe_name);
+  data->flags = flags;
+  g_task_set_task_data (task, data, (GDestroyNotify) get_data_free);
+
+  g_mutex_lock (&pool->mutex);
+
+  bucket = get_bucket (pool, pipe_name);
+  connection = take_idle (pool, bucket, flags, &dropped);
+  if (connection == NULL)
+    {
+      reserved = reserve_connection (pool, bucket);
+      if (!reserved)
+        {
+          /* The queue owns the reference on the task */
+          g_queue_push_tail (&bucket->waiters, task);
+
+          data->cancellable_source = g_cancellable_source_new (cancellable);
+          g_task_attach_source (task, data->cancellable_source, (GSourceFunc) waiter_cancelled);
+        }
+    }
+
+  g_mutex_unlock (&pool->mutex);
+
+  drop_connections (dropped);
+
+  if (connection != NULL)
+    {
+      g_task_return_pointer (task, connection, g_object_unref);
+      g_object_unref (task);
+    }
+  else if (reserved)
+    wing_named_pipe_client_connect_async (pool->client, pipe_name, flags,
+                                          cancellable, pool_connected_cb, task);
+}
+
+/**
+ * wing_named_pipe_client_pool_get_finish:
+ * @pool: a #WingNamedPipeClientPool.
+ * @result: a #GAsyncResult.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Finishes an async get operation. See wing_named_pipe_client_pool_get_async()
+ *
+ * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
+ */
+WingNamedPipeConnection *
+wing_named_pipe_client_pool_get_finish (WingNamedPipeClientPool  *pool,
+                                        GAsyncResult             *result,
+                                        GError                  **error)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, pool), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * wing_named_pipe_client_pool_release:
+ * @pool: a #WingNamedPipeClientPool.
+ * @connection: (transfer full): a #WingNamedPipeConnection got from @pool.
+ *
+ * Gives back a connection once the exchange with the server is over,
+ * taking the reference of the caller. The connection is handed to a
+ * waiting request with the same flags, or kept idle if it is still usable
+ * and no request waits for a connection to the same pipe. Otherwise it is
+ * closed, which lets a request waiting for other flags open its own. The
+ * idle connections to the same pipe which timed out, or are in excess of
+ * #WingNamedPipeClientPool:max-idle, are closed as well.
+ */
+void
+wing_named_pipe_client_pool_release (WingNamedPipeClientPool *pool,
+                                     WingNamedPipeConnection *connection)
+{
+  PooledConnection *pooled;
+  PoolBucket *bucket;
+  GTask *waiter = NULL;
+  GSList *dropped = NULL;
+  GList *l;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+  g_return_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection));
+
+  g_mutex_lock (&pool->mutex);
+
+  pooled = g_hash_table_lookup (pool->connections, connection);
+  if (pooled == NULL || pooled->idle)
+    {
+      g_mutex_unlock (&pool->mutex);
+      g_critical ("%s: the connection does not belong to the pool or is already released", G_STRFUNC);
+      return;
+    }
+
+  if (!connection_is_healthy (connection))
+    {
+      g_mutex_unlock (&pool->mutex);
+      g_object_unref (connection);
+      return;
+    }
+
+  bucket = pooled->bucket;
+  reap_bucket (pool, bucket, &dropped);
+
+  for (l = bucket->waiters.head; l != NULL; l = l->next)
+    {
+      GetData *data = g_task_get_task_data (l->data);
+
+      if (data->flags == pooled->flags)
+        {
+          waiter = l->data;
+          g_queue_delete_link (&bucket->waiters, l);
+          g_source_destroy (data->cancellable_source);
+          break;
+        }
+    }
+
+  /* A request waiting for other flags would otherwise wait until
+   * another connection is closed: the connection is closed instead of
+   * being kept idle, and its slot goes to the first waiter */
+  if (waiter == NULL && g_queue_is_empty (&bucket->waiters) &&
+      g_queue_get_length (&bucket->idle) < pool->max_idle)
+    {
+      pooled->idle = TRUE;
+      pooled->idle_since = g_get_monotonic_time ();
+      g_queue_push_head (&bucket->idle, pooled);
+      connection = NULL;
+    }
+
+  g_mutex_unlock (&pool->mutex);
+
+  drop_connections (dropped);
+
+  if (waiter != NULL)
+    {
+      g_task_return_pointer (waiter, connection, g_object_unref);
+      g_object_unref (waiter);
+    }
+  else if (connection != NULL)
+    g_object_unref (connection);
+}
+
+/**
+ * wing_named_pipe_client_pool_prewarm:
+ * @pool: a #WingNamedPipeClientPool.
+ * @pipe_name: a pipe name.
+ * @flags: requested access to the pipe (read, write, both or none).
+ * @n_connections: the number of idle connections wanted
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @error: #GError for error reporting, or %NULL to ignore.
+ *
+ * Opens connections to @pipe_name until @n_connections are idle,
+ * within the limits of #WingNamedPipeClientPool:max-idle and
+ * #WingNamedPipeClientPool:max-connections, so that the first requests
+ * do not have to open them.
+ *
+ * Returns: %TRUE on success, %FALSE if a connection could not be opened.
+ */
+gboolean
+wing_named_pipe_client_pool_prewarm (WingNamedPipeClientPool  *pool,
+                                     const gchar              *pipe_name,
+                                     WingNamedPipeClientFlags  flags,
+                                     guint                     n_connections,
+                                     GCancellable             *cancellable,
+                                     GError                  **error)
+{
+  PoolBucket *bucket;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), FALSE);
+  g_return_val_if_fail (pipe_name != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  while (TRUE)
+    {
+      WingNamedPipeConnection *connection;
+      PooledConnection *pooled;
+      GTask *waiter = NULL;
+      guint n_idle;
+
+      g_mutex_lock (&pool->mutex);
+
+      bucket = get_bucket (pool, pipe_name);
+      n_idle = g_queue_get_length (&bucket->idle);
+      if (n_idle >= MIN (n_connections, pool->max_idle) ||
+          !reserve_connection (pool, bucket))
+        {
+          g_mutex_unlock (&pool->mutex);
+          break;
+        }
+
+      g_mutex_unlock (&pool->mutex);
+
+      connection = wing_named_pipe_client_connect (pool->client, pipe_name, flags,
+                                                   cancellable, error);
+
+      g_mutex_lock (&pool->mutex);
+
+      if (connection != NULL)
+        {
+          pooled = add_connection (pool, bucket, connection, flags);
+          pooled->idle = TRUE;
+          pooled->idle_since = g_get_monotonic_time ();
+          g_queue_push_head (&bucket->idle, pooled);
+        }
+      else
+        waiter = release_reservation (pool, bucket);
+
+      g_mutex_unlock (&pool->mutex);
+
+      if (waiter != NULL)
+        start_waiter (pool, waiter);
+
+      if (connection == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * wing_named_pipe_client_pool_clear:
+ * @pool: a #WingNamedPipeClientPool.
+ *
+ * Closes all the idle connections of @pool.
+ */
+void
+wing_named_pipe_client_pool_clear (WingNamedPipeClientPool *pool)
+{
+  GHashTableIter iter;
+  PoolBucket *bucket;
+  GSList *dropped = NULL;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+
+  g_mutex_lock (&pool->mutex);
+
+  g_hash_table_iter_init (&iter, pool->buckets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &bucket))
+    while (!g_queue_is_empty (&bucket->idle))
+      drop_idle (g_queue_peek_head (&bucket->idle), &dropped);
+
+  g_mutex_unlock (&pool->mutex);
+
+  drop_connections (dropped);
+}
+
+/**
+ * wing_named_pipe_client_pool_get_n_idle:
+ * @pool: a #WingNamedPipeClientPool.
+ * @pipe_name: a pipe name.
+ *
+ * Gets the number of idle connections to @pipe_name.
+ *
+ * Returns: the number of idle connections
+ */
+guint
+wing_named_pipe_client_pool_get_n_idle (WingNamedPipeClientPool *pool,
+                                        const gchar             *pipe_name)
+{
+  PoolBucket *bucket;
+  guint n_idle = 0;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), 0);
+  g_return_val_if_fail (pipe_name != NULL, 0);
+
+  g_mutex_lock (&pool->mutex);
+
+  bucket = g_hash_table_lookup (pool->buckets, pipe_name);
+  if (bucket != NULL)
+    n_idle = g_queue_get_length (&bucket->idle);
+
+  g_mutex_unlock (&pool->mutex);
+
+  return n_idle;
+}
+
+/**
+ * wing_named_pipe_client_pool_set_max_idle:
+ * @pool: a #WingNamedPipeClientPool.
+ * @max_idle: the maximum number of idle connections for each pipe name.
+ *
+ * Sets #WingNamedPipeClientPool:max-idle. The idle connections in
+ * excess are closed on the next get or release for their pipe.
+ */
+void
+wing_named_pipe_client_pool_set_max_idle (WingNamedPipeClientPool *pool,
+                                          guint                    max_idle)
+{
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+
+  if (pool->max_idle != max_idle)
+    {
+      pool->max_idle = max_idle;
+      g_object_notify_by_pspec (G_OBJECT (pool), props[PROP_MAX_IDLE]);
+    }
+}
+
+/**
+ * wing_named_pipe_client_pool_get_max_idle:
+ * @pool: a #WingNamedPipeClientPool.
+ *
+ * Gets #WingNamedPipeClientPool:max-idle.
+ *
+ * Returns: the maximum number of idle connections for each pipe name
+ */
+guint
+wing_named_pipe_client_pool_get_max_idle (WingNamedPipeClientPool *pool)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), 0);
+
+  return pool->max_idle;
+}
+
+/**
+ * wing_named_pipe_client_pool_set_max_connections:
+ * @pool: a #WingNamedPipeClientPool.
+ * @max_connections: the maximum number of connections for each pipe
+ *     name, or 0 for no limit.
+ *
+ * Sets #WingNamedPipeClientPool:max-connections. The connections
+ * already open are not closed when lowering it.
+ */
+void
+wing_named_pipe_client_pool_set_max_connections (WingNamedPipeClientPool *pool,
+                                                 guint                    max_connections)
+{
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+
+  if (pool->max_connections != max_connections)
+    {
+      pool->max_connections = max_connections;
+      g_object_notify_by_pspec (G_OBJECT (pool), props[PROP_MAX_CONNECTIONS]);
+    }
+}
+
+/**
+ * wing_named_pipe_client_pool_get_max_connections:
+ * @pool: a #WingNamedPipeClientPool.
+ *
+ * Gets #WingNamedPipeClientPool:max-connections.
+ *
+ * Returns: the maximum number of connections for each pipe name, or 0
+ *     for no limit
+ */
+guint
+wing_named_pipe_client_pool_get_max_connections (WingNamedPipeClientPool *pool)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), 0);
+
+  return pool->max_connections;
+}
+
+/**
+ * wing_named_pipe_client_pool_set_idle_timeout:
+ * @pool: a #WingNamedPipeClientPool.
+ * @idle_timeout: the time in seconds after which an idle connection is
+ *     closed, or 0 to keep them.
+ *
+ * Sets #WingNamedPipeClientPool:idle-timeout.
+ */
+void
+wing_named_pipe_client_pool_set_idle_timeout (WingNamedPipeClientPool *pool,
+                                              guint                    idle_timeout)
+{
+  g_return_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool));
+
+  if (pool->idle_timeout != idle_timeout)
+    {
+      pool->idle_timeout = idle_timeout;
+      g_object_notify_by_pspec (G_OBJECT (pool), props[PROP_IDLE_TIMEOUT]);
+    }
+}
+
+/**
+ * wing_named_pipe_client_pool_get_idle_timeout:
+ * @pool: a #WingNamedPipeClientPool.
+ *
+ * Gets #WingNamedPipeClientPool:idle-timeout.
+ *
+ * Returns: the idle timeout in seconds, or 0 if there is none
+ */
+guint
+wing_named_pipe_client_pool_get_idle_timeout (WingNamedPipeClientPool *pool)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CLIENT_POOL (pool), 0);
+
+  return pool->idle_timeout;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_NAMED_PIPE_CLIENT_POOL_H
+#define WING_NAMED_PIPE_CLIENT_POOL_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+#include <wing/wingnamedpipeclient.h>
+#include <wing/wingnamedpipeconnection.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_NAMED_PIPE_CLIENT_POOL (wing_named_pipe_client_pool_get_type ())
+
+WING_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (WingNamedPipeClientPool, wing_named_pipe_client_pool, WING, NAMED_PIPE_CLIENT_POOL, GObject)
+
+WING_AVAILABLE_IN_ALL
+WingNamedPipeClientPool  *wing_named_pipe_client_pool_new                 (WingNamedPipeClient      *client);
+
+WING_AVAILABLE_IN_ALL
+WingNamedPipeConnection  *wing_named_pipe_client_pool_get                 (WingNamedPipeClientPool  *pool,
+                                                                           const gchar              *pipe_name,
+                                                                           WingNamedPipeClientFlags  flags,
+                                                                           GCancellable             *cancellable,
+                                                                           GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_get_async           (WingNamedPipeClientPool  *pool,
+                                                                           const gchar              *pipe_name,
+                                                                           WingNamedPipeClientFlags  flags,
+                                                                           GCancellable             *cancellable,
+                                                                           GAsyncReadyCallback       callback,
+                                                                           gpointer                  user_data);
+
+WING_AVAILABLE_IN_ALL
+WingNamedPipeConnection  *wing_named_pipe_client_pool_get_finish          (WingNamedPipeClientPool  *pool,
+                                                                           GAsyncResult             *result,
+                                                                           GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_release             (WingNamedPipeClientPool  *pool,
+                                                                           WingNamedPipeConnection  *connection);
+
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_client_pool_prewarm             (WingNamedPipeClientPool  *pool,
+                                                                           const gchar              *pipe_name,
+                                                                           WingNamedPipeClientFlags  flags,
+                                                                           guint                     n_connections,
+                                                                           GCancellable             *cancellable,
+                                                                           GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_clear               (WingNamedPipeClientPool  *pool);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_client_pool_get_n_idle          (WingNamedPipeClientPool  *pool,
+                                                                           const gchar              *pipe_name);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_set_max_idle        (WingNamedPipeClientPool  *pool,
+                                                                           guint                     max_idle);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_client_pool_get_max_idle        (WingNamedPipeClientPool  *pool);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_set_max_connections (WingNamedPipeClientPool  *pool,
+                                                                           guint                     max_connections);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_client_pool_get_max_connections (WingNamedPipeClientPool  *pool);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_client_pool_set_idle_timeout    (WingNamedPipeClientPool  *pool,
+                                                                           guint                     idle_timeout);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_client_pool_get_idle_timeout    (WingNamedPipeClientPool  *pool);
+
+G_END_DECLS
+
+#endif /* WING_NAMED_PIPE_CLIENT_POOL_H */
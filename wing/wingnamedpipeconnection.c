@@ -20,11 +20,14 @@
 
 #include "wingnamedpipeconnection.h"
 #include "winginputstream.h"
+#include "winginputstream-private.h"
 #include "wingoutputstream.h"
 #include "wingthreadpoolio.h"
 #include "wingiocpinputstream.h"
 #include "wingiocpoutputstream.h"
 #include "wingutils.h"
+#include "wingutils-private.h"
+#include "wingpipestats-private.h"
 
 #include <gio/gio.h>
 
@@ -38,8 +41,15 @@
  * @see_also: #GIOStream
  *
  * WingNamedPipeConnection creates a #GIOStream from an arbitrary handle.
+ *
+ * When the pipe is in message mode, whole messages can be read with
+ * wing_named_pipe_connection_receive_message() instead of the input
+ * stream, so no framing is needed on top of the pipe.
  */
 
+/* Used to read a message when its size is not known in advance */
+#define MESSAGE_CHUNK_SIZE 4096
+
 /**
  * WingNamedPipeConnection:
  *
@@ -58,6 +68,10 @@ struct _WingNamedPipeConnection
 
   gboolean use_iocp;
   WingThreadPoolIo *thread_pool_io;
+  WingThreadPool *thread_pool;
+  gint io_priority;
+
+  WingPipeStats *stats;
 };
 
 struct _WingNamedPipeConnectionClass
@@ -74,6 +88,10 @@ enum
   PROP_HANDLE,
   PROP_CLOSE_HANDLE,
   PROP_USE_IOCP,
+  PROP_THREADPOOL_IO,
+  PROP_INLINE_COMPLETION,
+  PROP_THREAD_POOL,
+  PROP_IO_PRIORITY,
   LAST_PROP
 };
 
@@ -108,6 +126,10 @@ wing_named_pipe_connection_finalize (GObject *object)
     }
 
   g_clear_pointer (&connection->thread_pool_io, wing_thread_pool_io_unref);
+  g_clear_pointer (&connection->thread_pool, wing_thread_pool_unref);
+
+  _wing_pipe_stats_close (connection->stats);
+  g_clear_pointer (&connection->stats, _wing_pipe_stats_unref);
 
   G_OBJECT_CLASS (wing_named_pipe_connection_parent_class)->finalize (object);
 }
@@ -138,6 +160,22 @@ wing_named_pipe_connection_set_property (GObject      *object,
       connection->use_iocp = g_value_get_boolean (value);
       break;
 
+    case PROP_THREADPOOL_IO:
+      connection->thread_pool_io = g_value_dup_boxed (value);
+      break;
+
+    case PROP_INLINE_COMPLETION:
+      wing_named_pipe_connection_set_inline_completion (connection, g_value_get_boolean (value));
+      break;
+
+    case PROP_THREAD_POOL:
+      connection->thread_pool = g_value_dup_boxed (value);
+      break;
+
+    case PROP_IO_PRIORITY:
+      connection->io_priority = g_value_get_int (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -170,6 +208,22 @@ wing_named_pipe_connection_get_property (GObject    *object,
       g_value_set_boolean (value, connection->use_iocp);
       break;
 
+    case PROP_THREADPOOL_IO:
+      g_value_set_boxed (value, connection->thread_pool_io);
+      break;
+
+    case PROP_INLINE_COMPLETION:
+      g_value_set_boolean (value, wing_named_pipe_connection_get_inline_completion (connection));
+      break;
+
+    case PROP_THREAD_POOL:
+      g_value_set_boxed (value, connection->thread_pool);
+      break;
+
+    case PROP_IO_PRIORITY:
+      g_value_set_int (value, connection->io_priority);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -184,9 +238,16 @@ wing_named_pipe_connection_constructed (GObject *object)
   if (connection->handle != NULL &&
       connection->handle != INVALID_HANDLE_VALUE)
     {
+      /* The handle may already be bound to a thread pool io */
+      if (connection->thread_pool_io != NULL)
+        connection->use_iocp = TRUE;
+      else if (connection->use_iocp)
+        connection->thread_pool_io = wing_thread_pool_io_new_full (connection->handle,
+                                                                   connection->thread_pool,
+                                                                   connection->io_priority);
+
       if (connection->use_iocp)
         {
-          connection->thread_pool_io = wing_thread_pool_io_new (connection->handle);
           if (connection->thread_pool_io != NULL)
             {
               connection->input_stream = wing_iocp_input_stream_new (FALSE, connection->thread_pool_io);
@@ -254,6 +315,8 @@ wing_named_pipe_connection_close (GIOStream     *stream,
 
   g_clear_pointer (&connection->thread_pool_io, wing_thread_pool_io_unref);
 
+  _wing_pipe_stats_close (connection->stats);
+
   return TRUE;
 }
 
@@ -330,6 +393,69 @@ wing_named_pipe_connection_class_init (WingNamedPipeConnectionClass *class)
                           G_PARAM_CONSTRUCT_ONLY |
                           G_PARAM_STATIC_STRINGS );
 
+  /**
+   * WingNamedPipeConnection:threadpool-io:
+   *
+   * The threadpool I/O object the handle is already bound to, if any.
+   * When set, the connection uses I/O completion port for async I/O.
+   */
+  props[PROP_THREADPOOL_IO] =
+    g_param_spec_boxed ("threadpool-io",
+                        "Threadpool I/O object",
+                        "The threadpool I/O object the handle is already bound to",
+                        WING_TYPE_THREAD_POOL_IO,
+                        G_PARAM_READWRITE |
+                        G_PARAM_CONSTRUCT_ONLY |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeConnection:inline-completion:
+   *
+   * Whether the async I/O calls back from the thread which completes it.
+   * See wing_named_pipe_connection_set_inline_completion().
+   */
+  props[PROP_INLINE_COMPLETION] =
+    g_param_spec_boolean ("inline-completion",
+                          "Inline completion",
+                          "Whether the async I/O calls back from the thread which completes it",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeConnection:thread-pool:
+   *
+   * The #WingThreadPool to run the completions of the async I/O on, or
+   * %NULL for the default thread pool of the process. Only used when
+   * the connection binds the handle to a completion port itself.
+   */
+  props[PROP_THREAD_POOL] =
+    g_param_spec_boxed ("thread-pool",
+                        "Thread pool",
+                        "The thread pool to run the completions of the async I/O on",
+                        WING_TYPE_THREAD_POOL,
+                        G_PARAM_READWRITE |
+                        G_PARAM_CONSTRUCT_ONLY |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeConnection:io-priority:
+   *
+   * The I/O priority the completions of the async I/O run with on the
+   * thread pool, see wing_thread_pool_io_new_full(). Only used when the
+   * connection binds the handle to a completion port itself.
+   */
+  props[PROP_IO_PRIORITY] =
+    g_param_spec_int ("io-priority",
+                      "I/O priority",
+                      "The I/O priority of the completions of the async I/O",
+                      G_MININT,
+                      G_MAXINT,
+                      G_PRIORITY_DEFAULT,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT_ONLY |
+                      G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, LAST_PROP, props);
 }
 
@@ -346,6 +472,56 @@ wing_named_pipe_connection_get_pipe_name (WingNamedPipeConnection *connection)
   return connection->pipe_name;
 }
 
+/**
+ * wing_named_pipe_connection_set_inline_completion:
+ * @connection: a #WingNamedPipeConnection.
+ * @inline_completion: %TRUE to complete the async I/O inline.
+ *
+ * Sets whether the async reads and writes of the streams of @connection
+ * call their callback directly from the thread of the pool which
+ * completes them, instead of from the main context they were started
+ * from. It saves a wakeup of the main context and a thread switch for
+ * each operation, but the callbacks then have to be thread-safe: see
+ * wing_thread_pool_io_set_inline_completion() for the rules to follow.
+ *
+ * This only has an effect when the connection uses I/O completion ports.
+ */
+void
+wing_named_pipe_connection_set_inline_completion (WingNamedPipeConnection *connection,
+                                                  gboolean                 inline_completion)
+{
+  g_return_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection));
+
+  if (connection->thread_pool_io == NULL)
+    return;
+
+  inline_completion = inline_completion != FALSE;
+  if (wing_thread_pool_io_get_inline_completion (connection->thread_pool_io) != inline_completion)
+    {
+      wing_thread_pool_io_set_inline_completion (connection->thread_pool_io, inline_completion);
+      g_object_notify_by_pspec (G_OBJECT (connection), props[PROP_INLINE_COMPLETION]);
+    }
+}
+
+/**
+ * wing_named_pipe_connection_get_inline_completion:
+ * @connection: a #WingNamedPipeConnection.
+ *
+ * Gets whether the async I/O of @connection completes inline.
+ *
+ * Returns: %TRUE if the async I/O completes inline.
+ */
+gboolean
+wing_named_pipe_connection_get_inline_completion (WingNamedPipeConnection *connection)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection), FALSE);
+
+  if (connection->thread_pool_io == NULL)
+    return FALSE;
+
+  return wing_thread_pool_io_get_inline_completion (connection->thread_pool_io);
+}
+
 static gulong
 get_client_process_id (WingNamedPipeConnection  *connection,
                        GError                  **error)
@@ -574,3 +750,413 @@ wing_named_pipe_connection_get_credentials (WingNamedPipeConnection  *connection
 
   return credentials;
 }
+
+/* Returns the size of the message, or of what is left of it, waiting
+ * in the pipe, 0 if the pipe is empty */
+static DWORD
+get_message_bytes_left (HANDLE handle)
+{
+  DWORD bytes_left = 0;
+
+  if (!PeekNamedPipe (handle, NULL, 0, NULL, NULL, &bytes_left))
+    return 0;
+
+  return bytes_left;
+}
+
+static HANDLE
+get_message_event (WingNamedPipeConnection *connection,
+                   HANDLE                   event)
+{
+  /* The handle may be bound to an I/O completion port, this prevents the
+   * port from being notified of the read. See the lpOverlapped parameter
+   * of GetQueuedCompletionStatus */
+  if (connection->thread_pool_io == NULL)
+    return event;
+
+#if GLIB_SIZEOF_VOID_P == 8
+  return (HANDLE) ((gint64) event | 0x1);
+#else
+  return (HANDLE) ((gint) event | 0x1);
+#endif
+}
+
+static void
+set_receive_message_error (GError **error,
+                           int      errsv)
+{
+  gchar *emsg;
+
+  emsg = g_win32_error_message (errsv);
+  g_set_error (error, G_IO_ERROR,
+               g_io_error_from_win32_error (errsv),
+               "Error receiving message: %s",
+               emsg);
+  g_free (emsg);
+}
+
+/**
+ * wing_named_pipe_connection_receive_message:
+ * @connection: a #WingNamedPipeConnection.
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Reads the next message from a pipe in message mode. The buffer is
+ * sized from the message waiting in the pipe, and grown while the
+ * message does not fit, so the whole message is returned at once.
+ *
+ * On a pipe in byte mode, the data available is returned instead.
+ *
+ * Returns: (transfer full): a #GBytes with the message on success, %NULL on error.
+ */
+GBytes *
+wing_named_pipe_connection_receive_message (WingNamedPipeConnection  *connection,
+                                            GCancellable             *cancellable,
+                                            GError                  **error)
+{
+  GByteArray *message;
+  OVERLAPPED overlap = { 0, };
+  HANDLE event;
+  DWORD chunk_size;
+  gboolean done = FALSE;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  if (connection->handle == NULL || connection->handle == INVALID_HANDLE_VALUE)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           "Error receiving message: the handle is closed");
+      return NULL;
+    }
+
+  event = _wing_event_acquire ();
+  g_return_val_if_fail (event != NULL, NULL);
+
+  message = g_byte_array_new ();
+
+  chunk_size = get_message_bytes_left (connection->handle);
+  if (chunk_size == 0)
+    chunk_size = MESSAGE_CHUNK_SIZE;
+
+  while (!done)
+    {
+      guint offset = message->len;
+      DWORD nread = 0;
+      BOOL res;
+      int errsv;
+
+      g_byte_array_set_size (message, offset + chunk_size);
+
+      memset (&overlap, 0, sizeof (overlap));
+      overlap.hEvent = get_message_event (connection, event);
+
+      res = ReadFile (connection->handle, message->data + offset, chunk_size, &nread, &overlap);
+      errsv = res ? NO_ERROR : GetLastError ();
+
+      if (errsv == ERROR_IO_PENDING)
+        {
+          wing_overlap_wait_result (connection->handle, &overlap, &nread, cancellable);
+
+          /* The wait calls other functions once the read is over, so the
+           * result is asked again to get the error of the read itself */
+          res = GetOverlappedResult (connection->handle, &overlap, &nread, FALSE);
+          errsv = res ? NO_ERROR : GetLastError ();
+        }
+
+      /* Set for the successful and for the partial reads */
+      nread = (DWORD) overlap.InternalHigh;
+      g_byte_array_set_size (message, offset + nread);
+
+      if (res)
+        done = TRUE;
+      else if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        break;
+      else if (errsv == ERROR_MORE_DATA)
+        {
+          chunk_size = get_message_bytes_left (connection->handle);
+          if (chunk_size == 0)
+            chunk_size = message->len;
+        }
+      else
+        {
+          set_receive_message_error (error, errsv);
+          break;
+        }
+    }
+
+  _wing_event_release (event);
+
+  if (!done)
+    {
+      g_byte_array_unref (message);
+      return NULL;
+    }
+
+  return g_byte_array_free_to_bytes (message);
+}
+
+typedef struct
+{
+  WingNamedPipeConnection *connection;
+  GByteArray *message;
+  guint offset;
+  gulong cancellable_id;
+} ReceiveMessageData;
+
+static void
+receive_message_data_free (ReceiveMessageData *data)
+{
+  if (data->message != NULL)
+    g_byte_array_unref (data->message);
+  g_object_unref (data->connection);
+  g_slice_free (ReceiveMessageData, data);
+}
+
+static void
+receive_message_cancelled (GCancellable *cancellable,
+                           gpointer      user_data)
+{
+  WingNamedPipeConnection *connection = user_data;
+
+  CancelIo (wing_thread_pool_get_handle (connection->thread_pool_io));
+}
+
+/* Called once the receive is over, before the task returns so that the
+ * callback can read from the connection again */
+static void
+receive_message_done (GTask *task)
+{
+  ReceiveMessageData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+
+  if (data->connection->thread_pool_io == NULL)
+    g_input_stream_clear_pending (data->connection->input_stream);
+  else if (cancellable != NULL)
+    g_cancellable_disconnect (cancellable, data->cancellable_id);
+}
+
+static void receive_message_read (GTask *task);
+
+static void
+receive_message_handle_result (GTask *task,
+                               int    errsv,
+                               gsize  nread)
+{
+  ReceiveMessageData *data = g_task_get_task_data (task);
+
+  g_byte_array_set_size (data->message, data->offset + (guint) nread);
+
+  if (errsv == NO_ERROR)
+    {
+      GBytes *bytes;
+
+      bytes = g_byte_array_free_to_bytes (data->message);
+      data->message = NULL;
+
+      receive_message_done (task);
+      g_task_return_pointer (task, bytes, (GDestroyNotify) g_bytes_unref);
+    }
+  else if (errsv == ERROR_MORE_DATA)
+    receive_message_read (task);
+  else
+    {
+      GError *error = NULL;
+
+      if (!g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &error))
+        set_receive_message_error (&error, errsv);
+
+      receive_message_done (task);
+      g_task_return_error (task, error);
+    }
+}
+
+static void
+receive_message_io_cb (WingThreadPoolIo *thread_pool_io,
+                       gulong            result,
+                       gsize             n_bytes,
+                       gpointer          user_data)
+{
+  GTask *task = user_data;
+
+  receive_message_handle_result (task, (int) result, n_bytes);
+  g_object_unref (task);
+}
+
+static void
+receive_message_stream_cb (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+  gssize nread;
+  int errsv;
+
+  nread = _wing_input_stream_read_message_finish (source, result, &errsv, &error);
+  if (nread < 0)
+    {
+      receive_message_done (task);
+      g_task_return_error (task, error);
+    }
+  else
+    receive_message_handle_result (task, errsv, nread);
+
+  g_object_unref (task);
+}
+
+static void
+receive_message_read (GTask *task)
+{
+  ReceiveMessageData *data = g_task_get_task_data (task);
+  WingNamedPipeConnection *connection = data->connection;
+  DWORD chunk_size;
+
+  chunk_size = get_message_bytes_left (connection->handle);
+  if (chunk_size == 0)
+    chunk_size = MAX (data->message->len, MESSAGE_CHUNK_SIZE);
+
+  data->offset = data->message->len;
+  g_byte_array_set_size (data->message, data->offset + chunk_size);
+
+  /* On a handle bound to a completion port, the read completes through
+   * the port with an overlapped structure of the pool, otherwise it is
+   * run by the input stream, on its event and task source */
+  if (connection->thread_pool_io != NULL)
+    {
+      GError *error = NULL;
+
+      if (!wing_thread_pool_io_read (connection->thread_pool_io,
+                                     data->message->data + data->offset,
+                                     chunk_size,
+                                     receive_message_io_cb,
+                                     g_object_ref (task),
+                                     &error))
+        {
+          receive_message_done (task);
+          g_task_return_error (task, error);
+          g_object_unref (task);
+        }
+    }
+  else
+    _wing_input_stream_read_message_async (connection->input_stream,
+                                           data->message->data + data->offset,
+                                           chunk_size,
+                                           g_task_get_cancellable (task),
+                                           receive_message_stream_cb,
+                                           g_object_ref (task));
+}
+
+/**
+ * wing_named_pipe_connection_receive_message_async:
+ * @connection: a #WingNamedPipeConnection.
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback
+ * @user_data: (closure): user data for the callback
+ *
+ * This is the asynchronous version of wing_named_pipe_connection_receive_message().
+ * As for a read, the input stream of @connection must not be in use
+ * until the operation is finished.
+ *
+ * When the operation is finished @callback will be called. You can then
+ * call wing_named_pipe_connection_receive_message_finish() to get the
+ * result of the operation.
+ */
+void
+wing_named_pipe_connection_receive_message_async (WingNamedPipeConnection *connection,
+                                                  GCancellable            *cancellable,
+                                                  GAsyncReadyCallback      callback,
+                                                  gpointer                 user_data)
+{
+  ReceiveMessageData *data;
+  GTask *task;
+  GError *error = NULL;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection));
+
+  task = g_task_new (connection, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_named_pipe_connection_receive_message_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  if (connection->handle == NULL || connection->handle == INVALID_HANDLE_VALUE)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                               "Error receiving message: the handle is closed");
+      g_object_unref (task);
+      return;
+    }
+
+  /* The input stream lends its overlapped structure to the reads */
+  if (connection->thread_pool_io == NULL &&
+      !g_input_stream_set_pending (connection->input_stream, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  data = g_slice_new0 (ReceiveMessageData);
+  data->connection = g_object_ref (connection);
+  data->message = g_byte_array_new ();
+  g_task_set_task_data (task, data, (GDestroyNotify) receive_message_data_free);
+
+  if (connection->thread_pool_io != NULL && cancellable != NULL)
+    data->cancellable_id = g_cancellable_connect (cancellable,
+                                                  G_CALLBACK (receive_message_cancelled),
+                                                  connection, NULL);
+
+  receive_message_read (task);
+  g_object_unref (task);
+}
+
+/**
+ * wing_named_pipe_connection_receive_message_finish:
+ * @connection: a #WingNamedPipeConnection.
+ * @result: a #GAsyncResult.
+ * @error: a #GError location to store the error occurring, or %NULL to
+ * ignore.
+ *
+ * Finishes an async receive operation. See wing_named_pipe_connection_receive_message_async()
+ *
+ * Returns: (transfer full): a #GBytes with the message on success, %NULL on error.
+ */
+GBytes *
+wing_named_pipe_connection_receive_message_finish (WingNamedPipeConnection  *connection,
+                                                   GAsyncResult             *result,
+                                                   GError                  **error)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CONNECTION (connection), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, connection), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+_wing_named_pipe_connection_set_pipe_stats (gpointer       connection,
+                                            WingPipeStats *stats)
+{
+  WingNamedPipeConnection *pipe_connection = WING_NAMED_PIPE_CONNECTION (connection);
+
+  g_clear_pointer (&pipe_connection->stats, _wing_pipe_stats_unref);
+  if (stats != NULL)
+    pipe_connection->stats = _wing_pipe_stats_ref (stats);
+
+  if (WING_IS_IOCP_INPUT_STREAM (pipe_connection->input_stream))
+    _wing_iocp_input_stream_set_pipe_stats (pipe_connection->input_stream, stats);
+  else if (pipe_connection->input_stream != NULL)
+    _wing_input_stream_set_pipe_stats (pipe_connection->input_stream, stats);
+
+  if (WING_IS_IOCP_OUTPUT_STREAM (pipe_connection->output_stream))
+    _wing_iocp_output_stream_set_pipe_stats (pipe_connection->output_stream, stats);
+  else if (pipe_connection->output_stream != NULL)
+    _wing_output_stream_set_pipe_stats (pipe_connection->output_stream, stats);
+}
@@ -38,9 +38,32 @@ GType                         wing_named_pipe_connection_get_type
 WING_AVAILABLE_IN_ALL
 const gchar                  *wing_named_pipe_connection_get_pipe_name           (WingNamedPipeConnection  *connection);
 
+WING_AVAILABLE_IN_ALL
+void                          wing_named_pipe_connection_set_inline_completion   (WingNamedPipeConnection  *connection,
+                                                                                  gboolean                  inline_completion);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_named_pipe_connection_get_inline_completion   (WingNamedPipeConnection  *connection);
+
 WING_AVAILABLE_IN_ALL
 WingCredentials              *wing_named_pipe_connection_get_credentials         (WingNamedPipeConnection  *connection,
                                                                                   GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+GBytes                       *wing_named_pipe_connection_receive_message         (WingNamedPipeConnection  *connection,
+                                                                                  GCancellable             *cancellable,
+                                                                                  GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+void                          wing_named_pipe_connection_receive_message_async   (WingNamedPipeConnection  *connection,
+                                                                                  GCancellable             *cancellable,
+                                                                                  GAsyncReadyCallback       callback,
+                                                                                  gpointer                  user_data);
+
+WING_AVAILABLE_IN_ALL
+GBytes                       *wing_named_pipe_connection_receive_message_finish  (WingNamedPipeConnection  *connection,
+                                                                                  GAsyncResult             *result,
+                                                                                  GError                  **error);
 G_END_DECLS
 
 #endif /* WING_NAMED_PIPE_CONNECTION_H */
@@ -19,25 +19,89 @@
 
 #include "wingnamedpipelistener.h"
 #include "wingnamedpipeconnection.h"
+#include "wingthreadpoolio.h"
 #include "wingsource.h"
+#include "wingutils.h"
+#include "wingpipestats-private.h"
 
 #include <windows.h>
 #include <sddl.h>
 
 #define DEFAULT_PIPE_BUF_SIZE 8192
+#define MAX_PIPE_BUF_SIZE (16 * 1024 * 1024)
+
+/* The adaptive buffer sizes follow the traffic of the last connections */
+#define ADAPTIVE_SAMPLES 32
+#define MIN_ADAPTIVE_BUF_SIZE 4096
+#define MAX_ADAPTIVE_BUF_SIZE (1024 * 1024)
+#define DEFAULT_BACKLOG 1
+#define MAX_BACKLOG 1024
+
+/* Leave room for the cancellable in the handles g_poll waits on */
+#define MAX_POLLED_INSTANCES (MAXIMUM_WAIT_OBJECTS - 1)
+#define POLL_INTERVAL_MS 50
+
+typedef enum
+{
+  PIPE_INSTANCE_IDLE,
+  PIPE_INSTANCE_CONNECTING,
+  PIPE_INSTANCE_CONNECTED,
+  PIPE_INSTANCE_FAILED
+} PipeInstanceState;
 
 typedef struct
 {
   gchar *pipe_name;
   gchar *security_descriptor;
-  gboolean protect_first_instance;
 
   gunichar2 *pipe_namew;
-  HANDLE handle;
-  OVERLAPPED overlapped;
   SECURITY_ATTRIBUTES *security_attributes;
+  gboolean message_mode;
+
+  GPtrArray *instances;
+} PipeEndpoint;
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  WingNamedPipeListener *listener;
+  GWeakRef listener_ref;
+  PipeEndpoint *endpoint;
+  HANDLE handle;
+  WingOverlappedData overlapped;
+  WingThreadPoolIo *thread_pool_io;
+  PipeInstanceState state;
+  DWORD error_code;
+  GSource *source;
+} PipeInstance;
+
+typedef struct
+{
+  gchar *pipe_name;
+  gchar *security_descriptor;
+  gboolean protect_first_instance;
 
   gboolean use_iocp;
+  guint backlog;
+  gboolean message_mode;
+
+  WingThreadPool *thread_pool;
+  gint io_priority;
+
+  guint in_buffer_size;
+  guint out_buffer_size;
+  gboolean adaptive_buffer_sizes;
+  guint effective_in_buffer_size;
+  guint effective_out_buffer_size;
+  WingPipeStats *samples[ADAPTIVE_SAMPLES];
+  guint next_sample;
+
+  GMutex mutex;
+  GPtrArray *endpoints;
+  GQueue ready;
+  GQueue pending_tasks;
+  GMainContext *watch_context;
 } WingNamedPipeListenerPrivate;
 
 enum
@@ -47,6 +111,13 @@ enum
   PROP_SECURITY_DESCRIPTOR,
   PROP_PROTECT_FIRST_INSTANCE,
   PROP_USE_IOCP,
+  PROP_BACKLOG,
+  PROP_MESSAGE_MODE,
+  PROP_IN_BUFFER_SIZE,
+  PROP_OUT_BUFFER_SIZE,
+  PROP_ADAPTIVE_BUFFER_SIZES,
+  PROP_THREAD_POOL,
+  PROP_IO_PRIORITY,
   LAST_PROP
 };
 
@@ -90,6 +161,34 @@ wing_named_pipe_listener_set_property (GObject      *object,
       priv->use_iocp = g_value_get_boolean (value);
       break;
 
+    case PROP_BACKLOG:
+      wing_named_pipe_listener_set_backlog (listener, g_value_get_uint (value));
+      break;
+
+    case PROP_MESSAGE_MODE:
+      wing_named_pipe_listener_set_message_mode (listener, g_value_get_boolean (value));
+      break;
+
+    case PROP_IN_BUFFER_SIZE:
+      wing_named_pipe_listener_set_in_buffer_size (listener, g_value_get_uint (value));
+      break;
+
+    case PROP_OUT_BUFFER_SIZE:
+      wing_named_pipe_listener_set_out_buffer_size (listener, g_value_get_uint (value));
+      break;
+
+    case PROP_ADAPTIVE_BUFFER_SIZES:
+      wing_named_pipe_listener_set_adaptive_buffer_sizes (listener, g_value_get_boolean (value));
+      break;
+
+    case PROP_THREAD_POOL:
+      wing_named_pipe_listener_set_thread_pool (listener, g_value_get_boxed (value));
+      break;
+
+    case PROP_IO_PRIORITY:
+      wing_named_pipe_listener_set_io_priority (listener, g_value_get_int (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -125,33 +224,149 @@ wing_named_pipe_listener_get_property (GObject    *object,
       g_value_set_boolean (value, priv->use_iocp);
       break;
 
+    case PROP_BACKLOG:
+      g_value_set_uint (value, priv->backlog);
+      break;
+
+    case PROP_MESSAGE_MODE:
+      g_value_set_boolean (value, priv->message_mode);
+      break;
+
+    case PROP_IN_BUFFER_SIZE:
+      g_value_set_uint (value, priv->in_buffer_size);
+      break;
+
+    case PROP_OUT_BUFFER_SIZE:
+      g_value_set_uint (value, priv->out_buffer_size);
+      break;
+
+    case PROP_ADAPTIVE_BUFFER_SIZES:
+      g_value_set_boolean (value, priv->adaptive_buffer_sizes);
+      break;
+
+    case PROP_THREAD_POOL:
+      g_value_set_boxed (value, priv->thread_pool);
+      break;
+
+    case PROP_IO_PRIORITY:
+      g_value_set_int (value, priv->io_priority);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+static PipeInstance *
+pipe_instance_ref (PipeInstance *instance)
+{
+  g_atomic_int_inc (&instance->ref_count);
+
+  return instance;
+}
+
+static void
+pipe_instance_unwatch (PipeInstance *instance)
+{
+  if (instance->source != NULL)
+    {
+      g_source_destroy (instance->source);
+      g_source_unref (instance->source);
+      instance->source = NULL;
+    }
+}
+
+static void
+pipe_instance_unref (PipeInstance *instance)
+{
+  if (!g_atomic_int_dec_and_test (&instance->ref_count))
+    return;
+
+  if (instance->handle != INVALID_HANDLE_VALUE)
+    {
+      if (instance->state == PIPE_INSTANCE_CONNECTING)
+        {
+          DWORD cbret;
+
+          /* The overlapped structure must stay valid until the pending connect is aborted */
+          CancelIoEx (instance->handle, &instance->overlapped.overlapped);
+          GetOverlappedResult (instance->handle, &instance->overlapped.overlapped, &cbret, TRUE);
+        }
+      else if (instance->state == PIPE_INSTANCE_CONNECTED)
+        {
+          DisconnectNamedPipe (instance->handle);
+        }
+
+      /* The thread pool io owns the handle */
+      if (instance->thread_pool_io == NULL)
+        CloseHandle (instance->handle);
+    }
+
+  g_clear_pointer (&instance->thread_pool_io, wing_thread_pool_io_unref);
+  g_weak_ref_clear (&instance->listener_ref);
+  CloseHandle (instance->overlapped.overlapped.hEvent);
+  g_slice_free (PipeInstance, instance);
+}
+
+static void
+pipe_instance_free (PipeInstance *instance)
+{
+  pipe_instance_unwatch (instance);
+
+  /* A connect pending on the thread pool holds its own reference on the
+   * instance, abort it so that the instance gets released */
+  if (instance->thread_pool_io != NULL &&
+      instance->state == PIPE_INSTANCE_CONNECTING)
+    CancelIoEx (instance->handle, &instance->overlapped.overlapped);
+
+  pipe_instance_unref (instance);
+}
+
+static void
+pipe_endpoint_free (PipeEndpoint *endpoint)
+{
+  g_ptr_array_foreach (endpoint->instances, (GFunc) pipe_instance_free, NULL);
+  g_ptr_array_free (endpoint->instances, TRUE);
+
+  g_free (endpoint->pipe_name);
+  g_free (endpoint->pipe_namew);
+  g_free (endpoint->security_descriptor);
+
+  if (endpoint->security_attributes != NULL)
+    {
+      if (endpoint->security_attributes->lpSecurityDescriptor != NULL)
+        LocalFree (endpoint->security_attributes->lpSecurityDescriptor);
+
+      g_free (endpoint->security_attributes);
+    }
+
+  g_slice_free (PipeEndpoint, endpoint);
+}
+
 static void
 wing_named_pipe_listener_finalize (GObject *object)
 {
   WingNamedPipeListener *listener = WING_NAMED_PIPE_LISTENER (object);
   WingNamedPipeListenerPrivate *priv;
+  guint i;
 
   priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  g_free (priv->pipe_name);
-  g_free (priv->pipe_namew);
-  g_free (priv->security_descriptor);
-  CloseHandle (priv->handle);
-  CloseHandle (priv->overlapped.hEvent);
+  /* Pending accepts keep a reference on the listener */
+  g_assert (g_queue_is_empty (&priv->pending_tasks));
 
-  if (priv->security_attributes != NULL)
-    {
-      if (priv->security_attributes->lpSecurityDescriptor != NULL)
-        LocalFree (priv->security_attributes->lpSecurityDescriptor);
+  g_queue_foreach (&priv->ready, (GFunc) pipe_instance_free, NULL);
+  g_queue_clear (&priv->ready);
+  g_ptr_array_free (priv->endpoints, TRUE);
+  g_clear_pointer (&priv->watch_context, g_main_context_unref);
+  for (i = 0; i < ADAPTIVE_SAMPLES; i++)
+    g_clear_pointer (&priv->samples[i], _wing_pipe_stats_unref);
+  g_clear_pointer (&priv->thread_pool, wing_thread_pool_unref);
+  g_mutex_clear (&priv->mutex);
 
-      g_free (priv->security_attributes);
-    }
+  g_free (priv->pipe_name);
+  g_free (priv->security_descriptor);
 
   G_OBJECT_CLASS (wing_named_pipe_listener_parent_class)->finalize (object);
 }
@@ -208,12 +423,147 @@ wing_named_pipe_listener_class_init (WingNamedPipeListenerClass *klass)
                           G_PARAM_WRITABLE |
                           G_PARAM_STATIC_STRINGS);
 
+  /**
+   * WingNamedPipeListener:backlog:
+   *
+   * The number of pipe instances kept waiting for a client at any time.
+   * Clients connecting to the already waiting instances are queued until
+   * they are accepted, so a burst of clients does not have to retry with
+   * WaitNamedPipe while the next instance is being created.
+   */
+  props[PROP_BACKLOG] =
+    g_param_spec_uint ("backlog",
+                       "Backlog",
+                       "The number of pipe instances waiting for a client",
+                       1,
+                       MAX_BACKLOG,
+                       DEFAULT_BACKLOG,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:message-mode:
+   *
+   * Whether the named pipes are created in message mode. In message mode
+   * each write of a client is read back as a separate message, see
+   * wing_named_pipe_connection_receive_message().
+   */
+  props[PROP_MESSAGE_MODE] =
+    g_param_spec_boolean ("message-mode",
+                          "Message mode",
+                          "Whether the named pipes are created in message mode",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:in-buffer-size:
+   *
+   * The size in bytes of the input buffer of the pipe instances, that is
+   * how much a client can write before having to wait for the server to
+   * read. 0 lets the system choose.
+   */
+  props[PROP_IN_BUFFER_SIZE] =
+    g_param_spec_uint ("in-buffer-size",
+                       "Input buffer size",
+                       "The size of the input buffer of the pipe instances",
+                       0,
+                       MAX_PIPE_BUF_SIZE,
+                       DEFAULT_PIPE_BUF_SIZE,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:out-buffer-size:
+   *
+   * The size in bytes of the output buffer of the pipe instances, that is
+   * how much the server can write before having to wait for the client
+   * to read. 0 lets the system choose.
+   */
+  props[PROP_OUT_BUFFER_SIZE] =
+    g_param_spec_uint ("out-buffer-size",
+                       "Output buffer size",
+                       "The size of the output buffer of the pipe instances",
+                       0,
+                       MAX_PIPE_BUF_SIZE,
+                       DEFAULT_PIPE_BUF_SIZE,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:adaptive-buffer-sizes:
+   *
+   * Whether the buffer sizes of the new pipe instances follow the traffic
+   * of the last accepted connections, instead of
+   * #WingNamedPipeListener:in-buffer-size and
+   * #WingNamedPipeListener:out-buffer-size, see
+   * wing_named_pipe_listener_set_adaptive_buffer_sizes().
+   */
+  props[PROP_ADAPTIVE_BUFFER_SIZES] =
+    g_param_spec_boolean ("adaptive-buffer-sizes",
+                          "Adaptive buffer sizes",
+                          "Whether the buffer sizes follow the traffic of the connections",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_CONSTRUCT |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:thread-pool:
+   *
+   * The #WingThreadPool to run the completions of the async I/O on, both
+   * of the listener and of the connections it accepts, when using
+   * I/O completion port. %NULL for the default thread pool of the process.
+   */
+  props[PROP_THREAD_POOL] =
+    g_param_spec_boxed ("thread-pool",
+                        "Thread pool",
+                        "The thread pool to run the completions of the async I/O on",
+                        WING_TYPE_THREAD_POOL,
+                        G_PARAM_READWRITE |
+                        G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeListener:io-priority:
+   *
+   * The I/O priority the completions of the async I/O run with on the
+   * thread pool, both for the listener and for the connections it
+   * accepts, when using I/O completion port.
+   */
+  props[PROP_IO_PRIORITY] =
+    g_param_spec_int ("io-priority",
+                      "I/O priority",
+                      "The I/O priority of the completions of the async I/O",
+                      G_MININT,
+                      G_MAXINT,
+                      G_PRIORITY_DEFAULT,
+                      G_PARAM_READWRITE |
+                      G_PARAM_CONSTRUCT |
+                      G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (gobject_class, LAST_PROP, props);
 }
 
 static void
 wing_named_pipe_listener_init (WingNamedPipeListener *listener)
 {
+  WingNamedPipeListenerPrivate *priv;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_init (&priv->mutex);
+  priv->endpoints = g_ptr_array_new_with_free_func ((GDestroyNotify) pipe_endpoint_free);
+  g_queue_init (&priv->ready);
+  g_queue_init (&priv->pending_tasks);
+  priv->backlog = DEFAULT_BACKLOG;
+  priv->in_buffer_size = DEFAULT_PIPE_BUF_SIZE;
+  priv->out_buffer_size = DEFAULT_PIPE_BUF_SIZE;
+  priv->effective_in_buffer_size = DEFAULT_PIPE_BUF_SIZE;
+  priv->effective_out_buffer_size = DEFAULT_PIPE_BUF_SIZE;
 }
 
 /**
@@ -258,439 +608,1479 @@ wing_named_pipe_listener_new (const gchar            *pipe_name,
                          NULL);
 }
 
-static gboolean
-create_pipe (WingNamedPipeListenerPrivate  *priv,
-             gboolean                       protect_first_instance,
-             GError                       **error)
-{
-  g_assert (priv->handle == INVALID_HANDLE_VALUE);
-
-  priv->handle = CreateNamedPipeW (priv->pipe_namew,
-                                   PIPE_ACCESS_DUPLEX |
-                                   FILE_FLAG_OVERLAPPED |
-                                   (protect_first_instance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
-                                   PIPE_TYPE_BYTE |
-                                   PIPE_READMODE_BYTE |
-                                   PIPE_WAIT |
-                                   PIPE_REJECT_REMOTE_CLIENTS,
-                                   PIPE_UNLIMITED_INSTANCES,
-                                   DEFAULT_PIPE_BUF_SIZE,
-                                   DEFAULT_PIPE_BUF_SIZE,
-                                   0,
-                                   priv->security_attributes);
-  if (priv->handle == INVALID_HANDLE_VALUE)
+static PipeEndpoint *
+pipe_endpoint_new (const gchar  *pipe_name,
+                   const gchar  *security_descriptor,
+                   gboolean      message_mode,
+                   GError      **error)
+{
+  PipeEndpoint *endpoint;
+  SECURITY_ATTRIBUTES *sa = NULL;
+
+  if (security_descriptor != NULL)
     {
-      int errsv = GetLastError ();
-      gchar *emsg = g_win32_error_message (errsv);
+      gunichar2 *security_descriptorw;
+      gboolean success;
 
-      g_set_error (error,
-                   G_IO_ERROR,
-                   g_io_error_from_win32_error (errsv),
-                   "Error creating named pipe '%s': %s",
-                   priv->pipe_name, emsg);
-      g_free (emsg);
+      sa = g_malloc0 (sizeof (SECURITY_ATTRIBUTES));
+      sa->nLength = sizeof (SECURITY_ATTRIBUTES);
 
-      return FALSE;
+      security_descriptorw = g_utf8_to_utf16 (security_descriptor, -1, NULL, NULL, NULL);
+      success = ConvertStringSecurityDescriptorToSecurityDescriptorW (security_descriptorw,
+                                                                      SDDL_REVISION_1,
+                                                                      &sa->lpSecurityDescriptor,
+                                                                      NULL);
+      g_free (security_descriptorw);
+
+      if (!success)
+        {
+          int errsv = GetLastError ();
+          gchar *emsg = g_win32_error_message (errsv);
+
+          g_set_error (error,
+                      G_IO_ERROR,
+                      g_io_error_from_win32_error (errsv),
+                      "Could not convert the security descriptor '%s': %s",
+                      security_descriptor, emsg);
+          g_free (emsg);
+          g_free (sa);
+
+          return NULL;
+        }
     }
 
-  return TRUE;
+  endpoint = g_slice_new0 (PipeEndpoint);
+  endpoint->pipe_name = g_strdup (pipe_name);
+  endpoint->pipe_namew = g_utf8_to_utf16 (pipe_name, -1, NULL, NULL, NULL);
+  endpoint->security_descriptor = g_strdup (security_descriptor);
+  endpoint->security_attributes = sa;
+  endpoint->message_mode = message_mode;
+  endpoint->instances = g_ptr_array_new ();
+
+  return endpoint;
 }
 
-static gboolean
-connect_ready (HANDLE   handle,
-               gpointer user_data)
+static guint
+adaptive_buffer_size (WingNamedPipeListenerPrivate *priv,
+                      WingPipeStatsDirection        direction,
+                      guint                         fallback)
 {
-  GTask *task = user_data;
-  WingNamedPipeListener *listener = g_task_get_source_object (task);
-  WingNamedPipeListenerPrivate *priv;
-  WingNamedPipeConnection *connection = NULL;
-  gulong cbret;
+  guint64 total = 0;
+  guint n_samples = 0;
+  gsize size;
   guint i;
-  GError *error = NULL;
-  GError *local_error = NULL;
-  HANDLE old_handle = INVALID_HANDLE_VALUE;
+
+  for (i = 0; i < ADAPTIVE_SAMPLES; i++)
+    {
+      if (priv->samples[i] == NULL)
+        continue;
+
+      size = _wing_pipe_stats_get_buffer_size (priv->samples[i], direction);
+      if (size > 0)
+        {
+          total += size;
+          n_samples++;
+        }
+    }
+
+  if (n_samples == 0)
+    return fallback;
+
+  size = (gsize) CLAMP (total / n_samples, MIN_ADAPTIVE_BUF_SIZE, MAX_ADAPTIVE_BUF_SIZE);
+
+  /* Rounded up to a power of two, the system rounds them to whole pages anyway */
+  return 1u << g_bit_storage (size - 1);
+}
+
+/* Must be called with the listener lock held */
+static void
+update_buffer_sizes (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
 
   priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  if (g_task_return_error_if_cancelled (task))
+  if (!priv->adaptive_buffer_sizes)
     {
-      g_object_unref (task);
-
-      return G_SOURCE_REMOVE;
+      priv->effective_in_buffer_size = priv->in_buffer_size;
+      priv->effective_out_buffer_size = priv->out_buffer_size;
+      return;
     }
 
-  if (!GetOverlappedResult (priv->handle, &priv->overlapped, &cbret, FALSE))
+  /* The server reads what the clients write into the input buffer */
+  priv->effective_in_buffer_size = adaptive_buffer_size (priv, WING_PIPE_STATS_READ,
+                                                         priv->in_buffer_size);
+  priv->effective_out_buffer_size = adaptive_buffer_size (priv, WING_PIPE_STATS_WRITE,
+                                                          priv->out_buffer_size);
+}
+
+/* Must be called with the listener lock held */
+static PipeInstance *
+pipe_instance_new (WingNamedPipeListener  *listener,
+                   PipeEndpoint           *endpoint,
+                   gboolean                protect_first_instance,
+                   GError                **error)
+{
+  WingNamedPipeListenerPrivate *priv;
+  PipeInstance *instance;
+  HANDLE handle;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  update_buffer_sizes (listener);
+
+  handle = CreateNamedPipeW (endpoint->pipe_namew,
+                             PIPE_ACCESS_DUPLEX |
+                             FILE_FLAG_OVERLAPPED |
+                             (protect_first_instance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                             (endpoint->message_mode ?
+                              PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE :
+                              PIPE_TYPE_BYTE | PIPE_READMODE_BYTE) |
+                             PIPE_WAIT |
+                             PIPE_REJECT_REMOTE_CLIENTS,
+                             PIPE_UNLIMITED_INSTANCES,
+                             priv->effective_out_buffer_size,
+                             priv->effective_in_buffer_size,
+                             0,
+                             endpoint->security_attributes);
+  if (handle == INVALID_HANDLE_VALUE)
     {
       int errsv = GetLastError ();
       gchar *emsg = g_win32_error_message (errsv);
 
-      g_set_error (&error,
+      g_set_error (error,
                    G_IO_ERROR,
-                   G_IO_ERROR_INVALID_ARGUMENT,
-                   "There was an error querying the named pipe: %s",
-                   emsg);
+                   g_io_error_from_win32_error (errsv),
+                   "Error creating named pipe '%s': %s",
+                   endpoint->pipe_name, emsg);
       g_free (emsg);
 
-      old_handle = priv->handle;
+      return NULL;
     }
-  else
+
+  instance = g_slice_new0 (PipeInstance);
+  instance->ref_count = 1;
+  instance->listener = listener;
+  g_weak_ref_init (&instance->listener_ref, listener);
+  instance->endpoint = endpoint;
+  instance->handle = handle;
+  instance->state = PIPE_INSTANCE_IDLE;
+  instance->overlapped.overlapped.hEvent = CreateEvent (NULL, /* default security attribute */
+                                             TRUE, /* manual-reset event */
+                                             FALSE, /* initial state = non-signaled */
+                                             NULL); /* unnamed event object */
+
+  return instance;
+}
+
+static void connect_completed (PTP_CALLBACK_INSTANCE callback_instance,
+                               PVOID                 ctxt,
+                               PVOID                 overlapped,
+                               ULONG                 result,
+                               ULONG_PTR             number_of_bytes_transferred,
+                               PTP_IO                threadpool_io,
+                               gpointer              user_data);
+
+/* Starts waiting for a client on an idle instance.
+ * Returns %TRUE if the instance is still waiting for a client */
+static gboolean
+pipe_instance_connect (PipeInstance *instance)
+{
+  WingNamedPipeListenerPrivate *priv;
+  int errsv;
+
+  priv = wing_named_pipe_listener_get_instance_private (instance->listener);
+
+  /* The instance sticks to the mode it was armed with, since
+   * a handle can only be associated to one completion port */
+  if (priv->use_iocp && instance->thread_pool_io == NULL)
     {
-      connection = g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
-                                 "pipe-name", priv->pipe_name,
-                                 "handle", priv->handle,
-                                 "close-handle", TRUE,
-                                 "use-iocp", priv->use_iocp,
-                                 NULL);
+      instance->thread_pool_io = wing_thread_pool_io_new_full (instance->handle,
+                                                               priv->thread_pool,
+                                                               priv->io_priority);
+      if (instance->thread_pool_io == NULL)
+        g_info ("Failed to create thread pool io, falling back to not iocp version");
     }
 
-  priv->handle = INVALID_HANDLE_VALUE;
+  ResetEvent (instance->overlapped.overlapped.hEvent);
 
-  /* Create another pipe so more clients can already connect */
-  if (!create_pipe (priv, FALSE, &local_error))
+  if (instance->thread_pool_io != NULL)
     {
-      g_warning ("%s", local_error->message);
-      g_error_free (local_error);
+      instance->overlapped.callback = connect_completed;
+      instance->overlapped.user_data = instance;
+      wing_thread_pool_io_start (instance->thread_pool_io);
     }
 
-  if (connection != NULL)
+  if (ConnectNamedPipe (instance->handle, &instance->overlapped.overlapped))
     {
-      g_task_return_pointer (task, connection, g_object_unref);
+      /* The completion is still queued to the thread pool, unless the
+       * completion port engine skips it on success */
+      if (instance->thread_pool_io != NULL)
+        {
+          if (wing_thread_pool_io_get_skip_completion_port_on_success (instance->thread_pool_io))
+            wing_thread_pool_io_cancel (instance->thread_pool_io);
+          else
+            pipe_instance_ref (instance);
+        }
+
+      instance->state = PIPE_INSTANCE_CONNECTED;
+      return FALSE;
     }
-  else
+
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_PENDING)
     {
-      g_task_return_error (task, error);
+      /* Released once the connect completes on the thread pool */
+      if (instance->thread_pool_io != NULL)
+        pipe_instance_ref (instance);
 
-      /* We close the old pipe after having created the new one to avoid client connections
-       * failures because the pipe does not exists. 
-       */
-      CloseHandle (old_handle);
+      instance->state = PIPE_INSTANCE_CONNECTING;
+      return TRUE;
     }
 
-  g_object_unref (task);
+  if (instance->thread_pool_io != NULL)
+    wing_thread_pool_io_cancel (instance->thread_pool_io);
 
-  return G_SOURCE_REMOVE;
+  if (errsv == ERROR_PIPE_CONNECTED)
+    {
+      instance->state = PIPE_INSTANCE_CONNECTED;
+    }
+  else
+    {
+      instance->state = PIPE_INSTANCE_FAILED;
+      instance->error_code = errsv;
+    }
+
+  return FALSE;
 }
 
-static void
-free_source (GSource *source)
+/* Returns %TRUE if the pending connect of the instance has finished */
+static gboolean
+pipe_instance_poll (PipeInstance *instance)
 {
-  if (source != NULL)
+  DWORD cbret;
+  int errsv;
+
+  if (!HasOverlappedIoCompleted (&instance->overlapped.overlapped))
+    return FALSE;
+
+  if (GetOverlappedResult (instance->handle, &instance->overlapped.overlapped, &cbret, FALSE))
     {
-      g_source_destroy (source);
-      g_source_unref (source);
+      instance->state = PIPE_INSTANCE_CONNECTED;
+      return TRUE;
     }
+
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_INCOMPLETE)
+    return FALSE;
+
+  instance->state = PIPE_INSTANCE_FAILED;
+  instance->error_code = errsv;
+
+  return TRUE;
 }
 
-/**
- * wing_named_pipe_listener_accept:
- * @listener: a #WingNamedPipeListener
- * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
- * @error: #GError for error reporting, or %NULL to ignore.
- *
- * Blocks waiting for a client to connect to any of the named pipes added
- * to the listener. Returns the #WingNamedPipeConnection that was accepted.
- *
- * If @cancellable is not %NULL, then the operation can be cancelled by
- * triggering the cancellable object from another thread. If the operation
- * was cancelled, the error %G_IO_ERROR_CANCELLED will be returned.
- *
- * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
+/* Must be called with the listener lock held.
+ * Moves the instances of the endpoint a client connected to into the
+ * ready queue and creates new instances so that the backlog is full.
+ * Fails only if the endpoint is left without waiting instances.
  */
-WingNamedPipeConnection *
-wing_named_pipe_listener_accept (WingNamedPipeListener  *listener,
-                                 GCancellable           *cancellable,
-                                 GError                **error)
+static gboolean
+fill_endpoint_backlog (WingNamedPipeListener  *listener,
+                       PipeEndpoint           *endpoint,
+                       GError                **error)
 {
   WingNamedPipeListenerPrivate *priv;
-  WingNamedPipeConnection *connection = NULL;
-  GError *local_error = NULL;
-  gboolean success = TRUE;
-  HANDLE old_handle;
-
-  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), NULL);
+  guint missing;
+  guint i = 0;
 
   priv = wing_named_pipe_listener_get_instance_private (listener);
-  
-  /* This should not happen. If it happens, it means the creation of the pipe failed in the previous accept */
-  if  (priv->handle == INVALID_HANDLE_VALUE &&
-       !create_pipe (priv, FALSE, error))
+
+  while (i < endpoint->instances->len)
     {
-      return NULL;
+      PipeInstance *instance = g_ptr_array_index (endpoint->instances, i);
+      gboolean waiting;
+
+      if (instance->state == PIPE_INSTANCE_IDLE)
+        waiting = pipe_instance_connect (instance);
+      else
+        waiting = !pipe_instance_poll (instance);
+
+      if (waiting)
+        {
+          i++;
+          continue;
+        }
+
+      pipe_instance_unwatch (instance);
+      g_ptr_array_remove_index (endpoint->instances, i);
+      g_queue_push_tail (&priv->ready, instance);
     }
 
-  if (!ConnectNamedPipe (priv->handle, &priv->overlapped))
+  /* Create the new instances before handing out the ready ones, to avoid
+   * client connection failures because the pipe does not exist.
+   */
+  missing = priv->backlog > endpoint->instances->len ? priv->backlog - endpoint->instances->len : 0;
+  for (; missing > 0; missing--)
     {
-      switch (GetLastError ())
+      PipeInstance *instance;
+      GError *local_error = NULL;
+
+      instance = pipe_instance_new (listener, endpoint, FALSE, &local_error);
+      if (instance == NULL)
         {
-        case ERROR_PIPE_CONNECTED:
+          if (endpoint->instances->len == 0)
+            {
+              g_propagate_error (error, local_error);
+              return FALSE;
+            }
+
+          g_warning ("%s", local_error->message);
+          g_error_free (local_error);
           break;
-        case ERROR_IO_PENDING:
-          {
-            DWORD cbret;
-
-            if (GetOverlappedResult (priv->handle, &priv->overlapped, &cbret, TRUE))
-              break;
-
-            /* FALLTHROUGH */
-          }
-        default:
-          {
-            int errsv = GetLastError ();
-            gchar *emsg = g_win32_error_message (errsv);
-
-            g_set_error (error,
-                         G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
-                         "Failed to connect named pipe '%s': %s",
-                         priv->pipe_name, emsg);
-            g_free (emsg);
-
-            old_handle = priv->handle;
-            success = FALSE;
-          }
         }
+
+      if (pipe_instance_connect (instance))
+        g_ptr_array_add (endpoint->instances, instance);
+      else
+        g_queue_push_tail (&priv->ready, instance);
     }
 
-  if (success)
+  return TRUE;
+}
+
+/* Must be called with the listener lock held.
+ * Drops the instances of the endpoint still waiting for a client once
+ * the backlog has been lowered.
+ */
+static void
+trim_endpoint_backlog (WingNamedPipeListener *listener,
+                       PipeEndpoint          *endpoint)
+{
+  WingNamedPipeListenerPrivate *priv;
+  guint i;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  i = endpoint->instances->len;
+  while (endpoint->instances->len > priv->backlog && i > 0)
     {
-      connection = g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
-                                 "pipe-name", priv->pipe_name,
-                                 "handle", priv->handle,
-                                 "close-handle", TRUE,
-                                 "use-iocp", priv->use_iocp,
-                                 NULL);
+      PipeInstance *instance = g_ptr_array_index (endpoint->instances, --i);
+
+      /* A client connected meanwhile, it is handed out on the next accept */
+      if (instance->state != PIPE_INSTANCE_IDLE && pipe_instance_poll (instance))
+        continue;
+
+      g_ptr_array_remove_index (endpoint->instances, i);
+      pipe_instance_free (instance);
     }
+}
+
+/* Must be called with the listener lock held.
+ * Fills the backlog of all the endpoints of the listener. Fails only if
+ * there is neither a ready instance nor an instance waiting for a client.
+ */
+static gboolean
+fill_backlog (WingNamedPipeListener  *listener,
+              GError                **error)
+{
+  WingNamedPipeListenerPrivate *priv;
+  GError *endpoint_error = NULL;
+  gboolean waiting = FALSE;
+  guint i;
 
-  priv->handle = INVALID_HANDLE_VALUE;
+  priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  /* Create another pipe so more clients can already connect */
-  if (!create_pipe (priv, FALSE, &local_error))
+  if (priv->endpoints->len == 0)
     {
-      g_warning ("%s", local_error->message);
-      g_error_free (local_error);
+      g_set_error_literal (error,
+                           G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+                           "No named pipe was added to the listener");
+      return FALSE;
     }
 
-  if (!success)
+  for (i = 0; i < priv->endpoints->len; i++)
     {
-      /* We close the old pipe after having created the new one to avoid client connections
-       * failures because the pipe does not exists. 
-       */
-      CloseHandle (old_handle);
+      PipeEndpoint *endpoint = g_ptr_array_index (priv->endpoints, i);
+      GError *local_error = NULL;
+
+      if (!fill_endpoint_backlog (listener, endpoint, &local_error))
+        {
+          if (endpoint_error == NULL)
+            endpoint_error = local_error;
+          else
+            g_error_free (local_error);
+        }
+
+      waiting |= endpoint->instances->len > 0;
     }
 
-  return connection;
+  if (endpoint_error == NULL)
+    return TRUE;
+
+  if (!waiting && g_queue_is_empty (&priv->ready))
+    {
+      g_propagate_error (error, endpoint_error);
+      return FALSE;
+    }
+
+  g_warning ("%s", endpoint_error->message);
+  g_error_free (endpoint_error);
+
+  return TRUE;
 }
 
-/**
- * wing_named_pipe_listener_accept_async:
- * @listener: a #WingNamedPipeListener
- * @cancellable: (allow-none): a #GCancellable, or %NULL
- * @callback: (scope async): a #GAsyncReadyCallback
- * @user_data: (closure): user data for the callback
- *
- * This is the asynchronous version of wing_named_pipe_listener_accept().
- *
- * When the operation is finished @callback will be
- * called. You can then call wing_named_pipe_listener_accept_finish()
- * to get the result of the operation.
- */
-void
-wing_named_pipe_listener_accept_async (WingNamedPipeListener *listener,
-                                       GCancellable          *cancellable,
-                                       GAsyncReadyCallback    callback,
-                                       gpointer               user_data)
+/* Takes ownership of the instance */
+static WingNamedPipeConnection *
+pipe_instance_accept (PipeInstance  *instance,
+                      GError       **error)
 {
   WingNamedPipeListenerPrivate *priv;
   WingNamedPipeConnection *connection;
-  GError *local_error = NULL;
-  gboolean success = TRUE;
-  HANDLE old_handle;
-  GTask *task;
-  GError *error = NULL;
 
-  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+  priv = wing_named_pipe_listener_get_instance_private (instance->listener);
 
-  task = g_task_new (listener, cancellable, callback, user_data);
+  /* The client may have gone away while the connection was queued */
+  if (instance->state == PIPE_INSTANCE_CONNECTED &&
+      !PeekNamedPipe (instance->handle, NULL, 0, NULL, NULL, NULL) &&
+      GetLastError () == ERROR_BROKEN_PIPE)
+    {
+      instance->state = PIPE_INSTANCE_FAILED;
+      instance->error_code = ERROR_BROKEN_PIPE;
+    }
 
-  priv = wing_named_pipe_listener_get_instance_private (listener);
-  
-  /* This should not happen. If it happens, it means the creation of the pipe failed in the previous accept */
-  if  (priv->handle == INVALID_HANDLE_VALUE &&
-       !create_pipe (priv, FALSE, &error))
+  if (instance->state == PIPE_INSTANCE_FAILED)
     {
-      g_task_return_error (task, error);
-      g_object_unref (task);
-      return;
+      gchar *emsg = g_win32_error_message (instance->error_code);
+
+      g_set_error (error,
+                   G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Failed to connect named pipe '%s': %s",
+                   instance->endpoint->pipe_name, emsg);
+      g_free (emsg);
+
+      pipe_instance_free (instance);
+
+      return NULL;
+    }
+
+  /* The connection keeps using the thread pool io the handle is bound to */
+  connection = g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
+                             "pipe-name", instance->endpoint->pipe_name,
+                             "handle", instance->handle,
+                             "close-handle", TRUE,
+                             "use-iocp", priv->use_iocp,
+                             "threadpool-io", instance->thread_pool_io,
+                             NULL);
+
+  instance->handle = INVALID_HANDLE_VALUE;
+  g_clear_pointer (&instance->thread_pool_io, wing_thread_pool_io_unref);
+  pipe_instance_free (instance);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->adaptive_buffer_sizes)
+    {
+      WingPipeStats *stats;
+
+      /* The oldest sample makes room for the new connection */
+      stats = _wing_pipe_stats_new ();
+      _wing_named_pipe_connection_set_pipe_stats (connection, stats);
+      g_clear_pointer (&priv->samples[priv->next_sample], _wing_pipe_stats_unref);
+      priv->samples[priv->next_sample] = stats;
+      priv->next_sample = (priv->next_sample + 1) % ADAPTIVE_SAMPLES;
     }
 
-  if (!ConnectNamedPipe (priv->handle, &priv->overlapped))
+  g_mutex_unlock (&priv->mutex);
+
+  return connection;
+}
+
+static gboolean connect_ready (HANDLE   handle,
+                               gpointer user_data);
+
+/* Must be called with the listener lock held.
+ * Instances are only watched while there are pending async accepts.
+ * The instances bound to the thread pool are never watched, their
+ * connect completions are delivered by the thread pool.
+ */
+static void
+update_watches (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+  GMainContext *context = NULL;
+  guint i, j;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  if (!g_queue_is_empty (&priv->pending_tasks))
+    context = g_task_get_context (g_queue_peek_head (&priv->pending_tasks));
+
+  if (context != priv->watch_context)
     {
-      switch (GetLastError ())
+      for (i = 0; i < priv->endpoints->len; i++)
         {
-        case ERROR_PIPE_CONNECTED:
-          break;
-        case ERROR_IO_PENDING:
-          {
-            GSource *source;
-
-            source = wing_create_source (priv->overlapped.hEvent,
-                                        G_IO_IN,
-                                        cancellable);
-            g_source_set_callback (source,
-                                  (GSourceFunc) connect_ready,
-                                  task, NULL);
-            g_source_attach (source, g_main_context_get_thread_default ());
-
-            g_task_set_task_data (task, source, (GDestroyNotify) free_source);
-            return;
-          }
-        default:
-          {
-            int errsv = GetLastError ();
-            gchar *emsg = g_win32_error_message (errsv);
-
-            g_set_error (&error,
-                         G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
-                         "Failed to connect named pipe '%s': %s",
-                         priv->pipe_name, emsg);
-            g_free (emsg);
-            
-            old_handle = priv->handle;
-            success = FALSE;
-          }
+          PipeEndpoint *endpoint = g_ptr_array_index (priv->endpoints, i);
+
+          g_ptr_array_foreach (endpoint->instances, (GFunc) pipe_instance_unwatch, NULL);
         }
+
+      g_clear_pointer (&priv->watch_context, g_main_context_unref);
+
+      if (context != NULL)
+        priv->watch_context = g_main_context_ref (context);
     }
 
-  if (success)
+  if (priv->watch_context == NULL)
+    return;
+
+  for (i = 0; i < priv->endpoints->len; i++)
     {
-      connection = g_object_new (WING_TYPE_NAMED_PIPE_CONNECTION,
-                                "pipe-name", priv->pipe_name,
-                                "handle", priv->handle,
-                                "close-handle", TRUE,
-                                "use-iocp", priv->use_iocp,
-                                NULL);
+      PipeEndpoint *endpoint = g_ptr_array_index (priv->endpoints, i);
+
+      for (j = 0; j < endpoint->instances->len; j++)
+        {
+          PipeInstance *instance = g_ptr_array_index (endpoint->instances, j);
+
+          if (instance->state != PIPE_INSTANCE_CONNECTING ||
+              instance->thread_pool_io != NULL ||
+              instance->source != NULL)
+            continue;
+
+          instance->source = wing_create_source (instance->overlapped.overlapped.hEvent,
+                                                 G_IO_IN,
+                                                 NULL);
+          g_source_set_callback (instance->source,
+                                 (GSourceFunc) connect_ready,
+                                 pipe_instance_ref (instance),
+                                 (GDestroyNotify) pipe_instance_unref);
+          g_source_attach (instance->source, priv->watch_context);
+        }
     }
+}
+
+/* Must be called with the listener lock held.
+ * Pairs the pending accepts with the ready instances.
+ */
+static void
+dispatch_ready (WingNamedPipeListener *listener,
+                GQueue                *tasks,
+                GQueue                *instances)
+{
+  WingNamedPipeListenerPrivate *priv;
 
-  priv->handle = INVALID_HANDLE_VALUE;
+  priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  /* Create another pipe so more clients can already connect */
-  if (!create_pipe (priv, FALSE, &local_error))
+  while (!g_queue_is_empty (&priv->ready) &&
+         !g_queue_is_empty (&priv->pending_tasks))
     {
-      g_warning ("%s", local_error->message);
-      g_error_free (local_error);
+      g_queue_push_tail (tasks, g_queue_pop_head (&priv->pending_tasks));
+      g_queue_push_tail (instances, g_queue_pop_head (&priv->ready));
     }
+}
 
-  if (success)
+/* Must be called without the listener lock held, since the callbacks
+ * of the tasks may be invoked right away */
+static void
+return_accepted (GQueue *tasks,
+                 GQueue *instances)
+{
+  GTask *task;
+
+  while ((task = g_queue_pop_head (tasks)) != NULL)
     {
-      g_task_return_pointer (task, connection, g_object_unref);
+      WingNamedPipeConnection *connection;
+      GError *error = NULL;
+
+      connection = pipe_instance_accept (g_queue_pop_head (instances), &error);
+      if (connection != NULL)
+        g_task_return_pointer (task, connection, g_object_unref);
+      else
+        g_task_return_error (task, error);
+
+      g_object_unref (task);
     }
-  else
-    {
-      g_task_return_error (task, error);
+}
+
+static void
+process_backlog (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+  GQueue tasks = G_QUEUE_INIT;
+  GQueue instances = G_QUEUE_INIT;
+  GError *error = NULL;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
 
-      /* We close the old pipe after having created the new one to avoid client connections
-       * failures because the pipe does not exists. 
-       */
-      CloseHandle (old_handle);
+  g_mutex_lock (&priv->mutex);
+
+  if (!fill_backlog (listener, &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
     }
 
-  g_object_unref (task);
+  dispatch_ready (listener, &tasks, &instances);
+  update_watches (listener);
+
+  g_mutex_unlock (&priv->mutex);
+
+  return_accepted (&tasks, &instances);
 }
 
-/**
- * wing_named_pipe_listener_accept_finish:
- * @listener: a #WingNamedPipeListener.
- * @result: a #GAsyncResult.
- * @error: a #GError location to store the error occurring, or %NULL to ignore.
- *
- * Finishes an async accept operation. See wing_named_pipe_listener_accept_async()
- *
- * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
- */
-WingNamedPipeConnection *
-wing_named_pipe_listener_accept_finish (WingNamedPipeListener  *listener,
-                                        GAsyncResult           *result,
-                                        GError                **error)
+static gboolean
+connect_ready (HANDLE   handle,
+               gpointer user_data)
 {
-  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), NULL);
-  g_return_val_if_fail (g_task_is_valid (result, listener), NULL);
+  PipeInstance *instance = user_data;
 
-  return g_task_propagate_pointer (G_TASK (result), error);
+  process_backlog (instance->listener);
+
+  /* The source is destroyed once the instance leaves the backlog */
+  return G_SOURCE_CONTINUE;
 }
 
-void
-wing_named_pipe_listener_set_use_iocp (WingNamedPipeListener *listener,
-                                       gboolean               use_iocp)
+static void
+connect_completed (PTP_CALLBACK_INSTANCE callback_instance,
+                   PVOID                 ctxt,
+                   PVOID                 overlapped,
+                   ULONG                 result,
+                   ULONG_PTR             number_of_bytes_transferred,
+                   PTP_IO                threadpool_io,
+                   gpointer              user_data)
 {
-  WingNamedPipeListenerPrivate *priv;
+  PipeInstance *instance = user_data;
+  WingNamedPipeListener *listener;
 
-  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+  /* The listener may be finalized while the connect is pending */
+  listener = g_weak_ref_get (&instance->listener_ref);
+  if (listener != NULL)
+    {
+      process_backlog (listener);
+      g_object_unref (listener);
+    }
+  else
+    {
+      pipe_instance_poll (instance);
+    }
+
+  pipe_instance_unref (instance);
+}
+
+static gboolean
+accept_cancelled (GCancellable *cancellable,
+                  gpointer      user_data)
+{
+  GTask *task = user_data;
+  WingNamedPipeListener *listener = g_task_get_source_object (task);
+  WingNamedPipeListenerPrivate *priv;
+  gboolean pending;
 
   priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  if (priv->use_iocp != use_iocp)
+  g_mutex_lock (&priv->mutex);
+  pending = g_queue_remove (&priv->pending_tasks, task);
+  update_watches (listener);
+  g_mutex_unlock (&priv->mutex);
+
+  /* Otherwise the task was already completed */
+  if (pending)
     {
-      priv->use_iocp = use_iocp;
-      g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_USE_IOCP]);
+      g_task_return_error_if_cancelled (task);
+      g_object_unref (task);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+free_source (GSource *source)
+{
+  if (source != NULL)
+    {
+      g_source_destroy (source);
+      g_source_unref (source);
     }
 }
 
-static gboolean
-wing_named_pipe_listener_initable_init (GInitable     *initable,
-                                        GCancellable  *cancellable,
-                                        GError       **error)
+/**
+ * wing_named_pipe_listener_accept:
+ * @listener: a #WingNamedPipeListener
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @error: #GError for error reporting, or %NULL to ignore.
+ *
+ * Blocks waiting for a client to connect to any of the named pipes added
+ * to the listener. Returns the #WingNamedPipeConnection that was accepted.
+ *
+ * If @cancellable is not %NULL, then the operation can be cancelled by
+ * triggering the cancellable object from another thread. If the operation
+ * was cancelled, the error %G_IO_ERROR_CANCELLED will be returned.
+ *
+ * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
+ */
+WingNamedPipeConnection *
+wing_named_pipe_listener_accept (WingNamedPipeListener  *listener,
+                                 GCancellable           *cancellable,
+                                 GError                **error)
 {
-  WingNamedPipeListener *listener;
   WingNamedPipeListenerPrivate *priv;
-  gboolean success;
+  PipeInstance *instance = NULL;
 
-  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (initable), FALSE);
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), NULL);
 
-  listener = WING_NAMED_PIPE_LISTENER (initable);
   priv = wing_named_pipe_listener_get_instance_private (listener);
 
-  priv->pipe_namew = g_utf8_to_utf16 (priv->pipe_name, -1, NULL, NULL, NULL);
-  priv->handle = INVALID_HANDLE_VALUE;
-  priv->overlapped.hEvent = CreateEvent (NULL, /* default security attribute */
-                                         TRUE, /* manual-reset event */
-                                         FALSE, /* initial state = non-signaled */
-                                         NULL); /* unnamed event object */
-
-  if (priv->security_descriptor != NULL)
+  while (instance == NULL)
     {
-      gunichar2 *security_descriptorw;
-      gboolean success;
-      SECURITY_ATTRIBUTES *sa;
+      GPtrArray *waiting;
+      GPollFD *pollfds;
+      gint num;
+      gint timeout = -1;
+      guint i, j;
 
-      sa = g_malloc0 (sizeof (SECURITY_ATTRIBUTES));
-      sa->nLength = sizeof (SECURITY_ATTRIBUTES);
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return NULL;
 
-      security_descriptorw = g_utf8_to_utf16 (priv->security_descriptor, -1, NULL, NULL, NULL);
-      success = ConvertStringSecurityDescriptorToSecurityDescriptorW (security_descriptorw,
-                                                                      SDDL_REVISION_1,
-                                                                      &sa->lpSecurityDescriptor,
-                                                                      NULL);
-      g_free (security_descriptorw);
+      g_mutex_lock (&priv->mutex);
 
-      if (!success)
+      if (!fill_backlog (listener, error))
         {
-          int errsv = GetLastError ();
-          gchar *emsg = g_win32_error_message (errsv);
+          g_mutex_unlock (&priv->mutex);
+          return NULL;
+        }
 
-          g_set_error (error,
-                      G_IO_ERROR,
-                      g_io_error_from_win32_error (errsv),
-                      "Could not convert the security descriptor '%s': %s",
-                      priv->security_descriptor, emsg);
-          g_free (emsg);
-          g_free (sa);
+      instance = g_queue_pop_head (&priv->ready);
+      if (instance != NULL)
+        {
+          g_mutex_unlock (&priv->mutex);
+          break;
+        }
 
-          return FALSE;
+      /* Keep the instances alive while polling without the lock */
+      waiting = g_ptr_array_new_with_free_func ((GDestroyNotify) pipe_instance_unref);
+      for (i = 0; i < priv->endpoints->len; i++)
+        {
+          PipeEndpoint *endpoint = g_ptr_array_index (priv->endpoints, i);
+
+          for (j = 0; j < endpoint->instances->len; j++)
+            {
+              /* g_poll cannot wait on more handles, the instances which
+               * are not polled are checked again after a while */
+              if (waiting->len == MAX_POLLED_INSTANCES)
+                {
+                  timeout = POLL_INTERVAL_MS;
+                  break;
+                }
+
+              g_ptr_array_add (waiting, pipe_instance_ref (g_ptr_array_index (endpoint->instances, j)));
+            }
         }
 
-      priv->security_attributes = sa;
+      g_mutex_unlock (&priv->mutex);
+
+      pollfds = g_new (GPollFD, waiting->len + 1);
+      for (i = 0; i < waiting->len; i++)
+        {
+          PipeInstance *waiting_instance = g_ptr_array_index (waiting, i);
+
+#if GLIB_SIZEOF_VOID_P == 8
+          pollfds[i].fd = (gint64)waiting_instance->overlapped.overlapped.hEvent;
+#else
+          pollfds[i].fd = (gint)waiting_instance->overlapped.overlapped.hEvent;
+#endif
+          pollfds[i].events = G_IO_IN;
+          pollfds[i].revents = 0;
+        }
+      num = waiting->len;
+
+      if (g_cancellable_make_pollfd (cancellable, &pollfds[num]))
+        num++;
+
+      g_poll (pollfds, num, timeout);
+
+      if (num > (gint)waiting->len)
+        g_cancellable_release_fd (cancellable);
+
+      g_free (pollfds);
+      g_ptr_array_free (waiting, TRUE);
+    }
+
+  return pipe_instance_accept (instance, error);
+}
+
+/**
+ * wing_named_pipe_listener_accept_async:
+ * @listener: a #WingNamedPipeListener
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback
+ * @user_data: (closure): user data for the callback
+ *
+ * This is the asynchronous version of wing_named_pipe_listener_accept().
+ *
+ * When the operation is finished @callback will be
+ * called. You can then call wing_named_pipe_listener_accept_finish()
+ * to get the result of the operation.
+ */
+void
+wing_named_pipe_listener_accept_async (WingNamedPipeListener *listener,
+                                       GCancellable          *cancellable,
+                                       GAsyncReadyCallback    callback,
+                                       gpointer               user_data)
+{
+  WingNamedPipeListenerPrivate *priv;
+  WingNamedPipeConnection *connection;
+  PipeInstance *instance;
+  GTask *task;
+  GError *error = NULL;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  task = g_task_new (listener, cancellable, callback, user_data);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (!fill_backlog (listener, &error))
+    {
+      g_mutex_unlock (&priv->mutex);
+
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  instance = g_queue_pop_head (&priv->ready);
+  if (instance == NULL)
+    {
+      if (cancellable != NULL)
+        {
+          GSource *source;
+
+          source = g_cancellable_source_new (cancellable);
+          g_source_set_callback (source,
+                                 (GSourceFunc) accept_cancelled,
+                                 task, NULL);
+          g_source_attach (source, g_task_get_context (task));
+
+          g_task_set_task_data (task, source, (GDestroyNotify) free_source);
+        }
+
+      g_queue_push_tail (&priv->pending_tasks, task);
+      update_watches (listener);
+
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  g_mutex_unlock (&priv->mutex);
+
+  connection = pipe_instance_accept (instance, &error);
+  if (connection != NULL)
+    g_task_return_pointer (task, connection, g_object_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+/**
+ * wing_named_pipe_listener_accept_finish:
+ * @listener: a #WingNamedPipeListener.
+ * @result: a #GAsyncResult.
+ * @error: a #GError location to store the error occurring, or %NULL to ignore.
+ *
+ * Finishes an async accept operation. See wing_named_pipe_listener_accept_async()
+ *
+ * Returns: (transfer full): a #WingNamedPipeConnection on success, %NULL on error.
+ */
+WingNamedPipeConnection *
+wing_named_pipe_listener_accept_finish (WingNamedPipeListener  *listener,
+                                        GAsyncResult           *result,
+                                        GError                **error)
+{
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, listener), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+wing_named_pipe_listener_set_use_iocp (WingNamedPipeListener *listener,
+                                       gboolean               use_iocp)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  if (priv->use_iocp != use_iocp)
+    {
+      priv->use_iocp = use_iocp;
+      g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_USE_IOCP]);
     }
+}
+
+/**
+ * wing_named_pipe_listener_set_thread_pool:
+ * @listener: a #WingNamedPipeListener
+ * @thread_pool: (nullable): a #WingThreadPool, or %NULL
+ *
+ * Sets the thread pool to run the completions of the async I/O on, when
+ * using I/O completion port. The pipe instances are bound to it when they
+ * start waiting for a client, and the accepted connections keep using it.
+ * %NULL goes back to the default thread pool of the process. The
+ * instances already waiting for a client keep the pool they were bound to.
+ */
+void
+wing_named_pipe_listener_set_thread_pool (WingNamedPipeListener *listener,
+                                          WingThreadPool        *thread_pool)
+{
+  WingNamedPipeListenerPrivate *priv;
+  WingThreadPool *old_thread_pool;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->thread_pool == thread_pool)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  old_thread_pool = priv->thread_pool;
+  priv->thread_pool = thread_pool != NULL ? wing_thread_pool_ref (thread_pool) : NULL;
+
+  g_mutex_unlock (&priv->mutex);
+
+  if (old_thread_pool != NULL)
+    wing_thread_pool_unref (old_thread_pool);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_THREAD_POOL]);
+}
+
+/**
+ * wing_named_pipe_listener_get_thread_pool:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets the thread pool the completions of the async I/O run on.
+ *
+ * Returns: (transfer none) (nullable): the #WingThreadPool, or %NULL
+ * for the default thread pool of the process
+ */
+WingThreadPool *
+wing_named_pipe_listener_get_thread_pool (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), NULL);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->thread_pool;
+}
+
+/**
+ * wing_named_pipe_listener_set_io_priority:
+ * @listener: a #WingNamedPipeListener
+ * @io_priority: the I/O priority of the completions
+ *
+ * Sets the I/O priority the completions of the async I/O run with on the
+ * thread pool, when using I/O completion port, see
+ * wing_thread_pool_io_new_full(). Like the thread pool, it is fixed when
+ * a pipe instance starts waiting for a client, so a listener dedicated to
+ * the control traffic can be given a higher priority than the one for the
+ * bulk data. The instances already waiting keep their priority.
+ */
+void
+wing_named_pipe_listener_set_io_priority (WingNamedPipeListener *listener,
+                                          int                    io_priority)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->io_priority == io_priority)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  priv->io_priority = io_priority;
+
+  g_mutex_unlock (&priv->mutex);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_IO_PRIORITY]);
+}
+
+/**
+ * wing_named_pipe_listener_get_io_priority:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets the I/O priority the completions of the async I/O run with.
+ *
+ * Returns: the I/O priority
+ */
+int
+wing_named_pipe_listener_get_io_priority (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), G_PRIORITY_DEFAULT);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->io_priority;
+}
+
+/**
+ * wing_named_pipe_listener_set_backlog:
+ * @listener: a #WingNamedPipeListener
+ * @backlog: the number of pipe instances waiting for a client
+ *
+ * Sets the number of pipe instances the listener keeps waiting for a
+ * client. A bigger backlog lets bursts of clients connect without
+ * having to wait for the listener to create a new pipe instance after
+ * each accept. A bigger backlog is filled on the next accept, while
+ * lowering it closes the instances in excess right away.
+ */
+void
+wing_named_pipe_listener_set_backlog (WingNamedPipeListener *listener,
+                                      guint                  backlog)
+{
+  WingNamedPipeListenerPrivate *priv;
+  guint i;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+  g_return_if_fail (backlog > 0 && backlog <= MAX_BACKLOG);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->backlog == backlog)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  priv->backlog = backlog;
+
+  for (i = 0; i < priv->endpoints->len; i++)
+    trim_endpoint_backlog (listener, g_ptr_array_index (priv->endpoints, i));
+
+  g_mutex_unlock (&priv->mutex);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_BACKLOG]);
+}
+
+/**
+ * wing_named_pipe_listener_get_backlog:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets the number of pipe instances the listener keeps waiting for a client.
+ *
+ * Returns: the backlog of the listener
+ */
+guint
+wing_named_pipe_listener_get_backlog (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), 0);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->backlog;
+}
+
+/**
+ * wing_named_pipe_listener_set_message_mode:
+ * @listener: a #WingNamedPipeListener
+ * @message_mode: whether to create the named pipes in message mode
+ *
+ * Sets whether the named pipes are created in message mode. All the
+ * instances of a named pipe must have the same type, so the new value
+ * only applies to the named pipes added afterwards.
+ */
+void
+wing_named_pipe_listener_set_message_mode (WingNamedPipeListener *listener,
+                                           gboolean               message_mode)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  message_mode = !!message_mode;
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->message_mode == message_mode)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  priv->message_mode = message_mode;
+
+  g_mutex_unlock (&priv->mutex);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_MESSAGE_MODE]);
+}
+
+/**
+ * wing_named_pipe_listener_get_message_mode:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets whether the named pipes are created in message mode.
+ *
+ * Returns: %TRUE if the named pipes are created in message mode
+ */
+gboolean
+wing_named_pipe_listener_get_message_mode (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), FALSE);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->message_mode;
+}
+
+static void
+set_buffer_size (WingNamedPipeListener *listener,
+                 guint                 *field,
+                 guint                  buffer_size,
+                 GParamSpec            *pspec)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (*field == buffer_size)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  *field = buffer_size;
+
+  g_mutex_unlock (&priv->mutex);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), pspec);
+}
+
+/**
+ * wing_named_pipe_listener_set_in_buffer_size:
+ * @listener: a #WingNamedPipeListener
+ * @buffer_size: the size in bytes of the input buffer, or 0
+ *
+ * Sets the size of the input buffer of the pipe instances, which is
+ * how much the clients can write before having to wait for the server
+ * to read. The system rounds it to whole pages, and 0 lets it choose.
+ * The instances already waiting for a client keep their size, so the
+ * new value only applies to the instances created afterwards.
+ */
+void
+wing_named_pipe_listener_set_in_buffer_size (WingNamedPipeListener *listener,
+                                             guint                  buffer_size)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+  g_return_if_fail (buffer_size <= MAX_PIPE_BUF_SIZE);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  set_buffer_size (listener, &priv->in_buffer_size, buffer_size,
+                   props[PROP_IN_BUFFER_SIZE]);
+}
+
+/**
+ * wing_named_pipe_listener_get_in_buffer_size:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets the size of the input buffer of the pipe instances.
+ *
+ * Returns: the size in bytes of the input buffer
+ */
+guint
+wing_named_pipe_listener_get_in_buffer_size (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), 0);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->in_buffer_size;
+}
+
+/**
+ * wing_named_pipe_listener_set_out_buffer_size:
+ * @listener: a #WingNamedPipeListener
+ * @buffer_size: the size in bytes of the output buffer, or 0
+ *
+ * Sets the size of the output buffer of the pipe instances, which is
+ * how much the server can write before having to wait for the client
+ * to read. The system rounds it to whole pages, and 0 lets it choose.
+ * The new value only applies to the instances created afterwards.
+ */
+void
+wing_named_pipe_listener_set_out_buffer_size (WingNamedPipeListener *listener,
+                                              guint                  buffer_size)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+  g_return_if_fail (buffer_size <= MAX_PIPE_BUF_SIZE);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  set_buffer_size (listener, &priv->out_buffer_size, buffer_size,
+                   props[PROP_OUT_BUFFER_SIZE]);
+}
+
+/**
+ * wing_named_pipe_listener_get_out_buffer_size:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets the size of the output buffer of the pipe instances.
+ *
+ * Returns: the size in bytes of the output buffer
+ */
+guint
+wing_named_pipe_listener_get_out_buffer_size (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), 0);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->out_buffer_size;
+}
+
+/**
+ * wing_named_pipe_listener_set_adaptive_buffer_sizes:
+ * @listener: a #WingNamedPipeListener
+ * @adaptive_buffer_sizes: whether the buffer sizes follow the traffic
+ *
+ * Sets whether the buffer sizes of the pipe instances follow the traffic
+ * of the connections. When set, the listener keeps the byte counts of the
+ * last connections it accepted and sizes each new instance so that its
+ * buffers hold the largest transfers seen, or about 10 milliseconds of
+ * the observed throughput, between 4 KiB and 1 MiB. Until a direction
+ * has seen any traffic, #WingNamedPipeListener:in-buffer-size and
+ * #WingNamedPipeListener:out-buffer-size are used.
+ */
+void
+wing_named_pipe_listener_set_adaptive_buffer_sizes (WingNamedPipeListener *listener,
+                                                    gboolean               adaptive_buffer_sizes)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  adaptive_buffer_sizes = !!adaptive_buffer_sizes;
+
+  g_mutex_lock (&priv->mutex);
+
+  if (priv->adaptive_buffer_sizes == adaptive_buffer_sizes)
+    {
+      g_mutex_unlock (&priv->mutex);
+      return;
+    }
+
+  priv->adaptive_buffer_sizes = adaptive_buffer_sizes;
+
+  g_mutex_unlock (&priv->mutex);
+
+  g_object_notify_by_pspec (G_OBJECT (listener), props[PROP_ADAPTIVE_BUFFER_SIZES]);
+}
+
+/**
+ * wing_named_pipe_listener_get_adaptive_buffer_sizes:
+ * @listener: a #WingNamedPipeListener
+ *
+ * Gets whether the buffer sizes of the pipe instances follow the traffic
+ * of the connections.
+ *
+ * Returns: %TRUE if the buffer sizes are adaptive
+ */
+gboolean
+wing_named_pipe_listener_get_adaptive_buffer_sizes (WingNamedPipeListener *listener)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), FALSE);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  return priv->adaptive_buffer_sizes;
+}
+
+/**
+ * wing_named_pipe_listener_get_effective_buffer_sizes:
+ * @listener: a #WingNamedPipeListener
+ * @in_buffer_size: (out) (optional): return location for the input buffer size
+ * @out_buffer_size: (out) (optional): return location for the output buffer size
+ *
+ * Gets the buffer sizes the last pipe instance was created with, which
+ * differ from the configured ones when the buffer sizes are adaptive.
+ */
+void
+wing_named_pipe_listener_get_effective_buffer_sizes (WingNamedPipeListener *listener,
+                                                     guint                 *in_buffer_size,
+                                                     guint                 *out_buffer_size)
+{
+  WingNamedPipeListenerPrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener));
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+
+  if (in_buffer_size != NULL)
+    *in_buffer_size = priv->effective_in_buffer_size;
+  if (out_buffer_size != NULL)
+    *out_buffer_size = priv->effective_out_buffer_size;
+
+  g_mutex_unlock (&priv->mutex);
+}
+
+/* Must be called with the listener lock held */
+static gboolean
+add_endpoint (WingNamedPipeListener  *listener,
+              const gchar            *pipe_name,
+              const gchar            *security_descriptor,
+              gboolean                protect_first_instance,
+              GError                **error)
+{
+  WingNamedPipeListenerPrivate *priv;
+  PipeEndpoint *endpoint;
+  guint i;
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  endpoint = pipe_endpoint_new (pipe_name, security_descriptor, priv->message_mode, error);
+  if (endpoint == NULL)
+    return FALSE;
+
+  /* Clients can already connect to the instances before the first accept */
+  for (i = 0; i < priv->backlog; i++)
+    {
+      PipeInstance *instance;
+
+      instance = pipe_instance_new (listener, endpoint, i == 0 && protect_first_instance, error);
+      if (instance == NULL)
+        {
+          pipe_endpoint_free (endpoint);
+          return FALSE;
+        }
+
+      g_ptr_array_add (endpoint->instances, instance);
+    }
+
+  g_ptr_array_add (priv->endpoints, endpoint);
+
+  return TRUE;
+}
+
+/**
+ * wing_named_pipe_listener_add_named_pipe:
+ * @listener: a #WingNamedPipeListener
+ * @pipe_name: a name for the pipe.
+ * @security_descriptor: (allow-none): a security descriptor or %NULL.
+ * @protect_first_instance: if %TRUE, the pipe creation will fail if the pipe already exists
+ * @error: #GError for error reporting, or %NULL to ignore.
+ *
+ * Adds another named pipe to the listener, so that the accepts of the
+ * listener get the clients of all its named pipes. See
+ * wing_named_pipe_listener_new() for the details about the parameters.
+ *
+ * The name of the pipe a connection was accepted from can be retrieved
+ * with wing_named_pipe_connection_get_pipe_name().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ */
+gboolean
+wing_named_pipe_listener_add_named_pipe (WingNamedPipeListener  *listener,
+                                         const gchar            *pipe_name,
+                                         const gchar            *security_descriptor,
+                                         gboolean                protect_first_instance,
+                                         GError                **error)
+{
+  WingNamedPipeListenerPrivate *priv;
+  gboolean success;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (listener), FALSE);
+  g_return_val_if_fail (pipe_name != NULL, FALSE);
+
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  g_mutex_lock (&priv->mutex);
+  success = add_endpoint (listener, pipe_name, security_descriptor,
+                          protect_first_instance, error);
+  g_mutex_unlock (&priv->mutex);
+
+  /* Let the pending accepts wait on the new instances too */
+  if (success)
+    process_backlog (listener);
+
+  return success;
+}
+
+static gboolean
+wing_named_pipe_listener_initable_init (GInitable     *initable,
+                                        GCancellable  *cancellable,
+                                        GError       **error)
+{
+  WingNamedPipeListener *listener;
+  WingNamedPipeListenerPrivate *priv;
+  gboolean success;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_LISTENER (initable), FALSE);
+
+  listener = WING_NAMED_PIPE_LISTENER (initable);
+  priv = wing_named_pipe_listener_get_instance_private (listener);
+
+  /* The listener can also be created empty and filled with
+   * wing_named_pipe_listener_add_named_pipe() */
+  if (priv->pipe_name == NULL)
+    return TRUE;
+
+  g_mutex_lock (&priv->mutex);
+  success = add_endpoint (listener,
+                          priv->pipe_name,
+                          priv->security_descriptor,
+                          priv->protect_first_instance,
+                          error);
+  g_mutex_unlock (&priv->mutex);
 
-  return create_pipe (priv, priv->protect_first_instance, error);
+  return success;
 }
 
 static void
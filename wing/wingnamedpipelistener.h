@@ -20,7 +20,9 @@
 #define WING_NAMED_PIPE_LISTENER_H
 
 #include <gio/gio.h>
-#include <wing/wing.h>
+#include <wing/wingversionmacros.h>
+#include <wing/wingnamedpipeconnection.h>
+#include <wing/wingthreadpool.h>
 
 G_BEGIN_DECLS
 
@@ -58,6 +60,13 @@ WingNamedPipeListener    *wing_named_pipe_listener_new            (const gchar
                                                                    GCancellable           *cancellable,
                                                                    GError                **error);
 
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_listener_add_named_pipe (WingNamedPipeListener  *listener,
+                                                                   const gchar            *pipe_name,
+                                                                   const gchar            *security_descriptor,
+                                                                   gboolean                protect_first_instance,
+                                                                   GError                **error);
+
 WING_AVAILABLE_IN_ALL
 WingNamedPipeConnection  *wing_named_pipe_listener_accept         (WingNamedPipeListener  *listener,
                                                                    GCancellable           *cancellable,
@@ -78,6 +87,60 @@ WING_AVAILABLE_IN_ALL
 void                      wing_named_pipe_listener_set_use_iocp   (WingNamedPipeListener  *listener,
                                                                    gboolean                use_iocp);
 
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_thread_pool (WingNamedPipeListener  *listener,
+                                                                    WingThreadPool         *thread_pool);
+
+WING_AVAILABLE_IN_ALL
+WingThreadPool           *wing_named_pipe_listener_get_thread_pool (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_io_priority (WingNamedPipeListener  *listener,
+                                                                    int                     io_priority);
+
+WING_AVAILABLE_IN_ALL
+int                       wing_named_pipe_listener_get_io_priority (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_backlog    (WingNamedPipeListener  *listener,
+                                                                   guint                   backlog);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_listener_get_backlog    (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_message_mode (WingNamedPipeListener  *listener,
+                                                                     gboolean                message_mode);
+
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_listener_get_message_mode (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_in_buffer_size (WingNamedPipeListener  *listener,
+                                                                       guint                   buffer_size);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_listener_get_in_buffer_size (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_out_buffer_size (WingNamedPipeListener  *listener,
+                                                                        guint                   buffer_size);
+
+WING_AVAILABLE_IN_ALL
+guint                     wing_named_pipe_listener_get_out_buffer_size (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_set_adaptive_buffer_sizes (WingNamedPipeListener  *listener,
+                                                                              gboolean                adaptive_buffer_sizes);
+
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_listener_get_adaptive_buffer_sizes (WingNamedPipeListener  *listener);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_listener_get_effective_buffer_sizes (WingNamedPipeListener  *listener,
+                                                                               guint                  *in_buffer_size,
+                                                                               guint                  *out_buffer_size);
+
 G_END_DECLS
 
 #endif /* WING_NAMED_PIPE_LISTENER_H */
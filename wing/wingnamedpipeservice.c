@@ -0,0 +1,683 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "wingnamedpipeservice.h"
+#include <wing/wingenumtypes.h>
+
+/**
+ * SECTION:wingnamedpipeservice
+ * @short_description: Make it easy to implement a named pipe server
+ * @see_also: #WingNamedPipeListener
+ *
+ * A #WingNamedPipeService is a #WingNamedPipeListener which keeps an
+ * accept always pending while it is active, and emits the
+ * #WingNamedPipeService::incoming signal for each accepted connection.
+ *
+ * By default the signal is emitted on the thread-default main context
+ * of the caller of wing_named_pipe_service_start(). If
+ * #WingNamedPipeService:max-threads is not 0, the signal is emitted from
+ * a pool of at most that many threads instead, so that the handlers can
+ * block without delaying the following accepts.
+ *
+ * If #WingNamedPipeService:n-workers is not 0, the service runs that many
+ * worker threads, each one with its own #GMainContext, and distributes
+ * the connections among them following the
+ * #WingNamedPipeService:worker-policy. The signal is then emitted on
+ * the thread-default main context of the worker owning the connection,
+ * so that the async operations started by the handlers complete on it.
+ * A worker outlives the service until the last of its connections is
+ * finalized.
+ */
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  GThread *thread;
+  GMainLoop *loop;
+  volatile gint n_connections;
+} ServiceWorker;
+
+typedef struct
+{
+  gboolean active;
+  gboolean outstanding_accept;
+  GCancellable *cancellable;
+
+  guint max_threads;
+  GThreadPool *thread_pool;
+
+  guint n_workers;
+  WingNamedPipeServiceWorkerPolicy worker_policy;
+  GPtrArray *workers;
+  guint next_worker;
+} WingNamedPipeServicePrivate;
+
+enum
+{
+  PROP_0,
+  PROP_ACTIVE,
+  PROP_MAX_THREADS,
+  PROP_N_WORKERS,
+  PROP_WORKER_POLICY,
+  LAST_PROP
+};
+
+static GParamSpec *props[LAST_PROP];
+
+enum
+{
+  INCOMING,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE_WITH_PRIVATE (WingNamedPipeService, wing_named_pipe_service, WING_TYPE_NAMED_PIPE_LISTENER)
+
+typedef struct
+{
+  WingNamedPipeService *service;
+  WingNamedPipeConnection *connection;
+} IncomingData;
+
+static void do_accept (WingNamedPipeService *service);
+
+static void
+emit_incoming (WingNamedPipeService    *service,
+               WingNamedPipeConnection *connection)
+{
+  gboolean result;
+
+  g_signal_emit (service, signals[INCOMING], 0, connection, &result);
+}
+
+static void
+incoming_thread_func (gpointer data,
+                      gpointer user_data)
+{
+  IncomingData *incoming_data = data;
+
+  emit_incoming (incoming_data->service, incoming_data->connection);
+
+  g_object_unref (incoming_data->connection);
+  g_object_unref (incoming_data->service);
+  g_slice_free (IncomingData, incoming_data);
+}
+
+static ServiceWorker *
+service_worker_ref (ServiceWorker *worker)
+{
+  g_atomic_int_inc (&worker->ref_count);
+
+  return worker;
+}
+
+static void
+service_worker_unref (ServiceWorker *worker)
+{
+  if (g_atomic_int_dec_and_test (&worker->ref_count))
+    {
+      g_main_loop_quit (worker->loop);
+
+      /* The last reference may be dropped on the worker itself, by a
+       * connection finalized from one of its callbacks */
+      if (worker->thread != g_thread_self ())
+        g_thread_join (worker->thread);
+      else
+        g_thread_unref (worker->thread);
+
+      g_main_loop_unref (worker->loop);
+      g_slice_free (ServiceWorker, worker);
+    }
+}
+
+static gpointer
+service_worker_thread_func (gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+  GMainContext *context;
+
+  context = g_main_loop_get_context (loop);
+
+  g_main_context_push_thread_default (context);
+  g_main_loop_run (loop);
+  g_main_context_pop_thread_default (context);
+
+  g_main_loop_unref (loop);
+
+  return NULL;
+}
+
+static ServiceWorker *
+service_worker_new (guint index)
+{
+  ServiceWorker *worker;
+  GMainContext *context;
+  gchar *name;
+
+  worker = g_slice_new0 (ServiceWorker);
+  worker->ref_count = 1;
+
+  context = g_main_context_new ();
+  worker->loop = g_main_loop_new (context, FALSE);
+  g_main_context_unref (context);
+
+  name = g_strdup_printf ("wing-pipe-worker-%u", index);
+  worker->thread = g_thread_new (name, service_worker_thread_func, g_main_loop_ref (worker->loop));
+  g_free (name);
+
+  return worker;
+}
+
+static void
+connection_finalized (gpointer  user_data,
+                      GObject  *where_the_object_was)
+{
+  ServiceWorker *worker = user_data;
+
+  g_atomic_int_add (&worker->n_connections, -1);
+  service_worker_unref (worker);
+}
+
+static ServiceWorker *
+pick_worker (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+  ServiceWorker *worker;
+  guint i;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  if (priv->worker_policy == WING_NAMED_PIPE_SERVICE_WORKER_LEAST_LOADED)
+    {
+      worker = g_ptr_array_index (priv->workers, 0);
+      for (i = 1; i < priv->workers->len; i++)
+        {
+          ServiceWorker *candidate = g_ptr_array_index (priv->workers, i);
+
+          if (g_atomic_int_get (&candidate->n_connections) < g_atomic_int_get (&worker->n_connections))
+            worker = candidate;
+        }
+    }
+  else
+    {
+      worker = g_ptr_array_index (priv->workers, priv->next_worker);
+      priv->next_worker = (priv->next_worker + 1) % priv->workers->len;
+    }
+
+  return worker;
+}
+
+static gboolean
+worker_incoming (gpointer user_data)
+{
+  IncomingData *incoming_data = user_data;
+
+  emit_incoming (incoming_data->service, incoming_data->connection);
+
+  g_object_unref (incoming_data->connection);
+  g_object_unref (incoming_data->service);
+  g_slice_free (IncomingData, incoming_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+accepted_cb (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  WingNamedPipeService *service = WING_NAMED_PIPE_SERVICE (source);
+  WingNamedPipeServicePrivate *priv;
+  WingNamedPipeConnection *connection;
+  GCancellable *cancellable = user_data;
+  GError *error = NULL;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  /* Keep the service alive while emitting the signal */
+  g_object_ref (service);
+
+  connection = wing_named_pipe_listener_accept_finish (WING_NAMED_PIPE_LISTENER (service),
+                                                       result, &error);
+
+  /* An accept cancelled by a stop may complete after a restart */
+  if (cancellable == priv->cancellable)
+    {
+      priv->outstanding_accept = FALSE;
+
+      /* Re-arm right away so that the next client does not wait on the handlers */
+      if (priv->active)
+        do_accept (service);
+    }
+
+  g_object_unref (cancellable);
+
+  if (connection != NULL)
+    {
+      if (priv->workers != NULL)
+        {
+          IncomingData *incoming_data;
+          ServiceWorker *worker;
+
+          worker = pick_worker (service);
+
+          /* The worker owns the connection until it is finalized */
+          g_atomic_int_inc (&worker->n_connections);
+          g_object_weak_ref (G_OBJECT (connection), connection_finalized,
+                             service_worker_ref (worker));
+
+          incoming_data = g_slice_new (IncomingData);
+          incoming_data->service = g_object_ref (service);
+          incoming_data->connection = connection;
+
+          g_main_context_invoke (g_main_loop_get_context (worker->loop),
+                                 worker_incoming, incoming_data);
+        }
+      else if (priv->thread_pool != NULL)
+        {
+          IncomingData *incoming_data;
+
+          incoming_data = g_slice_new (IncomingData);
+          incoming_data->service = g_object_ref (service);
+          incoming_data->connection = connection;
+
+          g_thread_pool_push (priv->thread_pool, incoming_data, NULL);
+        }
+      else
+        {
+          emit_incoming (service, connection);
+          g_object_unref (connection);
+        }
+    }
+  else
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Failed to accept named pipe connection: %s", error->message);
+
+      g_error_free (error);
+    }
+
+  g_object_unref (service);
+}
+
+static void
+do_accept (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  if (priv->outstanding_accept)
+    return;
+
+  wing_named_pipe_listener_accept_async (WING_NAMED_PIPE_LISTENER (service),
+                                         priv->cancellable,
+                                         accepted_cb,
+                                         g_object_ref (priv->cancellable));
+  priv->outstanding_accept = TRUE;
+}
+
+static void
+wing_named_pipe_service_finalize (GObject *object)
+{
+  WingNamedPipeService *service = WING_NAMED_PIPE_SERVICE (object);
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  /* The jobs hold a reference on the service, so the pool is idle */
+  if (priv->thread_pool != NULL)
+    g_thread_pool_free (priv->thread_pool, FALSE, FALSE);
+
+  if (priv->workers != NULL)
+    {
+      /* The workers keep running until the connections handed to them
+       * are gone, so that their pending operations still complete */
+      g_ptr_array_foreach (priv->workers, (GFunc) service_worker_unref, NULL);
+      g_ptr_array_free (priv->workers, TRUE);
+    }
+
+  g_object_unref (priv->cancellable);
+
+  G_OBJECT_CLASS (wing_named_pipe_service_parent_class)->finalize (object);
+}
+
+static void
+wing_named_pipe_service_constructed (GObject *object)
+{
+  WingNamedPipeService *service = WING_NAMED_PIPE_SERVICE (object);
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  if (priv->n_workers > 0)
+    {
+      guint i;
+
+      priv->workers = g_ptr_array_sized_new (priv->n_workers);
+      for (i = 0; i < priv->n_workers; i++)
+        g_ptr_array_add (priv->workers, service_worker_new (i));
+    }
+  else if (priv->max_threads > 0)
+    priv->thread_pool = g_thread_pool_new (incoming_thread_func,
+                                           NULL,
+                                           priv->max_threads,
+                                           FALSE,
+                                           NULL);
+
+  G_OBJECT_CLASS (wing_named_pipe_service_parent_class)->constructed (object);
+}
+
+static void
+wing_named_pipe_service_set_property (GObject      *object,
+                                      guint         prop_id,
+                                      const GValue *value,
+                                      GParamSpec   *pspec)
+{
+  WingNamedPipeService *service = WING_NAMED_PIPE_SERVICE (object);
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  switch (prop_id)
+    {
+    case PROP_ACTIVE:
+      if (g_value_get_boolean (value))
+        wing_named_pipe_service_start (service);
+      else
+        wing_named_pipe_service_stop (service);
+      break;
+
+    case PROP_MAX_THREADS:
+      priv->max_threads = g_value_get_uint (value);
+      break;
+
+    case PROP_N_WORKERS:
+      priv->n_workers = g_value_get_uint (value);
+      break;
+
+    case PROP_WORKER_POLICY:
+      priv->worker_policy = g_value_get_enum (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+wing_named_pipe_service_get_property (GObject    *object,
+                                      guint       prop_id,
+                                      GValue     *value,
+                                      GParamSpec *pspec)
+{
+  WingNamedPipeService *service = WING_NAMED_PIPE_SERVICE (object);
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  switch (prop_id)
+    {
+    case PROP_ACTIVE:
+      g_value_set_boolean (value, priv->active);
+      break;
+
+    case PROP_MAX_THREADS:
+      g_value_set_uint (value, priv->max_threads);
+      break;
+
+    case PROP_N_WORKERS:
+      g_value_set_uint (value, priv->n_workers);
+      break;
+
+    case PROP_WORKER_POLICY:
+      g_value_set_enum (value, priv->worker_policy);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+wing_named_pipe_service_class_init (WingNamedPipeServiceClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = wing_named_pipe_service_finalize;
+  gobject_class->constructed = wing_named_pipe_service_constructed;
+  gobject_class->get_property = wing_named_pipe_service_get_property;
+  gobject_class->set_property = wing_named_pipe_service_set_property;
+
+  /**
+   * WingNamedPipeService:active:
+   *
+   * Whether the service is currently accepting connections.
+   */
+  props[PROP_ACTIVE] =
+    g_param_spec_boolean ("active",
+                          "Active",
+                          "Whether the service is currently accepting connections",
+                          FALSE,
+                          G_PARAM_READWRITE |
+                          G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeService:max-threads:
+   *
+   * The maximum number of threads handling the incoming connections,
+   * or 0 to handle them on the main context the service was started on.
+   */
+  props[PROP_MAX_THREADS] =
+    g_param_spec_uint ("max-threads",
+                       "Max threads",
+                       "The maximum number of threads handling the incoming connections",
+                       0,
+                       G_MAXINT,
+                       0,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeService:n-workers:
+   *
+   * The number of worker threads, each one running its own main context,
+   * the connections are distributed to. If not 0, it takes precedence
+   * over #WingNamedPipeService:max-threads.
+   */
+  props[PROP_N_WORKERS] =
+    g_param_spec_uint ("n-workers",
+                       "Number of workers",
+                       "The number of worker threads the connections are distributed to",
+                       0,
+                       G_MAXINT,
+                       0,
+                       G_PARAM_READWRITE |
+                       G_PARAM_CONSTRUCT_ONLY |
+                       G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingNamedPipeService:worker-policy:
+   *
+   * The #WingNamedPipeServiceWorkerPolicy used to pick the worker of
+   * a new connection.
+   */
+  props[PROP_WORKER_POLICY] =
+    g_param_spec_enum ("worker-policy",
+                       "Worker policy",
+                       "How the connections are distributed to the workers",
+                       WING_TYPE_NAMED_PIPE_SERVICE_WORKER_POLICY,
+                       WING_NAMED_PIPE_SERVICE_WORKER_ROUND_ROBIN,
+                       G_PARAM_READWRITE |
+                       G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, LAST_PROP, props);
+
+  /**
+   * WingNamedPipeService::incoming:
+   * @service: the #WingNamedPipeService
+   * @connection: a new #WingNamedPipeConnection object
+   *
+   * The ::incoming signal is emitted when a new incoming connection
+   * has been accepted. The connection is released once the handlers
+   * returned, so take a reference on it to keep using it.
+   *
+   * If #WingNamedPipeService:n-workers or #WingNamedPipeService:max-threads
+   * is not 0, the signal is emitted from one of the threads of the service.
+   *
+   * Returns: %TRUE to stop other handlers from being called
+   */
+  signals[INCOMING] =
+    g_signal_new ("incoming",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (WingNamedPipeServiceClass, incoming),
+                  g_signal_accumulator_true_handled, NULL,
+                  NULL,
+                  G_TYPE_BOOLEAN,
+                  1, WING_TYPE_NAMED_PIPE_CONNECTION);
+}
+
+static void
+wing_named_pipe_service_init (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  priv->cancellable = g_cancellable_new ();
+}
+
+/**
+ * wing_named_pipe_service_new:
+ * @pipe_name: a name for the pipe.
+ * @security_descriptor: (allow-none): a security descriptor or %NULL.
+ * @protect_first_instance: if %TRUE, the pipe creation will fail if the pipe already exists
+ * @max_threads: the maximum number of threads handling the incoming connections,
+ *   or 0 to handle them on the main context
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore.
+ * @error: #GError for error reporting, or %NULL to ignore.
+ *
+ * Creates a new #WingNamedPipeService. See wing_named_pipe_listener_new()
+ * for the details about the pipe parameters.
+ *
+ * The service is not accepting connections until
+ * wing_named_pipe_service_start() is called.
+ *
+ * Returns: (transfer full): a new #WingNamedPipeService.
+ */
+WingNamedPipeService *
+wing_named_pipe_service_new (const gchar            *pipe_name,
+                             const gchar            *security_descriptor,
+                             gboolean                protect_first_instance,
+                             guint                   max_threads,
+                             GCancellable           *cancellable,
+                             GError                **error)
+{
+  return g_initable_new (WING_TYPE_NAMED_PIPE_SERVICE,
+                         cancellable,
+                         error,
+                         "pipe-name", pipe_name,
+                         "security-descriptor", security_descriptor,
+                         "protect-first-instance", protect_first_instance,
+                         "max-threads", max_threads,
+                         NULL);
+}
+
+/**
+ * wing_named_pipe_service_start:
+ * @service: a #WingNamedPipeService
+ *
+ * Starts accepting the incoming connections. The accepts are performed
+ * on the thread-default main context of the caller, which must be
+ * running for the service to work.
+ */
+void
+wing_named_pipe_service_start (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_SERVICE (service));
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  if (priv->active)
+    return;
+
+  priv->active = TRUE;
+  do_accept (service);
+
+  g_object_notify_by_pspec (G_OBJECT (service), props[PROP_ACTIVE]);
+}
+
+/**
+ * wing_named_pipe_service_stop:
+ * @service: a #WingNamedPipeService
+ *
+ * Stops accepting the incoming connections. The connections which are
+ * being handled are not affected.
+ *
+ * Note that the pending accept keeps a reference on the service, so
+ * the service must be stopped to be released.
+ */
+void
+wing_named_pipe_service_stop (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_SERVICE (service));
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  if (!priv->active)
+    return;
+
+  priv->active = FALSE;
+
+  g_cancellable_cancel (priv->cancellable);
+  g_object_unref (priv->cancellable);
+  priv->cancellable = g_cancellable_new ();
+  priv->outstanding_accept = FALSE;
+
+  g_object_notify_by_pspec (G_OBJECT (service), props[PROP_ACTIVE]);
+}
+
+/**
+ * wing_named_pipe_service_is_active:
+ * @service: a #WingNamedPipeService
+ *
+ * Checks whether @service is accepting the incoming connections.
+ *
+ * Returns: %TRUE if the service is active
+ */
+gboolean
+wing_named_pipe_service_is_active (WingNamedPipeService *service)
+{
+  WingNamedPipeServicePrivate *priv;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_SERVICE (service), FALSE);
+
+  priv = wing_named_pipe_service_get_instance_private (service);
+
+  return priv->active;
+}
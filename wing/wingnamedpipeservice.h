@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_NAMED_PIPE_SERVICE_H
+#define WING_NAMED_PIPE_SERVICE_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+#include <wing/wingnamedpipelistener.h>
+#include <wing/wingnamedpipeconnection.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_NAMED_PIPE_SERVICE            (wing_named_pipe_service_get_type ())
+#define WING_NAMED_PIPE_SERVICE(o)              (G_TYPE_CHECK_INSTANCE_CAST ((o), WING_TYPE_NAMED_PIPE_SERVICE, WingNamedPipeService))
+#define WING_NAMED_PIPE_SERVICE_CLASS(k)        (G_TYPE_CHECK_CLASS_CAST ((k), WING_TYPE_NAMED_PIPE_SERVICE, WingNamedPipeServiceClass))
+#define WING_IS_NAMED_PIPE_SERVICE(o)           (G_TYPE_CHECK_INSTANCE_TYPE ((o), WING_TYPE_NAMED_PIPE_SERVICE))
+#define WING_IS_NAMED_PIPE_SERVICE_CLASS(k)     (G_TYPE_CHECK_CLASS_TYPE ((k),  WING_TYPE_NAMED_PIPE_SERVICE))
+#define WING_NAMED_PIPE_SERVICE_GET_CLASS(o)    (G_TYPE_INSTANCE_GET_CLASS ((o), WING_TYPE_NAMED_PIPE_SERVICE, WingNamedPipeServiceClass))
+
+/**
+ * WingNamedPipeServiceWorkerPolicy:
+ * @WING_NAMED_PIPE_SERVICE_WORKER_ROUND_ROBIN: the connections are given to the workers in turn
+ * @WING_NAMED_PIPE_SERVICE_WORKER_LEAST_LOADED: the connections are given to the worker
+ *   which owns the fewest connections
+ *
+ * How a #WingNamedPipeService distributes the connections to its workers.
+ */
+typedef enum
+{
+  WING_NAMED_PIPE_SERVICE_WORKER_ROUND_ROBIN,
+  WING_NAMED_PIPE_SERVICE_WORKER_LEAST_LOADED
+} WingNamedPipeServiceWorkerPolicy;
+
+typedef struct _WingNamedPipeService                       WingNamedPipeService;
+typedef struct _WingNamedPipeServiceClass                  WingNamedPipeServiceClass;
+
+struct _WingNamedPipeService
+{
+  /*< private >*/
+  WingNamedPipeListener parent_instance;
+};
+
+struct _WingNamedPipeServiceClass
+{
+  WingNamedPipeListenerClass parent_class;
+
+  gboolean (*incoming) (WingNamedPipeService    *service,
+                        WingNamedPipeConnection *connection);
+
+  /*< private >*/
+  gpointer padding[10];
+};
+
+WING_AVAILABLE_IN_ALL
+GType                     wing_named_pipe_service_get_type        (void) G_GNUC_CONST;
+
+WING_AVAILABLE_IN_ALL
+WingNamedPipeService     *wing_named_pipe_service_new             (const gchar            *pipe_name,
+                                                                   const gchar            *security_descriptor,
+                                                                   gboolean                protect_first_instance,
+                                                                   guint                   max_threads,
+                                                                   GCancellable           *cancellable,
+                                                                   GError                **error);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_service_start           (WingNamedPipeService   *service);
+
+WING_AVAILABLE_IN_ALL
+void                      wing_named_pipe_service_stop            (WingNamedPipeService   *service);
+
+WING_AVAILABLE_IN_ALL
+gboolean                  wing_named_pipe_service_is_active       (WingNamedPipeService   *service);
+
+G_END_DECLS
+
+#endif /* WING_NAMED_PIPE_SERVICE_H */
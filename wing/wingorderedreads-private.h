@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_ORDERED_READS_PRIVATE_H
+#define WING_ORDERED_READS_PRIVATE_H
+
+#include "wingthreadpoolio.h"
+
+#include <gio/gio.h>
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* Keeps several overlapped reads in flight on a handle and hands their
+ * data out in the order they were posted, one read for each waiting
+ * task. Shared by #WingIocpReader and #WingFileReader, which only differ
+ * in where the buffers come from and in how the offsets and the end of
+ * the data are found */
+typedef struct _WingOrderedReads WingOrderedReads;
+
+typedef enum
+{
+  WING_ORDERED_READ_DATA,
+  WING_ORDERED_READ_SKIP,
+  WING_ORDERED_READ_EOF,
+  WING_ORDERED_READ_ERROR
+} WingOrderedReadStatus;
+
+typedef struct
+{
+  /* Gets a buffer of the size of the reads */
+  gpointer              (*acquire_buffer)       (gpointer  owner);
+
+  /* Frees a buffer which was not handed out */
+  void                  (*release_buffer)       (gpointer  owner,
+                                                 gpointer  buffer);
+
+  /* Hands out the @size bytes read into @buffer, which is taken over */
+  GBytes               *(*wrap_buffer)          (gpointer  owner,
+                                                 gpointer  buffer,
+                                                 gsize     size);
+
+  /* Gets the offset of the read with sequence number @seq, or returns
+   * FALSE if it is past the end of the data. Without it the handle is
+   * read at offset 0 until the end of the data is reached */
+  gboolean              (*get_offset)           (gpointer  owner,
+                                                 guint64   seq,
+                                                 guint64  *offset);
+
+  /* Tells what a read which is over yielded. A skipped read is dropped
+   * and posted again */
+  WingOrderedReadStatus (*check_result)         (gpointer  owner,
+                                                 DWORD     result,
+                                                 DWORD     transferred);
+} WingOrderedReadsHooks;
+
+/* @owner is the source object of the tasks, and is kept alive while
+ * reads are in flight. The reads have to be used from the thread-default
+ * main context at the time this is called */
+WingOrderedReads     *_wing_ordered_reads_new           (gpointer                      owner,
+                                                         const WingOrderedReadsHooks  *hooks,
+                                                         WingThreadPoolIo             *thread_pool_io,
+                                                         guint                         n_reads,
+                                                         gsize                         buffer_size,
+                                                         const gchar                  *error_message);
+
+/* Every read in flight holds a reference on the owner, so they must all
+ * be over */
+void                  _wing_ordered_reads_free          (WingOrderedReads             *reads);
+
+/* Returns the next buffer read through @task, a #GBytes, whose reference
+ * is taken over */
+void                  _wing_ordered_reads_queue         (WingOrderedReads             *reads,
+                                                         GTask                        *task);
+
+void                  _wing_ordered_reads_close         (WingOrderedReads             *reads);
+
+G_END_DECLS
+
+#endif /* WING_ORDERED_READS_PRIVATE_H */
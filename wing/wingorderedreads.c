@@ -0,0 +1,492 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingorderedreads-private.h"
+#include "wingthreadpoolio-private.h"
+#include "wingutils.h"
+
+#include <windows.h>
+#include <string.h>
+
+typedef enum
+{
+  SLOT_IDLE,
+  SLOT_PENDING,
+  SLOT_DONE
+} SlotState;
+
+typedef struct
+{
+  /* Must be the first member, it is given to ReadFile */
+  WingOverlappedData overlapped;
+
+  WingOrderedReads *reads;
+  gpointer buffer;
+
+  /* Written by the completion, protected by the lock */
+  SlotState state;
+  DWORD result;
+  DWORD transferred;
+} ReadSlot;
+
+/* The task data of a waiting task */
+typedef struct
+{
+  WingOrderedReads *reads;
+  GSource *cancellable_source;
+} Waiter;
+
+struct _WingOrderedReads
+{
+  gpointer owner;
+  const WingOrderedReadsHooks *hooks;
+  WingThreadPoolIo *thread_pool_io;
+  guint n_reads;
+  gsize buffer_size;
+  gchar *error_message;
+  GMainContext *context;
+
+  GMutex mutex;
+
+  /* The read with sequence number n uses slots[n % n_reads], the reads
+   * being handed out in the same order as they are posted */
+  ReadSlot *slots;
+  guint64 next_post;
+  guint64 next_deliver;
+
+  /* GTask waiting for data, the oldest first */
+  GQueue waiters;
+  gboolean delivering;
+
+  gboolean eof;
+  gboolean closed;
+  GError *error;
+};
+
+WingOrderedReads *
+_wing_ordered_reads_new (gpointer                      owner,
+                         const WingOrderedReadsHooks  *hooks,
+                         WingThreadPoolIo             *thread_pool_io,
+                         guint                         n_reads,
+                         gsize                         buffer_size,
+                         const gchar                  *error_message)
+{
+  WingOrderedReads *reads;
+  guint i;
+
+  reads = g_slice_new0 (WingOrderedReads);
+  reads->owner = owner;
+  reads->hooks = hooks;
+  reads->thread_pool_io = wing_thread_pool_io_ref (thread_pool_io);
+  reads->n_reads = n_reads;
+  reads->buffer_size = buffer_size;
+  reads->error_message = g_strdup (error_message);
+  reads->context = g_main_context_ref_thread_default ();
+  g_mutex_init (&reads->mutex);
+  g_queue_init (&reads->waiters);
+
+  reads->slots = g_new0 (ReadSlot, n_reads);
+  for (i = 0; i < n_reads; i++)
+    {
+      reads->slots[i].reads = reads;
+      reads->slots[i].buffer = hooks->acquire_buffer (owner);
+    }
+
+  return reads;
+}
+
+void
+_wing_ordered_reads_free (WingOrderedReads *reads)
+{
+  guint i;
+
+  g_assert (g_queue_is_empty (&reads->waiters));
+
+  for (i = 0; i < reads->n_reads; i++)
+    reads->hooks->release_buffer (reads->owner, reads->slots[i].buffer);
+  g_free (reads->slots);
+
+  wing_thread_pool_io_unref (reads->thread_pool_io);
+  g_main_context_unref (reads->context);
+  g_clear_error (&reads->error);
+  g_free (reads->error_message);
+  g_mutex_clear (&reads->mutex);
+
+  g_slice_free (WingOrderedReads, reads);
+}
+
+static void
+waiter_free (gpointer user_data)
+{
+  Waiter *waiter = user_data;
+
+  g_source_unref (waiter->cancellable_source);
+  g_slice_free (Waiter, waiter);
+}
+
+static void
+deliver (WingOrderedReads *reads);
+
+static gboolean
+dispatch_reads (gpointer user_data)
+{
+  deliver (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+unref_owner (gpointer user_data)
+{
+  WingOrderedReads *reads = user_data;
+
+  g_object_unref (reads->owner);
+}
+
+/* Takes over a reference on the owner */
+static void
+schedule_dispatch (WingOrderedReads *reads)
+{
+  GSource *source;
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, dispatch_reads, reads, unref_owner);
+  g_source_attach (source, reads->context);
+  g_source_unref (source);
+}
+
+static void
+read_completion (PTP_CALLBACK_INSTANCE instance,
+                 PVOID                 ctxt,
+                 PVOID                 overlapped,
+                 ULONG                 result,
+                 ULONG_PTR             number_of_bytes_transferred,
+                 PTP_IO                threadpool_io,
+                 gpointer              user_data)
+{
+  ReadSlot *slot = user_data;
+  WingOrderedReads *reads = slot->reads;
+
+  g_mutex_lock (&reads->mutex);
+  slot->result = result;
+  slot->transferred = (DWORD) number_of_bytes_transferred;
+  slot->state = SLOT_DONE;
+  g_mutex_unlock (&reads->mutex);
+
+  /* The reference taken when the read was posted */
+  schedule_dispatch (reads);
+}
+
+static void
+post_read (WingOrderedReads *reads,
+           ReadSlot         *slot,
+           guint64           offset)
+{
+  HANDLE handle;
+  int errsv;
+
+  handle = wing_thread_pool_get_handle (reads->thread_pool_io);
+
+  memset (&slot->overlapped, 0, sizeof (slot->overlapped));
+  slot->overlapped.user_data = slot;
+  slot->overlapped.callback = read_completion;
+  slot->overlapped.overlapped.OffsetHigh = (DWORD) (offset >> 32);
+  slot->overlapped.overlapped.Offset = (DWORD) offset;
+
+  g_mutex_lock (&reads->mutex);
+  slot->state = SLOT_PENDING;
+  g_mutex_unlock (&reads->mutex);
+
+  /* Released once the completion is dispatched */
+  g_object_ref (reads->owner);
+
+  wing_thread_pool_io_start (reads->thread_pool_io);
+
+  if (ReadFile (handle, slot->buffer, (DWORD) reads->buffer_size, NULL, (OVERLAPPED *) slot))
+    {
+      _wing_thread_pool_io_complete_sync (reads->thread_pool_io, &slot->overlapped);
+      return;
+    }
+
+  /* A message longer than the buffer is completed as a success */
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_PENDING || errsv == ERROR_MORE_DATA)
+    return;
+
+  wing_thread_pool_io_cancel (reads->thread_pool_io);
+
+  g_mutex_lock (&reads->mutex);
+  slot->result = errsv;
+  slot->transferred = 0;
+  slot->state = SLOT_DONE;
+  g_mutex_unlock (&reads->mutex);
+
+  schedule_dispatch (reads);
+}
+
+/* Whether no more reads are to be posted. *@offset is the one of the
+ * next read otherwise */
+static gboolean
+is_finished (WingOrderedReads *reads,
+             guint64          *offset)
+{
+  guint64 next_offset = 0;
+
+  if (reads->eof || reads->closed || reads->error != NULL)
+    return TRUE;
+
+  if (reads->hooks->get_offset != NULL &&
+      !reads->hooks->get_offset (reads->owner, reads->next_post, &next_offset))
+    return TRUE;
+
+  if (offset != NULL)
+    *offset = next_offset;
+
+  return FALSE;
+}
+
+static void
+post_reads (WingOrderedReads *reads)
+{
+  guint64 offset;
+
+  while (reads->next_post - reads->next_deliver < reads->n_reads &&
+         !is_finished (reads, &offset))
+    {
+      post_read (reads, &reads->slots[reads->next_post % reads->n_reads], offset);
+      reads->next_post++;
+    }
+}
+
+static GTask *
+pop_waiter (WingOrderedReads *reads)
+{
+  GTask *task;
+  Waiter *waiter;
+
+  task = g_queue_pop_head (&reads->waiters);
+  waiter = g_task_get_task_data (task);
+  g_source_destroy (waiter->cancellable_source);
+
+  return task;
+}
+
+/* Hands out the slot to @task, the queue and the slot being updated
+ * beforehand so that the callback of the task may read again */
+static void
+return_slot (WingOrderedReads      *reads,
+             ReadSlot              *slot,
+             WingOrderedReadStatus  status,
+             GTask                 *task)
+{
+  switch (status)
+    {
+    case WING_ORDERED_READ_DATA:
+      {
+        GBytes *bytes;
+
+        bytes = reads->hooks->wrap_buffer (reads->owner, slot->buffer, slot->transferred);
+        slot->buffer = reads->hooks->acquire_buffer (reads->owner);
+        g_task_return_pointer (task, bytes, (GDestroyNotify) g_bytes_unref);
+      }
+      break;
+    case WING_ORDERED_READ_EOF:
+      reads->eof = TRUE;
+      g_task_return_pointer (task, g_bytes_new (NULL, 0), (GDestroyNotify) g_bytes_unref);
+      break;
+    case WING_ORDERED_READ_ERROR:
+    default:
+      {
+        gchar *emsg = g_win32_error_message (slot->result);
+
+        if (reads->error == NULL)
+          reads->error = g_error_new (G_IO_ERROR,
+                                      g_io_error_from_win32_error (slot->result),
+                                      "%s: %s",
+                                      reads->error_message, emsg);
+        g_free (emsg);
+
+        g_task_return_error (task, g_error_copy (reads->error));
+      }
+      break;
+    }
+}
+
+static void
+return_finished (WingOrderedReads *reads,
+                 GTask            *task)
+{
+  if (reads->closed)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                             "The reader is closed");
+  else if (reads->error != NULL)
+    g_task_return_error (task, g_error_copy (reads->error));
+  else
+    g_task_return_pointer (task, g_bytes_new (NULL, 0), (GDestroyNotify) g_bytes_unref);
+}
+
+static void
+deliver (WingOrderedReads *reads)
+{
+  /* The callbacks of the tasks may read again */
+  if (reads->delivering)
+    return;
+
+  reads->delivering = TRUE;
+
+  while (TRUE)
+    {
+      ReadSlot *slot;
+      WingOrderedReadStatus status;
+      GTask *task;
+      gboolean done;
+
+      if (reads->next_deliver == reads->next_post)
+        {
+          if (g_queue_is_empty (&reads->waiters) || !is_finished (reads, NULL))
+            break;
+
+          task = pop_waiter (reads);
+          return_finished (reads, task);
+          g_object_unref (task);
+          continue;
+        }
+
+      slot = &reads->slots[reads->next_deliver % reads->n_reads];
+
+      g_mutex_lock (&reads->mutex);
+      done = slot->state == SLOT_DONE;
+      g_mutex_unlock (&reads->mutex);
+
+      if (!done)
+        break;
+
+      /* Once closed the reads are drained without being handed out, as
+       * are the skipped ones */
+      status = reads->hooks->check_result (reads->owner, slot->result, slot->transferred);
+      if (reads->closed || status == WING_ORDERED_READ_SKIP)
+        {
+          slot->state = SLOT_IDLE;
+          reads->next_deliver++;
+          post_reads (reads);
+          continue;
+        }
+
+      if (g_queue_is_empty (&reads->waiters))
+        break;
+
+      task = pop_waiter (reads);
+      slot->state = SLOT_IDLE;
+      reads->next_deliver++;
+
+      return_slot (reads, slot, status, task);
+      g_object_unref (task);
+
+      post_reads (reads);
+    }
+
+  reads->delivering = FALSE;
+}
+
+static gboolean
+waiter_cancelled (GCancellable *cancellable,
+                  gpointer      user_data)
+{
+  GTask *task = user_data;
+  Waiter *waiter = g_task_get_task_data (task);
+  WingOrderedReads *reads = waiter->reads;
+
+  /* The data of the reads in flight goes to the next waiter */
+  if (g_queue_remove (&reads->waiters, task))
+    {
+      g_task_return_error_if_cancelled (task);
+      g_object_unref (task);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+void
+_wing_ordered_reads_queue (WingOrderedReads *reads,
+                           GTask            *task)
+{
+  Waiter *waiter;
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  if (reads->closed)
+    {
+      return_finished (reads, task);
+      g_object_unref (task);
+      return;
+    }
+
+  waiter = g_slice_new (Waiter);
+  waiter->reads = reads;
+  waiter->cancellable_source = g_cancellable_source_new (g_task_get_cancellable (task));
+  g_task_set_task_data (task, waiter, waiter_free);
+  g_task_attach_source (task, waiter->cancellable_source, (GSourceFunc) waiter_cancelled);
+
+  /* The queue owns the reference on the task */
+  g_queue_push_tail (&reads->waiters, task);
+
+  post_reads (reads);
+  deliver (reads);
+}
+
+void
+_wing_ordered_reads_close (WingOrderedReads *reads)
+{
+  HANDLE handle;
+  guint64 seq;
+
+  if (reads->closed)
+    return;
+
+  reads->closed = TRUE;
+
+  handle = wing_thread_pool_get_handle (reads->thread_pool_io);
+
+  for (seq = reads->next_deliver; seq < reads->next_post; seq++)
+    {
+      ReadSlot *slot = &reads->slots[seq % reads->n_reads];
+      gboolean pending;
+
+      g_mutex_lock (&reads->mutex);
+      pending = slot->state == SLOT_PENDING;
+      g_mutex_unlock (&reads->mutex);
+
+      /* A read completing meanwhile is not found, which is harmless */
+      if (pending)
+        CancelIoEx (handle, (OVERLAPPED *) slot);
+    }
+
+  while (!g_queue_is_empty (&reads->waiters))
+    {
+      GTask *task = pop_waiter (reads);
+
+      return_finished (reads, task);
+      g_object_unref (task);
+    }
+
+  /* Drops the reads which are already over */
+  deliver (reads);
+}
@@ -23,7 +23,13 @@
 
 #include "wingoutputstream.h"
 #include "wingutils.h"
-#include "wingsource.h"
+#include "wingutils-private.h"
+#include "wingpollable-private.h"
+#include "wingpipestats-private.h"
+#include "wingoutputvectors-private.h"
+#include "wingtasksource-private.h"
+#include "wingpositionalio-private.h"
+#include "wingsplice-private.h"
 
 #include <windows.h>
 
@@ -35,13 +41,25 @@
  *
  * #WingOutputStream implements #GOutputStream for writing to a
  * Windows file handle.
+ *
+ * On a disk file, the stream implements #GSeekable, and
+ * wing_output_stream_write_at() and wing_output_stream_write_at_async()
+ * write at a given offset without moving the position of the stream,
+ * which lets several of them run at the same time on the handle.
  */
 
 typedef struct {
   HANDLE handle;
   gboolean close_handle;
+  gboolean is_disk;
+  goffset current_offset;
 
   OVERLAPPED overlap;
+  WingTaskSource task_source;
+
+  WingPollableWriter *writer;
+
+  WingPipeStats *stats;
 } WingOutputStreamPrivate;
 
 enum {
@@ -53,7 +71,15 @@ enum {
 
 static GParamSpec *props[LAST_PROP];
 
-G_DEFINE_TYPE_WITH_PRIVATE (WingOutputStream, wing_output_stream, G_TYPE_OUTPUT_STREAM)
+static void wing_output_stream_pollable_iface_init (GPollableOutputStreamInterface *iface);
+static void wing_output_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (WingOutputStream, wing_output_stream, G_TYPE_OUTPUT_STREAM,
+                         G_ADD_PRIVATE (WingOutputStream)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_OUTPUT_STREAM,
+                                                wing_output_stream_pollable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                wing_output_stream_seekable_iface_init))
 
 static void
 wing_output_stream_finalize (GObject *object)
@@ -64,9 +90,16 @@ wing_output_stream_finalize (GObject *object)
   wing_stream = WING_OUTPUT_STREAM (object);
   priv = wing_output_stream_get_instance_private (wing_stream);
 
+  if (priv->writer != NULL)
+    _wing_pollable_writer_free (priv->writer, priv->handle);
+
+  _wing_task_source_clear (&priv->task_source);
+
   if (priv->overlap.hEvent != INVALID_HANDLE_VALUE)
     CloseHandle (priv->overlap.hEvent);
 
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+
   G_OBJECT_CLASS (wing_output_stream_parent_class)->finalize (object);
 }
 
@@ -86,6 +119,9 @@ wing_output_stream_set_property (GObject         *object,
     {
     case PROP_HANDLE:
       priv->handle = g_value_get_pointer (value);
+      /* The type does not change, no need to ask on each write */
+      priv->is_disk = priv->handle != NULL &&
+                      GetFileType (priv->handle) == FILE_TYPE_DISK;
       break;
     case PROP_CLOSE_HANDLE:
       priv->close_handle = g_value_get_boolean (value);
@@ -146,9 +182,12 @@ wing_output_stream_write (GOutputStream  *stream,
   else
     nbytes = count;
 
-  overlap.hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+  overlap.hEvent = _wing_event_acquire ();
   g_return_val_if_fail (overlap.hEvent != NULL, -1);
 
+  overlap.OffsetHigh = (DWORD)(priv->current_offset >> 32);
+  overlap.Offset = (DWORD)priv->current_offset;
+
   res = WriteFile (priv->handle, buffer, nbytes, &nwritten, &overlap);
   if (res)
     retval = nwritten;
@@ -187,7 +226,12 @@ wing_output_stream_write (GOutputStream  *stream,
     }
 
 end:
-  CloseHandle (overlap.hEvent);
+  _wing_event_release (overlap.hEvent);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, retval);
+
+  if (priv->is_disk && retval > 0)
+    priv->current_offset += retval;
+
   return retval;
 }
 
@@ -203,6 +247,13 @@ wing_output_stream_close (GOutputStream  *stream,
   wing_stream = WING_OUTPUT_STREAM (stream);
   priv = wing_output_stream_get_instance_private (wing_stream);
 
+  /* GOutputStream flushed it before closing */
+  if (priv->writer != NULL)
+    {
+      _wing_pollable_writer_free (priv->writer, priv->handle);
+      priv->writer = NULL;
+    }
+
   if (!priv->close_handle)
     return TRUE;
 
@@ -224,47 +275,58 @@ wing_output_stream_close (GOutputStream  *stream,
 }
 
 static gboolean
-write_async_ready (HANDLE   handle,
-                   gpointer user_data)
+write_async_ready (gpointer user_data)
 {
-  WingOutputStream *wing_stream;
+  WingOutputStream *wing_stream = user_data;
   WingOutputStreamPrivate *priv;
-  GTask *task = user_data;
+  GTask *task;
   GCancellable *cancellable;
   DWORD nwritten;
   gboolean result;
 
-  wing_stream = g_task_get_source_object (task);
   priv = wing_output_stream_get_instance_private (wing_stream);
+  task = _wing_task_source_get_task (&priv->task_source);
 
   cancellable = g_task_get_cancellable (task);
   if (cancellable != NULL && g_cancellable_is_cancelled (cancellable))
     {
+      /* The overlapped structure is reused by the next operation, and
+       * the abort signals the event again */
       CancelIo (priv->handle);
+      GetOverlappedResult (priv->handle, &priv->overlap, &nwritten, TRUE);
       ResetEvent (priv->overlap.hEvent);
 
+      task = _wing_task_source_steal_task (&priv->task_source);
       g_task_return_new_error (task, G_IO_ERROR,
                                G_IO_ERROR_CANCELLED,
                                "Error reading from handle: the operation is cancelled");
       g_object_unref (task);
 
-      return G_SOURCE_REMOVE;
+      return G_SOURCE_CONTINUE;
     }
 
   result = GetOverlappedResult (priv->overlap.hEvent, &priv->overlap, &nwritten, FALSE);
   if (!result && GetLastError () == ERROR_IO_INCOMPLETE)
     {
-      /* Try again to wait for the event to get ready */
+      /* Woken up by an earlier operation. The event is reset not to spin,
+       * then looked at again not to miss the completion of this one */
       ResetEvent (priv->overlap.hEvent);
-      return G_SOURCE_CONTINUE;
+      result = GetOverlappedResult (priv->overlap.hEvent, &priv->overlap, &nwritten, FALSE);
+      if (!result && GetLastError () == ERROR_IO_INCOMPLETE)
+        return G_SOURCE_CONTINUE;
     }
 
   ResetEvent (priv->overlap.hEvent);
+  task = _wing_task_source_steal_task (&priv->task_source);
+
+  if (priv->is_disk)
+    priv->current_offset += nwritten;
 
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, nwritten);
   g_task_return_int (task, nwritten);
   g_object_unref (task);
 
-  return G_SOURCE_REMOVE;
+  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -295,11 +357,16 @@ wing_output_stream_write_async (GOutputStream            *stream,
     nbytes = count;
 
   ResetEvent (priv->overlap.hEvent);
+  priv->overlap.OffsetHigh = (DWORD)(priv->current_offset >> 32);
+  priv->overlap.Offset = (DWORD)priv->current_offset;
 
   res = WriteFile (priv->handle, buffer, nbytes, &nwritten, &priv->overlap);
   if (res)
     {
       ResetEvent (priv->overlap.hEvent);
+      if (priv->is_disk)
+        priv->current_offset += nwritten;
+      _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, nwritten);
       g_task_return_int (task, nwritten);
       g_object_unref (task);
       return;
@@ -309,12 +376,7 @@ wing_output_stream_write_async (GOutputStream            *stream,
 
   if (errsv == ERROR_IO_PENDING)
     {
-      GSource *handle_source;
-
-      handle_source = wing_create_source (priv->overlap.hEvent, G_IO_IN, cancellable);
-      g_task_attach_source (task, handle_source,
-                            (GSourceFunc)write_async_ready);
-      g_source_unref (handle_source);
+      _wing_task_source_wait (&priv->task_source, priv->overlap.hEvent, task);
       return;
     }
 
@@ -334,6 +396,193 @@ wing_output_stream_write_async (GOutputStream            *stream,
   g_free (emsg);
 }
 
+static gboolean
+wing_output_stream_flush (GOutputStream  *stream,
+                          GCancellable   *cancellable,
+                          GError        **error)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (stream));
+
+  if (priv->writer == NULL)
+    return TRUE;
+
+  return _wing_pollable_writer_flush (priv->writer,
+                                      priv->handle,
+                                      cancellable, error);
+}
+
+static gboolean
+wing_output_stream_pollable_can_poll (GPollableOutputStream *pollable)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (pollable));
+
+  return _wing_pollable_can_poll (priv->handle);
+}
+
+static gboolean
+wing_output_stream_pollable_is_writable (GPollableOutputStream *pollable)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (pollable));
+
+  return priv->writer == NULL || _wing_pollable_writer_is_writable (priv->writer);
+}
+
+static WingPollableWriter *
+wing_output_stream_pollable_get_writer (WingOutputStreamPrivate *priv)
+{
+  if (priv->writer == NULL)
+    priv->writer = _wing_pollable_writer_new ();
+
+  return priv->writer;
+}
+
+static GSource *
+wing_output_stream_pollable_create_source (GPollableOutputStream *pollable,
+                                           GCancellable          *cancellable)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (pollable));
+
+  return _wing_pollable_writer_create_source (wing_output_stream_pollable_get_writer (priv),
+                                              G_OUTPUT_STREAM (pollable),
+                                              cancellable);
+}
+
+static gssize
+wing_output_stream_pollable_write_nonblocking (GPollableOutputStream  *pollable,
+                                               const void             *buffer,
+                                               gsize                   count,
+                                               GError                **error)
+{
+  WingOutputStreamPrivate *priv;
+  gssize written;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (pollable));
+
+  written = _wing_pollable_writer_write (wing_output_stream_pollable_get_writer (priv),
+                                         priv->handle,
+                                         buffer, count, error);
+  _wing_pipe_stats_add (priv->stats, WING_PIPE_STATS_WRITE, written);
+
+  return written;
+}
+
+static void
+wing_output_stream_pollable_iface_init (GPollableOutputStreamInterface *iface)
+{
+  iface->can_poll = wing_output_stream_pollable_can_poll;
+  iface->is_writable = wing_output_stream_pollable_is_writable;
+  iface->create_source = wing_output_stream_pollable_create_source;
+  iface->write_nonblocking = wing_output_stream_pollable_write_nonblocking;
+}
+
+static goffset
+wing_output_stream_tell (GSeekable *seekable)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (seekable));
+
+  return priv->current_offset;
+}
+
+static gboolean
+wing_output_stream_can_seek (GSeekable *seekable)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (seekable));
+
+  return priv->is_disk;
+}
+
+static gboolean
+wing_output_stream_seek (GSeekable     *seekable,
+                         goffset        offset,
+                         GSeekType      type,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (seekable));
+
+  if (!priv->is_disk)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Seek not supported on stream");
+      return FALSE;
+    }
+
+  return _wing_positional_io_seek (priv->handle, &priv->current_offset,
+                                   offset, type, error);
+}
+
+static gboolean
+wing_output_stream_can_truncate (GSeekable *seekable)
+{
+  return wing_output_stream_can_seek (seekable);
+}
+
+static gboolean
+wing_output_stream_truncate (GSeekable     *seekable,
+                             goffset        offset,
+                             GCancellable  *cancellable,
+                             GError       **error)
+{
+  WingOutputStreamPrivate *priv;
+  FILE_END_OF_FILE_INFO info;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (seekable));
+
+  if (!priv->is_disk)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Truncate not supported on stream");
+      return FALSE;
+    }
+
+  if (offset < 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid truncate request");
+      return FALSE;
+    }
+
+  info.EndOfFile.QuadPart = offset;
+  if (!SetFileInformationByHandle (priv->handle, FileEndOfFileInfo, &info, sizeof (info)))
+    {
+      int errsv = GetLastError ();
+      gchar *emsg = g_win32_error_message (errsv);
+
+      g_set_error (error, G_IO_ERROR,
+                   g_io_error_from_win32_error (errsv),
+                   "Error truncating handle: %s",
+                   emsg);
+      g_free (emsg);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+wing_output_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = wing_output_stream_tell;
+  iface->can_seek = wing_output_stream_can_seek;
+  iface->seek = wing_output_stream_seek;
+  iface->can_truncate = wing_output_stream_can_truncate;
+  iface->truncate_fn = wing_output_stream_truncate;
+}
+
 static void
 wing_output_stream_class_init (WingOutputStreamClass *klass)
 {
@@ -346,7 +595,15 @@ wing_output_stream_class_init (WingOutputStreamClass *klass)
 
   stream_class->write_fn = wing_output_stream_write;
   stream_class->close_fn = wing_output_stream_close;
+  stream_class->flush = wing_output_stream_flush;
   stream_class->write_async = wing_output_stream_write_async;
+  stream_class->splice_async = _wing_output_stream_splice_async;
+  stream_class->splice_finish = _wing_output_stream_splice_finish;
+#if GLIB_CHECK_VERSION (2, 60, 0)
+  stream_class->writev_fn = _wing_output_stream_writev;
+  stream_class->writev_async = _wing_output_stream_writev_async;
+  stream_class->writev_finish = _wing_output_stream_writev_finish;
+#endif
 
    /**
    * WingOutputStream:handle:
@@ -385,6 +642,7 @@ wing_output_stream_init (WingOutputStream *wing_stream)
   priv = wing_output_stream_get_instance_private (wing_stream);
   priv->handle = NULL;
   priv->close_handle = TRUE;
+  _wing_task_source_init (&priv->task_source, write_async_ready, wing_stream);
   priv->overlap.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
   g_return_if_fail (priv->overlap.hEvent != INVALID_HANDLE_VALUE);
 }
@@ -479,3 +737,153 @@ wing_output_stream_get_handle (WingOutputStream *stream)
 
   return priv->handle;
 }
+
+static gboolean
+check_write_at (WingOutputStream  *stream,
+                GError           **error)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (stream);
+
+  if (g_output_stream_is_closed (G_OUTPUT_STREAM (stream)))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           "Stream is already closed");
+      return FALSE;
+    }
+
+  if (!priv->is_disk)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Writing at an offset is only supported on disk files");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * wing_output_stream_write_at:
+ * @stream: a #WingOutputStream on a disk file
+ * @buffer: (array length=count) (element-type guint8): the buffer
+ *     containing the data to write
+ * @count: the number of bytes to write
+ * @offset: the offset in the file to write at
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @error: location to store the error occurring, or %NULL to ignore
+ *
+ * Writes up to @count bytes to the file of @stream at @offset, as
+ * pwrite() does. The position of @stream is neither used nor moved,
+ * and the stream is not marked as having a pending operation, so that
+ * several writes at different offsets may run at the same time.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+gssize
+wing_output_stream_write_at (WingOutputStream  *stream,
+                             const void        *buffer,
+                             gsize              count,
+                             goffset            offset,
+                             GCancellable      *cancellable,
+                             GError           **error)
+{
+  WingOutputStreamPrivate *priv;
+
+  g_return_val_if_fail (WING_IS_OUTPUT_STREAM (stream), -1);
+  g_return_val_if_fail (buffer != NULL || count == 0, -1);
+  g_return_val_if_fail (offset >= 0, -1);
+
+  priv = wing_output_stream_get_instance_private (stream);
+
+  if (!check_write_at (stream, error))
+    return -1;
+
+  return _wing_positional_io (priv->handle, TRUE, (gpointer)buffer, count,
+                              offset, cancellable, error);
+}
+
+/**
+ * wing_output_stream_write_at_async:
+ * @stream: a #WingOutputStream on a disk file
+ * @buffer: (array length=count) (element-type guint8): the buffer
+ *     containing the data to write, which must stay valid until the
+ *     write is over
+ * @count: the number of bytes to write
+ * @offset: the offset in the file to write at
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): callback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Starts writing up to @count bytes to the file of @stream at
+ * @offset. See wing_output_stream_write_at(), any number of these
+ * writes may be pending at once.
+ */
+void
+wing_output_stream_write_at_async (WingOutputStream    *stream,
+                                   const void          *buffer,
+                                   gsize                count,
+                                   goffset              offset,
+                                   int                  io_priority,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  WingOutputStreamPrivate *priv;
+  GTask *task;
+  GError *error = NULL;
+
+  g_return_if_fail (WING_IS_OUTPUT_STREAM (stream));
+  g_return_if_fail (buffer != NULL || count == 0);
+  g_return_if_fail (offset >= 0);
+
+  priv = wing_output_stream_get_instance_private (stream);
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wing_output_stream_write_at_async);
+  g_task_set_priority (task, io_priority);
+
+  if (!check_write_at (stream, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  _wing_positional_io_async (priv->handle, TRUE, (gpointer)buffer, count, offset, task);
+}
+
+/**
+ * wing_output_stream_write_at_finish:
+ * @stream: a #WingOutputStream
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occurring, or %NULL to ignore
+ *
+ * Finishes a write started with wing_output_stream_write_at_async().
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+gssize
+wing_output_stream_write_at_finish (WingOutputStream  *stream,
+                                    GAsyncResult      *result,
+                                    GError           **error)
+{
+  g_return_val_if_fail (WING_IS_OUTPUT_STREAM (stream), -1);
+  g_return_val_if_fail (g_task_is_valid (result, stream), -1);
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+void
+_wing_output_stream_set_pipe_stats (gpointer       stream,
+                                    WingPipeStats *stats)
+{
+  WingOutputStreamPrivate *priv;
+
+  priv = wing_output_stream_get_instance_private (WING_OUTPUT_STREAM (stream));
+
+  g_clear_pointer (&priv->stats, _wing_pipe_stats_unref);
+  if (stats != NULL)
+    priv->stats = _wing_pipe_stats_ref (stats);
+}
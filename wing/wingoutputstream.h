@@ -60,6 +60,29 @@ gboolean        wing_output_stream_get_close_handle (WingOutputStream *stream);
 WING_AVAILABLE_IN_ALL
 void           *wing_output_stream_get_handle       (WingOutputStream *stream);
 
+WING_AVAILABLE_IN_ALL
+gssize          wing_output_stream_write_at         (WingOutputStream   *stream,
+                                                     const void         *buffer,
+                                                     gsize               count,
+                                                     goffset             offset,
+                                                     GCancellable       *cancellable,
+                                                     GError            **error);
+
+WING_AVAILABLE_IN_ALL
+void            wing_output_stream_write_at_async   (WingOutputStream   *stream,
+                                                     const void         *buffer,
+                                                     gsize               count,
+                                                     goffset             offset,
+                                                     int                 io_priority,
+                                                     GCancellable       *cancellable,
+                                                     GAsyncReadyCallback callback,
+                                                     gpointer            user_data);
+
+WING_AVAILABLE_IN_ALL
+gssize          wing_output_stream_write_at_finish  (WingOutputStream   *stream,
+                                                     GAsyncResult       *result,
+                                                     GError            **error);
+
 G_END_DECLS
 
 #endif /* WING_OUTPUT_STREAM_H */
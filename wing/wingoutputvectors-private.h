@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_OUTPUT_VECTORS_PRIVATE_H
+#define WING_OUTPUT_VECTORS_PRIVATE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+
+gboolean        _wing_output_stream_writev              (GOutputStream        *stream,
+                                                         const GOutputVector  *vectors,
+                                                         gsize                 n_vectors,
+                                                         gsize                *bytes_written,
+                                                         GCancellable         *cancellable,
+                                                         GError              **error);
+
+void            _wing_output_stream_writev_async        (GOutputStream        *stream,
+                                                         const GOutputVector  *vectors,
+                                                         gsize                 n_vectors,
+                                                         int                   io_priority,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+
+gboolean        _wing_output_stream_writev_finish       (GOutputStream        *stream,
+                                                         GAsyncResult         *result,
+                                                         gsize                *bytes_written,
+                                                         GError              **error);
+
+#endif
+
+G_END_DECLS
+
+#endif /* WING_OUTPUT_VECTORS_PRIVATE_H */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingoutputvectors-private.h"
+
+#include <string.h>
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+
+/* Vectored writes for the output streams. A pipe has no gather write,
+ * so the small vectors are copied into a staging buffer and sent with
+ * a single WriteFile, while the large ones are written as they are.
+ * As for writev(), only part of the vectors may be written */
+
+/* The size of the staging buffer */
+#define STAGING_SIZE 16384
+
+/* The vectors from this size are written without being copied */
+#define DIRECT_WRITE_THRESHOLD 8192
+
+/* Computes the next write of a vectored write. Returns the number of
+ * bytes to write from *buffer, which is either the first non-empty
+ * vector or @staging filled with the leading small vectors. @staging
+ * may be %NULL, to only compute the number of bytes staged */
+static gsize
+coalesce_vectors (const GOutputVector  *vectors,
+                  gsize                 n_vectors,
+                  guint8               *staging,
+                  gconstpointer        *buffer)
+{
+  gsize first, last, staged = 0;
+  gsize i;
+
+  for (first = 0; first < n_vectors && vectors[first].size == 0; first++)
+    ;
+
+  if (first == n_vectors)
+    {
+      *buffer = NULL;
+      return 0;
+    }
+
+  for (last = first; last < n_vectors; last++)
+    {
+      gsize size = vectors[last].size;
+
+      if (size >= DIRECT_WRITE_THRESHOLD || staged + size > STAGING_SIZE)
+        break;
+
+      staged += size;
+    }
+
+  /* Nothing to gain from a copy */
+  if (last - first <= 1)
+    {
+      *buffer = vectors[first].buffer;
+      return MIN (vectors[first].size, G_MAXINT);
+    }
+
+  if (staging != NULL)
+    {
+      guint8 *p = staging;
+
+      for (i = first; i < last; i++)
+        {
+          memcpy (p, vectors[i].buffer, vectors[i].size);
+          p += vectors[i].size;
+        }
+    }
+
+  *buffer = staging;
+
+  return staged;
+}
+
+gboolean
+_wing_output_stream_writev (GOutputStream        *stream,
+                            const GOutputVector  *vectors,
+                            gsize                 n_vectors,
+                            gsize                *bytes_written,
+                            GCancellable         *cancellable,
+                            GError              **error)
+{
+  guint8 staging[STAGING_SIZE];
+  gconstpointer buffer;
+  gsize count;
+  gssize res;
+
+  if (bytes_written != NULL)
+    *bytes_written = 0;
+
+  count = coalesce_vectors (vectors, n_vectors, staging, &buffer);
+  if (count == 0)
+    return TRUE;
+
+  res = G_OUTPUT_STREAM_GET_CLASS (stream)->write_fn (stream, buffer, count,
+                                                      cancellable, error);
+  if (res < 0)
+    return FALSE;
+
+  if (bytes_written != NULL)
+    *bytes_written = res;
+
+  return TRUE;
+}
+
+static void
+writev_write_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GOutputStream *stream = G_OUTPUT_STREAM (source);
+  GTask *task = user_data;
+  GError *error = NULL;
+  gssize res;
+
+  res = G_OUTPUT_STREAM_GET_CLASS (stream)->write_finish (stream, result, &error);
+  if (res < 0)
+    g_task_return_error (task, error);
+  else
+    g_task_return_int (task, res);
+
+  g_object_unref (task);
+}
+
+void
+_wing_output_stream_writev_async (GOutputStream        *stream,
+                                  const GOutputVector  *vectors,
+                                  gsize                 n_vectors,
+                                  int                   io_priority,
+                                  GCancellable         *cancellable,
+                                  GAsyncReadyCallback   callback,
+                                  gpointer              user_data)
+{
+  GTask *task;
+  guint8 *staging;
+  gconstpointer buffer;
+  gsize count;
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _wing_output_stream_writev_async);
+  g_task_set_priority (task, io_priority);
+
+  count = coalesce_vectors (vectors, n_vectors, NULL, &buffer);
+  if (count == 0)
+    {
+      g_task_return_int (task, 0);
+      g_object_unref (task);
+      return;
+    }
+
+  /* The staged data must live until the write completes */
+  if (buffer == NULL)
+    {
+      staging = g_malloc (count);
+      coalesce_vectors (vectors, n_vectors, staging, &buffer);
+      g_task_set_task_data (task, staging, g_free);
+    }
+
+  G_OUTPUT_STREAM_GET_CLASS (stream)->write_async (stream, buffer, count, io_priority,
+                                                   cancellable, writev_write_cb, task);
+}
+
+gboolean
+_wing_output_stream_writev_finish (GOutputStream  *stream,
+                                   GAsyncResult   *result,
+                                   gsize          *bytes_written,
+                                   GError        **error)
+{
+  gssize res;
+
+  g_return_val_if_fail (g_task_is_valid (result, stream), FALSE);
+
+  res = g_task_propagate_int (G_TASK (result), error);
+  if (bytes_written != NULL)
+    *bytes_written = MAX (res, 0);
+
+  return res >= 0;
+}
+
+#endif
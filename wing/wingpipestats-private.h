@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_PIPE_STATS_PRIVATE_H
+#define WING_PIPE_STATS_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The traffic seen on a pipe by its streams, from which the listener
+ * chooses the buffer sizes of the new pipe instances */
+typedef enum
+{
+  WING_PIPE_STATS_READ,
+  WING_PIPE_STATS_WRITE,
+  WING_PIPE_STATS_N_DIRECTIONS
+} WingPipeStatsDirection;
+
+typedef struct _WingPipeStats WingPipeStats;
+
+WingPipeStats  *_wing_pipe_stats_new                (void);
+
+WingPipeStats  *_wing_pipe_stats_ref                (WingPipeStats          *stats);
+
+void            _wing_pipe_stats_unref              (WingPipeStats          *stats);
+
+/* @stats may be %NULL, and only the transfers of some data are counted */
+void            _wing_pipe_stats_add                (WingPipeStats          *stats,
+                                                     WingPipeStatsDirection  direction,
+                                                     gssize                  n_bytes);
+
+/* Stops the clock once the connection is closed, @stats may be %NULL */
+void            _wing_pipe_stats_close              (WingPipeStats          *stats);
+
+gsize           _wing_pipe_stats_get_buffer_size    (WingPipeStats          *stats,
+                                                     WingPipeStatsDirection  direction);
+
+/* Have the streams of a connection gather the stats */
+void            _wing_named_pipe_connection_set_pipe_stats (gpointer         connection,
+                                                            WingPipeStats   *stats);
+
+void            _wing_input_stream_set_pipe_stats          (gpointer         stream,
+                                                            WingPipeStats   *stats);
+
+void            _wing_output_stream_set_pipe_stats         (gpointer         stream,
+                                                            WingPipeStats   *stats);
+
+void            _wing_iocp_input_stream_set_pipe_stats     (gpointer         stream,
+                                                            WingPipeStats   *stats);
+
+void            _wing_iocp_output_stream_set_pipe_stats    (gpointer         stream,
+                                                            WingPipeStats   *stats);
+
+G_END_DECLS
+
+#endif /* WING_PIPE_STATS_PRIVATE_H */
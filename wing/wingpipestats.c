@@ -0,0 +1,124 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingpipestats-private.h"
+
+#include <windows.h>
+
+/* The buffer should take the data of this long without the writer
+ * having to wait */
+#define BUFFERED_TIME_MS 10
+
+struct _WingPipeStats
+{
+  volatile gint ref_count;
+
+  gint64 start_time;
+  volatile LONG64 end_time;
+  volatile LONG64 n_bytes[WING_PIPE_STATS_N_DIRECTIONS];
+  volatile LONG max_transfer[WING_PIPE_STATS_N_DIRECTIONS];
+};
+
+WingPipeStats *
+_wing_pipe_stats_new (void)
+{
+  WingPipeStats *stats;
+
+  stats = g_slice_new0 (WingPipeStats);
+  stats->ref_count = 1;
+  stats->start_time = g_get_monotonic_time ();
+
+  return stats;
+}
+
+WingPipeStats *
+_wing_pipe_stats_ref (WingPipeStats *stats)
+{
+  g_atomic_int_inc (&stats->ref_count);
+
+  return stats;
+}
+
+void
+_wing_pipe_stats_unref (WingPipeStats *stats)
+{
+  if (g_atomic_int_dec_and_test (&stats->ref_count))
+    g_slice_free (WingPipeStats, stats);
+}
+
+void
+_wing_pipe_stats_add (WingPipeStats          *stats,
+                      WingPipeStatsDirection  direction,
+                      gssize                  n_bytes)
+{
+  LONG max_transfer;
+  LONG transfer;
+
+  if (stats == NULL || n_bytes <= 0)
+    return;
+
+  InterlockedExchangeAdd64 (&stats->n_bytes[direction], n_bytes);
+
+  transfer = (LONG) MIN (n_bytes, G_MAXLONG);
+  max_transfer = stats->max_transfer[direction];
+  while (transfer > max_transfer)
+    {
+      LONG previous;
+
+      previous = InterlockedCompareExchange (&stats->max_transfer[direction],
+                                             transfer, max_transfer);
+      if (previous == max_transfer)
+        break;
+
+      max_transfer = previous;
+    }
+}
+
+void
+_wing_pipe_stats_close (WingPipeStats *stats)
+{
+  if (stats == NULL)
+    return;
+
+  InterlockedCompareExchange64 (&stats->end_time, g_get_monotonic_time (), 0);
+}
+
+/* The size to hold the largest transfer, and the data of BUFFERED_TIME_MS
+ * at the average throughput while the connection was open. 0 if nothing
+ * was transferred */
+gsize
+_wing_pipe_stats_get_buffer_size (WingPipeStats          *stats,
+                                  WingPipeStatsDirection  direction)
+{
+  gint64 end_time;
+  gint64 elapsed;
+  guint64 n_bytes;
+  guint64 buffered;
+
+  n_bytes = (guint64) stats->n_bytes[direction];
+  if (n_bytes == 0)
+    return 0;
+
+  end_time = InterlockedCompareExchange64 (&stats->end_time, 0, 0);
+  if (end_time == 0)
+    end_time = g_get_monotonic_time ();
+
+  elapsed = MAX (end_time - stats->start_time, G_TIME_SPAN_MILLISECOND);
+  buffered = n_bytes * BUFFERED_TIME_MS * G_TIME_SPAN_MILLISECOND / elapsed;
+
+  return (gsize) MIN (MAX (buffered, (guint64) stats->max_transfer[direction]), G_MAXSIZE);
+}
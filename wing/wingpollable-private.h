@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_POLLABLE_PRIVATE_H
+#define WING_POLLABLE_PRIVATE_H
+
+#include <gio/gio.h>
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* The pollable streams are implemented for pipes only */
+gboolean            _wing_pollable_can_poll                 (HANDLE         handle);
+
+gboolean            _wing_pollable_is_readable              (HANDLE         handle);
+
+gssize              _wing_pollable_read_nonblocking         (GInputStream  *stream,
+                                                             HANDLE         handle,
+                                                             void          *buffer,
+                                                             gsize          count,
+                                                             GError       **error);
+
+GSource            *_wing_pollable_create_read_source       (GInputStream  *stream,
+                                                             HANDLE         handle,
+                                                             GCancellable  *cancellable);
+
+/* Owns the data of the non-blocking writes while the pipe takes it */
+typedef struct _WingPollableWriter WingPollableWriter;
+
+WingPollableWriter *_wing_pollable_writer_new               (void);
+
+void                _wing_pollable_writer_free              (WingPollableWriter  *writer,
+                                                             HANDLE               handle);
+
+gboolean            _wing_pollable_writer_is_writable       (WingPollableWriter  *writer);
+
+gssize              _wing_pollable_writer_write             (WingPollableWriter  *writer,
+                                                             HANDLE               handle,
+                                                             const void          *buffer,
+                                                             gsize                count,
+                                                             GError             **error);
+
+gboolean            _wing_pollable_writer_flush             (WingPollableWriter  *writer,
+                                                             HANDLE               handle,
+                                                             GCancellable        *cancellable,
+                                                             GError             **error);
+
+GSource            *_wing_pollable_writer_create_source     (WingPollableWriter  *writer,
+                                                             GOutputStream       *stream,
+                                                             GCancellable        *cancellable);
+
+G_END_DECLS
+
+#endif /* WING_POLLABLE_PRIVATE_H */
@@ -0,0 +1,406 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Readiness for the pipe streams, shared by the plain and IOCP ones.
+ *
+ * A pipe is readable when PeekNamedPipe finds data, or fails because the
+ * other end is gone. To wait for it, a zero-byte read is posted: it
+ * completes as soon as data arrives, without consuming any.
+ *
+ * Pipes have no write readiness to wait for. Instead, a non-blocking
+ * write copies the data into a buffer owned by the stream and starts an
+ * overlapped write from it: the stream is writable again once the pipe
+ * has taken that data. The writes started afterwards, with any of the
+ * stream functions, are queued behind it by the pipe, so the order of
+ * the data is kept. An error of such a write is reported by the next
+ * non-blocking write or flush.
+ *
+ * The events of these operations have their low-order bit set, so that
+ * a handle bound to a completion port does not post them to the port. */
+
+#include "wingpollable-private.h"
+#include "wingutils.h"
+
+#include <string.h>
+
+#define WRITER_BUFFER_SIZE 65536
+
+struct _WingPollableWriter
+{
+  OVERLAPPED overlap;
+  HANDLE event;
+  guint8 *buffer;
+  gboolean pending;
+};
+
+typedef struct
+{
+  GSource source;
+  GPollFD pollfd;
+
+  /* The readable source owns the event of its zero-byte read */
+  HANDLE handle;
+  HANDLE event;
+  OVERLAPPED overlap;
+  gboolean reading;
+
+  /* The writable source waits on the event of the writer */
+  WingPollableWriter *writer;
+} ReadySource;
+
+static HANDLE
+tag_event (HANDLE event)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  return (HANDLE) ((gint64) event | 0x1);
+#else
+  return (HANDLE) ((gint) event | 0x1);
+#endif
+}
+
+gboolean
+_wing_pollable_can_poll (HANDLE handle)
+{
+  return handle != INVALID_HANDLE_VALUE &&
+         GetFileType (handle) == FILE_TYPE_PIPE;
+}
+
+gboolean
+_wing_pollable_is_readable (HANDLE handle)
+{
+  DWORD available;
+
+  /* A failure, such as a broken pipe, is reported by the next read */
+  if (!PeekNamedPipe (handle, NULL, 0, NULL, &available, NULL))
+    return TRUE;
+
+  return available > 0;
+}
+
+gssize
+_wing_pollable_read_nonblocking (GInputStream  *stream,
+                                 HANDLE         handle,
+                                 void          *buffer,
+                                 gsize          count,
+                                 GError       **error)
+{
+  DWORD available = 0;
+
+  if (PeekNamedPipe (handle, NULL, 0, NULL, &available, NULL) && available == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK,
+                           "No data available in the pipe");
+      return -1;
+    }
+
+  /* With data available the read completes right away, and a failed
+   * peek is reported by the read itself */
+  if (available > 0)
+    count = MIN (count, available);
+
+  return G_INPUT_STREAM_GET_CLASS (stream)->read_fn (stream, buffer, count, NULL, error);
+}
+
+static gboolean
+read_source_ready (ReadySource *ready_source)
+{
+  static gchar dummy;
+  int errsv;
+
+  if (ready_source->reading)
+    {
+      if (!HasOverlappedIoCompleted (&ready_source->overlap))
+        return FALSE;
+
+      ready_source->reading = FALSE;
+      return TRUE;
+    }
+
+  if (_wing_pollable_is_readable (ready_source->handle))
+    return TRUE;
+
+  memset (&ready_source->overlap, 0, sizeof (ready_source->overlap));
+  ready_source->overlap.hEvent = tag_event (ready_source->event);
+
+  if (ReadFile (ready_source->handle, &dummy, 0, NULL, &ready_source->overlap))
+    return TRUE;
+
+  errsv = GetLastError ();
+  if (errsv != ERROR_IO_PENDING)
+    return TRUE;
+
+  ready_source->reading = TRUE;
+
+  return FALSE;
+}
+
+static gboolean
+ready_source_prepare (GSource *source,
+                      gint    *timeout)
+{
+  ReadySource *ready_source = (ReadySource *) source;
+
+  *timeout = -1;
+
+  if (ready_source->writer != NULL)
+    return _wing_pollable_writer_is_writable (ready_source->writer);
+
+  return read_source_ready (ready_source);
+}
+
+static gboolean
+ready_source_check (GSource *source)
+{
+  gint timeout;
+
+  return ready_source_prepare (source, &timeout);
+}
+
+static gboolean
+ready_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  return callback != NULL ? callback (user_data) : G_SOURCE_CONTINUE;
+}
+
+static void
+ready_source_finalize (GSource *source)
+{
+  ReadySource *ready_source = (ReadySource *) source;
+
+  if (ready_source->reading)
+    {
+      DWORD transferred;
+
+      CancelIoEx (ready_source->handle, &ready_source->overlap);
+      GetOverlappedResult (ready_source->handle, &ready_source->overlap, &transferred, TRUE);
+    }
+
+  if (ready_source->event != NULL)
+    CloseHandle (ready_source->event);
+}
+
+static GSourceFuncs ready_source_funcs = {
+  ready_source_prepare,
+  ready_source_check,
+  ready_source_dispatch,
+  ready_source_finalize
+};
+
+static GSource *
+ready_source_new (HANDLE event)
+{
+  ReadySource *ready_source;
+  GSource *source;
+
+  source = g_source_new (&ready_source_funcs, sizeof (ReadySource));
+  ready_source = (ReadySource *) source;
+  g_source_set_name (source, "WingPollableSource");
+
+#if GLIB_SIZEOF_VOID_P == 8
+  ready_source->pollfd.fd = (gint64) event;
+#else
+  ready_source->pollfd.fd = (gint) event;
+#endif
+  ready_source->pollfd.events = G_IO_IN;
+  ready_source->pollfd.revents = 0;
+  g_source_add_poll (source, &ready_source->pollfd);
+
+  return source;
+}
+
+GSource *
+_wing_pollable_create_read_source (GInputStream *stream,
+                                   HANDLE        handle,
+                                   GCancellable *cancellable)
+{
+  ReadySource *ready_source;
+  GSource *child_source;
+  GSource *source;
+  HANDLE event;
+
+  event = CreateEvent (NULL, TRUE, FALSE, NULL);
+  child_source = ready_source_new (event);
+  ready_source = (ReadySource *) child_source;
+  ready_source->handle = handle;
+  ready_source->event = event;
+
+  source = g_pollable_source_new_full (stream, child_source, cancellable);
+  g_source_unref (child_source);
+
+  return source;
+}
+
+WingPollableWriter *
+_wing_pollable_writer_new (void)
+{
+  WingPollableWriter *writer;
+
+  writer = g_slice_new0 (WingPollableWriter);
+  writer->event = CreateEvent (NULL, TRUE, TRUE, NULL);
+  writer->buffer = g_malloc (WRITER_BUFFER_SIZE);
+
+  return writer;
+}
+
+void
+_wing_pollable_writer_free (WingPollableWriter *writer,
+                            HANDLE              handle)
+{
+  if (writer->pending)
+    {
+      DWORD transferred;
+
+      /* The data which was to be written is lost, as with a stream not
+       * flushed before being dropped */
+      CancelIoEx (handle, &writer->overlap);
+      GetOverlappedResult (handle, &writer->overlap, &transferred, TRUE);
+    }
+
+  CloseHandle (writer->event);
+  g_free (writer->buffer);
+  g_slice_free (WingPollableWriter, writer);
+}
+
+gboolean
+_wing_pollable_writer_is_writable (WingPollableWriter *writer)
+{
+  return !writer->pending || HasOverlappedIoCompleted (&writer->overlap);
+}
+
+static void
+set_write_error (int      errsv,
+                 GError **error)
+{
+  gchar *emsg = g_win32_error_message (errsv);
+
+  g_set_error (error, G_IO_ERROR,
+               g_io_error_from_win32_error (errsv),
+               "Error writing to handle: %s",
+               emsg);
+  g_free (emsg);
+}
+
+/* The pending write must be over */
+static gboolean
+writer_collect (WingPollableWriter  *writer,
+                HANDLE               handle,
+                GError             **error)
+{
+  DWORD transferred;
+
+  writer->pending = FALSE;
+
+  if (!GetOverlappedResult (handle, &writer->overlap, &transferred, FALSE))
+    {
+      set_write_error (GetLastError (), error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+gssize
+_wing_pollable_writer_write (WingPollableWriter  *writer,
+                             HANDLE               handle,
+                             const void          *buffer,
+                             gsize                count,
+                             GError             **error)
+{
+  int errsv;
+
+  if (writer->pending)
+    {
+      if (!HasOverlappedIoCompleted (&writer->overlap))
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK,
+                               "The previous write is still in progress");
+          return -1;
+        }
+
+      if (!writer_collect (writer, handle, error))
+        return -1;
+    }
+
+  count = MIN (count, WRITER_BUFFER_SIZE);
+  memcpy (writer->buffer, buffer, count);
+
+  memset (&writer->overlap, 0, sizeof (writer->overlap));
+  writer->overlap.hEvent = tag_event (writer->event);
+
+  if (WriteFile (handle, writer->buffer, (DWORD) count, NULL, &writer->overlap))
+    return count;
+
+  errsv = GetLastError ();
+  if (errsv != ERROR_IO_PENDING)
+    {
+      set_write_error (errsv, error);
+      return -1;
+    }
+
+  writer->pending = TRUE;
+
+  return count;
+}
+
+gboolean
+_wing_pollable_writer_flush (WingPollableWriter  *writer,
+                             HANDLE               handle,
+                             GCancellable        *cancellable,
+                             GError             **error)
+{
+  DWORD transferred;
+
+  if (!writer->pending)
+    return TRUE;
+
+  if (wing_overlap_wait_result (handle, &writer->overlap, &transferred, cancellable))
+    {
+      writer->pending = FALSE;
+      return TRUE;
+    }
+
+  /* Either way the write is over now */
+  writer->pending = FALSE;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  set_write_error (GetLastError (), error);
+
+  return FALSE;
+}
+
+GSource *
+_wing_pollable_writer_create_source (WingPollableWriter *writer,
+                                     GOutputStream      *stream,
+                                     GCancellable       *cancellable)
+{
+  ReadySource *ready_source;
+  GSource *child_source;
+  GSource *source;
+
+  child_source = ready_source_new (writer->event);
+  ready_source = (ReadySource *) child_source;
+  ready_source->writer = writer;
+
+  source = g_pollable_source_new_full (stream, child_source, cancellable);
+  g_source_unref (child_source);
+
+  return source;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_POSITIONAL_IO_PRIVATE_H
+#define WING_POSITIONAL_IO_PRIVATE_H
+
+#include <gio/gio.h>
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* Reads or writes a disk handle at @offset with an overlapped structure
+ * of its own, so that any number of these may run at the same time on
+ * the handle regardless of the position of its streams */
+gssize          _wing_positional_io                 (HANDLE         handle,
+                                                     gboolean       write,
+                                                     gpointer       buffer,
+                                                     gsize          count,
+                                                     goffset        offset,
+                                                     GCancellable  *cancellable,
+                                                     GError       **error);
+
+/* Returns the number of bytes transferred as an int through @task,
+ * whose reference is taken over */
+void            _wing_positional_io_async           (HANDLE         handle,
+                                                     gboolean       write,
+                                                     gpointer       buffer,
+                                                     gsize          count,
+                                                     goffset        offset,
+                                                     GTask         *task);
+
+/* Computes the new *@position of a stream on a disk handle as
+ * g_seekable_seek() */
+gboolean        _wing_positional_io_seek            (HANDLE         handle,
+                                                     goffset       *position,
+                                                     goffset        offset,
+                                                     GSeekType      type,
+                                                     GError       **error);
+
+G_END_DECLS
+
+#endif /* WING_POSITIONAL_IO_PRIVATE_H */
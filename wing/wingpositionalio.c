@@ -0,0 +1,260 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingpositionalio-private.h"
+#include "wingutils.h"
+#include "wingutils-private.h"
+#include "wingsource.h"
+
+typedef struct
+{
+  OVERLAPPED overlap;
+  HANDLE handle;
+  gboolean write;
+} PositionalOp;
+
+static void
+positional_op_free (PositionalOp *op)
+{
+  _wing_event_release (op->overlap.hEvent);
+  g_slice_free (PositionalOp, op);
+}
+
+static void
+set_offset (OVERLAPPED *overlap,
+            goffset     offset)
+{
+  overlap->OffsetHigh = (DWORD)((guint64)offset >> 32);
+  overlap->Offset = (DWORD)offset;
+}
+
+static GError *
+positional_io_error (gboolean write,
+                     int      errsv)
+{
+  GError *error;
+  gchar *emsg;
+
+  emsg = g_win32_error_message (errsv);
+  error = g_error_new (G_IO_ERROR,
+                       g_io_error_from_win32_error (errsv),
+                       write ? "Error writing to handle: %s" : "Error reading from handle: %s",
+                       emsg);
+  g_free (emsg);
+
+  return error;
+}
+
+gssize
+_wing_positional_io (HANDLE         handle,
+                     gboolean       write,
+                     gpointer       buffer,
+                     gsize          count,
+                     goffset        offset,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  OVERLAPPED overlap = { 0, };
+  DWORD nbytes, transferred;
+  gssize retval = -1;
+  BOOL res;
+  int errsv;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return -1;
+
+  nbytes = (DWORD)MIN (count, G_MAXINT);
+
+  overlap.hEvent = _wing_event_acquire ();
+  g_return_val_if_fail (overlap.hEvent != NULL, -1);
+  set_offset (&overlap, offset);
+
+  if (write)
+    res = WriteFile (handle, buffer, nbytes, &transferred, &overlap);
+  else
+    res = ReadFile (handle, buffer, nbytes, &transferred, &overlap);
+
+  if (res ||
+      (GetLastError () == ERROR_IO_PENDING &&
+       wing_overlap_wait_result (handle, &overlap, &transferred, cancellable)))
+    {
+      retval = transferred;
+      goto end;
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto end;
+
+  errsv = GetLastError ();
+  if (errsv == ERROR_HANDLE_EOF)
+    retval = 0;
+  else
+    g_propagate_error (error, positional_io_error (write, errsv));
+
+end:
+  _wing_event_release (overlap.hEvent);
+
+  return retval;
+}
+
+static gboolean
+positional_io_ready (HANDLE   handle,
+                     gpointer user_data)
+{
+  GTask *task = user_data;
+  PositionalOp *op = g_task_get_task_data (task);
+  GCancellable *cancellable;
+  DWORD transferred;
+  int errsv;
+
+  cancellable = g_task_get_cancellable (task);
+  if (cancellable != NULL && g_cancellable_is_cancelled (cancellable))
+    {
+      /* The overlapped structure is freed with the task */
+      CancelIoEx (op->handle, &op->overlap);
+      GetOverlappedResult (op->handle, &op->overlap, &transferred, TRUE);
+
+      g_task_return_new_error (task, G_IO_ERROR,
+                               G_IO_ERROR_CANCELLED,
+                               "The operation is cancelled");
+      g_object_unref (task);
+
+      return G_SOURCE_REMOVE;
+    }
+
+  if (GetOverlappedResult (op->handle, &op->overlap, &transferred, FALSE))
+    g_task_return_int (task, transferred);
+  else
+    {
+      errsv = GetLastError ();
+      if (errsv == ERROR_IO_INCOMPLETE)
+        return G_SOURCE_CONTINUE;
+
+      if (errsv == ERROR_HANDLE_EOF)
+        g_task_return_int (task, 0);
+      else
+        g_task_return_error (task, positional_io_error (op->write, errsv));
+    }
+
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+void
+_wing_positional_io_async (HANDLE         handle,
+                           gboolean       write,
+                           gpointer       buffer,
+                           gsize          count,
+                           goffset        offset,
+                           GTask         *task)
+{
+  PositionalOp *op;
+  DWORD nbytes, transferred;
+  GSource *source;
+  BOOL res;
+  int errsv;
+
+  op = g_slice_new0 (PositionalOp);
+  op->handle = handle;
+  op->write = write;
+  op->overlap.hEvent = _wing_event_acquire ();
+  set_offset (&op->overlap, offset);
+  g_task_set_task_data (task, op, (GDestroyNotify)positional_op_free);
+
+  nbytes = (DWORD)MIN (count, G_MAXINT);
+
+  if (write)
+    res = WriteFile (handle, buffer, nbytes, &transferred, &op->overlap);
+  else
+    res = ReadFile (handle, buffer, nbytes, &transferred, &op->overlap);
+
+  if (res)
+    {
+      g_task_return_int (task, transferred);
+      g_object_unref (task);
+      return;
+    }
+
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_PENDING)
+    {
+      source = wing_create_source (op->overlap.hEvent, G_IO_IN,
+                                   g_task_get_cancellable (task));
+      g_task_attach_source (task, source, (GSourceFunc)positional_io_ready);
+      g_source_unref (source);
+      return;
+    }
+
+  if (errsv == ERROR_HANDLE_EOF)
+    g_task_return_int (task, 0);
+  else
+    g_task_return_error (task, positional_io_error (write, errsv));
+
+  g_object_unref (task);
+}
+
+gboolean
+_wing_positional_io_seek (HANDLE         handle,
+                          goffset       *position,
+                          goffset        offset,
+                          GSeekType      type,
+                          GError       **error)
+{
+  LARGE_INTEGER size;
+  goffset base;
+
+  switch (type)
+    {
+    case G_SEEK_SET:
+      base = 0;
+      break;
+    case G_SEEK_CUR:
+      base = *position;
+      break;
+    case G_SEEK_END:
+      if (!GetFileSizeEx (handle, &size))
+        {
+          int errsv = GetLastError ();
+          gchar *emsg = g_win32_error_message (errsv);
+
+          g_set_error (error, G_IO_ERROR,
+                       g_io_error_from_win32_error (errsv),
+                       "Error seeking in handle: %s",
+                       emsg);
+          g_free (emsg);
+          return FALSE;
+        }
+      base = size.QuadPart;
+      break;
+    default:
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid seek type");
+      return FALSE;
+    }
+
+  if ((offset > 0 && base > G_MAXINT64 - offset) || base + offset < 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid seek request");
+      return FALSE;
+    }
+
+  *position = base + offset;
+
+  return TRUE;
+}
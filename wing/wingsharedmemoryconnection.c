@@ -0,0 +1,1123 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingsharedmemoryconnection.h"
+
+#include <windows.h>
+#include <string.h>
+
+/**
+ * SECTION:wingsharedmemoryconnection
+ * @short_description: A connection over shared memory
+ * @see_also: #WingNamedPipeConnection, #GIOStream
+ *
+ * #WingSharedMemoryConnection moves the data between two processes on
+ * the same host through a file mapping instead of a pipe, so that no
+ * system call is needed as long as neither side has to wait for the
+ * other one.
+ *
+ * It is set up over an established #WingNamedPipeConnection: the server
+ * end of the pipe creates the mapping and passes it to the client end.
+ * Each direction is a ring buffer with a single writer and a single
+ * reader. An event wakes up the reader when the ring was empty, and the
+ * writer when it was full. The pipe is only used for the setup, and is
+ * left to the caller afterwards.
+ *
+ * The streams of the connection are not pollable, their async functions
+ * run the blocking ones in a thread, as #GInputStream does by default.
+ */
+
+#define DEFAULT_RING_SIZE (1024 * 1024)
+#define MIN_RING_SIZE 4096
+#define MAX_RING_SIZE (256 * 1024 * 1024)
+
+#define HANDSHAKE_MAGIC 0x4d485357 /* "WSHM" */
+#define HANDSHAKE_VERSION 1
+#define HANDSHAKE_REFUSED 0
+
+#define CACHE_LINE_SIZE 64
+
+/* The ring written by the server end comes first in the mapping */
+enum
+{
+  SERVER_DATA_EVENT,
+  SERVER_SPACE_EVENT,
+  CLIENT_DATA_EVENT,
+  CLIENT_SPACE_EVENT,
+  N_EVENTS
+};
+
+/* The positions only grow, the offset in the ring being the position
+ * modulo its size. The writer and the reader keep their own fields on
+ * different cache lines */
+typedef struct
+{
+  volatile LONG64 write_pos;
+  volatile LONG writer_closed;
+  volatile LONG writer_waiting;
+  guint8 writer_padding[CACHE_LINE_SIZE - sizeof (LONG64) - 2 * sizeof (LONG)];
+
+  volatile LONG64 read_pos;
+  volatile LONG reader_closed;
+  volatile LONG reader_waiting;
+  guint8 reader_padding[CACHE_LINE_SIZE - sizeof (LONG64) - 2 * sizeof (LONG)];
+} RingHeader;
+
+/* Sent by the server end, with handles valid in the client process */
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint64 ring_size;
+  guint64 mapping;
+  guint64 events[N_EVENTS];
+} Handshake;
+
+typedef struct
+{
+  volatile gint ref_count;
+
+  HANDLE mapping;
+  guint8 *view;
+  gsize ring_size;
+  HANDLE events[N_EVENTS];
+
+  /* Signaled if the other end exits without closing */
+  HANDLE peer_process;
+
+  /* Set once the rings were found inconsistent, both directions then fail */
+  volatile gint broken;
+} SharedMemory;
+
+typedef struct
+{
+  SharedMemory *shm;
+  RingHeader *header;
+  guint8 *data;
+  gsize size;
+  HANDLE data_event;
+  HANDLE space_event;
+} Ring;
+
+typedef enum
+{
+  RING_WAIT_READY,
+  RING_WAIT_PEER_GONE,
+  RING_WAIT_FAILED
+} WaitResult;
+
+static void
+set_error_from_last_error (GError      **error,
+                           const gchar  *message)
+{
+  int errsv = GetLastError ();
+  gchar *emsg = g_win32_error_message (errsv);
+
+  g_set_error (error, G_IO_ERROR,
+               g_io_error_from_win32_error (errsv),
+               "%s: %s", message, emsg);
+  g_free (emsg);
+}
+
+static void
+close_handles (HANDLE *handles,
+               guint   n_handles)
+{
+  guint i;
+
+  for (i = 0; i < n_handles; i++)
+    if (handles[i] != NULL)
+      CloseHandle (handles[i]);
+}
+
+/* Takes the handles on success, they are left to the caller otherwise */
+static SharedMemory *
+shared_memory_new (HANDLE    mapping,
+                   gsize     ring_size,
+                   HANDLE   *events,
+                   HANDLE    peer_process,
+                   GError  **error)
+{
+  SharedMemory *shm;
+
+  shm = g_slice_new0 (SharedMemory);
+  shm->ref_count = 1;
+  shm->mapping = mapping;
+  shm->ring_size = ring_size;
+  memcpy (shm->events, events, sizeof (shm->events));
+  shm->peer_process = peer_process;
+
+  shm->view = MapViewOfFile (mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+                             2 * (sizeof (RingHeader) + ring_size));
+  if (shm->view == NULL)
+    {
+      set_error_from_last_error (error, "Could not map the shared memory");
+      g_slice_free (SharedMemory, shm);
+      return NULL;
+    }
+
+  return shm;
+}
+
+static SharedMemory *
+shared_memory_ref (SharedMemory *shm)
+{
+  g_atomic_int_inc (&shm->ref_count);
+
+  return shm;
+}
+
+static void
+shared_memory_unref (SharedMemory *shm)
+{
+  if (g_atomic_int_dec_and_test (&shm->ref_count))
+    {
+      UnmapViewOfFile (shm->view);
+      close_handles (shm->events, N_EVENTS);
+      CloseHandle (shm->mapping);
+      CloseHandle (shm->peer_process);
+      g_slice_free (SharedMemory, shm);
+    }
+}
+
+static void
+ring_init (Ring         *ring,
+           SharedMemory *shm,
+           gboolean      server_ring)
+{
+  guint index = server_ring ? 0 : 1;
+
+  ring->shm = shared_memory_ref (shm);
+  ring->header = (RingHeader *) (shm->view + index * (sizeof (RingHeader) + shm->ring_size));
+  ring->data = (guint8 *) (ring->header + 1);
+  ring->size = shm->ring_size;
+  ring->data_event = shm->events[server_ring ? SERVER_DATA_EVENT : CLIENT_DATA_EVENT];
+  ring->space_event = shm->events[server_ring ? SERVER_SPACE_EVENT : CLIENT_SPACE_EVENT];
+}
+
+static void
+ring_clear (Ring *ring)
+{
+  g_clear_pointer (&ring->shm, shared_memory_unref);
+}
+
+/* The data written before a position is visible once the position is */
+static LONG64
+load_acquire (volatile LONG64 *pos)
+{
+  LONG64 value = *pos;
+
+  MemoryBarrier ();
+
+  return value;
+}
+
+static void
+set_broken_error (GError **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "The shared memory was corrupted by the other end");
+}
+
+/* The positions are written by the other end as well, so they are not
+ * trusted: a ring never holds more than its size */
+static gboolean
+ring_check_positions (Ring     *ring,
+                      LONG64    write_pos,
+                      LONG64    read_pos,
+                      GError  **error)
+{
+  if (g_atomic_int_get (&ring->shm->broken))
+    {
+      set_broken_error (error);
+      return FALSE;
+    }
+
+  if ((guint64) (write_pos - read_pos) > ring->size)
+    {
+      g_atomic_int_set (&ring->shm->broken, TRUE);
+      set_broken_error (error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static WaitResult
+ring_wait (Ring          *ring,
+           HANDLE         event,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+  HANDLE handles[3];
+  DWORD n_handles = 0;
+  GPollFD pollfd;
+  gboolean has_pollfd;
+  DWORD res;
+
+  handles[n_handles++] = event;
+  handles[n_handles++] = ring->shm->peer_process;
+
+  has_pollfd = g_cancellable_make_pollfd (cancellable, &pollfd);
+  if (has_pollfd)
+    handles[n_handles++] = (HANDLE) (gintptr) pollfd.fd;
+
+  res = WaitForMultipleObjects (n_handles, handles, FALSE, INFINITE);
+
+  if (has_pollfd)
+    g_cancellable_release_fd (cancellable);
+
+  switch (res)
+    {
+    case WAIT_OBJECT_0:
+      return RING_WAIT_READY;
+    case WAIT_OBJECT_0 + 1:
+      return RING_WAIT_PEER_GONE;
+    case WAIT_OBJECT_0 + 2:
+      g_cancellable_set_error_if_cancelled (cancellable, error);
+      return RING_WAIT_FAILED;
+    default:
+      set_error_from_last_error (error, "Error waiting for the other end");
+      return RING_WAIT_FAILED;
+    }
+}
+
+static gssize
+ring_read (Ring          *ring,
+           guint8        *buffer,
+           gsize          count,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+  RingHeader *header = ring->header;
+  LONG64 read_pos = header->read_pos;
+  gsize available;
+  gsize offset, chunk;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return -1;
+
+  for (;;)
+    {
+      LONG64 write_pos;
+      LONG closed;
+
+      /* The closing comes after the last write, so it is looked at first */
+      closed = header->writer_closed;
+      MemoryBarrier ();
+      write_pos = load_acquire (&header->write_pos);
+      if (!ring_check_positions (ring, write_pos, read_pos, error))
+        return -1;
+
+      available = (gsize) (write_pos - read_pos);
+      if (available > 0)
+        break;
+      if (closed)
+        return 0;
+
+      /* Look again once the wait is announced, not to miss a write
+       * which did not see it */
+      InterlockedExchange (&header->reader_waiting, 1);
+      closed = header->writer_closed;
+      MemoryBarrier ();
+      if (load_acquire (&header->write_pos) != read_pos || closed)
+        {
+          InterlockedExchange (&header->reader_waiting, 0);
+          continue;
+        }
+
+      switch (ring_wait (ring, ring->data_event, cancellable, error))
+        {
+        case RING_WAIT_READY:
+          break;
+        case RING_WAIT_PEER_GONE:
+          /* What was written before it exited can still be read */
+          InterlockedExchange (&header->reader_waiting, 0);
+          if (load_acquire (&header->write_pos) == read_pos)
+            return 0;
+          break;
+        case RING_WAIT_FAILED:
+          InterlockedExchange (&header->reader_waiting, 0);
+          return -1;
+        }
+    }
+
+  count = MIN (count, available);
+  offset = (gsize) read_pos & (ring->size - 1);
+  chunk = MIN (count, ring->size - offset);
+  memcpy (buffer, ring->data + offset, chunk);
+  memcpy (buffer + chunk, ring->data, count - chunk);
+
+  InterlockedExchange64 (&header->read_pos, read_pos + count);
+
+  if (header->writer_waiting && InterlockedExchange (&header->writer_waiting, 0))
+    SetEvent (ring->space_event);
+
+  return count;
+}
+
+static gssize
+ring_write (Ring          *ring,
+            const guint8  *buffer,
+            gsize          count,
+            GCancellable  *cancellable,
+            GError       **error)
+{
+  RingHeader *header = ring->header;
+  LONG64 write_pos = header->write_pos;
+  gsize space;
+  gsize offset, chunk;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return -1;
+
+  for (;;)
+    {
+      LONG64 read_pos;
+
+      if (header->reader_closed)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE,
+                               "The other end of the connection was closed");
+          return -1;
+        }
+
+      read_pos = load_acquire (&header->read_pos);
+      if (!ring_check_positions (ring, write_pos, read_pos, error))
+        return -1;
+
+      space = ring->size - (gsize) (write_pos - read_pos);
+      if (space > 0)
+        break;
+
+      InterlockedExchange (&header->writer_waiting, 1);
+      if (load_acquire (&header->read_pos) != write_pos - (LONG64) ring->size ||
+          header->reader_closed)
+        {
+          InterlockedExchange (&header->writer_waiting, 0);
+          continue;
+        }
+
+      switch (ring_wait (ring, ring->space_event, cancellable, error))
+        {
+        case RING_WAIT_READY:
+          break;
+        case RING_WAIT_PEER_GONE:
+          InterlockedExchange (&header->writer_waiting, 0);
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE,
+                               "The other end of the connection exited");
+          return -1;
+        case RING_WAIT_FAILED:
+          InterlockedExchange (&header->writer_waiting, 0);
+          return -1;
+        }
+    }
+
+  count = MIN (count, space);
+  offset = (gsize) write_pos & (ring->size - 1);
+  chunk = MIN (count, ring->size - offset);
+  memcpy (ring->data + offset, buffer, chunk);
+  memcpy (ring->data, buffer + chunk, count - chunk);
+
+  InterlockedExchange64 (&header->write_pos, write_pos + count);
+
+  if (header->reader_waiting && InterlockedExchange (&header->reader_waiting, 0))
+    SetEvent (ring->data_event);
+
+  return count;
+}
+
+#define WING_TYPE_SHARED_MEMORY_INPUT_STREAM (_wing_shared_memory_input_stream_get_type ())
+
+G_DECLARE_FINAL_TYPE (WingSharedMemoryInputStream, _wing_shared_memory_input_stream, WING, SHARED_MEMORY_INPUT_STREAM, GInputStream)
+
+struct _WingSharedMemoryInputStream
+{
+  GInputStream parent_instance;
+
+  Ring ring;
+};
+
+G_DEFINE_TYPE (WingSharedMemoryInputStream, _wing_shared_memory_input_stream, G_TYPE_INPUT_STREAM)
+
+static void
+wing_shared_memory_input_stream_finalize (GObject *object)
+{
+  WingSharedMemoryInputStream *stream = WING_SHARED_MEMORY_INPUT_STREAM (object);
+
+  ring_clear (&stream->ring);
+
+  G_OBJECT_CLASS (_wing_shared_memory_input_stream_parent_class)->finalize (object);
+}
+
+static gssize
+wing_shared_memory_input_stream_read (GInputStream  *stream,
+                                      void          *buffer,
+                                      gsize          count,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  WingSharedMemoryInputStream *shm_stream = WING_SHARED_MEMORY_INPUT_STREAM (stream);
+
+  return ring_read (&shm_stream->ring, buffer, count, cancellable, error);
+}
+
+static gboolean
+wing_shared_memory_input_stream_close (GInputStream  *stream,
+                                       GCancellable  *cancellable,
+                                       GError       **error)
+{
+  WingSharedMemoryInputStream *shm_stream = WING_SHARED_MEMORY_INPUT_STREAM (stream);
+
+  /* Fails the writes of the other end, and wakes it up if it waits */
+  InterlockedExchange (&shm_stream->ring.header->reader_closed, 1);
+  SetEvent (shm_stream->ring.space_event);
+
+  return TRUE;
+}
+
+static void
+_wing_shared_memory_input_stream_class_init (WingSharedMemoryInputStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = wing_shared_memory_input_stream_finalize;
+
+  stream_class->read_fn = wing_shared_memory_input_stream_read;
+  stream_class->close_fn = wing_shared_memory_input_stream_close;
+}
+
+static void
+_wing_shared_memory_input_stream_init (WingSharedMemoryInputStream *stream)
+{
+}
+
+#define WING_TYPE_SHARED_MEMORY_OUTPUT_STREAM (_wing_shared_memory_output_stream_get_type ())
+
+G_DECLARE_FINAL_TYPE (WingSharedMemoryOutputStream, _wing_shared_memory_output_stream, WING, SHARED_MEMORY_OUTPUT_STREAM, GOutputStream)
+
+struct _WingSharedMemoryOutputStream
+{
+  GOutputStream parent_instance;
+
+  Ring ring;
+};
+
+G_DEFINE_TYPE (WingSharedMemoryOutputStream, _wing_shared_memory_output_stream, G_TYPE_OUTPUT_STREAM)
+
+static void
+wing_shared_memory_output_stream_finalize (GObject *object)
+{
+  WingSharedMemoryOutputStream *stream = WING_SHARED_MEMORY_OUTPUT_STREAM (object);
+
+  ring_clear (&stream->ring);
+
+  G_OBJECT_CLASS (_wing_shared_memory_output_stream_parent_class)->finalize (object);
+}
+
+static gssize
+wing_shared_memory_output_stream_write (GOutputStream  *stream,
+                                        const void     *buffer,
+                                        gsize           count,
+                                        GCancellable   *cancellable,
+                                        GError        **error)
+{
+  WingSharedMemoryOutputStream *shm_stream = WING_SHARED_MEMORY_OUTPUT_STREAM (stream);
+
+  return ring_write (&shm_stream->ring, buffer, count, cancellable, error);
+}
+
+static gboolean
+wing_shared_memory_output_stream_close (GOutputStream  *stream,
+                                        GCancellable   *cancellable,
+                                        GError        **error)
+{
+  WingSharedMemoryOutputStream *shm_stream = WING_SHARED_MEMORY_OUTPUT_STREAM (stream);
+
+  /* The other end reads what is left, then the end of the stream */
+  InterlockedExchange (&shm_stream->ring.header->writer_closed, 1);
+  SetEvent (shm_stream->ring.data_event);
+
+  return TRUE;
+}
+
+static void
+_wing_shared_memory_output_stream_class_init (WingSharedMemoryOutputStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = wing_shared_memory_output_stream_finalize;
+
+  stream_class->write_fn = wing_shared_memory_output_stream_write;
+  stream_class->close_fn = wing_shared_memory_output_stream_close;
+}
+
+static void
+_wing_shared_memory_output_stream_init (WingSharedMemoryOutputStream *stream)
+{
+}
+
+struct _WingSharedMemoryConnection
+{
+  GIOStream parent_instance;
+
+  WingNamedPipeConnection *pipe_connection;
+  gsize ring_size;
+
+  GInputStream *input_stream;
+  GOutputStream *output_stream;
+};
+
+enum
+{
+  PROP_0,
+  PROP_PIPE_CONNECTION,
+  PROP_RING_SIZE,
+  LAST_PROP
+};
+
+static GParamSpec *props[LAST_PROP];
+
+G_DEFINE_TYPE (WingSharedMemoryConnection, wing_shared_memory_connection, G_TYPE_IO_STREAM)
+
+static void
+wing_shared_memory_connection_finalize (GObject *object)
+{
+  WingSharedMemoryConnection *connection = WING_SHARED_MEMORY_CONNECTION (object);
+
+  g_clear_object (&connection->input_stream);
+  g_clear_object (&connection->output_stream);
+  g_clear_object (&connection->pipe_connection);
+
+  G_OBJECT_CLASS (wing_shared_memory_connection_parent_class)->finalize (object);
+}
+
+static void
+wing_shared_memory_connection_get_property (GObject    *object,
+                                            guint       prop_id,
+                                            GValue     *value,
+                                            GParamSpec *pspec)
+{
+  WingSharedMemoryConnection *connection = WING_SHARED_MEMORY_CONNECTION (object);
+
+  switch (prop_id)
+    {
+    case PROP_PIPE_CONNECTION:
+      g_value_set_object (value, connection->pipe_connection);
+      break;
+
+    case PROP_RING_SIZE:
+      g_value_set_uint (value, (guint) connection->ring_size);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static GInputStream *
+wing_shared_memory_connection_get_input_stream (GIOStream *stream)
+{
+  WingSharedMemoryConnection *connection = WING_SHARED_MEMORY_CONNECTION (stream);
+
+  return connection->input_stream;
+}
+
+static GOutputStream *
+wing_shared_memory_connection_get_output_stream (GIOStream *stream)
+{
+  WingSharedMemoryConnection *connection = WING_SHARED_MEMORY_CONNECTION (stream);
+
+  return connection->output_stream;
+}
+
+static void
+wing_shared_memory_connection_class_init (WingSharedMemoryConnectionClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GIOStreamClass *io_class = G_IO_STREAM_CLASS (klass);
+
+  gobject_class->finalize = wing_shared_memory_connection_finalize;
+  gobject_class->get_property = wing_shared_memory_connection_get_property;
+
+  io_class->get_input_stream = wing_shared_memory_connection_get_input_stream;
+  io_class->get_output_stream = wing_shared_memory_connection_get_output_stream;
+
+  /**
+   * WingSharedMemoryConnection:pipe-connection:
+   *
+   * The pipe connection the shared memory was set up through.
+   */
+  props[PROP_PIPE_CONNECTION] =
+    g_param_spec_object ("pipe-connection",
+                         "Pipe connection",
+                         "The pipe connection the shared memory was set up through",
+                         WING_TYPE_NAMED_PIPE_CONNECTION,
+                         G_PARAM_READABLE |
+                         G_PARAM_STATIC_STRINGS);
+
+  /**
+   * WingSharedMemoryConnection:ring-size:
+   *
+   * The size in bytes of the ring buffer of each direction.
+   */
+  props[PROP_RING_SIZE] =
+    g_param_spec_uint ("ring-size",
+                       "Ring size",
+                       "The size in bytes of the ring buffer of each direction",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE |
+                       G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, LAST_PROP, props);
+}
+
+static void
+wing_shared_memory_connection_init (WingSharedMemoryConnection *connection)
+{
+}
+
+static gsize
+normalize_ring_size (gsize ring_size)
+{
+  gsize size = MIN_RING_SIZE;
+
+  if (ring_size == 0)
+    return DEFAULT_RING_SIZE;
+
+  /* A power of two, so that an offset is a position masked */
+  ring_size = MIN (ring_size, MAX_RING_SIZE);
+  while (size < ring_size)
+    size <<= 1;
+
+  return size;
+}
+
+static HANDLE
+open_peer_process (HANDLE    pipe,
+                   gboolean  is_server,
+                   GError  **error)
+{
+  ULONG process_id;
+  HANDLE process;
+  BOOL res;
+
+  if (is_server)
+    res = GetNamedPipeClientProcessId (pipe, &process_id);
+  else
+    res = GetNamedPipeServerProcessId (pipe, &process_id);
+
+  if (!res)
+    {
+      set_error_from_last_error (error, "Could not get the process id of the other end");
+      return NULL;
+    }
+
+  /* The server end duplicates the handles into the client process */
+  process = OpenProcess (SYNCHRONIZE | (is_server ? PROCESS_DUP_HANDLE : 0),
+                         FALSE, process_id);
+  if (process == NULL)
+    set_error_from_last_error (error, "Could not open the process of the other end");
+
+  return process;
+}
+
+/* Closes the handles sent to the client process, if it did not get them */
+static void
+close_remote_handles (HANDLE     process,
+                      Handshake *handshake)
+{
+  guint i;
+
+  if (handshake->mapping != 0)
+    DuplicateHandle (process, (HANDLE) (gintptr) handshake->mapping,
+                     NULL, NULL, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+
+  for (i = 0; i < N_EVENTS; i++)
+    if (handshake->events[i] != 0)
+      DuplicateHandle (process, (HANDLE) (gintptr) handshake->events[i],
+                       NULL, NULL, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+}
+
+static gboolean
+send_handle (HANDLE   process,
+             HANDLE   handle,
+             guint64 *remote_handle,
+             GError **error)
+{
+  HANDLE remote;
+
+  if (!DuplicateHandle (GetCurrentProcess (), handle, process, &remote,
+                        0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+      set_error_from_last_error (error, "Could not pass a handle to the other end");
+      return FALSE;
+    }
+
+  *remote_handle = (guint64) (gintptr) remote;
+
+  return TRUE;
+}
+
+static SharedMemory *
+handshake_server (WingNamedPipeConnection  *pipe_connection,
+                  HANDLE                    peer_process,
+                  gsize                     ring_size,
+                  GCancellable             *cancellable,
+                  GError                  **error)
+{
+  Handshake handshake = { 0, };
+  HANDLE mapping;
+  HANDLE events[N_EVENTS] = { NULL, };
+  SharedMemory *shm;
+  guint32 ack;
+  guint i;
+
+  mapping = CreateFileMapping (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                               (DWORD) (2 * (sizeof (RingHeader) + ring_size)),
+                               NULL);
+  if (mapping == NULL)
+    {
+      set_error_from_last_error (error, "Could not create the shared memory");
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  for (i = 0; i < N_EVENTS; i++)
+    {
+      events[i] = CreateEvent (NULL, FALSE, FALSE, NULL);
+      if (events[i] == NULL)
+        {
+          set_error_from_last_error (error, "Could not create an event");
+          close_handles (events, N_EVENTS);
+          CloseHandle (mapping);
+          CloseHandle (peer_process);
+          return NULL;
+        }
+    }
+
+  /* The new mapping is zeroed, which is the initial state of the rings */
+  shm = shared_memory_new (mapping, ring_size, events, peer_process, error);
+  if (shm == NULL)
+    {
+      close_handles (events, N_EVENTS);
+      CloseHandle (mapping);
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  handshake.magic = HANDSHAKE_MAGIC;
+  handshake.version = HANDSHAKE_VERSION;
+  handshake.ring_size = ring_size;
+
+  if (!send_handle (peer_process, mapping, &handshake.mapping, error))
+    goto fail_send;
+
+  for (i = 0; i < N_EVENTS; i++)
+    if (!send_handle (peer_process, events[i], &handshake.events[i], error))
+      goto fail_send;
+
+  if (!g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (pipe_connection)),
+                                  &handshake, sizeof (handshake), NULL,
+                                  cancellable, error))
+    goto fail_send;
+
+  /* Unless they are refused, the handles belong to the client from now on */
+  if (!g_input_stream_read_all (g_io_stream_get_input_stream (G_IO_STREAM (pipe_connection)),
+                                &ack, sizeof (ack), NULL,
+                                cancellable, error))
+    goto fail;
+
+  if (ack != HANDSHAKE_MAGIC)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The other end refused the shared memory");
+      if (ack == HANDSHAKE_REFUSED)
+        goto fail_send;
+      goto fail;
+    }
+
+  return shm;
+
+fail_send:
+  close_remote_handles (peer_process, &handshake);
+fail:
+  shared_memory_unref (shm);
+
+  return NULL;
+}
+
+/* The handles in the handshake were sent by the other end and nothing
+ * tells they are ones it passed, so they are never closed here: the
+ * server end closes them once it is told they were refused */
+static void
+refuse_handshake (WingNamedPipeConnection *pipe_connection,
+                  GCancellable            *cancellable)
+{
+  guint32 ack = HANDSHAKE_REFUSED;
+
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (pipe_connection)),
+                             &ack, sizeof (ack), NULL,
+                             cancellable, NULL);
+}
+
+static SharedMemory *
+handshake_client (WingNamedPipeConnection  *pipe_connection,
+                  HANDLE                    peer_process,
+                  GCancellable             *cancellable,
+                  GError                  **error)
+{
+  Handshake handshake;
+  HANDLE events[N_EVENTS];
+  SharedMemory *shm;
+  guint32 ack = HANDSHAKE_MAGIC;
+  guint i;
+
+  if (!g_input_stream_read_all (g_io_stream_get_input_stream (G_IO_STREAM (pipe_connection)),
+                                &handshake, sizeof (handshake), NULL,
+                                cancellable, error))
+    {
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  if (handshake.magic != HANDSHAKE_MAGIC)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The other end does not offer shared memory");
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  if (handshake.version != HANDSHAKE_VERSION ||
+      handshake.ring_size < MIN_RING_SIZE ||
+      handshake.ring_size > MAX_RING_SIZE ||
+      (handshake.ring_size & (handshake.ring_size - 1)) != 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "The shared memory offered by the other end is not supported");
+      refuse_handshake (pipe_connection, cancellable);
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  for (i = 0; i < N_EVENTS; i++)
+    events[i] = (HANDLE) (gintptr) handshake.events[i];
+
+  shm = shared_memory_new ((HANDLE) (gintptr) handshake.mapping,
+                           (gsize) handshake.ring_size,
+                           events, peer_process, error);
+  if (shm == NULL)
+    {
+      refuse_handshake (pipe_connection, cancellable);
+      CloseHandle (peer_process);
+      return NULL;
+    }
+
+  if (!g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (pipe_connection)),
+                                  &ack, sizeof (ack), NULL,
+                                  cancellable, error))
+    {
+      shared_memory_unref (shm);
+      return NULL;
+    }
+
+  return shm;
+}
+
+/**
+ * wing_shared_memory_connection_new:
+ * @pipe_connection: a connected #WingNamedPipeConnection
+ * @ring_size: the size of the ring buffers, or 0 for the default
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore
+ * @error: a #GError location to store the error occurring, or %NULL to
+ *   ignore
+ *
+ * Sets up a shared memory connection with the process at the other end
+ * of @pipe_connection, which must call this function as well.
+ *
+ * The server end of the pipe creates the shared memory, with a ring
+ * buffer of @ring_size bytes for each direction, rounded up to a power
+ * of two. The default is 1 MiB. On the client end @ring_size is ignored.
+ *
+ * Nothing else must be read or written on @pipe_connection during the
+ * setup. Afterwards it can be used or closed as the caller sees fit.
+ *
+ * Returns: (transfer full): a new #WingSharedMemoryConnection, or %NULL
+ *   on error
+ */
+WingSharedMemoryConnection *
+wing_shared_memory_connection_new (WingNamedPipeConnection  *pipe_connection,
+                                   gsize                     ring_size,
+                                   GCancellable             *cancellable,
+                                   GError                  **error)
+{
+  WingSharedMemoryConnection *connection;
+  WingSharedMemoryInputStream *input_stream;
+  WingSharedMemoryOutputStream *output_stream;
+  SharedMemory *shm;
+  HANDLE pipe;
+  HANDLE peer_process;
+  DWORD flags;
+  gboolean is_server;
+
+  g_return_val_if_fail (WING_IS_NAMED_PIPE_CONNECTION (pipe_connection), NULL);
+
+  g_object_get (pipe_connection, "handle", &pipe, NULL);
+
+  if (!GetNamedPipeInfo (pipe, &flags, NULL, NULL, NULL))
+    {
+      set_error_from_last_error (error, "Could not get the pipe information");
+      return NULL;
+    }
+
+  is_server = (flags & PIPE_SERVER_END) != 0;
+
+  peer_process = open_peer_process (pipe, is_server, error);
+  if (peer_process == NULL)
+    return NULL;
+
+  if (is_server)
+    shm = handshake_server (pipe_connection, peer_process,
+                            normalize_ring_size (ring_size),
+                            cancellable, error);
+  else
+    shm = handshake_client (pipe_connection, peer_process,
+                            cancellable, error);
+
+  if (shm == NULL)
+    return NULL;
+
+  connection = g_object_new (WING_TYPE_SHARED_MEMORY_CONNECTION, NULL);
+  connection->pipe_connection = g_object_ref (pipe_connection);
+  connection->ring_size = shm->ring_size;
+
+  input_stream = g_object_new (WING_TYPE_SHARED_MEMORY_INPUT_STREAM, NULL);
+  ring_init (&input_stream->ring, shm, !is_server);
+  connection->input_stream = G_INPUT_STREAM (input_stream);
+
+  output_stream = g_object_new (WING_TYPE_SHARED_MEMORY_OUTPUT_STREAM, NULL);
+  ring_init (&output_stream->ring, shm, is_server);
+  connection->output_stream = G_OUTPUT_STREAM (output_stream);
+
+  shared_memory_unref (shm);
+
+  return connection;
+}
+
+static void
+new_thread (GTask        *task,
+            gpointer      source_object,
+            gpointer      task_data,
+            GCancellable *cancellable)
+{
+  WingSharedMemoryConnection *connection;
+  GError *error = NULL;
+
+  connection = wing_shared_memory_connection_new (source_object,
+                                                  GPOINTER_TO_SIZE (task_data),
+                                                  cancellable, &error);
+  if (connection == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, connection, g_object_unref);
+}
+
+/**
+ * wing_shared_memory_connection_new_async:
+ * @pipe_connection: a connected #WingNamedPipeConnection
+ * @ring_size: the size of the ring buffers, or 0 for the default
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): callback to call when the request is satisfied
+ * @user_data: (closure): the data to pass to callback function
+ *
+ * Asynchronously sets up a shared memory connection, see
+ * wing_shared_memory_connection_new().
+ */
+void
+wing_shared_memory_connection_new_async (WingNamedPipeConnection *pipe_connection,
+                                         gsize                    ring_size,
+                                         int                      io_priority,
+                                         GCancellable            *cancellable,
+                                         GAsyncReadyCallback      callback,
+                                         gpointer                 user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (WING_IS_NAMED_PIPE_CONNECTION (pipe_connection));
+
+  task = g_task_new (pipe_connection, cancellable, callback, user_data);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, GSIZE_TO_POINTER (ring_size), NULL);
+  g_task_run_in_thread (task, new_thread);
+  g_object_unref (task);
+}
+
+/**
+ * wing_shared_memory_connection_new_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occurring, or %NULL to
+ *   ignore
+ *
+ * Finishes wing_shared_memory_connection_new_async().
+ *
+ * Returns: (transfer full): a new #WingSharedMemoryConnection, or %NULL
+ *   on error
+ */
+WingSharedMemoryConnection *
+wing_shared_memory_connection_new_finish (GAsyncResult  *result,
+                                          GError       **error)
+{
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * wing_shared_memory_connection_get_pipe_connection:
+ * @connection: a #WingSharedMemoryConnection
+ *
+ * Gets the pipe connection @connection was set up through.
+ *
+ * Returns: (transfer none): the #WingNamedPipeConnection of @connection
+ */
+WingNamedPipeConnection *
+wing_shared_memory_connection_get_pipe_connection (WingSharedMemoryConnection *connection)
+{
+  g_return_val_if_fail (WING_IS_SHARED_MEMORY_CONNECTION (connection), NULL);
+
+  return connection->pipe_connection;
+}
+
+/**
+ * wing_shared_memory_connection_get_ring_size:
+ * @connection: a #WingSharedMemoryConnection
+ *
+ * Gets the size of the ring buffer of each direction.
+ *
+ * Returns: the size in bytes of the ring buffers
+ */
+gsize
+wing_shared_memory_connection_get_ring_size (WingSharedMemoryConnection *connection)
+{
+  g_return_val_if_fail (WING_IS_SHARED_MEMORY_CONNECTION (connection), 0);
+
+  return connection->ring_size;
+}
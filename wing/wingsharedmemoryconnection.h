@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_SHARED_MEMORY_CONNECTION_H
+#define WING_SHARED_MEMORY_CONNECTION_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+#include <wing/wingnamedpipeconnection.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_SHARED_MEMORY_CONNECTION (wing_shared_memory_connection_get_type ())
+
+WING_AVAILABLE_IN_ALL
+G_DECLARE_FINAL_TYPE (WingSharedMemoryConnection, wing_shared_memory_connection, WING, SHARED_MEMORY_CONNECTION, GIOStream)
+
+WING_AVAILABLE_IN_ALL
+WingSharedMemoryConnection *wing_shared_memory_connection_new                 (WingNamedPipeConnection  *pipe_connection,
+                                                                               gsize                     ring_size,
+                                                                               GCancellable             *cancellable,
+                                                                               GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+void                        wing_shared_memory_connection_new_async           (WingNamedPipeConnection  *pipe_connection,
+                                                                               gsize                     ring_size,
+                                                                               int                       io_priority,
+                                                                               GCancellable             *cancellable,
+                                                                               GAsyncReadyCallback       callback,
+                                                                               gpointer                  user_data);
+
+WING_AVAILABLE_IN_ALL
+WingSharedMemoryConnection *wing_shared_memory_connection_new_finish          (GAsyncResult             *result,
+                                                                               GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+WingNamedPipeConnection    *wing_shared_memory_connection_get_pipe_connection (WingSharedMemoryConnection *connection);
+
+WING_AVAILABLE_IN_ALL
+gsize                       wing_shared_memory_connection_get_ring_size       (WingSharedMemoryConnection *connection);
+
+G_END_DECLS
+
+#endif /* WING_SHARED_MEMORY_CONNECTION_H */
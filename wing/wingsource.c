@@ -18,18 +18,152 @@
 
 #include "wingsource.h"
 
+/* The handles are not polled by the main context, which on Windows is
+ * limited to 64 handles by WaitForMultipleObjects, but waited by the
+ * thread pool. Once a wait is satisfied, its source is flagged and the
+ * context is woken up through a single batch source per context, so
+ * that the sources signalled together only cost one wakeup */
+
+typedef struct {
+  GSource source;
+  GMainContext *context;
+  volatile gint pending;
+  guint n_users;
+} BatchSource;
 
 typedef struct {
   GSource source;
   GPollFD pollfd;
+  PTP_WAIT wait;
+  BatchSource *batch;
+  gboolean armed;
+  volatile gint signalled;
 } WingSource;
 
+G_LOCK_DEFINE_STATIC (batch_sources);
+static GHashTable *batch_sources;
+
+static gboolean
+batch_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  BatchSource *batch = (BatchSource *)source;
+
+  /* The sources signalled from now on wake up the context again, the
+   * ones signalled before are seen by their prepare on the next
+   * iteration */
+  g_source_set_ready_time (source, -1);
+  g_atomic_int_set (&batch->pending, 0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs batch_source_funcs = {
+  NULL,
+  NULL,
+  batch_source_dispatch,
+  NULL
+};
+
+/* Returns a reference on the batch source of @context */
+static BatchSource *
+batch_source_acquire (GMainContext *context)
+{
+  BatchSource *batch;
+
+  G_LOCK (batch_sources);
+
+  if (batch_sources == NULL)
+    batch_sources = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_source_unref);
+
+  batch = g_hash_table_lookup (batch_sources, context);
+
+  /* Left over by a context that was freed at the same address */
+  if (batch != NULL && g_source_is_destroyed ((GSource *)batch))
+    batch = NULL;
+
+  if (batch == NULL)
+    {
+      GSource *source;
+
+      source = g_source_new (&batch_source_funcs, sizeof (BatchSource));
+      g_source_set_name (source, "WingBatchSource");
+      /* Only dispatched when no other source is ready, which lets the
+       * signalled sources run in the iteration that was woken up */
+      g_source_set_priority (source, G_MAXINT);
+      g_source_attach (source, context);
+
+      batch = (BatchSource *)source;
+      batch->context = context;
+      g_hash_table_replace (batch_sources, context, batch);
+    }
+
+  batch->n_users++;
+  g_source_ref ((GSource *)batch);
+
+  G_UNLOCK (batch_sources);
+
+  return batch;
+}
+
+static void
+batch_source_release (BatchSource *batch)
+{
+  G_LOCK (batch_sources);
+
+  if (--batch->n_users == 0)
+    {
+      g_source_destroy ((GSource *)batch);
+
+      /* Unless replaced already */
+      if (g_hash_table_lookup (batch_sources, batch->context) == batch)
+        g_hash_table_remove (batch_sources, batch->context);
+    }
+
+  G_UNLOCK (batch_sources);
+
+  g_source_unref ((GSource *)batch);
+}
+
+static void CALLBACK
+wing_source_wait_callback (PTP_CALLBACK_INSTANCE instance,
+                           PVOID                 context,
+                           PTP_WAIT              wait,
+                           TP_WAIT_RESULT        wait_result)
+{
+  WingSource *hsource = context;
+
+  g_atomic_int_set (&hsource->signalled, TRUE);
+
+  /* Only the first source signalled in a batch wakes up the context */
+  if (g_atomic_int_or (&hsource->batch->pending, 1) == 0)
+    g_source_set_ready_time ((GSource *)hsource->batch, 0);
+}
+
 static gboolean
 wing_source_prepare (GSource *source,
                      gint    *timeout)
 {
+  WingSource *hsource = (WingSource *)source;
+
   *timeout = -1;
-  return FALSE;
+
+  if (hsource->wait == NULL)
+    return FALSE;
+
+  /* The context is only known once the source is attached */
+  if (hsource->batch == NULL)
+    hsource->batch = batch_source_acquire (g_source_get_context (source));
+
+  /* A wait only triggers once */
+  if (!hsource->armed)
+    {
+      hsource->armed = TRUE;
+      SetThreadpoolWait (hsource->wait, (HANDLE)hsource->pollfd.fd, NULL);
+    }
+
+  return g_atomic_int_get (&hsource->signalled);
 }
 
 static gboolean
@@ -37,7 +171,10 @@ wing_source_check (GSource *source)
 {
   WingSource *hsource = (WingSource *)source;
 
-  return hsource->pollfd.revents;
+  if (hsource->wait == NULL)
+    return hsource->pollfd.revents;
+
+  return g_atomic_int_get (&hsource->signalled);
 }
 
 static gboolean
@@ -48,12 +185,29 @@ wing_source_dispatch (GSource     *source,
   WingSourceFunc func = (WingSourceFunc)callback;
   WingSource *hsource = (WingSource *)source;
 
+  if (hsource->wait != NULL && g_atomic_int_get (&hsource->signalled))
+    {
+      g_atomic_int_set (&hsource->signalled, FALSE);
+      hsource->armed = FALSE;
+    }
+
   return func ((HANDLE)hsource->pollfd.fd, user_data);
 }
 
 static void
 wing_source_finalize (GSource *source)
 {
+  WingSource *hsource = (WingSource *)source;
+
+  if (hsource->wait != NULL)
+    {
+      SetThreadpoolWait (hsource->wait, NULL, NULL);
+      WaitForThreadpoolWaitCallbacks (hsource->wait, TRUE);
+      CloseThreadpoolWait (hsource->wait);
+    }
+
+  if (hsource->batch != NULL)
+    batch_source_release (hsource->batch);
 }
 
 static gboolean
@@ -97,6 +251,11 @@ GSourceFuncs wing_source_funcs = {
  * Creates a #GSource that can be attached to a %GMainContext to monitor
  * for the availability of the specified @condition on the handle.
  *
+ * The handle is waited by the thread pool rather than polled by the
+ * main context, so that any number of these sources can be pending at
+ * once. The sources signalled at the same time wake up their context
+ * only once.
+ *
  * The callback on the source is of the #WingSourceFunc type.
  *
  * @cancellable if not %NULL can be used to cancel the source, which will
@@ -136,7 +295,11 @@ wing_create_source (HANDLE        handle,
 #endif
   hsource->pollfd.events = condition;
   hsource->pollfd.revents = 0;
-  g_source_add_poll (source, &hsource->pollfd);
+
+  /* Fall back to polling the handle from the main context */
+  hsource->wait = CreateThreadpoolWait (wing_source_wait_callback, hsource, NULL);
+  if (hsource->wait == NULL)
+    g_source_add_poll (source, &hsource->pollfd);
 
   return source;
 }
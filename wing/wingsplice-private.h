@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_SPLICE_PRIVATE_H
+#define WING_SPLICE_PRIVATE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void            _wing_output_stream_splice_async        (GOutputStream             *stream,
+                                                         GInputStream              *source,
+                                                         GOutputStreamSpliceFlags   flags,
+                                                         int                        io_priority,
+                                                         GCancellable              *cancellable,
+                                                         GAsyncReadyCallback        callback,
+                                                         gpointer                   user_data);
+
+gssize          _wing_output_stream_splice_finish       (GOutputStream             *stream,
+                                                         GAsyncResult              *result,
+                                                         GError                   **error);
+
+G_END_DECLS
+
+#endif /* WING_SPLICE_PRIVATE_H */
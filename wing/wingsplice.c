@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingsplice-private.h"
+#include "winginputstream.h"
+#include "wingiocpinputstream.h"
+#include "wingutils-private.h"
+
+/* Async splice for the output streams. GLib alternates a read and a
+ * write over a single buffer, so only one of the two streams is busy at
+ * a time. When the source is a wing stream as well, the next reads go
+ * on while the data already read is written, through a ring of buffers
+ * from the read buffer pool */
+
+/* The number of buffers the reads may run ahead of the writes */
+#define N_SPLICE_BUFFERS 4
+
+typedef struct
+{
+  gpointer data;
+  gsize size;
+  gsize written;
+} SpliceBuffer;
+
+typedef struct
+{
+  GInputStream *source;
+  GOutputStreamSpliceFlags flags;
+
+  /* The reads fill the buffer at head, the writes drain the one at tail */
+  SpliceBuffer buffers[N_SPLICE_BUFFERS];
+  guint head;
+  guint tail;
+  guint n_filled;
+
+  /* Cancelled along with the one of the task, or on the first error,
+   * since the read may otherwise wait forever for an idle source */
+  GCancellable *cancellable;
+  GCancellable *task_cancellable;
+  gulong cancelled_id;
+
+  gboolean reading;
+  gboolean writing;
+  gboolean eof;
+  gssize n_spliced;
+  GError *error;
+} SpliceData;
+
+static void
+splice_data_free (SpliceData *data)
+{
+  guint i;
+
+  for (i = 0; i < N_SPLICE_BUFFERS; i++)
+    if (data->buffers[i].data != NULL)
+      _wing_read_buffer_release (data->buffers[i].data);
+
+  if (data->task_cancellable != NULL)
+    {
+      g_cancellable_disconnect (data->task_cancellable, data->cancelled_id);
+      g_object_unref (data->task_cancellable);
+    }
+  g_object_unref (data->cancellable);
+
+  g_clear_error (&data->error);
+  g_object_unref (data->source);
+  g_slice_free (SpliceData, data);
+}
+
+static void
+splice_cancelled_cb (GCancellable *task_cancellable,
+                     gpointer      user_data)
+{
+  g_cancellable_cancel (user_data);
+}
+
+/* The first error is the one reported, the operation left is cancelled */
+static void
+splice_set_error (SpliceData *data,
+                  GError     *error)
+{
+  if (data->error != NULL)
+    {
+      g_error_free (error);
+      return;
+    }
+
+  data->error = error;
+  g_cancellable_cancel (data->cancellable);
+}
+
+static void splice_continue (GTask *task);
+
+static void
+splice_return (GTask *task)
+{
+  SpliceData *data = g_task_get_task_data (task);
+
+  if (data->error != NULL)
+    g_task_return_error (task, g_steal_pointer (&data->error));
+  else
+    g_task_return_int (task, data->n_spliced);
+
+  g_object_unref (task);
+}
+
+/* As for the splice of GLib, an error closing a stream is only
+ * reported if the splice itself succeeded */
+static void
+splice_close_source_cb (GObject      *object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  GTask *task = user_data;
+  SpliceData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  if (!g_input_stream_close_finish (G_INPUT_STREAM (object), result, &error))
+    splice_set_error (data, error);
+
+  data->flags &= ~G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE;
+  splice_continue (task);
+}
+
+static void
+splice_close_target_cb (GObject      *object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  GOutputStream *stream = G_OUTPUT_STREAM (object);
+  GTask *task = user_data;
+  SpliceData *data = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  if (!G_OUTPUT_STREAM_GET_CLASS (stream)->close_finish (stream, result, &error))
+    splice_set_error (data, error);
+
+  data->flags &= ~G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET;
+  splice_continue (task);
+}
+
+static void
+splice_read_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  GTask *task = user_data;
+  SpliceData *data = g_task_get_task_data (task);
+  SpliceBuffer *buffer = &data->buffers[data->head];
+  GError *error = NULL;
+  gssize res;
+
+  data->reading = FALSE;
+
+  res = g_input_stream_read_finish (data->source, result, &error);
+  if (res < 0)
+    splice_set_error (data, error);
+  else if (res == 0)
+    data->eof = TRUE;
+  else
+    {
+      buffer->size = res;
+      buffer->written = 0;
+      data->head = (data->head + 1) % N_SPLICE_BUFFERS;
+      data->n_filled++;
+    }
+
+  splice_continue (task);
+  g_object_unref (task);
+}
+
+static void
+splice_write_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GOutputStream *stream = G_OUTPUT_STREAM (object);
+  GTask *task = user_data;
+  SpliceData *data = g_task_get_task_data (task);
+  SpliceBuffer *buffer = &data->buffers[data->tail];
+  GError *error = NULL;
+  gssize res;
+
+  data->writing = FALSE;
+
+  /* The stream is pending for the splice, so its class is called directly */
+  res = G_OUTPUT_STREAM_GET_CLASS (stream)->write_finish (stream, result, &error);
+  if (res < 0)
+    splice_set_error (data, error);
+  else
+    {
+      buffer->written += res;
+      data->n_spliced += res;
+
+      if (buffer->written == buffer->size)
+        {
+          data->tail = (data->tail + 1) % N_SPLICE_BUFFERS;
+          data->n_filled--;
+        }
+    }
+
+  splice_continue (task);
+  g_object_unref (task);
+}
+
+/* Starts the read and the write which can be started, or finishes the
+ * splice once both are over and there is nothing left to write */
+static void
+splice_continue (GTask *task)
+{
+  GOutputStream *stream = g_task_get_source_object (task);
+  SpliceData *data = g_task_get_task_data (task);
+  gboolean done;
+
+  done = data->error != NULL || (data->eof && data->n_filled == 0);
+
+  if (done)
+    {
+      if (data->reading || data->writing)
+        return;
+
+      if (data->flags & G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE)
+        g_input_stream_close_async (data->source, g_task_get_priority (task),
+                                    g_task_get_cancellable (task),
+                                    splice_close_source_cb, task);
+      else if (data->flags & G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET)
+        G_OUTPUT_STREAM_GET_CLASS (stream)->close_async (stream, g_task_get_priority (task),
+                                                         g_task_get_cancellable (task),
+                                                         splice_close_target_cb, task);
+      else
+        splice_return (task);
+
+      return;
+    }
+
+  if (!data->reading && !data->eof && data->n_filled < N_SPLICE_BUFFERS)
+    {
+      SpliceBuffer *buffer = &data->buffers[data->head];
+
+      if (buffer->data == NULL)
+        buffer->data = _wing_read_buffer_acquire ();
+
+      data->reading = TRUE;
+      g_input_stream_read_async (data->source, buffer->data, WING_READ_BUFFER_SIZE,
+                                 g_task_get_priority (task),
+                                 data->cancellable,
+                                 splice_read_cb, g_object_ref (task));
+    }
+
+  if (!data->writing && data->n_filled > 0)
+    {
+      SpliceBuffer *buffer = &data->buffers[data->tail];
+
+      data->writing = TRUE;
+      G_OUTPUT_STREAM_GET_CLASS (stream)->write_async (stream,
+                                                       (guint8 *) buffer->data + buffer->written,
+                                                       buffer->size - buffer->written,
+                                                       g_task_get_priority (task),
+                                                       data->cancellable,
+                                                       splice_write_cb, g_object_ref (task));
+    }
+}
+
+static void
+fallback_splice_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  GOutputStreamClass *parent_class;
+  GTask *task = user_data;
+  GError *error = NULL;
+  gssize res;
+
+  parent_class = g_type_class_peek (G_TYPE_OUTPUT_STREAM);
+
+  res = parent_class->splice_finish (G_OUTPUT_STREAM (object), result, &error);
+  if (res < 0)
+    g_task_return_error (task, error);
+  else
+    g_task_return_int (task, res);
+
+  g_object_unref (task);
+}
+
+void
+_wing_output_stream_splice_async (GOutputStream             *stream,
+                                  GInputStream              *source,
+                                  GOutputStreamSpliceFlags   flags,
+                                  int                        io_priority,
+                                  GCancellable              *cancellable,
+                                  GAsyncReadyCallback        callback,
+                                  gpointer                   user_data)
+{
+  SpliceData *data;
+  GTask *task;
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, _wing_output_stream_splice_async);
+  g_task_set_priority (task, io_priority);
+
+  /* The other streams are spliced as GLib does */
+  if (!WING_IS_INPUT_STREAM (source) && !WING_IS_IOCP_INPUT_STREAM (source))
+    {
+      GOutputStreamClass *parent_class;
+
+      parent_class = g_type_class_peek (G_TYPE_OUTPUT_STREAM);
+      parent_class->splice_async (stream, source, flags, io_priority,
+                                  cancellable, fallback_splice_cb, task);
+      return;
+    }
+
+  data = g_slice_new0 (SpliceData);
+  data->source = g_object_ref (source);
+  data->flags = flags;
+  data->cancellable = g_cancellable_new ();
+  if (cancellable != NULL)
+    {
+      data->task_cancellable = g_object_ref (cancellable);
+      data->cancelled_id = g_cancellable_connect (cancellable,
+                                                  G_CALLBACK (splice_cancelled_cb),
+                                                  data->cancellable, NULL);
+    }
+  g_task_set_task_data (task, data, (GDestroyNotify) splice_data_free);
+
+  splice_continue (task);
+}
+
+gssize
+_wing_output_stream_splice_finish (GOutputStream  *stream,
+                                   GAsyncResult   *result,
+                                   GError        **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, stream), -1);
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
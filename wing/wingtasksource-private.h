@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_TASK_SOURCE_PRIVATE_H
+#define WING_TASK_SOURCE_PRIVATE_H
+
+#include <gio/gio.h>
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* A source kept by a stream on the event of its overlapped structure,
+ * which runs the async operations one after the other. It is attached
+ * once, along with a child source for the last cancellable given, and
+ * only re-armed for each operation */
+typedef struct
+{
+  GSource *source;
+  GSource *cancellable_source;
+  GCancellable *cancellable;
+  GTask *task;
+  HANDLE event;
+
+  GSourceFunc ready_func;
+  gpointer user_data;
+} WingTaskSource;
+
+/* @ready_func is called with @user_data whenever the event of the
+ * pending operation may be signalled or its cancellable is cancelled */
+void            _wing_task_source_init              (WingTaskSource *self,
+                                                     GSourceFunc     ready_func,
+                                                     gpointer        user_data);
+
+void            _wing_task_source_clear             (WingTaskSource *self);
+
+/* Waits for @event on behalf of @task, whose reference is taken over */
+void            _wing_task_source_wait              (WingTaskSource *self,
+                                                     HANDLE          event,
+                                                     GTask          *task);
+
+/* Returns the pending task, or %NULL */
+GTask          *_wing_task_source_get_task          (WingTaskSource *self);
+
+/* Returns the reference on the pending task, which is over */
+GTask          *_wing_task_source_steal_task        (WingTaskSource *self);
+
+G_END_DECLS
+
+#endif /* WING_TASK_SOURCE_PRIVATE_H */
@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingtasksource-private.h"
+#include "wingsource.h"
+
+void
+_wing_task_source_init (WingTaskSource *self,
+                        GSourceFunc     ready_func,
+                        gpointer        user_data)
+{
+  self->source = NULL;
+  self->cancellable_source = NULL;
+  self->cancellable = NULL;
+  self->task = NULL;
+  self->event = NULL;
+  self->ready_func = ready_func;
+  self->user_data = user_data;
+}
+
+static void
+remove_cancellable_source (WingTaskSource *self)
+{
+  if (self->cancellable_source == NULL)
+    return;
+
+  g_source_remove_child_source (self->source, self->cancellable_source);
+  g_source_unref (self->cancellable_source);
+  self->cancellable_source = NULL;
+  g_clear_object (&self->cancellable);
+}
+
+static void
+destroy_source (WingTaskSource *self)
+{
+  if (self->source == NULL)
+    return;
+
+  /* Destroys the child source as well */
+  g_source_destroy (self->source);
+  g_source_unref (self->source);
+  self->source = NULL;
+
+  g_clear_pointer (&self->cancellable_source, g_source_unref);
+  g_clear_object (&self->cancellable);
+}
+
+void
+_wing_task_source_clear (WingTaskSource *self)
+{
+  destroy_source (self);
+  g_clear_object (&self->task);
+}
+
+static gboolean
+task_source_ready (HANDLE   handle,
+                   gpointer user_data)
+{
+  WingTaskSource *self = user_data;
+
+  if (self->task != NULL)
+    {
+      self->ready_func (self->user_data);
+      return G_SOURCE_CONTINUE;
+    }
+
+  /* Cancelled with no operation to cancel, it would keep triggering
+   * the source */
+  if (self->cancellable != NULL && g_cancellable_is_cancelled (self->cancellable))
+    remove_cancellable_source (self);
+
+  /* Otherwise the event was signalled by an operation that succeeded
+   * right away or was cancelled. Nothing is in flight, so the event is
+   * reset, or it would keep triggering the source as well */
+  ResetEvent (self->event);
+
+  return G_SOURCE_CONTINUE;
+}
+
+void
+_wing_task_source_wait (WingTaskSource *self,
+                        HANDLE          event,
+                        GTask          *task)
+{
+  GMainContext *context;
+  GCancellable *cancellable;
+
+  g_return_if_fail (self->task == NULL);
+
+  context = g_task_get_context (task);
+  if (self->source != NULL &&
+      (g_source_is_destroyed (self->source) ||
+       g_source_get_context (self->source) != context))
+    destroy_source (self);
+
+  if (self->source == NULL)
+    {
+      self->source = wing_create_source (event, G_IO_IN, NULL);
+      g_source_set_callback (self->source, (GSourceFunc)task_source_ready, self, NULL);
+      g_source_attach (self->source, context);
+    }
+
+  cancellable = g_task_get_cancellable (task);
+  if (cancellable != self->cancellable)
+    {
+      remove_cancellable_source (self);
+
+      if (cancellable != NULL)
+        {
+          self->cancellable = g_object_ref (cancellable);
+          self->cancellable_source = g_cancellable_source_new (cancellable);
+          g_source_set_dummy_callback (self->cancellable_source);
+          g_source_add_child_source (self->source, self->cancellable_source);
+        }
+    }
+
+  g_source_set_priority (self->source, g_task_get_priority (task));
+  self->event = event;
+  self->task = task;
+}
+
+GTask *
+_wing_task_source_get_task (WingTaskSource *self)
+{
+  return self->task;
+}
+
+GTask *
+_wing_task_source_steal_task (WingTaskSource *self)
+{
+  GTask *task;
+
+  task = self->task;
+  self->task = NULL;
+
+  /* It would keep triggering the source until the next operation */
+  if (self->cancellable != NULL && g_cancellable_is_cancelled (self->cancellable))
+    remove_cancellable_source (self);
+
+  return task;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_THREAD_POOL_PRIVATE_H
+#define WING_THREAD_POOL_PRIVATE_H
+
+#include "wingthreadpool.h"
+
+#include <windows.h>
+
+G_BEGIN_DECLS
+
+/* Higher than the default is high, idle ones are low */
+TP_CALLBACK_PRIORITY   _wing_thread_pool_priority_from_io_priority (int             io_priority);
+
+/* The objects of the pool are created between these two calls, so that
+ * they do not race with wing_thread_pool_shutdown(), which closes them
+ * all. The environment, which has the callback
+ * priority matching @io_priority, is NULL once the pool is shut down */
+PTP_CALLBACK_ENVIRON   _wing_thread_pool_lock                      (WingThreadPool *pool,
+                                                                    int             io_priority);
+
+void                   _wing_thread_pool_unlock                    (WingThreadPool *pool);
+
+/* An object is closed on its own between these two calls, without the
+ * lock held since waiting for its callbacks may take a while, and they
+ * may need the lock. wing_thread_pool_shutdown() waits for the closings
+ * in progress. Returns %FALSE if the pool already closed the object */
+gboolean               _wing_thread_pool_begin_close               (WingThreadPool *pool);
+
+void                   _wing_thread_pool_end_close                 (WingThreadPool *pool);
+
+G_END_DECLS
+
+#endif /* WING_THREAD_POOL_PRIVATE_H */
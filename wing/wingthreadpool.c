@@ -0,0 +1,336 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wingthreadpool.h"
+#include "wingthreadpool-private.h"
+
+#include <windows.h>
+
+/**
+ * SECTION:wingthreadpool
+ * @short_description: A private Windows thread pool
+ * @see_also: #WingThreadPoolIo
+ *
+ * By default the completions of the async I/O run on the thread pool of
+ * the process, which is shared with anything else the process and the
+ * libraries it loads do. A #WingThreadPool is a pool of its own, with
+ * a minimum and a maximum number of threads, which can be given to
+ * wing_thread_pool_io_new_full() and to the objects creating the thread
+ * pool I/O objects, like #WingNamedPipeListener and #WingNamedPipeClient.
+ *
+ * All the thread pool objects created in the pool belong to a cleanup
+ * group, so that wing_thread_pool_shutdown() closes them at once instead
+ * of one by one.
+ *
+ * The objects are created with a callback priority derived from a GLib
+ * I/O priority: the pool runs the queued callbacks of the objects with
+ * a higher priority first, so that a latency sensitive connection is not
+ * delayed by the bulk transfers of the others when all the threads are
+ * busy.
+ */
+
+/**
+ * WingThreadPool:
+ *
+ * A private Windows thread pool.
+ */
+struct _WingThreadPool
+{
+  volatile gint ref_count;
+
+  PTP_POOL pool;
+  PTP_CLEANUP_GROUP cleanup_group;
+  TP_CALLBACK_ENVIRON callback_environs[TP_CALLBACK_PRIORITY_COUNT];
+
+  guint min_threads;
+  guint max_threads;
+
+  GMutex mutex;
+  GCond closed_cond;
+  guint n_closing;
+  volatile gint shut_down;
+};
+
+G_DEFINE_BOXED_TYPE (WingThreadPool, wing_thread_pool, wing_thread_pool_ref, wing_thread_pool_unref)
+
+/**
+ * wing_thread_pool_new:
+ * @min_threads: the minimum number of threads of the pool
+ * @max_threads: the maximum number of threads of the pool, at least 1
+ * @error: a #GError location to store the error occurring, or %NULL to ignore
+ *
+ * Creates a new thread pool. The pool keeps @min_threads threads alive
+ * even when idle, and never runs more than @max_threads callbacks at once.
+ *
+ * Returns: (transfer full): a new #WingThreadPool, or %NULL on error
+ */
+WingThreadPool *
+wing_thread_pool_new (guint    min_threads,
+                      guint    max_threads,
+                      GError **error)
+{
+  WingThreadPool *pool;
+  PTP_POOL tp_pool;
+  PTP_CLEANUP_GROUP cleanup_group;
+  guint i;
+
+  g_return_val_if_fail (max_threads > 0, NULL);
+  g_return_val_if_fail (min_threads <= max_threads, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  tp_pool = CreateThreadpool (NULL);
+  if (tp_pool == NULL)
+    goto fail;
+
+  /* The maximum first, the minimum cannot exceed it */
+  SetThreadpoolThreadMaximum (tp_pool, max_threads);
+  if (!SetThreadpoolThreadMinimum (tp_pool, min_threads))
+    {
+      int errsv = GetLastError ();
+
+      CloseThreadpool (tp_pool);
+      SetLastError (errsv);
+      goto fail;
+    }
+
+  cleanup_group = CreateThreadpoolCleanupGroup ();
+  if (cleanup_group == NULL)
+    {
+      int errsv = GetLastError ();
+
+      CloseThreadpool (tp_pool);
+      SetLastError (errsv);
+      goto fail;
+    }
+
+  pool = g_slice_new0 (WingThreadPool);
+  pool->ref_count = 1;
+  pool->pool = tp_pool;
+  pool->cleanup_group = cleanup_group;
+  pool->min_threads = min_threads;
+  pool->max_threads = max_threads;
+  g_mutex_init (&pool->mutex);
+  g_cond_init (&pool->closed_cond);
+
+  for (i = 0; i < TP_CALLBACK_PRIORITY_COUNT; i++)
+    {
+      InitializeThreadpoolEnvironment (&pool->callback_environs[i]);
+      SetThreadpoolCallbackPool (&pool->callback_environs[i], tp_pool);
+      SetThreadpoolCallbackCleanupGroup (&pool->callback_environs[i], cleanup_group, NULL);
+      SetThreadpoolCallbackPriority (&pool->callback_environs[i], (TP_CALLBACK_PRIORITY) i);
+    }
+
+  return pool;
+
+fail:
+  {
+    int errsv = GetLastError ();
+    gchar *emsg = g_win32_error_message (errsv);
+
+    g_set_error (error, G_IO_ERROR,
+                 g_io_error_from_win32_error (errsv),
+                 "Failed to create thread pool: %s",
+                 emsg);
+    g_free (emsg);
+  }
+
+  return NULL;
+}
+
+/**
+ * wing_thread_pool_ref:
+ * @pool: a #WingThreadPool
+ *
+ * Increases the reference count of @pool.
+ *
+ * Returns: (transfer full): @pool
+ */
+WingThreadPool *
+wing_thread_pool_ref (WingThreadPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_atomic_int_inc (&pool->ref_count);
+
+  return pool;
+}
+
+/**
+ * wing_thread_pool_unref:
+ * @pool: a #WingThreadPool
+ *
+ * Decreases the reference count of @pool. The thread pool I/O objects
+ * created in the pool keep a reference on it, so the pool is destroyed
+ * after all of them.
+ */
+void
+wing_thread_pool_unref (WingThreadPool *pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  if (g_atomic_int_dec_and_test (&pool->ref_count))
+    {
+      guint i;
+
+      wing_thread_pool_shutdown (pool);
+
+      CloseThreadpoolCleanupGroup (pool->cleanup_group);
+      for (i = 0; i < TP_CALLBACK_PRIORITY_COUNT; i++)
+        DestroyThreadpoolEnvironment (&pool->callback_environs[i]);
+      CloseThreadpool (pool->pool);
+      g_mutex_clear (&pool->mutex);
+      g_cond_clear (&pool->closed_cond);
+
+      g_slice_free (WingThreadPool, pool);
+    }
+}
+
+/**
+ * wing_thread_pool_get_min_threads:
+ * @pool: a #WingThreadPool
+ *
+ * Gets the minimum number of threads of @pool.
+ *
+ * Returns: the minimum number of threads
+ */
+guint
+wing_thread_pool_get_min_threads (WingThreadPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, 0);
+
+  return pool->min_threads;
+}
+
+/**
+ * wing_thread_pool_get_max_threads:
+ * @pool: a #WingThreadPool
+ *
+ * Gets the maximum number of threads of @pool.
+ *
+ * Returns: the maximum number of threads
+ */
+guint
+wing_thread_pool_get_max_threads (WingThreadPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, 0);
+
+  return pool->max_threads;
+}
+
+/**
+ * wing_thread_pool_shutdown:
+ * @pool: a #WingThreadPool
+ *
+ * Closes at once all the thread pool objects created in @pool, waiting
+ * for the callbacks already queued to run. No object can be created in
+ * the pool afterwards.
+ *
+ * The I/O on the handles bound to the pool must be over, usually by
+ * closing the handles or the connections using them, since no completion
+ * is delivered anymore. The #WingThreadPoolIo objects stay valid until
+ * they are unreferenced, but cannot start any operation.
+ */
+void
+wing_thread_pool_shutdown (WingThreadPool *pool)
+{
+  gboolean was_shut_down;
+
+  g_return_if_fail (pool != NULL);
+
+  /* Only the flag is protected: the callbacks waited for below may
+   * themselves create objects in the pool, which then fails. The objects
+   * being closed on their own are left to finish first */
+  g_mutex_lock (&pool->mutex);
+  was_shut_down = pool->shut_down;
+  g_atomic_int_set (&pool->shut_down, TRUE);
+  while (pool->n_closing > 0)
+    g_cond_wait (&pool->closed_cond, &pool->mutex);
+  g_mutex_unlock (&pool->mutex);
+
+  if (!was_shut_down)
+    CloseThreadpoolCleanupGroupMembers (pool->cleanup_group, FALSE, NULL);
+}
+
+/**
+ * wing_thread_pool_is_shut_down:
+ * @pool: a #WingThreadPool
+ *
+ * Gets whether wing_thread_pool_shutdown() was called on @pool.
+ *
+ * Returns: %TRUE if @pool is shut down
+ */
+gboolean
+wing_thread_pool_is_shut_down (WingThreadPool *pool)
+{
+  g_return_val_if_fail (pool != NULL, FALSE);
+
+  return g_atomic_int_get (&pool->shut_down);
+}
+
+TP_CALLBACK_PRIORITY
+_wing_thread_pool_priority_from_io_priority (int io_priority)
+{
+  if (io_priority < G_PRIORITY_DEFAULT)
+    return TP_CALLBACK_PRIORITY_HIGH;
+  else if (io_priority < G_PRIORITY_HIGH_IDLE)
+    return TP_CALLBACK_PRIORITY_NORMAL;
+  else
+    return TP_CALLBACK_PRIORITY_LOW;
+}
+
+PTP_CALLBACK_ENVIRON
+_wing_thread_pool_lock (WingThreadPool *pool,
+                        int             io_priority)
+{
+  g_mutex_lock (&pool->mutex);
+
+  if (pool->shut_down)
+    return NULL;
+
+  return &pool->callback_environs[_wing_thread_pool_priority_from_io_priority (io_priority)];
+}
+
+void
+_wing_thread_pool_unlock (WingThreadPool *pool)
+{
+  g_mutex_unlock (&pool->mutex);
+}
+
+gboolean
+_wing_thread_pool_begin_close (WingThreadPool *pool)
+{
+  gboolean closing = FALSE;
+
+  g_mutex_lock (&pool->mutex);
+  if (!pool->shut_down)
+    {
+      pool->n_closing++;
+      closing = TRUE;
+    }
+  g_mutex_unlock (&pool->mutex);
+
+  return closing;
+}
+
+void
+_wing_thread_pool_end_close (WingThreadPool *pool)
+{
+  g_mutex_lock (&pool->mutex);
+  if (--pool->n_closing == 0)
+    g_cond_broadcast (&pool->closed_cond);
+  g_mutex_unlock (&pool->mutex);
+}
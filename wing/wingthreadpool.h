@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_THREAD_POOL_H
+#define WING_THREAD_POOL_H
+
+#include <gio/gio.h>
+#include <wing/wingversionmacros.h>
+
+G_BEGIN_DECLS
+
+#define WING_TYPE_THREAD_POOL                            (wing_thread_pool_get_type ())
+
+typedef struct _WingThreadPool WingThreadPool;
+
+WING_AVAILABLE_IN_ALL
+GType                         wing_thread_pool_get_type                          (void) G_GNUC_CONST;
+
+WING_AVAILABLE_IN_ALL
+WingThreadPool               *wing_thread_pool_new                               (guint                     min_threads,
+                                                                                  guint                     max_threads,
+                                                                                  GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+WingThreadPool               *wing_thread_pool_ref                               (WingThreadPool           *pool);
+
+WING_AVAILABLE_IN_ALL
+void                          wing_thread_pool_unref                             (WingThreadPool           *pool);
+
+WING_AVAILABLE_IN_ALL
+guint                         wing_thread_pool_get_min_threads                   (WingThreadPool           *pool);
+
+WING_AVAILABLE_IN_ALL
+guint                         wing_thread_pool_get_max_threads                   (WingThreadPool           *pool);
+
+WING_AVAILABLE_IN_ALL
+void                          wing_thread_pool_shutdown                          (WingThreadPool           *pool);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_thread_pool_is_shut_down                      (WingThreadPool           *pool);
+
+G_END_DECLS
+
+#endif /* WING_THREAD_POOL_H */
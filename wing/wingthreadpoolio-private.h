@@ -0,0 +1,43 @@
+/*
+ * Copyright © 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WING_THREAD_POOL_IO_PRIVATE_H
+#define WING_THREAD_POOL_IO_PRIVATE_H
+
+#include "wingthreadpoolio.h"
+#include "wingutils.h"
+
+G_BEGIN_DECLS
+
+/* To call when an operation started on @self succeeded right away. If
+ * the completion port is skipped on success, this runs the callback of
+ * @overlapped since no completion will be queued, otherwise it does
+ * nothing */
+void            _wing_thread_pool_io_complete_sync       (WingThreadPoolIo   *self,
+                                                          WingOverlappedData *overlapped);
+
+/* Same as _wing_thread_pool_io_complete_sync(), but the callback is
+ * queued to the engine instead of being run from the calling thread.
+ * Used by the operations completing inline, whose callback must not run
+ * before the call starting them returns */
+void            _wing_thread_pool_io_complete_sync_later (WingThreadPoolIo   *self,
+                                                          WingOverlappedData *overlapped);
+
+G_END_DECLS
+
+#endif /* WING_THREAD_POOL_IO_PRIVATE_H */
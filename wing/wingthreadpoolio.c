@@ -20,7 +20,11 @@
 
 
 #include "wingthreadpoolio.h"
+#include "wingthreadpoolio-private.h"
+#include "wingthreadpool-private.h"
+#include "wingiocpengine-private.h"
 #include "wingutils.h"
+#include "wingutils-private.h"
 #include <windows.h>
 
 /**
@@ -28,6 +32,26 @@
  * @short_description: A wrapper around a Windows thread pool IO.
  *
  * WingThreadPoolIo creates a ThreadpoolIO object attached to an handle.
+ * Its completions run on the default thread pool of the process, or on
+ * a #WingThreadPool given to wing_thread_pool_io_new_full().
+ *
+ * Besides the streams built on it, wing_thread_pool_io_read() and
+ * wing_thread_pool_io_write() start an operation and call back directly
+ * from the thread of the pool which completes it, without going through
+ * a #GTask and a main context. The overlapped structures of these
+ * operations come from a pool, so that no memory is allocated for them
+ * once it is warm.
+ *
+ * Two engines can deliver the completions, chosen when the object is
+ * created with wing_thread_pool_io_set_default_engine() or with the
+ * WING_THREAD_POOL_IO_ENGINE environment variable, set to "thread-pool"
+ * or "completion-port". The thread pool engine, the default, runs each
+ * completion as a callback of the Windows thread pool. The completion
+ * port engine binds the handles to a completion port of its own, whose
+ * worker threads dequeue the completions in batches. It also asks the
+ * system not to queue the completion of the operations succeeding right
+ * away, except on message mode pipes, see
+ * wing_thread_pool_io_get_skip_completion_port_on_success().
  */
 
 /**
@@ -39,8 +63,15 @@ struct _WingThreadPoolIo
 {
   volatile gint ref_count;
 
+  WingThreadPoolIoEngine engine;
+  gboolean skip_completion_port_on_success;
+
   PTP_IO thread_pool_io;
   HANDLE handle;
+  WingThreadPool *pool;
+  int io_priority;
+
+  volatile gint inline_completion;
 };
 
 G_DEFINE_BOXED_TYPE(WingThreadPoolIo, wing_thread_pool_io, wing_thread_pool_io_ref, wing_thread_pool_io_unref)
@@ -64,16 +95,172 @@ threadpool_io_completion (PTP_CALLBACK_INSTANCE instance,
                              overlapped_data->user_data);
 }
 
+static WingThreadPoolIoEngine
+engine_from_environment (void)
+{
+  const gchar *value;
+
+  value = g_getenv ("WING_THREAD_POOL_IO_ENGINE");
+  if (value == NULL || g_strcmp0 (value, "thread-pool") == 0)
+    return WING_THREAD_POOL_IO_ENGINE_THREAD_POOL;
+  else if (g_strcmp0 (value, "completion-port") == 0)
+    return WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT;
+
+  g_warning ("Unknown WING_THREAD_POOL_IO_ENGINE '%s', using the thread pool", value);
+
+  return WING_THREAD_POOL_IO_ENGINE_THREAD_POOL;
+}
+
+static volatile gint default_engine = -1;
+
+/**
+ * wing_thread_pool_io_set_default_engine:
+ * @engine: a #WingThreadPoolIoEngine
+ *
+ * Sets the engine delivering the completions of the #WingThreadPoolIo
+ * objects created afterwards without a #WingThreadPool. The objects
+ * created in a #WingThreadPool always use the thread pool engine.
+ *
+ * This overrides the WING_THREAD_POOL_IO_ENGINE environment variable,
+ * and allows to compare the engines within a single process.
+ */
+void
+wing_thread_pool_io_set_default_engine (WingThreadPoolIoEngine engine)
+{
+  g_return_if_fail (engine == WING_THREAD_POOL_IO_ENGINE_THREAD_POOL ||
+                    engine == WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT);
+
+  g_atomic_int_set (&default_engine, engine);
+}
+
+/**
+ * wing_thread_pool_io_get_default_engine:
+ *
+ * Gets the engine delivering the completions of the new #WingThreadPoolIo
+ * objects, see wing_thread_pool_io_set_default_engine().
+ *
+ * Returns: the default #WingThreadPoolIoEngine
+ */
+WingThreadPoolIoEngine
+wing_thread_pool_io_get_default_engine (void)
+{
+  gint engine;
+
+  engine = g_atomic_int_get (&default_engine);
+  if (engine < 0)
+    {
+      engine = engine_from_environment ();
+
+      /* Unless set meanwhile */
+      if (!g_atomic_int_compare_and_exchange (&default_engine, -1, engine))
+        engine = g_atomic_int_get (&default_engine);
+    }
+
+  return (WingThreadPoolIoEngine) engine;
+}
+
+/* The callback environments of the default thread pool, by priority */
+static PTP_CALLBACK_ENVIRON
+get_default_callback_environ (int io_priority)
+{
+  static TP_CALLBACK_ENVIRON callback_environs[TP_CALLBACK_PRIORITY_COUNT];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint i;
+
+      for (i = 0; i < TP_CALLBACK_PRIORITY_COUNT; i++)
+        {
+          InitializeThreadpoolEnvironment (&callback_environs[i]);
+          SetThreadpoolCallbackPriority (&callback_environs[i], (TP_CALLBACK_PRIORITY) i);
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return &callback_environs[_wing_thread_pool_priority_from_io_priority (io_priority)];
+}
+
 WingThreadPoolIo *
 wing_thread_pool_io_new (void *handle)
+{
+  return wing_thread_pool_io_new_full (handle, NULL, G_PRIORITY_DEFAULT);
+}
+
+/**
+ * wing_thread_pool_io_new_full:
+ * @handle: the handle to bind
+ * @pool: (nullable): the #WingThreadPool to run the completions on, or %NULL
+ * @io_priority: the I/O priority of the completions
+ *
+ * Binds @handle to a thread pool I/O object whose completions run on
+ * @pool, or on the default thread pool of the process if @pool is %NULL.
+ * The new object keeps a reference on @pool.
+ *
+ * When the threads of the pool are all busy, the completions with a
+ * higher priority are run first. The priority is mapped to one of the
+ * three callback priorities of the thread pools: higher than
+ * %G_PRIORITY_DEFAULT is high, %G_PRIORITY_HIGH_IDLE and lower is low,
+ * anything in between is normal. A handle can only be bound once, so
+ * the priority is the same for all the operations on @handle; the
+ * @io_priority given to each async operation of the streams only orders
+ * their callbacks in the main context.
+ *
+ * Without @pool, the completions are delivered by the engine returned by
+ * wing_thread_pool_io_get_default_engine(). The completion port engine
+ * has no priorities, @io_priority is then only recorded.
+ *
+ * Returns: (transfer full): a new #WingThreadPoolIo, or %NULL if it could
+ * not be created, for instance because @pool is shut down
+ */
+WingThreadPoolIo *
+wing_thread_pool_io_new_full (void           *handle,
+                              WingThreadPool *pool,
+                              int             io_priority)
 {
   WingThreadPoolIo *self;
-  PTP_IO thread_pool_io;
+  WingThreadPoolIoEngine engine;
+  PTP_IO thread_pool_io = NULL;
+  gboolean skip_completion_port_on_success = FALSE;
 
   g_return_val_if_fail (handle != NULL && (HANDLE) handle != INVALID_HANDLE_VALUE, NULL);
 
-  thread_pool_io = CreateThreadpoolIo ((HANDLE) handle, threadpool_io_completion, NULL, NULL);
-  if (thread_pool_io == NULL)
+  engine = pool != NULL ? WING_THREAD_POOL_IO_ENGINE_THREAD_POOL : wing_thread_pool_io_get_default_engine ();
+
+  if (engine == WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT)
+    {
+      if (!_wing_iocp_engine_bind ((HANDLE) handle, &skip_completion_port_on_success))
+        {
+          gchar *emsg;
+
+          emsg = g_win32_error_message (GetLastError ());
+          g_warning ("Failed to bind the handle to the completion port: %s", emsg);
+          g_free (emsg);
+
+          return NULL;
+        }
+    }
+  else if (pool != NULL)
+    {
+      PTP_CALLBACK_ENVIRON callback_environ;
+
+      callback_environ = _wing_thread_pool_lock (pool, io_priority);
+      if (callback_environ == NULL)
+        {
+          _wing_thread_pool_unlock (pool);
+          g_warning ("Failed to create thread pool IO: the thread pool is shut down");
+          return NULL;
+        }
+
+      thread_pool_io = CreateThreadpoolIo ((HANDLE) handle, threadpool_io_completion, NULL, callback_environ);
+      _wing_thread_pool_unlock (pool);
+    }
+  else
+    thread_pool_io = CreateThreadpoolIo ((HANDLE) handle, threadpool_io_completion, NULL,
+                                         get_default_callback_environ (io_priority));
+
+  if (engine == WING_THREAD_POOL_IO_ENGINE_THREAD_POOL && thread_pool_io == NULL)
     {
       gchar *emsg;
 
@@ -87,8 +274,13 @@ wing_thread_pool_io_new (void *handle)
   self = g_slice_new (WingThreadPoolIo);
   self->ref_count = 1;
 
+  self->engine = engine;
+  self->skip_completion_port_on_success = skip_completion_port_on_success;
   self->handle = (HANDLE) handle;
   self->thread_pool_io = thread_pool_io;
+  self->pool = pool != NULL ? wing_thread_pool_ref (pool) : NULL;
+  self->io_priority = io_priority;
+  self->inline_completion = FALSE;
 
   return self;
 }
@@ -103,13 +295,37 @@ wing_thread_pool_io_ref (WingThreadPoolIo *self)
   return self;
 }
 
+static void
+close_thread_pool_io (WingThreadPoolIo *self)
+{
+  if (self->pool != NULL)
+    {
+      /* Already closed with the whole pool if it was shut down */
+      if (_wing_thread_pool_begin_close (self->pool))
+        {
+          WaitForThreadpoolIoCallbacks (self->thread_pool_io, FALSE);
+          CloseThreadpoolIo (self->thread_pool_io);
+          _wing_thread_pool_end_close (self->pool);
+        }
+    }
+  else
+    {
+      WaitForThreadpoolIoCallbacks (self->thread_pool_io, FALSE);
+      CloseThreadpoolIo (self->thread_pool_io);
+    }
+}
+
 static gboolean
 destroy_thread_pool_io_idle (gpointer user_data)
 {
   WingThreadPoolIo *self = (WingThreadPoolIo *) user_data;
 
-  WaitForThreadpoolIoCallbacks (self->thread_pool_io, FALSE);
-  CloseThreadpoolIo (self->thread_pool_io);
+  /* The completions on the port only refer to their overlapped data,
+   * so there is nothing to wait for with that engine */
+  if (self->engine == WING_THREAD_POOL_IO_ENGINE_THREAD_POOL)
+    close_thread_pool_io (self);
+
+  g_clear_pointer (&self->pool, wing_thread_pool_unref);
   g_slice_free (WingThreadPoolIo, self);
 
   return G_SOURCE_REMOVE;
@@ -134,7 +350,8 @@ wing_thread_pool_io_start (WingThreadPoolIo *self)
 {
   g_return_if_fail (self != NULL);
 
-  StartThreadpoolIo (self->thread_pool_io);
+  if (self->engine == WING_THREAD_POOL_IO_ENGINE_THREAD_POOL)
+    StartThreadpoolIo (self->thread_pool_io);
 }
 
 void
@@ -142,7 +359,113 @@ wing_thread_pool_io_cancel (WingThreadPoolIo *self)
 {
   g_return_if_fail (self != NULL);
 
-  CancelThreadpoolIo (self->thread_pool_io);
+  if (self->engine == WING_THREAD_POOL_IO_ENGINE_THREAD_POOL)
+    CancelThreadpoolIo (self->thread_pool_io);
+}
+
+/**
+ * wing_thread_pool_io_get_engine:
+ * @self: a #WingThreadPoolIo
+ *
+ * Gets the engine delivering the completions of @self.
+ *
+ * Returns: the #WingThreadPoolIoEngine of @self
+ */
+WingThreadPoolIoEngine
+wing_thread_pool_io_get_engine (WingThreadPoolIo *self)
+{
+  g_return_val_if_fail (self != NULL, WING_THREAD_POOL_IO_ENGINE_THREAD_POOL);
+
+  return self->engine;
+}
+
+/**
+ * wing_thread_pool_io_get_skip_completion_port_on_success:
+ * @self: a #WingThreadPoolIo
+ *
+ * Gets whether the operations on the handle of @self which succeed right
+ * away are not completed through the port. In that case, the code which
+ * starts an operation with wing_thread_pool_io_start() and sees it
+ * succeed immediately must call wing_thread_pool_io_cancel() and handle
+ * the result itself, as no completion will follow. The streams, the
+ * listener and wing_thread_pool_io_read() and wing_thread_pool_io_write()
+ * take care of it.
+ *
+ * Returns: %TRUE if the synchronous successes skip the completion port
+ */
+gboolean
+wing_thread_pool_io_get_skip_completion_port_on_success (WingThreadPoolIo *self)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return self->skip_completion_port_on_success;
+}
+
+typedef struct
+{
+  GQueue queue;
+  gboolean completing;
+} SyncCompletions;
+
+static GPrivate sync_completions_private = G_PRIVATE_INIT (g_free);
+
+void
+_wing_thread_pool_io_complete_sync (WingThreadPoolIo   *self,
+                                    WingOverlappedData *overlapped)
+{
+  SyncCompletions *completions;
+
+  if (!self->skip_completion_port_on_success)
+    return;
+
+  wing_thread_pool_io_cancel (self);
+
+  completions = g_private_get (&sync_completions_private);
+  if (completions == NULL)
+    {
+      completions = g_new0 (SyncCompletions, 1);
+      g_private_set (&sync_completions_private, completions);
+    }
+
+  /* A callback starting the next operation, which succeeds right away as
+   * well, would otherwise recurse for as long as there is data */
+  g_queue_push_tail (&completions->queue, overlapped);
+  if (completions->completing)
+    return;
+
+  completions->completing = TRUE;
+
+  while ((overlapped = g_queue_pop_head (&completions->queue)) != NULL)
+    overlapped->callback (NULL,
+                          NULL,
+                          overlapped,
+                          NO_ERROR,
+                          overlapped->overlapped.InternalHigh,
+                          NULL,
+                          overlapped->user_data);
+
+  completions->completing = FALSE;
+}
+
+void
+_wing_thread_pool_io_complete_sync_later (WingThreadPoolIo   *self,
+                                          WingOverlappedData *overlapped)
+{
+  if (!self->skip_completion_port_on_success)
+    return;
+
+  /* Only the completion port engine skips the port, so the completion
+   * the system did not queue is queued by hand */
+  if (!_wing_iocp_engine_post (&overlapped->overlapped,
+                               (DWORD) overlapped->overlapped.InternalHigh))
+    {
+      gchar *emsg = g_win32_error_message (GetLastError ());
+
+      g_warning ("Failed to queue a completion: %s", emsg);
+      g_free (emsg);
+
+      _wing_thread_pool_io_complete_sync (self, overlapped);
+    }
 }
 
 void *
@@ -153,6 +476,248 @@ wing_thread_pool_get_handle (WingThreadPoolIo *self)
   return (void *) self->handle;
 }
 
+/**
+ * wing_thread_pool_io_get_io_priority:
+ * @self: a #WingThreadPoolIo
+ *
+ * Gets the I/O priority the completions of @self run with, see
+ * wing_thread_pool_io_new_full().
+ *
+ * Returns: the I/O priority
+ */
+int
+wing_thread_pool_io_get_io_priority (WingThreadPoolIo *self)
+{
+  g_return_val_if_fail (self != NULL, G_PRIORITY_DEFAULT);
+
+  return self->io_priority;
+}
+
+/**
+ * wing_thread_pool_io_set_inline_completion:
+ * @self: a #WingThreadPoolIo
+ * @inline_completion: %TRUE to complete the async operations inline
+ *
+ * Sets whether the async operations of the #WingIocpInputStream and
+ * #WingIocpOutputStream built on @self call their callback directly
+ * from the thread of the pool which completes them, instead of from the
+ * thread-default main context of the caller. This saves waking up the
+ * main context and switching to its thread for each operation.
+ *
+ * This is only safe for callers following these rules:
+ *
+ * - the callback may run on any thread, concurrently with the thread
+ *   which started the operation: everything it touches has to be
+ *   thread-safe, and it must not rely on the thread-default main context;
+ * - the callback must not block, it holds a thread of the pool;
+ * - the stream must not be used by two threads at the same time, which
+ *   is the case when the next operation is only started from the
+ *   callback of the previous one;
+ * - the errors found before an operation is started, such as a
+ *   cancellable already cancelled, are still reported from the main
+ *   context, as usual.
+ *
+ * As with the main context, the callback never runs before the call
+ * starting the operation returns, even when the operation succeeds right
+ * away. It takes effect for the operations started afterwards.
+ */
+void
+wing_thread_pool_io_set_inline_completion (WingThreadPoolIo *self,
+                                           gboolean          inline_completion)
+{
+  g_return_if_fail (self != NULL);
+
+  g_atomic_int_set (&self->inline_completion, inline_completion != FALSE);
+}
+
+/**
+ * wing_thread_pool_io_get_inline_completion:
+ * @self: a #WingThreadPoolIo
+ *
+ * Gets whether the async operations on @self complete inline,
+ * see wing_thread_pool_io_set_inline_completion().
+ *
+ * Returns: %TRUE if the async operations complete inline
+ */
+gboolean
+wing_thread_pool_io_get_inline_completion (WingThreadPoolIo *self)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return g_atomic_int_get (&self->inline_completion);
+}
+
+static void
+io_operation_completion (PTP_CALLBACK_INSTANCE instance,
+                         PVOID                 ctxt,
+                         PVOID                 overlapped,
+                         ULONG                 result,
+                         ULONG_PTR             number_of_bytes_transferred,
+                         PTP_IO                threadpool_io,
+                         gpointer              user_data)
+{
+  WingPooledOverlapped *pooled = overlapped;
+  WingThreadPoolIo *self = user_data;
+  WingThreadPoolIoCallback callback;
+  gpointer callback_data;
+
+  callback = (WingThreadPoolIoCallback) pooled->extra[0];
+  callback_data = pooled->extra[1];
+
+  /* Given back first, so that the next operation started from the
+   * callback can reuse it */
+  _wing_overlapped_data_release (overlapped);
+
+  callback (self, result, number_of_bytes_transferred, callback_data);
+
+  wing_thread_pool_io_unref (self);
+}
+
+static gboolean
+start_io_operation (WingThreadPoolIo          *self,
+                    gboolean                   write,
+                    void                      *buffer,
+                    gsize                      count,
+                    WingThreadPoolIoCallback   callback,
+                    gpointer                   user_data,
+                    GError                   **error)
+{
+  WingOverlappedData *overlapped;
+  WingPooledOverlapped *pooled;
+  BOOL res;
+  int errsv;
+
+  if (self->handle == INVALID_HANDLE_VALUE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "Error %s handle: the handle is closed",
+                   write ? "writing to" : "reading from");
+      return FALSE;
+    }
+
+  if (self->pool != NULL && wing_thread_pool_is_shut_down (self->pool))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   "Error %s handle: the thread pool is shut down",
+                   write ? "writing to" : "reading from");
+      return FALSE;
+    }
+
+  overlapped = _wing_overlapped_data_acquire ();
+  overlapped->user_data = wing_thread_pool_io_ref (self);
+  overlapped->callback = io_operation_completion;
+
+  pooled = (WingPooledOverlapped *) overlapped;
+  pooled->extra[0] = (gpointer) callback;
+  pooled->extra[1] = user_data;
+
+  wing_thread_pool_io_start (self);
+
+  if (write)
+    res = WriteFile (self->handle, buffer, (DWORD) count, NULL, (OVERLAPPED *) overlapped);
+  else
+    res = ReadFile (self->handle, buffer, (DWORD) count, NULL, (OVERLAPPED *) overlapped);
+
+  if (res)
+    {
+      _wing_thread_pool_io_complete_sync (self, overlapped);
+      return TRUE;
+    }
+
+  /* A message longer than the buffer is still completed on the port */
+  errsv = GetLastError ();
+  if (errsv == ERROR_IO_PENDING || (!write && errsv == ERROR_MORE_DATA))
+    return TRUE;
+
+  wing_thread_pool_io_cancel (self);
+  _wing_overlapped_data_release (overlapped);
+  wing_thread_pool_io_unref (self);
+
+  {
+    gchar *emsg = g_win32_error_message (errsv);
+
+    g_set_error (error, G_IO_ERROR,
+                 g_io_error_from_win32_error (errsv),
+                 "Error %s handle: %s",
+                 write ? "writing to" : "reading from",
+                 emsg);
+    g_free (emsg);
+  }
+
+  return FALSE;
+}
+
+/**
+ * wing_thread_pool_io_read:
+ * @self: a #WingThreadPoolIo
+ * @buffer: (out caller-allocates): a buffer to read data into
+ * @count: the number of bytes that will be read from the handle
+ * @callback: the function to call once the read is over
+ * @user_data: the data to pass to @callback
+ * @error: a #GError location to store the error occurring, or %NULL to ignore
+ *
+ * Starts reading from the handle of @self. @callback is called from a
+ * thread of the pool once the read is over, with %ERROR_MORE_DATA when
+ * only part of a message was read from a pipe in message mode. When
+ * the read succeeds right away and the completion port is skipped, see
+ * wing_thread_pool_io_get_skip_completion_port_on_success(), @callback
+ * is called from the calling thread before this function returns.
+ *
+ * @buffer must stay valid until @callback is called. The read can be
+ * aborted with CancelIoEx() or by closing the handle, @callback is then
+ * called with %ERROR_OPERATION_ABORTED.
+ *
+ * Returns: %TRUE if the read was started, in which case @callback will
+ * be called, %FALSE if it failed right away
+ */
+gboolean
+wing_thread_pool_io_read (WingThreadPoolIo          *self,
+                          void                      *buffer,
+                          gsize                      count,
+                          WingThreadPoolIoCallback   callback,
+                          gpointer                   user_data,
+                          GError                   **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (count <= G_MAXUINT32, FALSE);
+  g_return_val_if_fail (callback != NULL, FALSE);
+
+  return start_io_operation (self, FALSE, buffer, count, callback, user_data, error);
+}
+
+/**
+ * wing_thread_pool_io_write:
+ * @self: a #WingThreadPoolIo
+ * @buffer: (array length=count) (element-type guint8): the buffer
+ *     containing the data to write
+ * @count: the number of bytes to write
+ * @callback: the function to call once the write is over
+ * @user_data: the data to pass to @callback
+ * @error: a #GError location to store the error occurring, or %NULL to ignore
+ *
+ * Starts writing to the handle of @self. @callback is called from a
+ * thread of the pool once the write is over. See wing_thread_pool_io_read().
+ *
+ * Returns: %TRUE if the write was started, in which case @callback will
+ * be called, %FALSE if it failed right away
+ */
+gboolean
+wing_thread_pool_io_write (WingThreadPoolIo          *self,
+                           const void                *buffer,
+                           gsize                      count,
+                           WingThreadPoolIoCallback   callback,
+                           gpointer                   user_data,
+                           GError                   **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (count <= G_MAXUINT32, FALSE);
+  g_return_val_if_fail (callback != NULL, FALSE);
+
+  return start_io_operation (self, TRUE, (void *) buffer, count, callback, user_data, error);
+}
+
 gboolean
 wing_thread_pool_io_close_handle (WingThreadPoolIo  *self,
                                   GError           **error)
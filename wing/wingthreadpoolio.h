@@ -23,6 +23,7 @@
 
 #include <gio/gio.h>
 #include <wing/wingversionmacros.h>
+#include <wing/wingthreadpool.h>
 
 G_BEGIN_DECLS
 
@@ -31,12 +32,54 @@ G_BEGIN_DECLS
 
 typedef struct _WingThreadPoolIo WingThreadPoolIo;
 
+/**
+ * WingThreadPoolIoEngine:
+ * @WING_THREAD_POOL_IO_ENGINE_THREAD_POOL: the completions are run by
+ *     the Windows thread pool
+ * @WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT: the completions are
+ *     dequeued in batches from a completion port owned by wing, and the
+ *     operations succeeding right away skip the port when possible
+ *
+ * How the completions of the operations on a #WingThreadPoolIo are
+ * delivered to its callbacks.
+ */
+typedef enum {
+  WING_THREAD_POOL_IO_ENGINE_THREAD_POOL,
+  WING_THREAD_POOL_IO_ENGINE_COMPLETION_PORT
+} WingThreadPoolIoEngine;
+
+/**
+ * WingThreadPoolIoCallback:
+ * @self: the #WingThreadPoolIo the operation was started on
+ * @result: the Win32 error code of the operation, 0 on success
+ * @n_bytes: the number of bytes transferred
+ * @user_data: the data given when the operation was started
+ *
+ * Called from a thread of the pool once an operation started with
+ * wing_thread_pool_io_read() or wing_thread_pool_io_write() is over.
+ */
+typedef void (*WingThreadPoolIoCallback) (WingThreadPoolIo *self,
+                                          gulong            result,
+                                          gsize             n_bytes,
+                                          gpointer          user_data);
+
 WING_AVAILABLE_IN_ALL
 GType                         wing_thread_pool_io_get_type                       (void) G_GNUC_CONST;
 
 WING_AVAILABLE_IN_ALL
 WingThreadPoolIo             *wing_thread_pool_io_new                            (void                     *handle);
 
+WING_AVAILABLE_IN_ALL
+WingThreadPoolIo             *wing_thread_pool_io_new_full                       (void                     *handle,
+                                                                                  WingThreadPool           *pool,
+                                                                                  int                       io_priority);
+
+WING_AVAILABLE_IN_ALL
+void                          wing_thread_pool_io_set_default_engine             (WingThreadPoolIoEngine    engine);
+
+WING_AVAILABLE_IN_ALL
+WingThreadPoolIoEngine        wing_thread_pool_io_get_default_engine             (void);
+
 WING_AVAILABLE_IN_ALL
 WingThreadPoolIo             *wing_thread_pool_io_ref                            (WingThreadPoolIo         *self);
 
@@ -52,6 +95,38 @@ void                          wing_thread_pool_io_cancel
 WING_AVAILABLE_IN_ALL
 void                         *wing_thread_pool_get_handle                        (WingThreadPoolIo         *self);
 
+WING_AVAILABLE_IN_ALL
+int                           wing_thread_pool_io_get_io_priority                (WingThreadPoolIo         *self);
+
+WING_AVAILABLE_IN_ALL
+WingThreadPoolIoEngine        wing_thread_pool_io_get_engine                     (WingThreadPoolIo         *self);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_thread_pool_io_get_skip_completion_port_on_success (WingThreadPoolIo    *self);
+
+WING_AVAILABLE_IN_ALL
+void                          wing_thread_pool_io_set_inline_completion          (WingThreadPoolIo         *self,
+                                                                                  gboolean                  inline_completion);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_thread_pool_io_get_inline_completion          (WingThreadPoolIo         *self);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_thread_pool_io_read                           (WingThreadPoolIo         *self,
+                                                                                  void                     *buffer,
+                                                                                  gsize                     count,
+                                                                                  WingThreadPoolIoCallback  callback,
+                                                                                  gpointer                  user_data,
+                                                                                  GError                  **error);
+
+WING_AVAILABLE_IN_ALL
+gboolean                      wing_thread_pool_io_write                          (WingThreadPoolIo         *self,
+                                                                                  const void               *buffer,
+                                                                                  gsize                     count,
+                                                                                  WingThreadPoolIoCallback  callback,
+                                                                                  gpointer                  user_data,
+                                                                                  GError                  **error);
+
 WING_AVAILABLE_IN_ALL
 gboolean                      wing_thread_pool_io_close_handle                   (WingThreadPoolIo         *self,
                                                                                   GError                  **error);
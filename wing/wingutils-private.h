@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 NICE s.r.l.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WING_UTILS_PRIVATE_H
+#define WING_UTILS_PRIVATE_H
+
+#include <glib.h>
+#include <windows.h>
+
+#include "wingutils.h"
+
+G_BEGIN_DECLS
+
+/* The #WingOverlappedData handed out by the pool, with room for
+ * the caller to keep some more state about the operation */
+typedef struct
+{
+  WingOverlappedData data;
+  gpointer extra[2];
+} WingPooledOverlapped;
+
+HANDLE          _wing_event_acquire             (void);
+
+void            _wing_event_release             (HANDLE event);
+
+WingOverlappedData *
+                _wing_overlapped_data_acquire   (void);
+
+void            _wing_overlapped_data_release   (WingOverlappedData *overlapped);
+
+/* The size of the buffers of the read buffer pool */
+#define WING_READ_BUFFER_SIZE 65536
+
+gpointer        _wing_read_buffer_acquire       (void);
+
+void            _wing_read_buffer_release       (gpointer            buffer);
+
+G_END_DECLS
+
+#endif /* WING_UTILS_PRIVATE_H */
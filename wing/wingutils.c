@@ -16,9 +16,50 @@
  */
 
 #include "wingutils.h"
+#include "wingutils-private.h"
 
 #include <windows.h>
 #include <psapi.h>
+#include <malloc.h>
+
+/* The number of events each thread keeps for its sync operations */
+#define EVENT_CACHE_SIZE 4
+
+typedef struct
+{
+  HANDLE events[EVENT_CACHE_SIZE];
+  guint n_events;
+} EventCache;
+
+static void
+event_cache_free (gpointer data)
+{
+  EventCache *cache = data;
+  guint i;
+
+  for (i = 0; i < cache->n_events; i++)
+    CloseHandle (cache->events[i]);
+
+  g_slice_free (EventCache, cache);
+}
+
+static GPrivate event_cache_private = G_PRIVATE_INIT (event_cache_free);
+
+/* The number of free overlapped structures kept for the async operations */
+#define OVERLAPPED_POOL_SIZE 1024
+
+typedef struct
+{
+  SLIST_ENTRY entry;
+  WingPooledOverlapped overlapped;
+} OverlappedNode;
+
+static SLIST_HEADER overlapped_pool;
+
+/* The number of free read buffers kept, 4 MiB in all */
+#define READ_BUFFER_POOL_SIZE 64
+
+static SLIST_HEADER read_buffer_pool;
 
 gboolean
 wing_is_wow_64 (void)
@@ -142,6 +183,10 @@ wing_overlap_wait_result (HANDLE           hfile,
   gboolean result = FALSE;
   gint num, npoll;
 
+  /* Nothing else to wait for, let the kernel block on the event */
+  if (cancellable == NULL)
+    return GetOverlappedResult (hfile, overlap, transferred, TRUE);
+
 #if GLIB_SIZEOF_VOID_P == 8
   pollfd[0].fd = (gint64)overlap->hEvent;
 #else
@@ -168,6 +213,11 @@ loop:
        * operaton on this thread, we can just use: */
       result = CancelIo (hfile);
       g_warn_if_fail (result);
+
+      /* The overlapped structure and its event are reused by the caller
+       * once we return, so wait for the operation to be aborted */
+      result = GetOverlappedResult (hfile, overlap, transferred, TRUE);
+      goto end;
     }
 
   result = GetOverlappedResult (overlap->hEvent, overlap, transferred, FALSE);
@@ -182,3 +232,175 @@ end:
 
   return result;
 }
+
+/*
+ * _wing_event_acquire:
+ *
+ * Gets an auto-reset event for a sync overlapped operation, taken from
+ * the events cached by the calling thread when possible. There is no
+ * need to reset it, the I/O functions do it when they start.
+ *
+ * Returns: an event to give back with _wing_event_release()
+ */
+HANDLE
+_wing_event_acquire (void)
+{
+  EventCache *cache;
+
+  cache = g_private_get (&event_cache_private);
+  if (cache != NULL && cache->n_events > 0)
+    return cache->events[--cache->n_events];
+
+  return CreateEvent (NULL, FALSE, FALSE, NULL);
+}
+
+/*
+ * _wing_event_release:
+ * @event: an event got from _wing_event_acquire()
+ *
+ * Gives back an event once no operation uses it anymore.
+ */
+void
+_wing_event_release (HANDLE event)
+{
+  EventCache *cache;
+
+  cache = g_private_get (&event_cache_private);
+  if (cache == NULL)
+    {
+      cache = g_slice_new0 (EventCache);
+      g_private_set (&event_cache_private, cache);
+    }
+
+  if (cache->n_events < EVENT_CACHE_SIZE)
+    cache->events[cache->n_events++] = event;
+  else
+    CloseHandle (event);
+}
+
+static PSLIST_HEADER
+get_overlapped_pool (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      InitializeSListHead (&overlapped_pool);
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return &overlapped_pool;
+}
+
+/*
+ * _wing_overlapped_data_acquire:
+ *
+ * Gets a zeroed #WingOverlappedData for an async operation. It is taken
+ * from a lock-free pool shared by all the threads, so that no memory is
+ * allocated once the pool holds as many structures as there are
+ * operations in flight.
+ *
+ * The structure is the first member of a #WingPooledOverlapped, whose
+ * extra pointers are free for the caller.
+ *
+ * Returns: a #WingOverlappedData to give back with _wing_overlapped_data_release()
+ */
+WingOverlappedData *
+_wing_overlapped_data_acquire (void)
+{
+  OverlappedNode *node;
+
+  node = (OverlappedNode *) InterlockedPopEntrySList (get_overlapped_pool ());
+  if (node == NULL)
+    {
+      node = _aligned_malloc (sizeof (OverlappedNode), MEMORY_ALLOCATION_ALIGNMENT);
+      if (node == NULL)
+        g_error ("%s: failed to allocate %" G_GSIZE_FORMAT " bytes",
+                 G_STRLOC, sizeof (OverlappedNode));
+    }
+
+  memset (&node->overlapped, 0, sizeof (node->overlapped));
+
+  return &node->overlapped.data;
+}
+
+/*
+ * _wing_overlapped_data_release:
+ * @overlapped: a #WingOverlappedData got from _wing_overlapped_data_acquire()
+ *
+ * Gives back @overlapped once its operation is over. It can be called
+ * from any thread.
+ */
+void
+_wing_overlapped_data_release (WingOverlappedData *overlapped)
+{
+  OverlappedNode *node;
+  PSLIST_HEADER pool;
+
+  node = CONTAINING_RECORD (overlapped, OverlappedNode, overlapped);
+  pool = get_overlapped_pool ();
+
+  /* The depth is only a hint, going a little over the limit is harmless */
+  if (QueryDepthSList (pool) < OVERLAPPED_POOL_SIZE)
+    InterlockedPushEntrySList (pool, &node->entry);
+  else
+    _aligned_free (node);
+}
+
+static PSLIST_HEADER
+get_read_buffer_pool (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      InitializeSListHead (&read_buffer_pool);
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return &read_buffer_pool;
+}
+
+/*
+ * _wing_read_buffer_acquire:
+ *
+ * Gets a buffer of %WING_READ_BUFFER_SIZE bytes from a pool shared by
+ * all the threads. While in the pool, a buffer holds its own list entry.
+ *
+ * Returns: a buffer to give back with _wing_read_buffer_release()
+ */
+gpointer
+_wing_read_buffer_acquire (void)
+{
+  gpointer buffer;
+
+  buffer = InterlockedPopEntrySList (get_read_buffer_pool ());
+  if (buffer == NULL)
+    {
+      buffer = _aligned_malloc (WING_READ_BUFFER_SIZE, MEMORY_ALLOCATION_ALIGNMENT);
+      if (buffer == NULL)
+        g_error ("%s: failed to allocate %d bytes",
+                 G_STRLOC, WING_READ_BUFFER_SIZE);
+    }
+
+  return buffer;
+}
+
+/*
+ * _wing_read_buffer_release:
+ * @buffer: a buffer got from _wing_read_buffer_acquire()
+ *
+ * Gives back @buffer. It can be called from any thread.
+ */
+void
+_wing_read_buffer_release (gpointer buffer)
+{
+  PSLIST_HEADER pool;
+
+  pool = get_read_buffer_pool ();
+
+  if (QueryDepthSList (pool) < READ_BUFFER_POOL_SIZE)
+    InterlockedPushEntrySList (pool, buffer);
+  else
+    _aligned_free (buffer);
+}